@@ -0,0 +1,446 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// Micro benchmarks for ccache's CPU bound inner loops. Each benchmark is run on
+// the concatenated content of the given files (typically real headers,
+// preprocessed output or object files) or, if no files are given, on generated
+// C code. The data is NUL terminated.
+//
+// Build with "make microbench" and run like this:
+//
+//     perf/microbench [-s MiB] [-l LEVEL] BENCHMARK|all [FILE...]
+//
+// The compression benchmarks use the given compression level (default: the
+// compression_level default) and report throughput relative to the
+// uncompressed size.
+
+#include "../src/ccache.h"
+#include "../src/compression.h"
+#include "../src/hashutil.h"
+#include "../src/macroskip.h"
+#include "../src/mdfour.h"
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#else
+#include "../src/getopt_long.h"
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+extern struct conf *conf;
+
+// Minimum time in seconds to spend running each benchmark.
+#define MIN_DURATION 0.5
+
+static void
+bench_md4(const char *data, size_t size)
+{
+	struct mdfour md;
+	unsigned char sum[16];
+	mdfour_begin(&md);
+	mdfour_update(&md, (const unsigned char *)data, size);
+	mdfour_update(&md, NULL, 0);
+	mdfour_result(&md, sum);
+}
+
+static void
+bench_hash(const char *data, size_t size)
+{
+	struct hash hash;
+	unsigned char sum[DIGEST_SIZE];
+	hash_start(&hash);
+	hash_buffer(&hash, data, size);
+	hash_result_as_bytes(&hash, sum);
+}
+
+// Count linemarker candidates the way process_preprocessed_file() finds them.
+static void
+bench_linemarkers(const char *data, size_t size)
+{
+	if (size < 2) {
+		return;
+	}
+	const char *p = data + 1;
+	const char *limit = data + size - 1;
+	unsigned n = 0;
+	while ((p = find_linemarker_candidate(p, limit, false)) < limit) {
+		n++;
+		p++;
+	}
+	volatile unsigned sink = n;
+	(void)sink;
+}
+
+// Same as bench_linemarkers but with the byte-by-byte loop used before.
+static void
+bench_linemarkers_bytewise(const char *data, size_t size)
+{
+	unsigned n = 0;
+	for (size_t i = 1; i + 1 < size; i++) {
+		if ((data[i] == '#' && data[i - 1] == '\n')
+		    || (data[i] == '.' && data[i + 1] == 'i')) {
+			n++;
+		}
+	}
+	volatile unsigned sink = n;
+	(void)sink;
+}
+
+static void
+bench_temporal(const char *data, size_t size)
+{
+	volatile int sink = check_for_temporal_macros(data, size);
+	(void)sink;
+}
+
+// The Boyer-Moore-Horspool search that check_for_temporal_macros() used before.
+static void
+bench_temporal_bmh(const char *data, size_t size)
+{
+	int result = 0;
+	for (size_t i = 7; i < size; i += macro_skip[(uint8_t)data[i]]) {
+		if (data[i - 2] == 'E' && data[i] == '_' && data[i - 7] == '_'
+		    && data[i - 1] == '_' && data[i - 6] == '_') {
+			if (data[i - 5] == 'D' && data[i - 4] == 'A' && data[i - 3] == 'T') {
+				result |= HASH_SOURCE_CODE_FOUND_DATE;
+			} else if (data[i - 5] == 'T' && data[i - 4] == 'I'
+			           && data[i - 3] == 'M') {
+				result |= HASH_SOURCE_CODE_FOUND_TIME;
+			}
+		}
+	}
+	volatile int sink = result;
+	(void)sink;
+}
+
+// Search for temporal macros and hash in separate passes.
+static void
+bench_source_separate(const char *data, size_t size)
+{
+	struct hash hash;
+	unsigned char sum[DIGEST_SIZE];
+	hash_start(&hash);
+	volatile int sink = check_for_temporal_macros(data, size);
+	(void)sink;
+	hash_buffer(&hash, data, size);
+	hash_result_as_bytes(&hash, sum);
+}
+
+static void
+bench_source_fused(const char *data, size_t size)
+{
+	struct hash hash;
+	unsigned char sum[DIGEST_SIZE];
+	hash_start(&hash);
+	volatile int sink = hash_source_code_buffer(conf, &hash, data, size);
+	(void)sink;
+	hash_result_as_bytes(&hash, sum);
+}
+
+static void
+bench_unify(const char *data, size_t size)
+{
+	struct hash hash;
+	unsigned char sum[DIGEST_SIZE];
+	hash_start(&hash);
+	unify_buffer(&hash, data, size, false);
+	hash_result_as_bytes(&hash, sum);
+}
+
+static void
+compress_to_fd(enum compression_type type, int fd, const char *data,
+               size_t size)
+{
+	const struct compressor *compressor = compressor_from_type(type);
+	struct compr_state *state = compressor->init(fd, conf->compression_level);
+	if (!state
+	    || !compressor->write(state, data, size)
+	    || !compressor->free(state)) {
+		fatal("Failed to compress with %s", compression_type_to_string(type));
+	}
+}
+
+static void
+bench_compress(enum compression_type type, const char *data, size_t size)
+{
+	int fd = open("/dev/null", O_WRONLY);
+	if (fd == -1) {
+		fatal("Failed to open /dev/null");
+	}
+	compress_to_fd(type, fd, data, size);
+	close(fd);
+}
+
+// Compressed copies of the input data, one per compression type, created on
+// first use.
+static char *compressed_paths[COMPR_TYPE_LZ4 + 1];
+
+static void
+bench_decompress(enum compression_type type, const char *data, size_t size)
+{
+	int fd;
+	struct stat st;
+	if (!compressed_paths[type]) {
+		compressed_paths[type] = x_strdup("microbench");
+		fd = create_tmp_fd(&compressed_paths[type]);
+		compress_to_fd(type, fd, data, size);
+		lseek(fd, 0, SEEK_SET);
+	} else {
+		fd = open(compressed_paths[type], O_RDONLY | O_BINARY);
+		if (fd == -1) {
+			fatal("Failed to open %s", compressed_paths[type]);
+		}
+	}
+
+	const struct decompressor *decompressor = decompressor_from_type(type);
+	if (fstat(fd, &st) != 0) {
+		fatal("Failed to stat %s", compressed_paths[type]);
+	}
+	struct decompr_state *state = decompressor->init(fd, st.st_size);
+	char buf[READ_BUFFER_SIZE];
+	bool ok = state != NULL;
+	while (ok && size > 0) {
+		size_t n = MIN(size, sizeof(buf));
+		ok = decompressor->read(state, buf, n);
+		size -= n;
+	}
+	if (!decompressor->free(state) || !ok) {
+		fatal("Failed to decompress with %s", compression_type_to_string(type));
+	}
+	close(fd);
+}
+
+static void
+bench_compress_zlib(const char *data, size_t size)
+{
+	bench_compress(COMPR_TYPE_ZLIB, data, size);
+}
+
+static void
+bench_decompress_zlib(const char *data, size_t size)
+{
+	bench_decompress(COMPR_TYPE_ZLIB, data, size);
+}
+
+#ifdef HAVE_LIBZSTD
+static void
+bench_compress_zstd(const char *data, size_t size)
+{
+	bench_compress(COMPR_TYPE_ZSTD, data, size);
+}
+
+static void
+bench_decompress_zstd(const char *data, size_t size)
+{
+	bench_decompress(COMPR_TYPE_ZSTD, data, size);
+}
+#endif
+
+#ifdef HAVE_LIBLZ4
+static void
+bench_compress_lz4(const char *data, size_t size)
+{
+	bench_compress(COMPR_TYPE_LZ4, data, size);
+}
+
+static void
+bench_decompress_lz4(const char *data, size_t size)
+{
+	bench_decompress(COMPR_TYPE_LZ4, data, size);
+}
+#endif
+
+static const struct {
+	const char *name;
+	const char *description;
+	void (*fn)(const char *data, size_t size);
+} benchmarks[] = {
+	{"md4", "MD4 (mdfour.c)", bench_md4},
+	{"hash", "hash_buffer() (hash.c)", bench_hash},
+	{"linemarkers", "find_linemarker_candidate() (scan.c)", bench_linemarkers},
+	{"linemarkers-byte", "Byte-by-byte linemarker scan",
+	 bench_linemarkers_bytewise},
+	{"temporal", "check_for_temporal_macros() (hashutil.c)", bench_temporal},
+	{"temporal-bmh", "Boyer-Moore-Horspool __DATE__/__TIME__ search",
+	 bench_temporal_bmh},
+	{"source-separate", "Temporal macro search, then hashing",
+	 bench_source_separate},
+	{"source-fused", "hash_source_code_buffer() (hashutil.c)",
+	 bench_source_fused},
+	{"unify", "unify_buffer() (unify.c)", bench_unify},
+	{"compress-zlib", "zlib compression (compr_zlib.c)", bench_compress_zlib},
+	{"decompress-zlib", "zlib decompression (compr_zlib.c)",
+	 bench_decompress_zlib},
+#ifdef HAVE_LIBZSTD
+	{"compress-zstd", "zstd compression (compr_zstd.c)", bench_compress_zstd},
+	{"decompress-zstd", "zstd decompression (compr_zstd.c)",
+	 bench_decompress_zstd},
+#endif
+#ifdef HAVE_LIBLZ4
+	{"compress-lz4", "LZ4 compression (compr_lz4.c)", bench_compress_lz4},
+	{"decompress-lz4", "LZ4 decompression (compr_lz4.c)", bench_decompress_lz4},
+#endif
+};
+
+static double
+now(void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#else
+	return (double)time(NULL);
+#endif
+}
+
+// Generate C-like code similar to what the test suite uses.
+static char *
+generate_data(size_t size)
+{
+	char *data = x_malloc(size + 1);
+	size_t pos = 0;
+	for (unsigned i = 0; pos < size; i++) {
+		char line[100];
+		int n = snprintf(line, sizeof(line),
+		                 "int foo_%u(int x) { return x + %u; }\n", i, i % 97);
+		size_t len = MIN((size_t)n, size - pos);
+		memcpy(data + pos, line, len);
+		pos += len;
+	}
+	data[size] = '\0';
+	return data;
+}
+
+static char *
+load_files(char **paths, int n, size_t *size)
+{
+	char *result = NULL;
+	*size = 0;
+	for (int i = 0; i < n; i++) {
+		char *data;
+		size_t len;
+		if (!read_file(paths[i], 0, &data, &len)) {
+			fatal("Failed to read %s", paths[i]);
+		}
+		result = x_realloc(result, *size + len + 1);
+		memcpy(result + *size, data, len);
+		*size += len;
+		free(data);
+	}
+	result[*size] = '\0';
+	return result;
+}
+
+static void
+run(size_t i, const char *data, size_t size)
+{
+	// Warm up caches.
+	benchmarks[i].fn(data, size);
+
+	unsigned iterations = 0;
+	double start = now();
+	double elapsed;
+	do {
+		benchmarks[i].fn(data, size);
+		iterations++;
+		elapsed = now() - start;
+	} while (elapsed < MIN_DURATION);
+
+	printf("%-16s %9.1f MB/s  %s\n",
+	       benchmarks[i].name,
+	       (double)size * iterations / elapsed / 1e6,
+	       benchmarks[i].description);
+}
+
+static void
+usage(FILE *stream)
+{
+	fprintf(stream,
+	        "Usage: microbench [-s MiB] [-l LEVEL] BENCHMARK|all [FILE...]\n"
+	        "\n"
+	        "Benchmarks:\n");
+	for (size_t i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		fprintf(stream, "    %-16s %s\n",
+		        benchmarks[i].name, benchmarks[i].description);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	conf = conf_create();
+
+	size_t generated_size = 64 * 1024 * 1024;
+	int c;
+	while ((c = getopt(argc, argv, "hl:s:")) != -1) {
+		switch (c) {
+		case 'l':
+			conf->compression_level = atoi(optarg);
+			break;
+
+		case 's':
+			generated_size = (size_t)atoi(optarg) * 1024 * 1024;
+			break;
+
+		case 'h':
+			usage(stdout);
+			return 0;
+
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(stderr);
+		return 1;
+	}
+
+	const char *name = argv[optind];
+	size_t size;
+	char *data;
+	if (optind + 1 < argc) {
+		data = load_files(argv + optind + 1, argc - optind - 1, &size);
+	} else {
+		size = generated_size;
+		data = generate_data(size);
+	}
+	printf("Input: %.1f MB\n", size / 1e6);
+
+	bool found = false;
+	for (size_t i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		if (str_eq(name, "all") || str_eq(name, benchmarks[i].name)) {
+			run(i, data, size);
+			found = true;
+		}
+	}
+	free(data);
+	for (size_t i = 0; i < ARRAY_SIZE(compressed_paths); i++) {
+		if (compressed_paths[i]) {
+			tmp_unlink(compressed_paths[i]);
+			free(compressed_paths[i]);
+		}
+	}
+
+	if (!found) {
+		fprintf(stderr, "Unknown benchmark: %s\n", name);
+		usage(stderr);
+		return 1;
+	}
+	return 0;
+}
@@ -24,11 +24,14 @@
 #else
 #include "getopt_long.h"
 #endif
+#include "hashpool.h"
 #include "hashtable.h"
 #include "hashtable_itr.h"
 #include "hashutil.h"
+#include "inodecache.h"
 #include "language.h"
 #include "manifest.h"
+#include "result.h"
 
 #define STRINGIFY(x) #x
 #define TO_STRING(x) STRINGIFY(x)
@@ -61,7 +64,12 @@ static const char USAGE_TEXT[] =
   "                          Ki, Mi, Gi, Ti (binary); default suffix: G\n"
   "    -o, --set-config=K=V  set configuration key K to value V\n"
   "    -p, --print-config    print current configuration options\n"
+  "        --print-stats     print statistics counters in a format for other\n"
+  "                          programs, see --stats-format\n"
   "    -s, --show-stats      show statistics summary\n"
+  "        --stats-format=F  format for --print-stats: raw (default), json or\n"
+  "                          prometheus\n"
+  "    -v, --verbose         also show phase duration percentiles with -s\n"
   "    -z, --zero-stats      zero statistics counters\n"
   "\n"
   "    -h, --help            print this help text\n"
@@ -84,6 +92,10 @@ char *current_working_dir = NULL;
 // The original argument list.
 static struct args *orig_args;
 
+// Dependency arguments like -MD that are passed to the real compiler instead of
+// the preprocessor in the depend mode.
+static struct args *depend_mode_args;
+
 // The source file.
 static char *input_file;
 
@@ -117,35 +129,10 @@ static char *arch_args[MAX_ARCH_ARGS] = {NULL};
 // object code.
 static struct file_hash *cached_obj_hash;
 
-// Full path to the file containing the cached object code
-// (cachedir/a/b/cdef[...]-size.o).
-static char *cached_obj;
-
-// Full path to the file containing the standard error output
-// (cachedir/a/b/cdef[...]-size.stderr).
-static char *cached_stderr;
-
-// Full path to the file containing the dependency information
-// (cachedir/a/b/cdef[...]-size.d).
-static char *cached_dep;
-
-// Full path to the file containing the coverage information
-// (cachedir/a/b/cdef[...]-size.gcno).
-static char *cached_cov;
-
-// Full path to the file containing the stack usage
-// (cachedir/a/b/cdef[...]-size.su).
-static char *cached_su;
-
-// Full path to the file containing the diagnostic information (for clang)
-// (cachedir/a/b/cdef[...]-size.dia).
-static char *cached_dia;
-
-// Full path to the file containing the split dwarf (for GCC 4.8 and above)
-// (cachedir/a/b/cdef[...]-size.dwo).
-//
-// Contains NULL if -gsplit-dwarf is not given.
-static char *cached_dwo;
+// Full path to the result file, which contains the object code, the standard
+// error output and the other outputs of the compilation
+// (cachedir/a/b/cdef[...]-size.result).
+static char *cached_result;
 
 // Full path to the file containing the manifest
 // (cachedir/a/b/cdef[...]-size.manifest).
@@ -159,6 +146,10 @@ time_t time_of_compilation;
 // Value: struct file_hash.
 static struct hashtable *included_files = NULL;
 
+// Pool hashing the content of included files in direct mode. Results end up in
+// included_files when the pool is finished.
+static struct hash_pool *include_file_hash_pool = NULL;
+
 // Uses absolute path for some include files.
 static bool has_absolute_include_headers = false;
 
@@ -531,7 +522,7 @@ get_path_in_cache(const char *name, const char *suffix)
 // global included_files variable. If the include file is a PCH, cpp_hash is
 // also updated. Takes over ownership of path.
 static void
-remember_include_file(char *path, struct mdfour *cpp_hash, bool system)
+remember_include_file(char *path, struct hash *cpp_hash, bool system)
 {
 	size_t path_len = strlen(path);
 	if (path_len >= 2 && (path[0] == '<' && path[path_len - 1] == '>')) {
@@ -616,7 +607,7 @@ remember_include_file(char *path, struct mdfour *cpp_hash, bool system)
 	}
 
 	// Let's hash the include file content.
-	struct mdfour fhash;
+	struct hash fhash;
 	hash_start(&fhash);
 
 	bool is_pch = is_precompiled_header(path);
@@ -647,29 +638,19 @@ remember_include_file(char *path, struct mdfour *cpp_hash, bool system)
 	}
 
 	if (conf->direct_mode) {
-		if (!is_pch) { // else: the file has already been hashed.
-			char *source = NULL;
-			size_t size;
-			if (st.st_size > 0) {
-				if (!read_file(path, st.st_size, &source, &size)) {
-					goto failure;
-				}
-			} else {
-				source = x_strdup("");
-				size = 0;
-			}
-
-			int result = hash_source_code_string(conf, &fhash, source, size, path);
-			free(source);
-			if (result & HASH_SOURCE_CODE_ERROR
-			    || result & HASH_SOURCE_CODE_FOUND_TIME) {
-				goto failure;
+		struct file_hash *h = x_malloc(sizeof(*h));
+		if (is_pch) {
+			// The file has already been hashed.
+			hash_result_as_bytes(&fhash, h->hash);
+			h->size = fhash.totalN;
+		} else {
+			// The content is hashed in the background and h is filled in by
+			// finish_include_file_hashing.
+			if (!include_file_hash_pool) {
+				include_file_hash_pool = hash_pool_create(conf, 0);
 			}
+			hash_pool_add(include_file_hash_pool, path, &st, h);
 		}
-
-		struct file_hash *h = x_malloc(sizeof(*h));
-		hash_result_as_bytes(&fhash, h->hash);
-		h->size = fhash.totalN;
 		hashtable_insert(included_files, path, h);
 	} else {
 		free(path);
@@ -687,6 +668,20 @@ ignore:
 	free(path);
 }
 
+// Wait for the include files queued by remember_include_file to be hashed.
+static void
+finish_include_file_hashing(void)
+{
+	if (!include_file_hash_pool) {
+		return;
+	}
+	if (!hash_pool_finish(include_file_hash_pool) && conf->direct_mode) {
+		cc_log("Disabling direct mode");
+		conf->direct_mode = false;
+	}
+	include_file_hash_pool = NULL;
+}
+
 // Make a relative path from current working directory to path if path is under
 // the base directory. Takes over ownership of path. Caller frees.
 static char *
@@ -743,22 +738,11 @@ make_relative_path(char *path)
 	}
 }
 
-// This function reads and hashes a file. While doing this, it also does these
-// things:
-//
-// - Makes include file paths for which the base directory is a prefix relative
-//   when computing the hash sum.
-// - Stores the paths and hashes of included files in the global variable
-//   included_files.
-static bool
-process_preprocessed_file(struct mdfour *hash, const char *path, bool pump)
+// Set up included_files and the ignore_headers_in_manifest list used by
+// remember_include_file.
+static void
+init_included_files(void)
 {
-	char *data;
-	size_t size;
-	if (!read_file(path, 0, &data, &size)) {
-		return false;
-	}
-
 	ignore_headers = NULL;
 	ignore_headers_len = 0;
 	if (!str_eq(conf->ignore_headers_in_manifest, "")) {
@@ -777,6 +761,29 @@ process_preprocessed_file(struct mdfour *hash, const char *path, bool pump)
 	if (!included_files) {
 		included_files = create_hashtable(1000, hash_from_string, strings_equal);
 	}
+}
+
+// This function reads and hashes a file. While doing this, it also does these
+// things:
+//
+// - Makes include file paths for which the base directory is a prefix relative
+//   when computing the hash sum.
+// - Stores the paths and hashes of included files in the global variable
+//   included_files.
+//
+// The file is only memory mapped if it's ccache's own preprocessor output, not
+// a preprocessed source file given by the user.
+static bool
+process_preprocessed_file(struct hash *hash, const char *path, bool pump)
+{
+	struct mapped_file file;
+	if (!map_file(path, 0, direct_i_file, &file)) {
+		return false;
+	}
+	char *data = file.data;
+	size_t size = file.size;
+
+	init_included_files();
 
 	// Bytes between p and q are pending to be hashed.
 	char *p = data;
@@ -850,7 +857,8 @@ process_preprocessed_file(struct mdfour *hash, const char *path, bool pump)
 			q++;
 			if (q >= end) {
 				cc_log("Failed to parse included file path");
-				free(data);
+				unmap_file(&file);
+				finish_include_file_hashing();
 				return false;
 			}
 			// q points to the beginning of an include file path
@@ -919,12 +927,13 @@ process_preprocessed_file(struct mdfour *hash, const char *path, bool pump)
 			p = q;
 			continue;
 		} else {
-			q++;
+			// Skip ahead to the next position that may be of interest.
+			q = (char *)find_linemarker_candidate(q + 1, end - 7, pump);
 		}
 	}
 
 	hash_buffer(hash, p, (end - p));
-	free(data);
+	unmap_file(&file);
 
 	// Explicitly check the .gch/.pch/.pth file, Clang does not include any
 	// mention of it in the preprocessed output.
@@ -935,6 +944,7 @@ process_preprocessed_file(struct mdfour *hash, const char *path, bool pump)
 		remember_include_file(path, hash, false);
 	}
 
+	finish_include_file_hashing();
 	return true;
 }
 
@@ -1018,134 +1028,127 @@ out:
 	free(tmp_file);
 }
 
-// Helper method for copy_file_to_cache and move_file_to_cache_same_fs.
-static void
-do_copy_or_move_file_to_cache(const char *source, const char *dest, bool copy)
+// Extract the next file name from a dependency file, starting at *p. Escaped
+// spaces and hashes ("\ " and "\#") and "$$" are unescaped and line
+// continuations are skipped. Returns NULL at the end of the data.
+static char *
+next_depfile_token(char **p)
 {
-	assert(!conf->read_only);
-	assert(!conf->read_only_direct);
-
-	struct stat orig_dest_st;
-	bool orig_dest_existed = stat(dest, &orig_dest_st) == 0;
-	int compression_level = conf->compression ? conf->compression_level : 0;
-	bool do_move = !copy && !conf->compression;
-	bool do_link = copy && conf->hard_link && !conf->compression;
-
-	if (do_move) {
-		move_uncompressed_file(source, dest, compression_level);
-	} else {
-		if (do_link) {
-			x_unlink(dest);
-			int ret = link(source, dest);
-			if (ret == 0) {
-			} else {
-				cc_log("Failed to link %s to %s: %s", source, dest, strerror(errno));
-				cc_log("Falling back to copying");
-				do_link = false;
-			}
-		}
-		if (!do_link) {
-			int ret = copy_file(source, dest, compression_level);
-			if (ret != 0) {
-				cc_log("Failed to copy %s to %s: %s", source, dest, strerror(errno));
-				stats_update(STATS_ERROR);
-				failed();
-			}
+	char *q = *p;
+	while (*q) {
+		if (q[0] == '\\' && q[1] == '\n') {
+			q += 2;
+		} else if (q[0] == '\\' && q[1] == '\r' && q[2] == '\n') {
+			q += 3;
+		} else if (isspace((unsigned char)*q)) {
+			q++;
+		} else {
+			break;
 		}
 	}
-
-	if (!copy && conf->compression) {
-		// We fell back to copying since dest should be compressed, so clean up.
-		x_unlink(source);
+	if (!*q) {
+		*p = q;
+		return NULL;
 	}
 
-	cc_log("Stored in cache: %s -> %s (%s)",
-	       source,
-	       dest,
-	       do_move ? "moved" : (do_link ? "linked" : "copied"));
-
-	struct stat st;
-	if (x_stat(dest, &st) != 0) {
-		stats_update(STATS_ERROR);
-		failed();
+	char *token = x_malloc(strlen(q) + 1);
+	size_t len = 0;
+	while (*q && !isspace((unsigned char)*q)) {
+		if (q[0] == '\\' && (q[1] == ' ' || q[1] == '#')) {
+			q++;
+		} else if (q[0] == '\\' && (q[1] == '\n' || q[1] == '\r')) {
+			break;
+		} else if (q[0] == '$' && q[1] == '$') {
+			q++;
+		}
+		token[len++] = *q++;
 	}
-	stats_update_size(
-	  file_size(&st) - (orig_dest_existed ? file_size(&orig_dest_st) : 0),
-	  orig_dest_existed ? 0 : 1);
+	token[len] = '\0';
+	*p = q;
+	return token;
 }
 
-// Copy a file into the cache.
-//
-// dest must be a path in the cache (see get_path_in_cache). source does not
-// have to be on the same file system as dest.
-//
-// An attempt will be made to hard link source to dest if conf->hard_link is
-// true and conf->compression is false, otherwise copy. dest will be compressed
-// if conf->compression is true.
-static void
-copy_file_to_cache(const char *source, const char *dest)
+// Compute the object hash in the depend mode: hash (the direct mode hash)
+// plus the paths and content hashes of the include files listed in the
+// dependency file written by the compiler. The include files are also stored
+// in included_files for the manifest. Returns NULL if some include file can't
+// be used, in which case the direct mode has been disabled.
+static struct file_hash *
+object_hash_from_depfile(const char *depfile, struct hash *hash)
 {
-	do_copy_or_move_file_to_cache(source, dest, true);
-}
+	char *data = read_text_file(depfile, 0);
+	if (!data) {
+		cc_log("Cannot open dependency file %s: %s", depfile, strerror(errno));
+		return NULL;
+	}
 
-// Move a file into the cache.
-//
-// dest must be a path in the cache (see get_path_in_cache). source must be on
-// the same file system as dest. dest will be compressed if conf->compression
-// is true.
-static void
-move_file_to_cache_same_fs(const char *source, const char *dest)
-{
-	do_copy_or_move_file_to_cache(source, dest, false);
-}
+	init_included_files();
 
-// Copy or link a file from the cache.
-static void
-get_file_from_cache(const char *source, const char *dest)
-{
-	int ret;
-	bool do_link = conf->hard_link && !file_is_compressed(source);
-	if (do_link) {
-		x_unlink(dest);
-		ret = link(source, dest);
-	} else {
-		ret = copy_file(source, dest, 0);
+	// Remember the order in which the files are listed so that the hash doesn't
+	// depend on the layout of included_files.
+	char **paths = NULL;
+	size_t n_paths = 0;
+	char *p = data;
+	char *token;
+	while ((token = next_depfile_token(&p))) {
+		size_t len = strlen(token);
+		if (len == 0 || token[len - 1] == ':' || hashtable_search(included_files,
+		                                                          token)) {
+			// A target or an already seen file.
+			free(token);
+			continue;
+		}
+		if (!has_absolute_include_headers) {
+			has_absolute_include_headers = is_absolute_path(token);
+		}
+		char *path = make_relative_path(token);
+		paths = x_realloc(paths, (n_paths + 1) * sizeof(*paths));
+		paths[n_paths++] = x_strdup(path);
+		remember_include_file(path, hash, false);
 	}
+	free(data);
 
-	if (ret == -1) {
-		if (errno == ENOENT || errno == ESTALE) {
-			cc_log("File missing in cache: %s", source);
-			stats_update(STATS_MISSING);
-		} else {
-			cc_log("Failed to %s %s to %s: %s",
-			       do_link ? "link" : "copy",
-			       source,
-			       dest,
-			       strerror(errno));
-			stats_update(STATS_ERROR);
-		}
+	finish_include_file_hashing();
 
-		// If there was trouble getting a file from the cached result, wipe the
-		// whole cached result for consistency.
-		x_unlink(cached_stderr);
-		x_unlink(cached_obj);
-		x_unlink(cached_dep);
-		x_unlink(cached_cov);
-		x_unlink(cached_su);
-		x_unlink(cached_dia);
-		x_unlink(cached_dwo);
+	struct file_hash *result = NULL;
+	if (conf->direct_mode) {
+		for (size_t i = 0; i < n_paths; i++) {
+			struct file_hash *h = hashtable_search(included_files, paths[i]);
+			if (h) {
+				hash_delimiter(hash, "include");
+				hash_string(hash, paths[i]);
+				hash_buffer(hash, h->hash, sizeof(h->hash));
+				hash_int(hash, h->size);
+			}
+		}
+		result = x_malloc(sizeof(*result));
+		hash_result_as_bytes(hash, result->hash);
+		result->size = hash->totalN;
+	}
 
-		failed();
+	for (size_t i = 0; i < n_paths; i++) {
+		free(paths[i]);
 	}
+	free(paths);
+	return result;
+}
 
-	cc_log("Created from cache: %s -> %s", source, dest);
+static void
+update_cached_result_globals(struct file_hash *hash)
+{
+	char *object_name = format_hash_as_string(hash->hash, hash->size);
+	cached_obj_hash = hash;
+	cached_result = get_path_in_cache(object_name, ".result");
+
+	stats_file = format("%s/%c/stats", conf->cache_dir, object_name[0]);
+	free(object_name);
 }
 
-// Send cached stderr, if any, to stderr.
+// Send the standard error output in path to stderr.
 static void
-send_cached_stderr(void)
+send_cached_stderr(const char *path)
 {
-	int fd_stderr = open(cached_stderr, O_RDONLY | O_BINARY);
+	int fd_stderr = open(path, O_RDONLY | O_BINARY);
 	if (fd_stderr != -1) {
 		copy_fd(fd_stderr, 2);
 		close(fd_stderr);
@@ -1167,24 +1170,40 @@ void update_manifest_file(void)
 	if (stat(manifest_path, &st) == 0) {
 		old_size = file_size(&st);
 	}
-	if (manifest_put(manifest_path, cached_obj_hash, included_files)) {
+	switch (manifest_put(manifest_path, cached_obj_hash, included_files)) {
+	case MANIFEST_PUT_ADDED:
 		cc_log("Added object file hash to %s", manifest_path);
 		update_mtime(manifest_path);
 		if (x_stat(manifest_path, &st) == 0) {
 			stats_update_size(file_size(&st) - old_size, old_size == 0 ? 1 : 0);
 		}
-	} else {
+		break;
+
+	case MANIFEST_PUT_FAILED:
 		cc_log("Failed to add object file hash to %s", manifest_path);
+		break;
+
+	case MANIFEST_PUT_SKIPPED:
+		break;
 	}
 }
 
-// Run the real compiler and put the result in cache.
+// Run the real compiler and put the result in cache. In the depend mode,
+// depend_mode_hash is the direct mode hash that the object hash is computed
+// from once the compiler has written the dependency file; otherwise it's NULL
+// and the cached_* globals are already set up.
 static void
-to_cache(struct args *args)
+to_cache(struct args *args, struct hash *depend_mode_hash)
 {
-	char *tmp_stdout = format("%s.tmp.stdout", cached_obj);
+	char *tmp_stdout, *tmp_stderr;
+	if (depend_mode_hash) {
+		tmp_stdout = format("%s/tmp.stdout", temp_dir());
+		tmp_stderr = format("%s/tmp.stderr", temp_dir());
+	} else {
+		tmp_stdout = format("%s.tmp.stdout", cached_result);
+		tmp_stderr = format("%s.tmp.stderr", cached_result);
+	}
 	int tmp_stdout_fd = create_tmp_fd(&tmp_stdout);
-	char *tmp_stderr = format("%s.tmp.stderr", cached_obj);
 	int tmp_stderr_fd = create_tmp_fd(&tmp_stderr);
 
 	args_add(args, "-o");
@@ -1208,8 +1227,15 @@ to_cache(struct args *args)
 	}
 
 	cc_log("Running real compiler");
+	int64_t compiler_start = time_monotonic_us();
+	int64_t compiler_cpu_start = time_children_cpu_us();
 	int status =
 	  execute(args->argv, tmp_stdout_fd, tmp_stderr_fd, &compiler_pid);
+	stats_phase_end(PHASE_COMPILER, compiler_start);
+	struct result_cost cost = {
+		(time_monotonic_us() - compiler_start) / 1000,
+		(time_children_cpu_us() - compiler_cpu_start) / 1000
+	};
 	args_pop(args, 3);
 
 	struct stat st;
@@ -1299,37 +1325,54 @@ to_cache(struct args *args)
 		failed();
 	}
 
-	if (x_stat(tmp_stderr, &st) != 0) {
-		stats_update(STATS_ERROR);
-		failed();
-	}
-	if (st.st_size > 0) {
-		move_file_to_cache_same_fs(tmp_stderr, cached_stderr);
-	} else {
-		tmp_unlink(tmp_stderr);
-		if (conf->recache) {
-			// If recaching, we need to remove any previous .stderr.
-			x_unlink(cached_stderr);
+	if (depend_mode_hash) {
+		struct file_hash *object_hash =
+		  object_hash_from_depfile(output_dep, depend_mode_hash);
+		if (!object_hash) {
+			// E.g. a too new include file. The compilation has already succeeded,
+			// so just don't store the result instead of running the compiler again.
+			cc_log("Can't hash the dependencies; not storing the result");
+			stats_update(STATS_UNHASHABLE_DEPENDENCY);
+			send_cached_stderr(tmp_stderr);
+			tmp_unlink(tmp_stderr);
+			x_exit(status);
 		}
+		update_cached_result_globals(object_hash);
 	}
 
-	copy_file_to_cache(output_obj, cached_obj);
+	struct result_files *result_files = result_files_init();
+	result_files_add(result_files, tmp_stderr, ".stderr");
+	result_files_add(result_files, output_obj, ".o");
 	if (generating_dependencies) {
 		use_relative_paths_in_depfile(output_dep);
-		copy_file_to_cache(output_dep, cached_dep);
+		result_files_add(result_files, output_dep, ".d");
 	}
 	if (generating_coverage) {
-		copy_file_to_cache(output_cov, cached_cov);
+		result_files_add(result_files, output_cov, ".gcno");
 	}
 	if (generating_stackusage) {
-		copy_file_to_cache(output_su, cached_su);
+		result_files_add(result_files, output_su, ".su");
 	}
 	if (generating_diagnostics) {
-		copy_file_to_cache(output_dia, cached_dia);
+		result_files_add(result_files, output_dia, ".dia");
 	}
 	if (using_split_dwarf) {
-		copy_file_to_cache(output_dwo, cached_dwo);
+		result_files_add(result_files, output_dwo, ".dwo");
+	}
+	enum compression_type compression_type = compression_type_from_config();
+	int64_t put_start = time_monotonic_us();
+	bool stored = result_put(cached_result, result_files, &cost,
+	                         compression_type, conf->compression_level,
+	                         conf->hard_link, conf->pack_threshold);
+	stats_phase_end(PHASE_RESULT_PUT, put_start);
+	result_files_free(result_files);
+	if (!stored) {
+		cc_log("Failed to store result in %s", cached_result);
+		stats_update(STATS_ERROR);
+		tmp_unlink(tmp_stderr);
+		failed();
 	}
+	cc_log("Stored in cache: %s", cached_result);
 
 	stats_update(STATS_TOCACHE);
 
@@ -1356,7 +1399,8 @@ to_cache(struct args *args)
 	}
 
 	// Everything OK.
-	send_cached_stderr();
+	send_cached_stderr(tmp_stderr);
+	tmp_unlink(tmp_stderr);
 	update_manifest_file();
 
 	free(tmp_stderr);
@@ -1366,7 +1410,7 @@ to_cache(struct args *args)
 // Find the object file name by running the compiler in preprocessor mode.
 // Returns the hash as a heap-allocated hex string.
 static struct file_hash *
-get_object_name_from_cpp(struct args *args, struct mdfour *hash)
+get_object_name_from_cpp(struct args *args, struct hash *hash)
 {
 	time_of_compilation = time(NULL);
 
@@ -1409,7 +1453,9 @@ get_object_name_from_cpp(struct args *args, struct mdfour *hash)
 		args_add(args, input_file);
 		add_prefix(args, conf->prefix_command_cpp);
 		cc_log("Running preprocessor");
+		int64_t cpp_start = time_monotonic_us();
 		status = execute(args->argv, path_stdout_fd, path_stderr_fd, &compiler_pid);
+		stats_phase_end(PHASE_PREPROCESSOR, cpp_start);
 		args_pop(args, args_added);
 	}
 
@@ -1428,7 +1474,7 @@ get_object_name_from_cpp(struct args *args, struct mdfour *hash)
 		hash_delimiter(hash, "unifycpp");
 
 		bool debug_unify = getenv("CCACHE_DEBUG_UNIFY");
-		if (unify_hash(hash, path_stdout, debug_unify) != 0) {
+		if (unify_hash(hash, path_stdout, direct_i_file, debug_unify) != 0) {
 			stats_update(STATS_ERROR);
 			cc_log("Failed to unify %s", path_stdout);
 			failed();
@@ -1473,27 +1519,56 @@ get_object_name_from_cpp(struct args *args, struct mdfour *hash)
 	return result;
 }
 
-static void
-update_cached_result_globals(struct file_hash *hash)
+// Hash the content of the compiler at path, or the output of the compiler
+// check command if command is true. What is hashed is a digest of the content
+// or output, which is remembered in the inode cache so that an unchanged
+// compiler doesn't have to be hashed (or the command run) again.
+static bool
+hash_compiler_fingerprint(struct hash *hash, struct stat *st, const char *path,
+                          bool command)
 {
-	char *object_name = format_hash_as_string(hash->hash, hash->size);
-	cached_obj_hash = hash;
-	cached_obj = get_path_in_cache(object_name, ".o");
-	cached_stderr = get_path_in_cache(object_name, ".stderr");
-	cached_dep = get_path_in_cache(object_name, ".d");
-	cached_cov = get_path_in_cache(object_name, ".gcno");
-	cached_su = get_path_in_cache(object_name, ".su");
-	cached_dia = get_path_in_cache(object_name, ".dia");
-	cached_dwo = get_path_in_cache(object_name, ".dwo");
+	char *tag;
+	bool use_cache;
+	if (command) {
+		tag = format("command %s %s", conf->compiler_check, orig_args->argv[0]);
+		use_cache = conf->sloppiness & SLOPPY_COMPILER_CHECK_OUTPUT;
+	} else {
+		tag = x_strdup("content");
+		use_cache = true;
+	}
 
-	stats_file = format("%s/%c/stats", conf->cache_dir, object_name[0]);
-	free(object_name);
+	struct file_hash fingerprint;
+	bool ok = true;
+	if (use_cache && inode_cache_get_tagged(conf, st, tag, &fingerprint)) {
+		cc_log("Using remembered compiler fingerprint for %s", path);
+	} else {
+		struct hash h;
+		hash_start(&h);
+		if (command) {
+			ok = hash_multicommand_output(
+			  &h, conf->compiler_check, orig_args->argv[0]);
+		} else {
+			ok = hash_file(&h, path);
+		}
+		hash_result_as_bytes(&h, fingerprint.hash);
+		fingerprint.size = h.totalN;
+		if (ok && use_cache) {
+			inode_cache_put_tagged(conf, st, tag, &fingerprint);
+		}
+	}
+	free(tag);
+
+	if (ok) {
+		hash_buffer(hash, fingerprint.hash, sizeof(fingerprint.hash));
+		hash_int(hash, fingerprint.size);
+	}
+	return ok;
 }
 
 // Hash mtime or content of a file, or the output of a command, according to
 // the CCACHE_COMPILERCHECK setting.
 static void
-hash_compiler(struct mdfour *hash, struct stat *st, const char *path,
+hash_compiler(struct hash *hash, struct stat *st, const char *path,
               bool allow_command)
 {
 	if (str_eq(conf->compiler_check, "none")) {
@@ -1507,10 +1582,10 @@ hash_compiler(struct mdfour *hash, struct stat *st, const char *path,
 		hash_string(hash, conf->compiler_check + strlen("string:"));
 	} else if (str_eq(conf->compiler_check, "content") || !allow_command) {
 		hash_delimiter(hash, "cc_content");
-		hash_file(hash, path);
+		hash_compiler_fingerprint(hash, st, path, false);
 	} else { // command string
-		if (!hash_multicommand_output(
-		      hash, conf->compiler_check, orig_args->argv[0])) {
+		hash_delimiter(hash, "cc_command");
+		if (!hash_compiler_fingerprint(hash, st, path, true)) {
 			fatal("Failure running compiler check command: %s", conf->compiler_check);
 		}
 	}
@@ -1522,7 +1597,7 @@ hash_compiler(struct mdfour *hash, struct stat *st, const char *path,
 // with -ccbin/--compiler-bindir. If they are NULL, the compilers are looked up
 // in PATH instead.
 static void
-hash_nvcc_host_compiler(struct mdfour *hash, struct stat *ccbin_st,
+hash_nvcc_host_compiler(struct hash *hash, struct stat *ccbin_st,
                         const char *ccbin)
 {
 	// From <http://docs.nvidia.com/cuda/cuda-compiler-driver-nvcc/index.html>:
@@ -1558,7 +1633,7 @@ hash_nvcc_host_compiler(struct mdfour *hash, struct stat *ccbin_st,
 				if (path) {
 					struct stat st;
 					x_stat(path, &st);
-					hash_compiler(hash, &st, ccbin, false);
+					hash_compiler(hash, &st, path, false);
 					free(path);
 				}
 			}
@@ -1571,7 +1646,7 @@ hash_nvcc_host_compiler(struct mdfour *hash, struct stat *ccbin_st,
 // Update a hash sum with information common for the direct and preprocessor
 // modes.
 static void
-calculate_common_hash(struct args *args, struct mdfour *hash)
+calculate_common_hash(struct args *args, struct hash *hash)
 {
 	hash_string(hash, HASH_PREFIX);
 
@@ -1686,13 +1761,13 @@ calculate_common_hash(struct args *args, struct mdfour *hash)
 // modes and calculate the object hash. Returns the object hash on success,
 // otherwise NULL. Caller frees.
 static struct file_hash *
-calculate_object_hash(struct args *args, struct mdfour *hash, int direct_mode)
+calculate_object_hash(struct args *args, struct hash *hash, int direct_mode)
 {
 	bool found_ccbin = false;
 
 	if (direct_mode) {
 		hash_delimiter(hash, "manifest version");
-		hash_int(hash, MANIFEST_VERSION);
+		hash_int(hash, MANIFEST_NAME_VERSION);
 	}
 
 	// clang will emit warnings for unused linker flags, so we shouldn't skip
@@ -1905,7 +1980,9 @@ calculate_object_hash(struct args *args, struct mdfour *hash, int direct_mode)
 		manifest_path = get_path_in_cache(manifest_name, ".manifest");
 		free(manifest_name);
 		cc_log("Looking for object file hash in %s", manifest_path);
+		int64_t manifest_start = time_monotonic_us();
 		object_hash = manifest_get(conf, manifest_path);
+		stats_phase_end(PHASE_MANIFEST_GET, manifest_start);
 		if (object_hash) {
 			cc_log("Got object file hash from manifest");
 		} else {
@@ -1962,69 +2039,71 @@ from_cache(enum fromcache_call_mode mode, bool put_object_in_manifest)
 		return;
 	}
 
-	// Occasionally, e.g. on hard reset, our cache ends up as just filesystem
-	// meta-data with no content. Catch an easy case of this.
-	struct stat st;
-	if (stat(cached_obj, &st) != 0) {
-		cc_log("Object file %s not in cache", cached_obj);
-		return;
-	}
-	if (st.st_size == 0) {
-		cc_log("Invalid (empty) object file %s in cache", cached_obj);
-		x_unlink(cached_obj);
-		return;
-	}
-
 	// (If mode != FROMCACHE_DIRECT_MODE, the dependency file is created by gcc.)
 	bool produce_dep_file =
 	  generating_dependencies && mode == FROMCACHE_DIRECT_MODE;
 
-	// Get result from cache.
+	char *tmp_stderr = format("%s/tmp.stderr", temp_dir());
+	int tmp_stderr_fd = create_tmp_fd(&tmp_stderr);
+	close(tmp_stderr_fd);
+
+	struct result_files *result_files = result_files_init();
+	result_files_add(result_files, tmp_stderr, ".stderr");
 	if (!str_eq(output_obj, "/dev/null")) {
-		get_file_from_cache(cached_obj, output_obj);
+		result_files_add(result_files, output_obj, ".o");
 		if (using_split_dwarf) {
-			get_file_from_cache(cached_dwo, output_dwo);
+			result_files_add(result_files, output_dwo, ".dwo");
 		}
 	}
 	if (produce_dep_file) {
-		get_file_from_cache(cached_dep, output_dep);
-	}
-	if (generating_coverage) {
-		get_file_from_cache(cached_cov, output_cov);
-	}
-	if (generating_stackusage) {
-		get_file_from_cache(cached_su, output_su);
-	}
-	if (generating_diagnostics) {
-		get_file_from_cache(cached_dia, output_dia);
-	}
-
-	// Update modification timestamps to save files from LRU cleanup. Also gives
-	// files a sensible mtime when hard-linking.
-	update_mtime(cached_obj);
-	update_mtime(cached_stderr);
-	if (produce_dep_file) {
-		update_mtime(cached_dep);
+		result_files_add(result_files, output_dep, ".d");
 	}
 	if (generating_coverage) {
-		update_mtime(cached_cov);
+		result_files_add(result_files, output_cov, ".gcno");
 	}
 	if (generating_stackusage) {
-		update_mtime(cached_su);
+		result_files_add(result_files, output_su, ".su");
 	}
 	if (generating_diagnostics) {
-		update_mtime(cached_dia);
+		result_files_add(result_files, output_dia, ".dia");
+	}
+	struct result_cost cost;
+	bool found;
+	int64_t get_start = time_monotonic_us();
+	bool ok = result_get(cached_result, result_files, &cost, &found);
+	result_files_free(result_files);
+	stats_phase_end(PHASE_RESULT_GET, get_start);
+	if (!found) {
+		cc_log("Result file %s not in cache", cached_result);
+		tmp_unlink(tmp_stderr);
+		free(tmp_stderr);
+		return;
 	}
-	if (cached_dwo) {
-		update_mtime(cached_dwo);
+	if (!ok) {
+		// Wipe the broken result so that it's replaced by the next compilation.
+		cc_log("Failed to get result from %s", cached_result);
+		stats_update(STATS_MISSING);
+		result_remove(cached_result);
+		tmp_unlink(tmp_stderr);
+		failed();
 	}
 
-	send_cached_stderr();
+	// Update modification timestamp to save the result from LRU cleanup.
+	update_mtime(cached_result);
+
+	send_cached_stderr(tmp_stderr);
+	tmp_unlink(tmp_stderr);
+	free(tmp_stderr);
 
 	if (put_object_in_manifest) {
 		update_manifest_file();
 	}
 
+	cc_log("Saved %u ms of compiler time (%u ms CPU time)",
+	       (unsigned)cost.wall_time, (unsigned)cost.cpu_time);
+	stats_add(STATS_SAVED_WALL_TIME, cost.wall_time);
+	stats_add(STATS_SAVED_CPU_TIME, cost.cpu_time);
+
 	// Log the cache hit.
 	switch (mode) {
 	case FROMCACHE_DIRECT_MODE:
@@ -3074,6 +3153,13 @@ cc_process_args(struct args *args, struct args **preprocessor_args,
 	// source.
 	args_extend(cpp_args, dep_args);
 
+	// In the depend mode the dependency file is instead written by the real
+	// compiler since the preprocessor isn't run. Whether the depend mode is used
+	// is only known later, so the arguments are added to the compiler arguments
+	// then.
+	args_free(depend_mode_args);
+	depend_mode_args = args_copy(dep_args);
+
 	*preprocessor_args = args_copy(stripped_args);
 	args_extend(*preprocessor_args, cpp_args);
 
@@ -3196,6 +3282,8 @@ initialize(void)
 void
 cc_reset(void)
 {
+	finish_include_file_hashing();
+	inode_cache_release();
 	conf_free(conf); conf = NULL;
 	free(primary_config_path); primary_config_path = NULL;
 	free(secondary_config_path); secondary_config_path = NULL;
@@ -3209,6 +3297,7 @@ cc_reset(void)
 	free(profile_dir); profile_dir = NULL;
 	free(included_pch_file); included_pch_file = NULL;
 	args_free(orig_args); orig_args = NULL;
+	args_free(depend_mode_args); depend_mode_args = NULL;
 	free(input_file); input_file = NULL;
 	free(output_obj); output_obj = NULL;
 	free(output_dep); output_dep = NULL;
@@ -3217,13 +3306,7 @@ cc_reset(void)
 	free(output_dia); output_dia = NULL;
 	free(output_dwo); output_dwo = NULL;
 	free(cached_obj_hash); cached_obj_hash = NULL;
-	free(cached_stderr); cached_stderr = NULL;
-	free(cached_obj); cached_obj = NULL;
-	free(cached_dep); cached_dep = NULL;
-	free(cached_cov); cached_cov = NULL;
-	free(cached_su); cached_su = NULL;
-	free(cached_dia); cached_dia = NULL;
-	free(cached_dwo); cached_dwo = NULL;
+	free(cached_result); cached_result = NULL;
 	free(manifest_path); manifest_path = NULL;
 	time_of_compilation = 0;
 	for (size_t i = 0; i < ignore_headers_len; i++) {
@@ -3341,12 +3424,27 @@ ccache(int argc, char *argv[])
 
 	cc_log("Object file: %s", output_obj);
 
-	struct mdfour common_hash;
+	if (conf->depend_mode
+	    && (!generating_dependencies
+	        || str_eq(output_dep, "/dev/null")
+	        || !conf->run_second_cpp
+	        || conf->unify)) {
+		cc_log("Disabling depend mode");
+		conf->depend_mode = false;
+	}
+
+	// Set here for the inode cache lookups of the compiler, and again when the
+	// preprocessor is run.
+	time_of_compilation = time(NULL);
+
+	struct hash common_hash;
 	hash_start(&common_hash);
+	int64_t common_hash_start = time_monotonic_us();
 	calculate_common_hash(preprocessor_args, &common_hash);
+	stats_phase_end(PHASE_COMMON_HASH, common_hash_start);
 
 	// Try to find the hash using the manifest.
-	struct mdfour direct_hash = common_hash;
+	struct hash direct_hash = common_hash;
 	bool put_object_in_manifest = false;
 	struct file_hash *object_hash = NULL;
 	struct file_hash *object_hash_from_manifest = NULL;
@@ -3375,8 +3473,31 @@ ccache(int argc, char *argv[])
 		failed();
 	}
 
+	if (conf->depend_mode && !conf->direct_mode) {
+		cc_log("Disabling depend mode");
+		conf->depend_mode = false;
+	}
+
+	if (conf->depend_mode) {
+		// Skip the preprocessor and compute the object hash from the direct mode
+		// hash and the include files listed in the dependency file once the
+		// compiler has run.
+		struct hash depend_mode_hash = direct_hash;
+		hash_delimiter(&depend_mode_hash, "depend mode");
+
+		if (conf->read_only) {
+			cc_log("Read-only mode; running real compiler");
+			failed();
+		}
+
+		args_extend(compiler_args, depend_mode_args);
+		add_prefix(compiler_args, conf->prefix_command);
+		to_cache(compiler_args, &depend_mode_hash);
+		x_exit(0);
+	}
+
 	// Find the hash using the preprocessed output. Also updates included_files.
-	struct mdfour cpp_hash = common_hash;
+	struct hash cpp_hash = common_hash;
 	object_hash = calculate_object_hash(preprocessor_args, &cpp_hash, 0);
 	if (!object_hash) {
 		fatal("internal error: object hash from cpp returned NULL");
@@ -3416,7 +3537,7 @@ ccache(int argc, char *argv[])
 	add_prefix(compiler_args, conf->prefix_command);
 
 	// Run real compiler, sending output to cache.
-	to_cache(compiler_args);
+	to_cache(compiler_args, NULL);
 
 	x_exit(0);
 }
@@ -3428,44 +3549,101 @@ configuration_printer(const char *descr, const char *origin, void *context)
 	fprintf(context, "(%s) %s\n", origin, descr);
 }
 
+// Check whether -v/--verbose is among the command line options so that -s can
+// be handled in argument order even if -v comes after it.
+static bool
+verbose_option_given(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (str_eq(arg, "--")) {
+			break;
+		}
+		if (str_eq(arg, "--verbose")) {
+			return true;
+		}
+		if (arg[0] != '-' || arg[1] == '-') {
+			continue;
+		}
+		for (const char *p = arg + 1; *p; p++) {
+			if (*p == 'v') {
+				return true;
+			}
+			if (strchr("FMo", *p)) {
+				// The rest of the argument or the next one is the option value.
+				if (!p[1]) {
+					i++;
+				}
+				break;
+			}
+		}
+	}
+	return false;
+}
+
 // The main program when not doing a compile.
 static int
 ccache_main_options(int argc, char *argv[])
 {
 	enum longopts {
-		DUMP_MANIFEST
+		DUMP_MANIFEST,
+		DUMP_RESULT,
+		PRINT_STATS,
+		STATS_FORMAT
 	};
 	static const struct option options[] = {
 		{"cleanup",       no_argument,       0, 'c'},
 		{"clear",         no_argument,       0, 'C'},
 		{"dump-manifest", required_argument, 0, DUMP_MANIFEST},
+		{"dump-result",   required_argument, 0, DUMP_RESULT},
 		{"help",          no_argument,       0, 'h'},
 		{"max-files",     required_argument, 0, 'F'},
 		{"max-size",      required_argument, 0, 'M'},
 		{"set-config",    required_argument, 0, 'o'},
 		{"print-config",  no_argument,       0, 'p'},
+		{"print-stats",   no_argument,       0, PRINT_STATS},
 		{"show-stats",    no_argument,       0, 's'},
+		{"stats-format",  required_argument, 0, STATS_FORMAT},
+		{"verbose",       no_argument,       0, 'v'},
 		{"version",       no_argument,       0, 'V'},
 		{"zero-stats",    no_argument,       0, 'z'},
 		{0, 0, 0, 0}
 	};
 
+	bool print_stats = false;
+	const char *stats_format = "raw";
+	bool verbose = verbose_option_given(argc, argv);
 	int c;
-	while ((c = getopt_long(argc, argv, "cChF:M:o:psVz", options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "cChF:M:o:psvVz", options, NULL))
+	       != -1) {
 		switch (c) {
 		case DUMP_MANIFEST:
 			manifest_dump(optarg, stdout);
 			break;
 
+		case DUMP_RESULT:
+			result_dump(optarg, stdout);
+			break;
+
+		case PRINT_STATS:
+			print_stats = true;
+			break;
+
+		case STATS_FORMAT:
+			stats_format = optarg;
+			break;
+
 		case 'c': // --cleanup
 			initialize();
 			clean_up_all(conf);
+			stats_flush();
 			printf("Cleaned cache\n");
 			break;
 
 		case 'C': // --clear
 			initialize();
 			wipe_all(conf);
+			stats_flush();
 			printf("Cleared cache\n");
 			break;
 
@@ -3538,7 +3716,10 @@ ccache_main_options(int argc, char *argv[])
 
 		case 's': // --show-stats
 			initialize();
-			stats_summary(conf);
+			stats_summary(conf, verbose);
+			break;
+
+		case 'v': // --verbose
 			break;
 
 		case 'V': // --version
@@ -3548,6 +3729,7 @@ ccache_main_options(int argc, char *argv[])
 		case 'z': // --zero-stats
 			initialize();
 			stats_zero();
+			stats_flush();
 			printf("Statistics cleared\n");
 			break;
 
@@ -3557,6 +3739,14 @@ ccache_main_options(int argc, char *argv[])
 		}
 	}
 
+	// Printed last so that --stats-format can be given after --print-stats.
+	if (print_stats) {
+		initialize();
+		if (!stats_print(conf, stats_format)) {
+			fatal("unknown statistics format: %s", stats_format);
+		}
+	}
+
 	return 0;
 }
 
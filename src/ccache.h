@@ -2,7 +2,7 @@
 #define CCACHE_H
 
 #include "system.h"
-#include "mdfour.h"
+#include "hash.h"
 #include "conf.h"
 #include "counters.h"
 
@@ -54,10 +54,28 @@ enum stats {
 	STATS_NUMCLEANUPS = 29,
 	STATS_UNSUPPORTED_DIRECTIVE = 30,
 	STATS_ZEROTIMESTAMP = 31,
+	STATS_SAVED_WALL_TIME = 32,
+	STATS_SAVED_CPU_TIME = 33,
+	STATS_LOCK_WAIT_TIME = 34,
+	STATS_LOCK_RETRIES = 35,
+	STATS_UNHASHABLE_DEPENDENCY = 36,
 
 	STATS_END
 };
 
+// Phases of a compilation whose durations are recorded in histograms.
+enum stats_phase {
+	PHASE_COMMON_HASH,
+	PHASE_MANIFEST_GET,
+	PHASE_PREPROCESSOR,
+	PHASE_COMPILER,
+	PHASE_RESULT_GET,
+	PHASE_RESULT_PUT,
+	PHASE_STATS_FLUSH,
+
+	PHASE_END
+};
+
 enum guessed_compiler {
 	GUESSED_CLANG,
 	GUESSED_GCC,
@@ -79,6 +97,9 @@ extern enum guessed_compiler guessed_compiler;
 // Allow us to not include any system headers in the manifest include files,
 // similar to -MM versus -M for dependencies.
 #define SLOPPY_NO_SYSTEM_HEADERS 64
+// Allow us to remember the output of the compiler check command for a compiler
+// whose stat information hasn't changed.
+#define SLOPPY_COMPILER_CHECK_OUTPUT 128
 
 #define str_eq(s1, s2) (strcmp((s1), (s2)) == 0)
 #define str_startswith(s, prefix) \
@@ -91,6 +112,11 @@ extern enum guessed_compiler guessed_compiler;
 // Buffer size for I/O operations. Should be a multiple of 4 KiB.
 #define READ_BUFFER_SIZE 65536
 
+// Regular files at least this large are memory mapped instead of read when
+// hashed or scanned. For smaller files, a single read() is cheaper than setting
+// up and tearing down a mapping.
+#define MMAP_MIN_SIZE READ_BUFFER_SIZE
+
 // ----------------------------------------------------------------------------
 // args.c
 
@@ -118,33 +144,44 @@ bool args_equal(struct args *args1, struct args *args2);
 // ----------------------------------------------------------------------------
 // hash.c
 
-void hash_start(struct mdfour *md);
-void hash_buffer(struct mdfour *md, const void *s, size_t len);
-char *hash_result(struct mdfour *md);
-void hash_result_as_bytes(struct mdfour *md, unsigned char *out);
-bool hash_equal(struct mdfour *md1, struct mdfour *md2);
-void hash_delimiter(struct mdfour *md, const char *type);
-void hash_string(struct mdfour *md, const char *s);
-void hash_string_length(struct mdfour *md, const char *s, int length);
-void hash_int(struct mdfour *md, int x);
-bool hash_fd(struct mdfour *md, int fd);
-bool hash_file(struct mdfour *md, const char *fname);
+void hash_start(struct hash *md);
+void hash_buffer(struct hash *md, const void *s, size_t len);
+char *hash_result(struct hash *md);
+void hash_result_as_bytes(struct hash *md, unsigned char *out);
+bool hash_equal(struct hash *md1, struct hash *md2);
+void hash_delimiter(struct hash *md, const char *type);
+void hash_string(struct hash *md, const char *s);
+void hash_string_length(struct hash *md, const char *s, int length);
+void hash_int(struct hash *md, int x);
+bool hash_fd(struct hash *md, int fd);
+bool hash_file(struct hash *md, const char *fname);
 
 // ----------------------------------------------------------------------------
 // util.c
 
+// Content of a file, either memory mapped or read into a heap buffer. In both
+// cases, data[size] is a NUL byte.
+struct mapped_file {
+	char *data;
+	size_t size;
+	bool mapped;
+	// Identity and modification time of the file that was read.
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+};
+
 void cc_log(const char *format, ...) ATTR_FORMAT(printf, 1, 2);
 void cc_bulklog(const char *format, ...) ATTR_FORMAT(printf, 1, 2);
 void cc_log_argv(const char *prefix, char **argv);
 void fatal(const char *format, ...) ATTR_FORMAT(printf, 1, 2) ATTR_NORETURN;
 void warn(const char *format, ...) ATTR_FORMAT(printf, 1, 2);
 
+bool write_fd(int fd, const void *buf, size_t size);
 void copy_fd(int fd_in, int fd_out);
-int copy_file(const char *src, const char *dest, int compress_level);
-int move_file(const char *src, const char *dest, int compress_level);
-int move_uncompressed_file(const char *src, const char *dest,
-                           int compress_level);
-bool file_is_compressed(const char *filename);
+bool clone_fd(int fd_in, int fd_out);
+bool copy_fd_range(int fd_in, uint64_t offset, int fd_out, uint64_t size);
+int copy_file(const char *src, const char *dest);
 int create_dir(const char *dir);
 int create_parent_dirs(const char *path);
 const char *get_hostname(void);
@@ -187,6 +224,8 @@ bool is_absolute_path(const char *path);
 bool is_full_path(const char *path);
 bool is_symlink(const char *path);
 void update_mtime(const char *path);
+int64_t time_monotonic_us(void);
+int64_t time_children_cpu_us(void);
 void x_exit(int status) ATTR_NORETURN;
 int x_rename(const char *oldpath, const char *newpath);
 int tmp_unlink(const char *path);
@@ -196,6 +235,9 @@ int x_try_unlink(const char *path);
 char *x_readlink(const char *path);
 #endif
 bool read_file(const char *path, size_t size_hint, char **data, size_t *size);
+bool map_file(const char *path, size_t size_hint, bool shared,
+              struct mapped_file *file);
+void unmap_file(struct mapped_file *file);
 char *read_text_file(const char *path, size_t size_hint);
 char *subst_env_in_string(const char *str, char **errmsg);
 void set_cloexec_flag(int fd);
@@ -204,10 +246,13 @@ void set_cloexec_flag(int fd);
 // stats.c
 
 void stats_update(enum stats stat);
+void stats_add(enum stats stat, uint64_t value);
 void stats_flush(void);
-unsigned stats_get_pending(enum stats stat);
+uint64_t stats_get_pending(enum stats stat);
 void stats_zero(void);
-void stats_summary(struct conf *conf);
+void stats_summary(struct conf *conf, bool verbose);
+bool stats_print(struct conf *conf, const char *format_name);
+void stats_phase_end(enum stats_phase phase, int64_t start);
 void stats_update_size(int64_t size, int files);
 void stats_get_obsolete_limits(const char *dir, unsigned *maxfiles,
                                uint64_t *maxsize);
@@ -217,10 +262,20 @@ void stats_timestamp(time_t time, struct counters *counters);
 void stats_read(const char *path, struct counters *counters);
 void stats_write(const char *path, struct counters *counters);
 
+// ----------------------------------------------------------------------------
+// scan.c
+
+void scan_init(void);
+const char *find_linemarker_candidate(const char *p, const char *limit,
+                                      bool pump);
+const char *find_temporal_macro_candidate(const char *p, const char *limit);
+
 // ----------------------------------------------------------------------------
 // unify.c
 
-int unify_hash(struct mdfour *hash, const char *fname, bool print);
+void unify_buffer(struct hash *hash, const char *data, size_t size,
+                  bool print);
+int unify_hash(struct hash *hash, const char *fname, bool shared, bool print);
 
 // ----------------------------------------------------------------------------
 // exitfn.c
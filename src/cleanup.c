@@ -16,6 +16,7 @@
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "ccache.h"
+#include "pack.h"
 
 #include <math.h>
 
@@ -23,10 +24,24 @@ static struct files {
 	char *fname;
 	time_t mtime;
 	uint64_t size;
+	// Index in packs if the file is stored in a pack, otherwise -1.
+	int pack;
+	// For a result file, the raw files stored next to it, see result.c. For a
+	// raw file, the next raw file of the same result.
+	struct files *raw;
 } **files;
 static unsigned allocated; // Size of the files array.
 static unsigned num_files; // Number of used entries in the files array.
 
+// Packs found in the directory and the names of the entries to remove from
+// them.
+static struct packs {
+	char *dir;
+	char **removed;
+	size_t n_removed;
+} *packs;
+static unsigned num_packs;
+
 static uint64_t cache_size;
 static size_t files_in_cache;
 static uint64_t cache_size_threshold;
@@ -45,6 +60,62 @@ files_compare(struct files **f1, struct files **f2)
 	return 1;
 }
 
+static void
+add_file(char *fname, time_t mtime, uint64_t size, int pack)
+{
+	if (num_files == allocated) {
+		allocated = 10000 + num_files*2;
+		files = (struct files **)x_realloc(files, sizeof(struct files *)*allocated);
+	}
+
+	files[num_files] = (struct files *)x_malloc(sizeof(struct files));
+	files[num_files]->fname = fname;
+	files[num_files]->mtime = mtime;
+	files[num_files]->size = size;
+	files[num_files]->pack = pack;
+	files[num_files]->raw = NULL;
+	cache_size += size;
+	files_in_cache++;
+	num_files++;
+}
+
+// Add the entries of the pack with the index index_path as files.
+static void
+add_pack(const char *index_path)
+{
+	char *dir = dirname(index_path);
+	struct pack_entry *entries;
+	size_t n;
+	if (!pack_list(dir, &entries, &n)) {
+		cc_log("Ignoring broken pack in %s", dir);
+		free(dir);
+		return;
+	}
+
+	packs = x_realloc(packs, (num_packs + 1) * sizeof(*packs));
+	packs[num_packs].dir = dir;
+	packs[num_packs].removed = NULL;
+	packs[num_packs].n_removed = 0;
+	for (size_t i = 0; i < n; i++) {
+		add_file(format("%s/%s", dir, entries[i].name), entries[i].atime,
+		         entries[i].size, num_packs);
+	}
+	num_packs++;
+	pack_entries_free(entries, n);
+}
+
+// Mark a packed file for removal when the pack is compacted.
+static void
+remove_packed_file(struct files *file)
+{
+	struct packs *pack = &packs[file->pack];
+	pack->removed = x_realloc(
+	  pack->removed, (pack->n_removed + 1) * sizeof(*pack->removed));
+	pack->removed[pack->n_removed++] = basename(file->fname);
+	cache_size -= file->size;
+	files_in_cache--;
+}
+
 // This builds the list of files in the cache.
 static void
 traverse_fn(const char *fname, struct stat *st)
@@ -54,7 +125,13 @@ traverse_fn(const char *fname, struct stat *st)
 	}
 
 	char *p = basename(fname);
-	if (str_eq(p, "stats")) {
+	if (str_eq(p, "stats") || str_eq(p, "stats.bin")) {
+		goto out;
+	}
+
+	if (str_endswith(p, ".lck")) {
+		// Lock files of the fcntl lock method must not be removed, see
+		// lockfile.c.
 		goto out;
 	}
 
@@ -73,18 +150,17 @@ traverse_fn(const char *fname, struct stat *st)
 		goto out;
 	}
 
-	if (num_files == allocated) {
-		allocated = 10000 + num_files*2;
-		files = (struct files **)x_realloc(files, sizeof(struct files *)*allocated);
+	if (str_eq(p, PACK_DATA_NAME)) {
+		// The entries are added when the index is found.
+		goto out;
 	}
 
-	files[num_files] = (struct files *)x_malloc(sizeof(struct files));
-	files[num_files]->fname = x_strdup(fname);
-	files[num_files]->mtime = st->st_mtime;
-	files[num_files]->size = file_size(st);
-	cache_size += files[num_files]->size;
-	files_in_cache++;
-	num_files++;
+	if (str_eq(p, PACK_INDEX_NAME)) {
+		add_pack(fname);
+		goto out;
+	}
+
+	add_file(x_strdup(fname), st->st_mtime, file_size(st), -1);
 
 out:
 	free(p);
@@ -106,6 +182,69 @@ delete_file(const char *path, size_t size, bool update_counters)
 	}
 }
 
+// File comparison function that orders files by name.
+static int
+files_name_compare(struct files **f1, struct files **f2)
+{
+	return strcmp((*f1)->fname, (*f2)->fname);
+}
+
+// Return the length of the part of path up to the first dot in the base name.
+static size_t
+stem_length(const char *path)
+{
+	const char *name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	const char *dot = strchr(name, '.');
+	return dot ? (size_t)(dot - path) : strlen(path);
+}
+
+// Attach the raw files stored next to a result file, which have the same name
+// but another suffix, to the result file so that they are evicted together
+// with it. Raw files without a result file are evicted on their own.
+static void
+attach_raw_files(void)
+{
+	if (num_files > 1) {
+		// Files with the same stem are then adjacent.
+		qsort(files, num_files, sizeof(struct files *),
+		      (COMPAR_FN_T)files_name_compare);
+	}
+
+	unsigned n = 0;
+	unsigned i = 0;
+	while (i < num_files) {
+		size_t len = stem_length(files[i]->fname);
+		unsigned end = i + 1;
+		while (end < num_files
+		       && strncmp(files[end]->fname, files[i]->fname, len + 1) == 0) {
+			end++;
+		}
+
+		struct files *result = NULL;
+		for (unsigned j = i; j < end; j++) {
+			if (files[j]->pack == -1 && str_endswith(files[j]->fname, ".result")) {
+				result = files[j];
+			}
+		}
+		for (unsigned j = i; j < end; j++) {
+			struct files *file = files[j];
+			if (result
+			    && file != result
+			    && file->pack == -1
+			    && !strstr(file->fname, ".tmp.")) {
+				file->raw = result->raw;
+				result->raw = file;
+				result->mtime = MAX(result->mtime, file->mtime);
+			} else {
+				files[n++] = file;
+			}
+		}
+		i = end;
+	}
+	num_files = n;
+}
+
 // Sort the files we've found and delete the oldest ones until we are below the
 // thresholds.
 static bool
@@ -119,8 +258,6 @@ sort_and_clean(void)
 	// Delete enough files to bring us below the threshold.
 	bool cleaned = false;
 	for (unsigned i = 0; i < num_files; i++) {
-		const char *ext;
-
 		if ((cache_size_threshold == 0
 		     || cache_size <= cache_size_threshold)
 		    && (files_in_cache_threshold == 0
@@ -128,28 +265,14 @@ sort_and_clean(void)
 			break;
 		}
 
-		ext = get_extension(files[i]->fname);
-		if (str_eq(ext, ".stderr")) {
-			// Make sure that the .o file is deleted before .stderr, because if the
-			// ccache process gets killed after deleting the .stderr but before
-			// deleting the .o, the cached result will be inconsistent. (.stderr is
-			// the only file that is optional; any other file missing from the cache
-			// will be detected by get_file_from_cache.)
-			char *base = remove_extension(files[i]->fname);
-			char *o_file = format("%s.o", base);
-
-			// Don't subtract this extra deletion from the cache size; that
-			// bookkeeping will be done when the loop reaches the .o file. If the
-			// loop doesn't reach the .o file since the target limits have been
-			// reached, the bookkeeping won't happen, but that small counter
-			// discrepancy won't do much harm and it will correct itself in the next
-			// cleanup.
-			delete_file(o_file, 0, false);
-
-			free(o_file);
-			free(base);
+		if (files[i]->pack != -1) {
+			remove_packed_file(files[i]);
+		} else {
+			for (struct files *raw = files[i]->raw; raw; raw = raw->raw) {
+				delete_file(raw->fname, raw->size, true);
+			}
+			delete_file(files[i]->fname, files[i]->size, true);
 		}
-		delete_file(files[i]->fname, files[i]->size, true);
 		cleaned = true;
 	}
 	return cleaned;
@@ -173,12 +296,29 @@ clean_up_dir(struct conf *conf, const char *dir, double limit_multiple)
 
 	// Build a list of files.
 	traverse(dir, traverse_fn);
+	attach_raw_files();
 
 	// Clean the cache.
 	cc_log("Before cleanup: %.0f KiB, %.0f files",
 	       (double)cache_size / 1024,
 	       (double)files_in_cache);
 	bool cleaned = sort_and_clean();
+
+	// Drop removed and replaced entries from the packs.
+	for (unsigned i = 0; i < num_packs; i++) {
+		if (!pack_compact(packs[i].dir, packs[i].removed, packs[i].n_removed)) {
+			cc_log("Failed to compact pack in %s", packs[i].dir);
+		}
+		for (size_t j = 0; j < packs[i].n_removed; j++) {
+			free(packs[i].removed[j]);
+		}
+		free(packs[i].removed);
+		free(packs[i].dir);
+	}
+	free(packs);
+	packs = NULL;
+	num_packs = 0;
+
 	cc_log("After cleanup: %.0f KiB, %.0f files",
 	       (double)cache_size / 1024,
 	       (double)files_in_cache);
@@ -192,6 +332,13 @@ clean_up_dir(struct conf *conf, const char *dir, double limit_multiple)
 
 	// Free it up.
 	for (unsigned i = 0; i < num_files; i++) {
+		struct files *raw = files[i]->raw;
+		while (raw) {
+			struct files *next = raw->raw;
+			free(raw->fname);
+			free(raw);
+			raw = next;
+		}
 		free(files[i]->fname);
 		free(files[i]);
 		files[i] = NULL;
@@ -225,7 +372,8 @@ static void wipe_fn(const char *fname, struct stat *st)
 	}
 
 	char *p = basename(fname);
-	if (str_eq(p, "stats")) {
+	if (str_eq(p, "stats") || str_eq(p, "stats.bin")
+	    || str_endswith(p, ".lck")) {
 		free(p);
 		return;
 	}
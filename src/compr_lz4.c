@@ -0,0 +1,219 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ccache.h"
+#include "compression.h"
+
+#ifdef HAVE_LIBLZ4
+
+#include <lz4frame.h>
+
+// LZ4 frames with content checksum. Compression levels below 3 use the fast
+// LZ4 compressor and higher levels use LZ4HC.
+
+struct compr_lz4_state {
+	int fd;
+	LZ4F_compressionContext_t context;
+	LZ4F_preferences_t preferences;
+	bool failed;
+	size_t buf_size;
+	char *buf;
+};
+
+struct decompr_lz4_state {
+	int fd;
+	LZ4F_decompressionContext_t context;
+	bool failed;
+	bool frame_end;
+	uint64_t remaining;
+	size_t pos;
+	size_t size;
+	char buf[READ_BUFFER_SIZE];
+};
+
+static bool
+check_error(size_t ret, const char *operation, bool *failed)
+{
+	if (LZ4F_isError(ret)) {
+		cc_log("LZ4 %s failed: %s", operation, LZ4F_getErrorName(ret));
+		*failed = true;
+	}
+	return !*failed;
+}
+
+static struct compr_state *
+compr_lz4_init(int fd, int compression_level)
+{
+	struct compr_lz4_state *state = x_malloc(sizeof(*state));
+	state->fd = fd;
+	state->failed = false;
+	if (LZ4F_isError(
+	      LZ4F_createCompressionContext(&state->context, LZ4F_VERSION))) {
+		cc_log("Failed to initialize LZ4 compression");
+		free(state);
+		return NULL;
+	}
+	memset(&state->preferences, 0, sizeof(state->preferences));
+	state->preferences.frameInfo.contentChecksumFlag =
+	  LZ4F_contentChecksumEnabled;
+	state->preferences.compressionLevel = compression_level;
+	state->buf_size =
+	  LZ4F_compressBound(READ_BUFFER_SIZE, &state->preferences);
+	state->buf = x_malloc(state->buf_size);
+
+	size_t n = LZ4F_compressBegin(
+	  state->context, state->buf, state->buf_size, &state->preferences);
+	if (check_error(n, "compression", &state->failed)
+	    && !write_fd(fd, state->buf, n)) {
+		state->failed = true;
+	}
+	return (struct compr_state *)state;
+}
+
+static bool
+compr_lz4_write(struct compr_state *handle, const void *data, size_t size)
+{
+	struct compr_lz4_state *state = (struct compr_lz4_state *)handle;
+	const char *p = data;
+	while (!state->failed && size > 0) {
+		size_t n = MIN(size, READ_BUFFER_SIZE);
+		size_t out = LZ4F_compressUpdate(
+		  state->context, state->buf, state->buf_size, p, n, NULL);
+		if (check_error(out, "compression", &state->failed)
+		    && out > 0
+		    && !write_fd(state->fd, state->buf, out)) {
+			state->failed = true;
+		}
+		p += n;
+		size -= n;
+	}
+	return !state->failed;
+}
+
+static bool
+compr_lz4_free(struct compr_state *handle)
+{
+	struct compr_lz4_state *state = (struct compr_lz4_state *)handle;
+	if (!state) {
+		return false;
+	}
+	if (!state->failed) {
+		size_t n =
+		  LZ4F_compressEnd(state->context, state->buf, state->buf_size, NULL);
+		if (check_error(n, "compression", &state->failed)
+		    && !write_fd(state->fd, state->buf, n)) {
+			state->failed = true;
+		}
+	}
+	bool ok = !state->failed;
+	LZ4F_freeCompressionContext(state->context);
+	free(state->buf);
+	free(state);
+	return ok;
+}
+
+static struct decompr_state *
+decompr_lz4_init(int fd, uint64_t input_size)
+{
+	struct decompr_lz4_state *state = x_malloc(sizeof(*state));
+	state->fd = fd;
+	state->remaining = input_size;
+	state->failed = false;
+	state->frame_end = false;
+	state->pos = 0;
+	state->size = 0;
+	if (LZ4F_isError(
+	      LZ4F_createDecompressionContext(&state->context, LZ4F_VERSION))) {
+		cc_log("Failed to initialize LZ4 decompression");
+		free(state);
+		return NULL;
+	}
+	return (struct decompr_state *)state;
+}
+
+static bool
+decompr_lz4_read(struct decompr_state *handle, void *data, size_t size)
+{
+	struct decompr_lz4_state *state = (struct decompr_lz4_state *)handle;
+	char *p = data;
+	while (!state->failed && size > 0) {
+		if (state->frame_end) {
+			// Not enough data.
+			return false;
+		}
+		if (state->pos == state->size) {
+			ssize_t n = read_compressed_input(
+			  state->fd, state->buf, sizeof(state->buf), &state->remaining);
+			if (n <= 0) {
+				state->failed = true;
+				return false;
+			}
+			state->pos = 0;
+			state->size = n;
+		}
+		size_t out_size = size;
+		size_t in_size = state->size - state->pos;
+		size_t ret = LZ4F_decompress(
+		  state->context, p, &out_size, state->buf + state->pos, &in_size, NULL);
+		if (!check_error(ret, "decompression", &state->failed)) {
+			return false;
+		}
+		if (ret == 0) {
+			state->frame_end = true;
+		}
+		state->pos += in_size;
+		p += out_size;
+		size -= out_size;
+	}
+	return !state->failed;
+}
+
+static bool
+decompr_lz4_free(struct decompr_state *handle)
+{
+	struct decompr_lz4_state *state = (struct decompr_lz4_state *)handle;
+	if (!state) {
+		return false;
+	}
+	bool ok = !state->failed;
+	if (ok && !state->frame_end) {
+		// The end mark and checksum may not have been consumed yet.
+		char c;
+		ok = !decompr_lz4_read(handle, &c, 1)
+		     && !state->failed
+		     && state->frame_end;
+	}
+	ok = ok
+	     && state->pos == state->size
+	     && state->remaining == 0;
+	LZ4F_freeDecompressionContext(state->context);
+	free(state);
+	return ok;
+}
+
+const struct compressor compressor_lz4_impl = {
+	compr_lz4_init,
+	compr_lz4_write,
+	compr_lz4_free
+};
+
+const struct decompressor decompressor_lz4_impl = {
+	decompr_lz4_init,
+	decompr_lz4_read,
+	decompr_lz4_free
+};
+
+#endif // HAVE_LIBLZ4
@@ -0,0 +1,137 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ccache.h"
+#include "compression.h"
+
+// Pass-through "compression". Data is buffered so that the many small writes
+// and reads of headers don't result in one system call each.
+
+struct state {
+	int fd;
+	bool failed;
+	uint64_t remaining;
+	size_t pos;
+	size_t size;
+	char buf[READ_BUFFER_SIZE];
+};
+
+static bool
+flush(struct state *state)
+{
+	if (state->size > 0 && !write_fd(state->fd, state->buf, state->size)) {
+		state->failed = true;
+	}
+	state->size = 0;
+	return !state->failed;
+}
+
+static struct compr_state *
+compr_none_init(int fd, int compression_level)
+{
+	(void)compression_level;
+	struct state *state = x_malloc(sizeof(*state));
+	state->fd = fd;
+	state->failed = false;
+	state->pos = 0;
+	state->size = 0;
+	return (struct compr_state *)state;
+}
+
+static bool
+compr_none_write(struct compr_state *handle, const void *data, size_t size)
+{
+	struct state *state = (struct state *)handle;
+	if (size > sizeof(state->buf) - state->size) {
+		if (!flush(state)) {
+			return false;
+		}
+		if (size >= sizeof(state->buf)) {
+			if (!write_fd(state->fd, data, size)) {
+				state->failed = true;
+			}
+			return !state->failed;
+		}
+	}
+	memcpy(state->buf + state->size, data, size);
+	state->size += size;
+	return true;
+}
+
+static bool
+compr_none_free(struct compr_state *handle)
+{
+	struct state *state = (struct state *)handle;
+	bool ok = flush(state);
+	free(state);
+	return ok;
+}
+
+static struct decompr_state *
+decompr_none_init(int fd, uint64_t input_size)
+{
+	struct state *state = (struct state *)compr_none_init(fd, 0);
+	state->remaining = input_size;
+	return (struct decompr_state *)state;
+}
+
+static bool
+decompr_none_read(struct decompr_state *handle, void *data, size_t size)
+{
+	struct state *state = (struct state *)handle;
+	char *p = data;
+	while (size > 0) {
+		if (state->pos == state->size) {
+			ssize_t n = read_compressed_input(
+			  state->fd, state->buf, sizeof(state->buf), &state->remaining);
+			if (n <= 0) {
+				state->failed = true;
+				return false;
+			}
+			state->pos = 0;
+			state->size = n;
+		}
+		size_t n = MIN(size, state->size - state->pos);
+		memcpy(p, state->buf + state->pos, n);
+		state->pos += n;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool
+decompr_none_free(struct decompr_state *handle)
+{
+	struct state *state = (struct state *)handle;
+	bool ok = !state->failed
+	          && state->pos == state->size
+	          && state->remaining == 0;
+	free(state);
+	return ok;
+}
+
+const struct compressor compressor_none_impl = {
+	compr_none_init,
+	compr_none_write,
+	compr_none_free
+};
+
+const struct decompressor decompressor_none_impl = {
+	decompr_none_init,
+	decompr_none_read,
+	decompr_none_free
+};
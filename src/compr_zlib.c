@@ -0,0 +1,204 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ccache.h"
+#include "compression.h"
+
+#include <zlib.h>
+
+// zlib streams (RFC 1950) without the gzip wrapper, since the cache file
+// header already tells what the data is.
+
+struct state {
+	int fd;
+	z_stream stream;
+	bool failed;
+	bool stream_end;
+	// Decompressor input left to read.
+	uint64_t remaining;
+	unsigned char buf[READ_BUFFER_SIZE];
+};
+
+static struct compr_state *
+compr_zlib_init(int fd, int compression_level)
+{
+	struct state *state = x_malloc(sizeof(*state));
+	state->fd = fd;
+	state->failed = false;
+	state->stream_end = false;
+	state->stream.zalloc = Z_NULL;
+	state->stream.zfree = Z_NULL;
+	state->stream.opaque = Z_NULL;
+	if (compression_level < Z_BEST_SPEED
+	    || compression_level > Z_BEST_COMPRESSION) {
+		compression_level = Z_DEFAULT_COMPRESSION;
+	}
+	if (deflateInit(&state->stream, compression_level) != Z_OK) {
+		free(state);
+		return NULL;
+	}
+	return (struct compr_state *)state;
+}
+
+// Feed the pending input to deflate and write the output.
+static bool
+deflate_and_write(struct state *state, int flush)
+{
+	int ret;
+	do {
+		state->stream.next_out = state->buf;
+		state->stream.avail_out = sizeof(state->buf);
+		ret = deflate(&state->stream, flush);
+		if (ret == Z_STREAM_ERROR) {
+			state->failed = true;
+			return false;
+		}
+		size_t n = sizeof(state->buf) - state->stream.avail_out;
+		if (n > 0 && !write_fd(state->fd, state->buf, n)) {
+			state->failed = true;
+			return false;
+		}
+	} while (state->stream.avail_out == 0
+	         || (flush == Z_FINISH && ret != Z_STREAM_END));
+	return true;
+}
+
+static bool
+compr_zlib_write(struct compr_state *handle, const void *data, size_t size)
+{
+	struct state *state = (struct state *)handle;
+	if (state->failed) {
+		return false;
+	}
+	const unsigned char *p = data;
+	while (size > 0) {
+		// avail_in is only an unsigned int.
+		size_t n = MIN(size, READ_BUFFER_SIZE);
+		state->stream.next_in = (unsigned char *)p;
+		state->stream.avail_in = n;
+		if (!deflate_and_write(state, Z_NO_FLUSH)) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool
+compr_zlib_free(struct compr_state *handle)
+{
+	struct state *state = (struct state *)handle;
+	if (!state) {
+		return false;
+	}
+	state->stream.next_in = Z_NULL;
+	state->stream.avail_in = 0;
+	bool ok = !state->failed && deflate_and_write(state, Z_FINISH);
+	deflateEnd(&state->stream);
+	free(state);
+	return ok;
+}
+
+static struct decompr_state *
+decompr_zlib_init(int fd, uint64_t input_size)
+{
+	struct state *state = x_malloc(sizeof(*state));
+	state->fd = fd;
+	state->remaining = input_size;
+	state->failed = false;
+	state->stream_end = false;
+	state->stream.zalloc = Z_NULL;
+	state->stream.zfree = Z_NULL;
+	state->stream.opaque = Z_NULL;
+	state->stream.next_in = Z_NULL;
+	state->stream.avail_in = 0;
+	if (inflateInit(&state->stream) != Z_OK) {
+		free(state);
+		return NULL;
+	}
+	return (struct decompr_state *)state;
+}
+
+static bool
+decompr_zlib_read(struct decompr_state *handle, void *data, size_t size)
+{
+	struct state *state = (struct state *)handle;
+	if (state->failed) {
+		return false;
+	}
+	state->stream.next_out = data;
+	state->stream.avail_out = size;
+	while (state->stream.avail_out > 0) {
+		if (state->stream_end) {
+			// Not enough data.
+			return false;
+		}
+		if (state->stream.avail_in == 0) {
+			ssize_t n = read_compressed_input(
+			  state->fd, state->buf, sizeof(state->buf), &state->remaining);
+			if (n <= 0) {
+				state->failed = true;
+				return false;
+			}
+			state->stream.next_in = state->buf;
+			state->stream.avail_in = n;
+		}
+		int ret = inflate(&state->stream, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			state->stream_end = true;
+		} else if (ret != Z_OK) {
+			state->failed = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+decompr_zlib_free(struct decompr_state *handle)
+{
+	struct state *state = (struct state *)handle;
+	if (!state) {
+		return false;
+	}
+	bool ok = !state->failed;
+	if (ok && !state->stream_end) {
+		// The trailing checksum may not have been consumed yet.
+		char c;
+		ok = !decompr_zlib_read(handle, &c, 1)
+		     && !state->failed
+		     && state->stream_end;
+	}
+	ok = ok
+	     && state->stream.avail_in == 0
+	     && state->remaining == 0;
+	inflateEnd(&state->stream);
+	free(state);
+	return ok;
+}
+
+const struct compressor compressor_zlib_impl = {
+	compr_zlib_init,
+	compr_zlib_write,
+	compr_zlib_free
+};
+
+const struct decompressor decompressor_zlib_impl = {
+	decompr_zlib_init,
+	decompr_zlib_read,
+	decompr_zlib_free
+};
@@ -0,0 +1,214 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ccache.h"
+#include "compression.h"
+
+#ifdef HAVE_LIBZSTD
+
+#include <zstd.h>
+
+struct compr_zstd_state {
+	int fd;
+	ZSTD_CStream *stream;
+	bool failed;
+	size_t buf_size;
+	char *buf;
+};
+
+struct decompr_zstd_state {
+	int fd;
+	ZSTD_DStream *stream;
+	ZSTD_inBuffer in;
+	bool failed;
+	bool frame_end;
+	uint64_t remaining;
+	size_t buf_size;
+	char *buf;
+};
+
+static struct compr_state *
+compr_zstd_init(int fd, int compression_level)
+{
+	struct compr_zstd_state *state = x_malloc(sizeof(*state));
+	state->fd = fd;
+	state->failed = false;
+	state->stream = ZSTD_createCStream();
+	if (compression_level > ZSTD_maxCLevel()) {
+		compression_level = ZSTD_maxCLevel();
+	}
+	if (!state->stream
+	    || ZSTD_isError(ZSTD_initCStream(state->stream, compression_level))) {
+		cc_log("Failed to initialize zstd compression");
+		ZSTD_freeCStream(state->stream);
+		free(state);
+		return NULL;
+	}
+	state->buf_size = ZSTD_CStreamOutSize();
+	state->buf = x_malloc(state->buf_size);
+	return (struct compr_state *)state;
+}
+
+// Write the output produced so far. out.pos is reset.
+static bool
+write_output(struct compr_zstd_state *state, ZSTD_outBuffer *out)
+{
+	if (out->pos > 0 && !write_fd(state->fd, out->dst, out->pos)) {
+		state->failed = true;
+	}
+	out->pos = 0;
+	return !state->failed;
+}
+
+static bool
+compr_zstd_write(struct compr_state *handle, const void *data, size_t size)
+{
+	struct compr_zstd_state *state = (struct compr_zstd_state *)handle;
+	if (state->failed) {
+		return false;
+	}
+	ZSTD_inBuffer in = {data, size, 0};
+	ZSTD_outBuffer out = {state->buf, state->buf_size, 0};
+	while (in.pos < in.size) {
+		size_t ret = ZSTD_compressStream(state->stream, &out, &in);
+		if (ZSTD_isError(ret)) {
+			cc_log("zstd compression failed: %s", ZSTD_getErrorName(ret));
+			state->failed = true;
+			return false;
+		}
+		if (!write_output(state, &out)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+compr_zstd_free(struct compr_state *handle)
+{
+	struct compr_zstd_state *state = (struct compr_zstd_state *)handle;
+	if (!state) {
+		return false;
+	}
+	bool ok = !state->failed;
+	ZSTD_outBuffer out = {state->buf, state->buf_size, 0};
+	size_t remaining = 1;
+	while (ok && remaining > 0) {
+		remaining = ZSTD_endStream(state->stream, &out);
+		ok = !ZSTD_isError(remaining) && write_output(state, &out);
+	}
+	ZSTD_freeCStream(state->stream);
+	free(state->buf);
+	free(state);
+	return ok;
+}
+
+static struct decompr_state *
+decompr_zstd_init(int fd, uint64_t input_size)
+{
+	struct decompr_zstd_state *state = x_malloc(sizeof(*state));
+	state->fd = fd;
+	state->remaining = input_size;
+	state->failed = false;
+	state->frame_end = false;
+	state->stream = ZSTD_createDStream();
+	if (!state->stream || ZSTD_isError(ZSTD_initDStream(state->stream))) {
+		cc_log("Failed to initialize zstd decompression");
+		ZSTD_freeDStream(state->stream);
+		free(state);
+		return NULL;
+	}
+	state->buf_size = ZSTD_DStreamInSize();
+	state->buf = x_malloc(state->buf_size);
+	state->in.src = state->buf;
+	state->in.size = 0;
+	state->in.pos = 0;
+	return (struct decompr_state *)state;
+}
+
+static bool
+decompr_zstd_read(struct decompr_state *handle, void *data, size_t size)
+{
+	struct decompr_zstd_state *state = (struct decompr_zstd_state *)handle;
+	if (state->failed) {
+		return false;
+	}
+	ZSTD_outBuffer out = {data, size, 0};
+	while (out.pos < out.size) {
+		if (state->frame_end) {
+			// Not enough data.
+			return false;
+		}
+		if (state->in.pos == state->in.size) {
+			ssize_t n = read_compressed_input(
+			  state->fd, state->buf, state->buf_size, &state->remaining);
+			if (n <= 0) {
+				state->failed = true;
+				return false;
+			}
+			state->in.size = n;
+			state->in.pos = 0;
+		}
+		size_t ret = ZSTD_decompressStream(state->stream, &out, &state->in);
+		if (ZSTD_isError(ret)) {
+			cc_log("zstd decompression failed: %s", ZSTD_getErrorName(ret));
+			state->failed = true;
+			return false;
+		}
+		if (ret == 0) {
+			state->frame_end = true;
+		}
+	}
+	return true;
+}
+
+static bool
+decompr_zstd_free(struct decompr_state *handle)
+{
+	struct decompr_zstd_state *state = (struct decompr_zstd_state *)handle;
+	if (!state) {
+		return false;
+	}
+	bool ok = !state->failed;
+	if (ok && !state->frame_end) {
+		// The end of the frame may not have been consumed yet.
+		char c;
+		ok = !decompr_zstd_read(handle, &c, 1)
+		     && !state->failed
+		     && state->frame_end;
+	}
+	ok = ok
+	     && state->in.pos == state->in.size
+	     && state->remaining == 0;
+	ZSTD_freeDStream(state->stream);
+	free(state->buf);
+	free(state);
+	return ok;
+}
+
+const struct compressor compressor_zstd_impl = {
+	compr_zstd_init,
+	compr_zstd_write,
+	compr_zstd_free
+};
+
+const struct decompressor decompressor_zstd_impl = {
+	decompr_zstd_init,
+	decompr_zstd_read,
+	decompr_zstd_free
+};
+
+#endif // HAVE_LIBZSTD
@@ -0,0 +1,131 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ccache.h"
+#include "compression.h"
+
+static const char *const type_names[] = {
+	"none",
+	"zlib",
+	"zstd",
+	"lz4",
+};
+
+// Return the compression type to use for new cache files.
+enum compression_type
+compression_type_from_config(void)
+{
+	extern struct conf *conf;
+	if (!conf->compression || conf->compression_level == 0) {
+		return COMPR_TYPE_NONE;
+	}
+	int type = compression_type_from_string(conf->compression_type);
+	if (type < 0 || !compression_type_is_supported(type)) {
+		cc_log("Compression type %s is not supported by this build, using zlib",
+		       conf->compression_type);
+		return COMPR_TYPE_ZLIB;
+	}
+	return type;
+}
+
+const char *
+compression_type_to_string(uint8_t type)
+{
+	return type < ARRAY_SIZE(type_names) ? type_names[type] : "unknown";
+}
+
+// Returns the compression type with the given name, or -1 if unknown. Types
+// that aren't supported by this build are still recognized.
+int
+compression_type_from_string(const char *str)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(type_names); i++) {
+		if (str_eq(str, type_names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool
+compression_type_is_supported(uint8_t type)
+{
+	return compressor_from_type(type) != NULL;
+}
+
+const struct compressor *
+compressor_from_type(uint8_t type)
+{
+	switch (type) {
+	case COMPR_TYPE_NONE:
+		return &compressor_none_impl;
+	case COMPR_TYPE_ZLIB:
+		return &compressor_zlib_impl;
+#ifdef HAVE_LIBZSTD
+	case COMPR_TYPE_ZSTD:
+		return &compressor_zstd_impl;
+#endif
+#ifdef HAVE_LIBLZ4
+	case COMPR_TYPE_LZ4:
+		return &compressor_lz4_impl;
+#endif
+	}
+	return NULL;
+}
+
+const struct decompressor *
+decompressor_from_type(uint8_t type)
+{
+	switch (type) {
+	case COMPR_TYPE_NONE:
+		return &decompressor_none_impl;
+	case COMPR_TYPE_ZLIB:
+		return &decompressor_zlib_impl;
+#ifdef HAVE_LIBZSTD
+	case COMPR_TYPE_ZSTD:
+		return &decompressor_zstd_impl;
+#endif
+#ifdef HAVE_LIBLZ4
+	case COMPR_TYPE_LZ4:
+		return &decompressor_lz4_impl;
+#endif
+	}
+	return NULL;
+}
+
+// Read at most size bytes of decompressor input from fd without reading past
+// the end of the input. Returns the number of bytes read, 0 at the end of the
+// input or -1 on error.
+ssize_t
+read_compressed_input(int fd, void *buf, size_t size, uint64_t *remaining)
+{
+	size = MIN(size, *remaining);
+	if (size == 0) {
+		return 0;
+	}
+	ssize_t n;
+	do {
+		n = read(fd, buf, size);
+	} while (n == -1 && errno == EINTR);
+	if (n == 0) {
+		// The file is shorter than it should be.
+		return -1;
+	}
+	if (n > 0) {
+		*remaining -= n;
+	}
+	return n;
+}
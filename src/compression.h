@@ -0,0 +1,74 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "system.h"
+
+// Compression types. The numbers are stored in cache files, so they must not
+// be changed.
+enum compression_type {
+	COMPR_TYPE_NONE = 0,
+	COMPR_TYPE_ZLIB = 1,
+	COMPR_TYPE_ZSTD = 2,
+	COMPR_TYPE_LZ4 = 3
+};
+
+struct compr_state;
+struct decompr_state;
+
+// A compressor writes a compressed stream to a file descriptor. free()
+// finishes the stream and returns false if any write has failed.
+struct compressor {
+	struct compr_state *(*init)(int fd, int compression_level);
+	bool (*write)(struct compr_state *state, const void *data, size_t size);
+	bool (*free)(struct compr_state *state);
+};
+
+// A decompressor reads a compressed stream of input_size bytes from the
+// current position of a file descriptor. read() returns false unless exactly
+// size bytes could be read. free() returns false if there has been an error or
+// if the stream didn't end exactly at the end of the input.
+struct decompressor {
+	struct decompr_state *(*init)(int fd, uint64_t input_size);
+	bool (*read)(struct decompr_state *state, void *data, size_t size);
+	bool (*free)(struct decompr_state *state);
+};
+
+extern const struct compressor compressor_none_impl;
+extern const struct decompressor decompressor_none_impl;
+extern const struct compressor compressor_zlib_impl;
+extern const struct decompressor decompressor_zlib_impl;
+#ifdef HAVE_LIBZSTD
+extern const struct compressor compressor_zstd_impl;
+extern const struct decompressor decompressor_zstd_impl;
+#endif
+#ifdef HAVE_LIBLZ4
+extern const struct compressor compressor_lz4_impl;
+extern const struct decompressor decompressor_lz4_impl;
+#endif
+
+enum compression_type compression_type_from_config(void);
+const char *compression_type_to_string(uint8_t type);
+int compression_type_from_string(const char *str);
+bool compression_type_is_supported(uint8_t type);
+const struct compressor *compressor_from_type(uint8_t type);
+const struct decompressor *decompressor_from_type(uint8_t type);
+ssize_t read_compressed_input(int fd, void *buf, size_t size,
+                              uint64_t *remaining);
+
+#endif
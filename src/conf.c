@@ -16,6 +16,7 @@
 
 #include "conf.h"
 #include "ccache.h"
+#include "compression.h"
 
 typedef bool (*conf_item_parser)(const char *str, void *result, char **errmsg);
 typedef bool (*conf_item_verifier)(void *value, char **errmsg);
@@ -102,7 +103,9 @@ parse_sloppiness(const char *str, void *result, char **errmsg)
 	char *word;
 	char *saveptr = NULL;
 	while ((word = strtok_r(q, ", ", &saveptr))) {
-		if (str_eq(word, "file_macro")) {
+		if (str_eq(word, "compiler_check_output")) {
+			*value |= SLOPPY_COMPILER_CHECK_OUTPUT;
+		} else if (str_eq(word, "file_macro")) {
 			*value |= SLOPPY_FILE_MACRO;
 		} else if (str_eq(word, "file_stat_matches")) {
 			*value |= SLOPPY_FILE_STAT_MATCHES;
@@ -196,6 +199,19 @@ verify_absolute_path(void *value, char **errmsg)
 	}
 }
 
+static bool
+verify_compression_type(void *value, char **errmsg)
+{
+	char **type = (char **)value;
+	assert(*type);
+	if (compression_type_from_string(*type) > COMPR_TYPE_NONE) {
+		return true;
+	} else {
+		*errmsg = format("unknown compression type: \"%s\"", *type);
+		return false;
+	}
+}
+
 static bool
 verify_dir_levels(void *value, char **errmsg)
 {
@@ -209,6 +225,19 @@ verify_dir_levels(void *value, char **errmsg)
 	}
 }
 
+static bool
+verify_lock_method(void *value, char **errmsg)
+{
+	char **method = (char **)value;
+	assert(*method);
+	if (str_eq(*method, "symlink") || str_eq(*method, "fcntl")) {
+		return true;
+	} else {
+		*errmsg = format("unknown lock method: \"%s\"", *method);
+		return false;
+	}
+}
+
 #define ITEM(name, type) \
   parse_ ## type, offsetof(struct conf, name), NULL
 #define ITEM_V(name, type, verification) \
@@ -327,18 +356,23 @@ conf_create(void)
 	conf->compiler_check = x_strdup("mtime");
 	conf->compression = false;
 	conf->compression_level = 6;
+	conf->compression_type = x_strdup("zlib");
 	conf->cpp_extension = x_strdup("");
+	conf->depend_mode = false;
 	conf->direct_mode = true;
 	conf->disable = false;
 	conf->extra_files_to_hash = x_strdup("");
 	conf->hard_link = false;
 	conf->hash_dir = true;
 	conf->ignore_headers_in_manifest = x_strdup("");
+	conf->inode_cache = true;
 	conf->keep_comments_cpp = false;
 	conf->limit_multiple = 0.8f;
+	conf->lock_method = x_strdup("symlink");
 	conf->log_file = x_strdup("");
 	conf->max_files = 0;
 	conf->max_size = (uint64_t)5 * 1000 * 1000 * 1000;
+	conf->pack_threshold = 0;
 	conf->path = x_strdup("");
 	conf->pch_external_checksum = false;
 	conf->prefix_command = x_strdup("");
@@ -369,9 +403,11 @@ conf_free(struct conf *conf)
 	free(conf->cache_dir);
 	free(conf->compiler);
 	free(conf->compiler_check);
+	free(conf->compression_type);
 	free(conf->cpp_extension);
 	free(conf->extra_files_to_hash);
 	free(conf->ignore_headers_in_manifest);
+	free(conf->lock_method);
 	free(conf->log_file);
 	free(conf->path);
 	free(conf->prefix_command);
@@ -561,9 +597,16 @@ conf_print_items(struct conf *conf,
 	printer(s, conf->item_origins[find_conf("compression_level")->number],
 	        context);
 
+	reformat(&s, "compression_type = %s", conf->compression_type);
+	printer(s, conf->item_origins[find_conf("compression_type")->number],
+	        context);
+
 	reformat(&s, "cpp_extension = %s", conf->cpp_extension);
 	printer(s, conf->item_origins[find_conf("cpp_extension")->number], context);
 
+	reformat(&s, "depend_mode = %s", bool_to_string(conf->depend_mode));
+	printer(s, conf->item_origins[find_conf("depend_mode")->number], context);
+
 	reformat(&s, "direct_mode = %s", bool_to_string(conf->direct_mode));
 	printer(s, conf->item_origins[find_conf("direct_mode")->number], context);
 
@@ -586,6 +629,9 @@ conf_print_items(struct conf *conf,
 	        conf->item_origins[find_conf("ignore_headers_in_manifest")->number],
 	        context);
 
+	reformat(&s, "inode_cache = %s", bool_to_string(conf->inode_cache));
+	printer(s, conf->item_origins[find_conf("inode_cache")->number], context);
+
 	reformat(&s, "keep_comments_cpp = %s",
 	         bool_to_string(conf->keep_comments_cpp));
 	printer(s, conf->item_origins[find_conf(
@@ -594,6 +640,9 @@ conf_print_items(struct conf *conf,
 	reformat(&s, "limit_multiple = %.1f", (double)conf->limit_multiple);
 	printer(s, conf->item_origins[find_conf("limit_multiple")->number], context);
 
+	reformat(&s, "lock_method = %s", conf->lock_method);
+	printer(s, conf->item_origins[find_conf("lock_method")->number], context);
+
 	reformat(&s, "log_file = %s", conf->log_file);
 	printer(s, conf->item_origins[find_conf("log_file")->number], context);
 
@@ -605,6 +654,11 @@ conf_print_items(struct conf *conf,
 	printer(s, conf->item_origins[find_conf("max_size")->number], context);
 	free(s2);
 
+	s2 = format_parsable_size_with_suffix(conf->pack_threshold);
+	reformat(&s, "pack_threshold = %s", s2);
+	printer(s, conf->item_origins[find_conf("pack_threshold")->number], context);
+	free(s2);
+
 	reformat(&s, "path = %s", conf->path);
 	printer(s, conf->item_origins[find_conf("path")->number], context);
 
@@ -655,6 +709,9 @@ conf_print_items(struct conf *conf,
 	if (conf->sloppiness & SLOPPY_NO_SYSTEM_HEADERS) {
 		reformat(&s, "%sno_system_headers, ", s);
 	}
+	if (conf->sloppiness & SLOPPY_COMPILER_CHECK_OUTPUT) {
+		reformat(&s, "%scompiler_check_output, ", s);
+	}
 	if (conf->sloppiness) {
 		// Strip last ", ".
 		s[strlen(s) - 2] = '\0';
@@ -11,18 +11,23 @@ struct conf {
 	char *compiler_check;
 	bool compression;
 	unsigned compression_level;
+	char *compression_type;
 	char *cpp_extension;
+	bool depend_mode;
 	bool direct_mode;
 	bool disable;
 	char *extra_files_to_hash;
 	bool hard_link;
 	bool hash_dir;
 	char *ignore_headers_in_manifest;
+	bool inode_cache;
 	bool keep_comments_cpp;
 	float limit_multiple;
+	char *lock_method;
 	char *log_file;
 	unsigned max_files;
 	uint64_t max_size;
+	uint64_t pack_threshold;
 	char *path;
 	bool pch_external_checksum;
 	char *prefix_command;
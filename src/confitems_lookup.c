@@ -31,7 +31,7 @@
 
 #line 8 "src/confitems.gperf"
 struct conf_item;
-/* maximum key range = 46, duplicates = 0 */
+/* maximum key range = 95, duplicates = 0 */
 
 #ifdef __GNUC__
 __inline
@@ -45,32 +45,32 @@ confitems_hash (register const char *str, register unsigned int len)
 {
   static const unsigned char asso_values[] =
     {
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50,  0, 35,  0,
-       5, 10, 50,  0, 30, 20, 50,  0, 10, 20,
-       5,  0,  0, 50,  5,  0, 10, 15, 50, 50,
-      20, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100,   0,   5,  40,
+       20,  30, 100,  20,  45,  20, 100,  15,  50,  20,
+        0,  25,  10, 100,  50,   5,   0,   0, 100, 100,
+       50, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+      100, 100, 100, 100, 100, 100
     };
   return len + asso_values[(unsigned char)str[1]] + asso_values[(unsigned char)str[0]];
 }
@@ -87,92 +87,128 @@ confitems_get (register const char *str, register unsigned int len)
 {
   enum
     {
-      TOTAL_KEYWORDS = 32,
+      TOTAL_KEYWORDS = 37,
       MIN_WORD_LENGTH = 4,
       MAX_WORD_LENGTH = 26,
-      MIN_HASH_VALUE = 4,
-      MAX_HASH_VALUE = 49
+      MIN_HASH_VALUE = 5,
+      MAX_HASH_VALUE = 99
     };
 
   static const struct conf_item wordlist[] =
     {
       {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
       {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
-#line 29 "src/confitems.gperf"
-      {"path",                19, ITEM(path, env_string)},
+      {"",0,NULL,0,NULL},
+#line 46 "src/confitems.gperf"
+      {"unify",               36, ITEM(unify, bool)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+#line 43 "src/confitems.gperf"
+      {"stats",               33, ITEM(stats, bool)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+#line 10 "src/confitems.gperf"
+      {"base_dir",             0, ITEM_V(base_dir, env_string, absolute_path)},
+#line 34 "src/confitems.gperf"
+      {"path",                24, ITEM(path, env_string)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
       {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
       {"",0,NULL,0,NULL},
-#line 13 "src/confitems.gperf"
-      {"compiler",             3, ITEM(compiler, string)},
+#line 33 "src/confitems.gperf"
+      {"pack_threshold",      23, ITEM(pack_threshold, size)},
+#line 45 "src/confitems.gperf"
+      {"umask",               35, ITEM(umask, umask)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+#line 32 "src/confitems.gperf"
+      {"max_size",            22, ITEM(max_size, size)},
+#line 31 "src/confitems.gperf"
+      {"max_files",           21, ITEM(max_files, unsigned)},
+      {"",0,NULL,0,NULL},
+#line 26 "src/confitems.gperf"
+      {"inode_cache",         16, ITEM(inode_cache, bool)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL},
+#line 44 "src/confitems.gperf"
+      {"temporary_dir",       34, ITEM(temporary_dir, env_string)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL},
+#line 21 "src/confitems.gperf"
+      {"disable",             11, ITEM(disable, bool)},
+      {"",0,NULL,0,NULL},
 #line 11 "src/confitems.gperf"
       {"cache_dir",            1, ITEM(cache_dir, env_string)},
       {"",0,NULL,0,NULL},
+#line 20 "src/confitems.gperf"
+      {"direct_mode",         10, ITEM(direct_mode, bool)},
+      {"",0,NULL,0,NULL},
+#line 24 "src/confitems.gperf"
+      {"hash_dir",            14, ITEM(hash_dir, bool)},
+#line 23 "src/confitems.gperf"
+      {"hard_link",           13, ITEM(hard_link, bool)},
+      {"",0,NULL,0,NULL},
+#line 12 "src/confitems.gperf"
+      {"cache_dir_levels",     2, ITEM_V(cache_dir_levels, unsigned, dir_levels)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+#line 19 "src/confitems.gperf"
+      {"depend_mode",          9, ITEM(depend_mode, bool)},
+#line 27 "src/confitems.gperf"
+      {"keep_comments_cpp",   17, ITEM(keep_comments_cpp, bool)},
+#line 18 "src/confitems.gperf"
+      {"cpp_extension",        8, ITEM(cpp_extension, string)},
+#line 41 "src/confitems.gperf"
+      {"run_second_cpp",      31, ITEM(run_second_cpp, bool)},
+#line 42 "src/confitems.gperf"
+      {"sloppiness",          32, ITEM(sloppiness, sloppiness)},
+#line 25 "src/confitems.gperf"
+      {"ignore_headers_in_manifest", 15, ITEM(ignore_headers_in_manifest, env_string)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+#line 35 "src/confitems.gperf"
+      {"pch_external_checksum", 25, ITEM(pch_external_checksum, bool)},
+      {"",0,NULL,0,NULL},
+#line 13 "src/confitems.gperf"
+      {"compiler",             3, ITEM(compiler, string)},
+#line 36 "src/confitems.gperf"
+      {"prefix_command",      26, ITEM(prefix_command, env_string)},
+      {"",0,NULL,0,NULL},
 #line 15 "src/confitems.gperf"
       {"compression",          5, ITEM(compression, bool)},
       {"",0,NULL,0,NULL},
-#line 17 "src/confitems.gperf"
-      {"cpp_extension",        7, ITEM(cpp_extension, string)},
+#line 37 "src/confitems.gperf"
+      {"prefix_command_cpp",  27, ITEM(prefix_command_cpp, env_string)},
 #line 14 "src/confitems.gperf"
       {"compiler_check",       4, ITEM(compiler_check, string)},
-#line 38 "src/confitems.gperf"
-      {"stats",               28, ITEM(stats, bool)},
-#line 12 "src/confitems.gperf"
-      {"cache_dir_levels",     2, ITEM_V(cache_dir_levels, unsigned, dir_levels)},
+      {"",0,NULL,0,NULL},
+#line 17 "src/confitems.gperf"
+      {"compression_type",     7, ITEM_V(compression_type, string, compression_type)},
 #line 16 "src/confitems.gperf"
       {"compression_level",    6, ITEM(compression_level, unsigned)},
-#line 26 "src/confitems.gperf"
-      {"log_file",            16, ITEM(log_file, env_string)},
-#line 31 "src/confitems.gperf"
-      {"prefix_command",      21, ITEM(prefix_command, env_string)},
-#line 37 "src/confitems.gperf"
-      {"sloppiness",          27, ITEM(sloppiness, sloppiness)},
 #line 30 "src/confitems.gperf"
-      {"pch_external_checksum", 20, ITEM(pch_external_checksum, bool)},
-#line 35 "src/confitems.gperf"
-      {"recache",             25, ITEM(recache, bool)},
-#line 32 "src/confitems.gperf"
-      {"prefix_command_cpp",  22, ITEM(prefix_command_cpp, env_string)},
-#line 33 "src/confitems.gperf"
-      {"read_only",           23, ITEM(read_only, bool)},
-#line 41 "src/confitems.gperf"
-      {"unify",               31, ITEM(unify, bool)},
-      {"",0,NULL,0,NULL},
-#line 24 "src/confitems.gperf"
-      {"keep_comments_cpp",   14, ITEM(keep_comments_cpp, bool)},
+      {"log_file",            20, ITEM(log_file, env_string)},
 #line 28 "src/confitems.gperf"
-      {"max_size",            18, ITEM(max_size, size)},
-#line 27 "src/confitems.gperf"
-      {"max_files",           17, ITEM(max_files, unsigned)},
+      {"limit_multiple",      18, ITEM(limit_multiple, float)},
       {"",0,NULL,0,NULL},
-#line 34 "src/confitems.gperf"
-      {"read_only_direct",    24, ITEM(read_only_direct, bool)},
-#line 19 "src/confitems.gperf"
-      {"disable",              9, ITEM(disable, bool)},
-#line 39 "src/confitems.gperf"
-      {"temporary_dir",       29, ITEM(temporary_dir, env_string)},
-#line 36 "src/confitems.gperf"
-      {"run_second_cpp",      26, ITEM(run_second_cpp, bool)},
-      {"",0,NULL,0,NULL},
-#line 18 "src/confitems.gperf"
-      {"direct_mode",          8, ITEM(direct_mode, bool)},
-      {"",0,NULL,0,NULL},
-#line 22 "src/confitems.gperf"
-      {"hash_dir",            12, ITEM(hash_dir, bool)},
-#line 21 "src/confitems.gperf"
-      {"hard_link",           11, ITEM(hard_link, bool)},
+#line 29 "src/confitems.gperf"
+      {"lock_method",         19, ITEM_V(lock_method, string, lock_method)},
 #line 40 "src/confitems.gperf"
-      {"umask",               30, ITEM(umask, umask)},
-      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
-#line 10 "src/confitems.gperf"
-      {"base_dir",             0, ITEM_V(base_dir, env_string, absolute_path)},
-#line 25 "src/confitems.gperf"
-      {"limit_multiple",      15, ITEM(limit_multiple, float)},
+      {"recache",             30, ITEM(recache, bool)},
       {"",0,NULL,0,NULL},
-#line 23 "src/confitems.gperf"
-      {"ignore_headers_in_manifest", 13, ITEM(ignore_headers_in_manifest, env_string)},
+#line 38 "src/confitems.gperf"
+      {"read_only",           28, ITEM(read_only, bool)},
       {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
-#line 20 "src/confitems.gperf"
-      {"extra_files_to_hash", 10, ITEM(extra_files_to_hash, env_string)}
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+#line 39 "src/confitems.gperf"
+      {"read_only_direct",    29, ITEM(read_only_direct, bool)},
+      {"",0,NULL,0,NULL}, {"",0,NULL,0,NULL},
+#line 22 "src/confitems.gperf"
+      {"extra_files_to_hash", 12, ITEM(extra_files_to_hash, env_string)}
     };
 
   if (len <= MAX_WORD_LENGTH && len >= MIN_WORD_LENGTH)
@@ -189,4 +225,4 @@ confitems_get (register const char *str, register unsigned int len)
     }
   return 0;
 }
-static const size_t CONFITEMS_TOTAL_KEYWORDS = 32;
+static const size_t CONFITEMS_TOTAL_KEYWORDS = 37;
@@ -18,9 +18,10 @@
 #define COUNTERS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct counters {
-	unsigned *data;   // counter value
+	uint64_t *data;   // counter value
 	size_t size;      // logical array size
 	size_t allocated; // allocated size
 };
@@ -31,7 +31,7 @@
 
 #line 9 "src/envtoconfitems.gperf"
 struct env_to_conf_item;
-/* maximum key range = 52, duplicates = 0 */
+/* maximum key range = 94, duplicates = 0 */
 
 #ifdef __GNUC__
 __inline
@@ -45,32 +45,32 @@ envtoconfitems_hash (register const char *str, register unsigned int len)
 {
   static const unsigned char asso_values[] =
     {
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-       0, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 25, 10,  0,  0, 15,
-      10, 54,  5,  0, 54, 10, 35, 15,  0, 25,
-       0, 54, 15, 20,  0, 54, 15, 54, 54,  0,
-      54, 54, 54, 54, 54,  5, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54, 54, 54, 54, 54,
-      54, 54, 54, 54, 54, 54
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      30, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96,  0, 40,  5, 45, 10,
+      50, 96, 35, 10, 96, 20, 10, 10, 35, 30,
+      20, 96, 45, 20,  0, 96, 35, 96, 96, 40,
+      96, 96, 96, 96, 96, 40, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+      96, 96, 96, 96, 96, 96
     };
   register int hval = len;
 
@@ -101,11 +101,11 @@ envtoconfitems_get (register const char *str, register unsigned int len)
 {
   enum
     {
-      TOTAL_KEYWORDS = 33,
+      TOTAL_KEYWORDS = 38,
       MIN_WORD_LENGTH = 2,
       MAX_WORD_LENGTH = 15,
       MIN_HASH_VALUE = 2,
-      MAX_HASH_VALUE = 53
+      MAX_HASH_VALUE = 95
     };
 
   static const struct env_to_conf_item wordlist[] =
@@ -113,82 +113,103 @@ envtoconfitems_get (register const char *str, register unsigned int len)
       {"",""}, {"",""},
 #line 12 "src/envtoconfitems.gperf"
       {"CC", "compiler"},
-#line 19 "src/envtoconfitems.gperf"
+#line 21 "src/envtoconfitems.gperf"
       {"DIR", "cache_dir"},
-#line 17 "src/envtoconfitems.gperf"
+      {"",""}, {"",""}, {"",""}, {"",""}, {"",""}, {"",""},
+      {"",""}, {"",""},
+#line 43 "src/envtoconfitems.gperf"
+      {"RECACHE", "recache"},
+      {"",""}, {"",""}, {"",""}, {"",""}, {"",""}, {"",""},
+      {"",""}, {"",""},
+#line 22 "src/envtoconfitems.gperf"
+      {"DIRECT", "direct_mode"},
+      {"",""}, {"",""},
+#line 30 "src/envtoconfitems.gperf"
+      {"LIMIT_MULTIPLE", "limit_multiple"},
+#line 45 "src/envtoconfitems.gperf"
+      {"STATS", "stats"},
+      {"",""}, {"",""},
+#line 19 "src/envtoconfitems.gperf"
+      {"COMMENTS", "keep_comments_cpp"},
+      {"",""}, {"",""}, {"",""}, {"",""},
+#line 36 "src/envtoconfitems.gperf"
+      {"PACKTHRESHOLD", "pack_threshold"},
+#line 18 "src/envtoconfitems.gperf"
       {"CPP2", "run_second_cpp"},
       {"",""}, {"",""},
-#line 41 "src/envtoconfitems.gperf"
-      {"TEMPDIR", "temporary_dir"},
+#line 34 "src/envtoconfitems.gperf"
+      {"MAXSIZE", "max_size"},
 #line 13 "src/envtoconfitems.gperf"
       {"COMPILER", "compiler"},
-#line 32 "src/envtoconfitems.gperf"
+#line 37 "src/envtoconfitems.gperf"
       {"PATH", "path"},
-#line 39 "src/envtoconfitems.gperf"
+#line 31 "src/envtoconfitems.gperf"
+      {"LOCKMETHOD", "lock_method"},
+      {"",""}, {"",""},
+#line 14 "src/envtoconfitems.gperf"
+      {"COMPILERCHECK", "compiler_check"},
+      {"",""},
+#line 47 "src/envtoconfitems.gperf"
+      {"UMASK", "umask"},
+      {"",""},
+#line 23 "src/envtoconfitems.gperf"
+      {"DISABLE", "disable"},
+      {"",""}, {"",""},
+#line 44 "src/envtoconfitems.gperf"
       {"SLOPPINESS", "sloppiness"},
+#line 20 "src/envtoconfitems.gperf"
+      {"DEPEND", "depend_mode"},
+#line 35 "src/envtoconfitems.gperf"
+      {"NLEVELS", "cache_dir_levels"},
       {"",""},
+#line 24 "src/envtoconfitems.gperf"
+      {"EXTENSION", "cpp_extension"},
 #line 25 "src/envtoconfitems.gperf"
-      {"HASHDIR", "hash_dir"},
-#line 14 "src/envtoconfitems.gperf"
-      {"COMPILERCHECK", "compiler_check"},
-#line 27 "src/envtoconfitems.gperf"
-      {"LIMIT_MULTIPLE", "limit_multiple"},
-#line 43 "src/envtoconfitems.gperf"
-      {"UNIFY", "unify"},
-#line 34 "src/envtoconfitems.gperf"
+      {"EXTRAFILES", "extra_files_to_hash"},
+      {"",""}, {"",""}, {"",""}, {"",""},
+#line 38 "src/envtoconfitems.gperf"
+      {"PCH_EXTSUM", "pch_external_checksum"},
+      {"",""},
+#line 11 "src/envtoconfitems.gperf"
+      {"BASEDIR", "base_dir"},
+#line 26 "src/envtoconfitems.gperf"
+      {"HARDLINK", "hard_link"},
+      {"",""},
+#line 29 "src/envtoconfitems.gperf"
+      {"INODECACHE", "inode_cache"},
+#line 39 "src/envtoconfitems.gperf"
       {"PREFIX", "prefix_command"},
-#line 28 "src/envtoconfitems.gperf"
+#line 32 "src/envtoconfitems.gperf"
       {"LOGFILE", "log_file"},
-#line 29 "src/envtoconfitems.gperf"
+#line 33 "src/envtoconfitems.gperf"
       {"MAXFILES", "max_files"},
       {"",""},
-#line 35 "src/envtoconfitems.gperf"
+#line 40 "src/envtoconfitems.gperf"
       {"PREFIX_CPP", "prefix_command_cpp"},
-#line 20 "src/envtoconfitems.gperf"
-      {"DIRECT", "direct_mode"},
-#line 11 "src/envtoconfitems.gperf"
-      {"BASEDIR", "base_dir"},
+      {"",""},
+#line 46 "src/envtoconfitems.gperf"
+      {"TEMPDIR", "temporary_dir"},
 #line 15 "src/envtoconfitems.gperf"
       {"COMPRESS", "compression"},
-#line 22 "src/envtoconfitems.gperf"
-      {"EXTENSION", "cpp_extension"},
-#line 40 "src/envtoconfitems.gperf"
-      {"STATS", "stats"},
-      {"",""},
-#line 30 "src/envtoconfitems.gperf"
-      {"MAXSIZE", "max_size"},
+      {"",""}, {"",""}, {"",""},
+#line 17 "src/envtoconfitems.gperf"
+      {"COMPRESSTYPE", "compression_type"},
 #line 16 "src/envtoconfitems.gperf"
       {"COMPRESSLEVEL", "compression_level"},
-      {"",""},
-#line 33 "src/envtoconfitems.gperf"
-      {"PCH_EXTSUM", "pch_external_checksum"},
-      {"",""},
-#line 38 "src/envtoconfitems.gperf"
-      {"RECACHE", "recache"},
-#line 36 "src/envtoconfitems.gperf"
+      {"",""}, {"",""}, {"",""}, {"",""},
+#line 41 "src/envtoconfitems.gperf"
       {"READONLY", "read_only"},
+      {"",""}, {"",""}, {"",""},
+#line 27 "src/envtoconfitems.gperf"
+      {"HASHDIR", "hash_dir"},
+#line 28 "src/envtoconfitems.gperf"
+      {"IGNOREHEADERS", "ignore_headers_in_manifest"},
       {"",""},
 #line 42 "src/envtoconfitems.gperf"
-      {"UMASK", "umask"},
-      {"",""},
-#line 31 "src/envtoconfitems.gperf"
-      {"NLEVELS", "cache_dir_levels"},
-#line 18 "src/envtoconfitems.gperf"
-      {"COMMENTS", "keep_comments_cpp"},
-      {"",""},
-#line 37 "src/envtoconfitems.gperf"
       {"READONLY_DIRECT", "read_only_direct"},
-      {"",""},
-#line 21 "src/envtoconfitems.gperf"
-      {"DISABLE", "disable"},
-#line 24 "src/envtoconfitems.gperf"
-      {"HARDLINK", "hard_link"},
-      {"",""}, {"",""}, {"",""}, {"",""}, {"",""}, {"",""},
-#line 23 "src/envtoconfitems.gperf"
-      {"EXTRAFILES", "extra_files_to_hash"},
-      {"",""}, {"",""},
-#line 26 "src/envtoconfitems.gperf"
-      {"IGNOREHEADERS", "ignore_headers_in_manifest"}
+      {"",""}, {"",""}, {"",""}, {"",""},
+#line 48 "src/envtoconfitems.gperf"
+      {"UNIFY", "unify"}
     };
 
   if (len <= MAX_WORD_LENGTH && len >= MIN_WORD_LENGTH)
@@ -205,4 +226,4 @@ envtoconfitems_get (register const char *str, register unsigned int len)
     }
   return 0;
 }
-static const size_t ENVTOCONFITEMS_TOTAL_KEYWORDS = 33;
+static const size_t ENVTOCONFITEMS_TOTAL_KEYWORDS = 38;
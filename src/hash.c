@@ -1,5 +1,5 @@
 // Copyright (C) 2002 Andrew Tridgell
-// Copyright (C) 2010-2016 Joel Rosdahl
+// Copyright (C) 2010-2018 Joel Rosdahl
 //
 // This program is free software; you can redistribute it and/or modify it
 // under the terms of the GNU General Public License as published by the Free
@@ -20,42 +20,58 @@
 #define HASH_DELIMITER "\000cCaChE"
 
 void
-hash_start(struct mdfour *md)
+hash_start(struct hash *hash)
 {
-	mdfour_begin(md);
+	mdfour_begin(&hash->md4);
+	hash->totalN = 0;
 }
 
 void
-hash_buffer(struct mdfour *md, const void *s, size_t len)
+hash_buffer(struct hash *hash, const void *s, size_t len)
 {
-	mdfour_update(md, (unsigned char *)s, len);
+	if (len == 0) {
+		return;
+	}
+
+#ifdef CCACHE_DEBUG_HASH
+	if (getenv("CCACHE_DEBUG_HASH")) {
+		FILE *f = fopen("ccache-debug-hash.bin", "a");
+		fwrite(s, 1, len, f);
+		fclose(f);
+	}
+#endif
+
+	mdfour_update(&hash->md4, (const unsigned char *)s, len);
+	hash->totalN += len;
 }
 
 // Return the hash result as a hex string. Caller frees.
 char *
-hash_result(struct mdfour *md)
+hash_result(struct hash *hash)
 {
-	unsigned char sum[16];
+	unsigned char sum[DIGEST_SIZE];
 
-	hash_result_as_bytes(md, sum);
-	return format_hash_as_string(sum, (unsigned) md->totalN);
+	hash_result_as_bytes(hash, sum);
+	return format_hash_as_string(sum, (unsigned) hash->totalN);
 }
 
-// Return the hash result as 16 binary bytes.
+// Return the hash result as DIGEST_SIZE binary bytes. The hash state is left
+// untouched, so more data may be added afterwards.
 void
-hash_result_as_bytes(struct mdfour *md, unsigned char *out)
+hash_result_as_bytes(struct hash *hash, unsigned char *out)
 {
-	hash_buffer(md, NULL, 0);
-	mdfour_result(md, out);
+	struct mdfour md4 = hash->md4;
+	mdfour_update(&md4, NULL, 0);
+	mdfour_result(&md4, out);
 }
 
 bool
-hash_equal(struct mdfour *md1, struct mdfour *md2)
+hash_equal(struct hash *hash1, struct hash *hash2)
 {
-	unsigned char sum1[16];
-	hash_result_as_bytes(md1, sum1);
-	unsigned char sum2[16];
-	hash_result_as_bytes(md2, sum2);
+	unsigned char sum1[DIGEST_SIZE];
+	hash_result_as_bytes(hash1, sum1);
+	unsigned char sum2[DIGEST_SIZE];
+	hash_result_as_bytes(hash2, sum2);
 	return memcmp(sum1, sum2, sizeof(sum1)) == 0;
 }
 
@@ -68,35 +84,38 @@ hash_equal(struct mdfour *md1, struct mdfour *md2)
 //   information X if CCACHE_A is set and information Y if CCACHE_B is set,
 //   there should never be a hash collision risk).
 void
-hash_delimiter(struct mdfour *md, const char *type)
+hash_delimiter(struct hash *hash, const char *type)
 {
-	hash_buffer(md, HASH_DELIMITER, sizeof(HASH_DELIMITER));
-	hash_buffer(md, type, strlen(type) + 1); // Include NUL.
+	hash_buffer(hash, HASH_DELIMITER, sizeof(HASH_DELIMITER));
+	hash_buffer(hash, type, strlen(type) + 1); // Include NUL.
 }
 
 void
-hash_string(struct mdfour *md, const char *s)
+hash_string(struct hash *hash, const char *s)
 {
-	hash_string_length(md, s, strlen(s));
+	hash_string_length(hash, s, strlen(s));
 }
 
 void
-hash_string_length(struct mdfour *md, const char *s, int length)
+hash_string_length(struct hash *hash, const char *s, int length)
 {
-	hash_buffer(md, s, length);
+	hash_buffer(hash, s, length);
 }
 
 void
-hash_int(struct mdfour *md, int x)
+hash_int(struct hash *hash, int x)
 {
-	hash_buffer(md, (char *)&x, sizeof(x));
+	hash_buffer(hash, (char *)&x, sizeof(x));
 }
 
 // Add contents of an open file to the hash. Returns true on success, otherwise
 // false.
 bool
-hash_fd(struct mdfour *md, int fd)
+hash_fd(struct hash *hash, int fd)
 {
+	// The file is read rather than mapped since it may be e.g. a source file or
+	// a compiler that is truncated while being hashed, which would make accesses
+	// to a mapping raise SIGBUS.
 	char buf[READ_BUFFER_SIZE];
 	ssize_t n;
 
@@ -105,7 +124,7 @@ hash_fd(struct mdfour *md, int fd)
 			break;
 		}
 		if (n > 0) {
-			hash_buffer(md, buf, n);
+			hash_buffer(hash, buf, n);
 		}
 	}
 	return n == 0;
@@ -114,7 +133,7 @@ hash_fd(struct mdfour *md, int fd)
 // Add contents of a file to the hash. Returns true on success, otherwise
 // false.
 bool
-hash_file(struct mdfour *md, const char *fname)
+hash_file(struct hash *hash, const char *fname)
 {
 	int fd = open(fname, O_RDONLY|O_BINARY);
 	if (fd == -1) {
@@ -122,7 +141,7 @@ hash_file(struct mdfour *md, const char *fname)
 		return false;
 	}
 
-	bool ret = hash_fd(md, fd);
+	bool ret = hash_fd(hash, fd);
 	close(fd);
 	return ret;
 }
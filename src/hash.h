@@ -0,0 +1,19 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "system.h"
+
+#include "mdfour.h"
+
+// Size of a hash sum in bytes. Hash sums are stored and compared as
+// DIGEST_SIZE bytes so that the algorithm behind struct hash can be replaced
+// by one with a longer digest.
+#define DIGEST_SIZE 16
+
+struct hash {
+	struct mdfour md4;
+	// Number of bytes hashed so far.
+	size_t totalN;
+};
+
+#endif
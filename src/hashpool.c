@@ -0,0 +1,264 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// A bounded pool of worker threads that hash source code files (typically
+// include files found in the preprocessor output) the same way as
+// hash_source_code_file() does.
+//
+// Files are queued with hash_pool_add() and hashed concurrently. Workers only
+// read and hash; everything that isn't thread-safe (logging, hashing of
+// __DATE__, writing the results) is done by hash_pool_finish() in the calling
+// thread, in the order the files were added, so the outcome doesn't depend on
+// scheduling. Without thread support, files are hashed directly by
+// hash_pool_add().
+
+#include "ccache.h"
+#include "hashpool.h"
+#include "inodecache.h"
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#define USE_THREADS
+#include <pthread.h>
+#endif
+
+struct hash_pool_job {
+	const char *path;
+	struct stat st;
+	bool has_stat;
+	struct file_hash *result;
+
+	// Written by the worker:
+	struct hash hash;
+	int flags; // Bitmask of HASH_SOURCE_CODE_*.
+	int error; // errno if flags has HASH_SOURCE_CODE_ERROR.
+};
+
+struct hash_pool {
+	struct conf *conf;
+	struct hash_pool_job **jobs;
+	size_t n_jobs;
+	size_t allocated;
+#ifdef USE_THREADS
+	size_t next_job; // Index of the next job to start.
+	bool finishing;
+	unsigned max_threads;
+	unsigned n_threads;
+	unsigned n_idle;
+	pthread_t threads[HASH_POOL_MAX_THREADS];
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+};
+
+// Hash the file of a job. Must not log or touch global state.
+static void
+run_job(struct conf *conf, struct hash_pool_job *job)
+{
+	hash_start(&job->hash);
+
+	int fd = open(job->path, O_RDONLY | O_BINARY);
+	if (fd == -1) {
+		job->flags = HASH_SOURCE_CODE_ERROR;
+		job->error = errno;
+		return;
+	}
+
+	job->flags = hash_source_code_fd(conf, &job->hash, fd);
+	job->error = errno;
+	close(fd);
+}
+
+static void
+append_job(struct hash_pool *pool, struct hash_pool_job *job)
+{
+	if (pool->n_jobs == pool->allocated) {
+		pool->allocated = pool->allocated == 0 ? 64 : 2 * pool->allocated;
+		pool->jobs = x_realloc(pool->jobs, pool->allocated * sizeof(*pool->jobs));
+	}
+	pool->jobs[pool->n_jobs++] = job;
+}
+
+#ifdef USE_THREADS
+static void *
+worker(void *arg)
+{
+	struct hash_pool *pool = arg;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		if (pool->next_job < pool->n_jobs) {
+			struct hash_pool_job *job = pool->jobs[pool->next_job++];
+			pthread_mutex_unlock(&pool->mutex);
+			run_job(pool->conf, job);
+			pthread_mutex_lock(&pool->mutex);
+		} else if (pool->finishing) {
+			break;
+		} else {
+			pool->n_idle++;
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			pool->n_idle--;
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+// Start another worker thread. Must be called with the mutex held.
+static void
+start_worker(struct hash_pool *pool)
+{
+	// Signals should be handled by the main thread only.
+	sigset_t all_signals;
+	sigset_t old_signals;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	int error = pthread_create(
+	  &pool->threads[pool->n_threads], NULL, worker, pool);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (error == 0) {
+		pool->n_threads++;
+	} else {
+		// Not fatal; queued jobs are run by hash_pool_finish().
+		cc_log("Failed to start hash worker thread: %s", strerror(error));
+		pool->max_threads = pool->n_threads;
+	}
+}
+#endif
+
+// Create a pool for hashing source code files according to conf, using at most
+// max_threads worker threads. 0 means one per online CPU, up to
+// HASH_POOL_MAX_THREADS.
+struct hash_pool *
+hash_pool_create(struct conf *conf, unsigned max_threads)
+{
+	struct hash_pool *pool = x_malloc(sizeof(*pool));
+	pool->conf = conf;
+	pool->jobs = NULL;
+	pool->n_jobs = 0;
+	pool->allocated = 0;
+
+#ifdef USE_THREADS
+	pool->next_job = 0;
+	pool->finishing = false;
+	if (max_threads == 0) {
+		// A single CPU is better off without threads.
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		max_threads = n_cpus < 2 ? 0 : n_cpus;
+	}
+	pool->max_threads = MIN(max_threads, HASH_POOL_MAX_THREADS);
+	pool->n_threads = 0;
+	pool->n_idle = 0;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	// The workers scan source code.
+	scan_init();
+#else
+	(void)max_threads;
+#endif
+
+	return pool;
+}
+
+// Queue path for hashing. The hash sum is stored in result by
+// hash_pool_finish(). path must stay valid until then. If st (the stat
+// information of path) is given, the inode cache is consulted first and
+// updated afterwards.
+void
+hash_pool_add(struct hash_pool *pool, const char *path, const struct stat *st,
+              struct file_hash *result)
+{
+	if (st && inode_cache_get(pool->conf, st, result)) {
+		return;
+	}
+
+	struct hash_pool_job *job = x_malloc(sizeof(*job));
+	job->path = path;
+	job->has_stat = st != NULL;
+	if (st) {
+		job->st = *st;
+	}
+	job->result = result;
+
+#ifdef USE_THREADS
+	if (pool->max_threads > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		append_job(pool, job);
+		if (pool->n_idle > 0) {
+			pthread_cond_signal(&pool->cond);
+		} else if (pool->n_threads < pool->max_threads) {
+			start_worker(pool);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+#endif
+
+	run_job(pool->conf, job);
+	append_job(pool, job);
+}
+
+// Wait for all queued files to be hashed, store the results and free the pool.
+// Returns false if any file could not be hashed or contains __TIME__ (unless
+// sloppy), in which case the direct mode should not be used.
+bool
+hash_pool_finish(struct hash_pool *pool)
+{
+#ifdef USE_THREADS
+	if (pool->max_threads > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->finishing = true;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+
+		// Help with the remaining jobs and then wait for the workers.
+		worker(pool);
+		for (unsigned i = 0; i < pool->n_threads; i++) {
+			pthread_join(pool->threads[i], NULL);
+		}
+	}
+#endif
+
+	bool ok = true;
+	for (size_t i = 0; i < pool->n_jobs; i++) {
+		struct hash_pool_job *job = pool->jobs[i];
+		if (job->flags & HASH_SOURCE_CODE_ERROR) {
+			cc_log("Failed to read %s: %s", job->path, strerror(job->error));
+			ok = false;
+		} else {
+			hash_temporal_macros(&job->hash, job->flags, job->path);
+			if (job->flags & HASH_SOURCE_CODE_FOUND_TIME) {
+				ok = false;
+			}
+			hash_result_as_bytes(&job->hash, job->result->hash);
+			job->result->size = job->hash.totalN;
+			if (job->has_stat
+			    && !(job->flags & (HASH_SOURCE_CODE_FOUND_DATE
+			                       | HASH_SOURCE_CODE_FOUND_TIME))) {
+				inode_cache_put(pool->conf, &job->st, job->result);
+			}
+		}
+		free(job);
+	}
+
+#ifdef USE_THREADS
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->cond);
+#endif
+	free(pool->jobs);
+	free(pool);
+	return ok;
+}
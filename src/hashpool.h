@@ -0,0 +1,33 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef HASHPOOL_H
+#define HASHPOOL_H
+
+#include "conf.h"
+#include "hashutil.h"
+
+// Maximum number of worker threads used by a hash pool.
+#define HASH_POOL_MAX_THREADS 8
+
+struct hash_pool;
+
+struct hash_pool *hash_pool_create(struct conf *conf, unsigned max_threads);
+void hash_pool_add(struct hash_pool *pool, const char *path,
+                   const struct stat *st, struct file_hash *result);
+bool hash_pool_finish(struct hash_pool *pool);
+
+#endif
@@ -16,9 +16,12 @@
 
 #include "ccache.h"
 #include "hashutil.h"
-#include "macroskip.h"
 #include "murmurhashneutral2.h"
 
+// Size of the chunks that hash_source_code_buffer() searches and hashes in one
+// go. Should fit comfortably in the L1/L2 data cache.
+#define HASH_CHUNK_SIZE (32 * 1024)
+
 unsigned
 hash_from_string(void *str)
 {
@@ -40,7 +43,7 @@ strings_equal(void *str1, void *str2)
 int
 file_hashes_equal(struct file_hash *fh1, struct file_hash *fh2)
 {
-	return memcmp(fh1->hash, fh2->hash, 16) == 0
+	return memcmp(fh1->hash, fh2->hash, DIGEST_SIZE) == 0
 	       && fh1->size == fh2->size;
 }
 
@@ -52,57 +55,103 @@ int
 check_for_temporal_macros(const char *str, size_t len)
 {
 	int result = 0;
+	if (len < 8) {
+		return result;
+	}
 
-	// We're using the Boyer-Moore-Horspool algorithm, which searches starting
-	// from the *end* of the needle. Our needles are 8 characters long, so i
-	// starts at 7.
-	size_t i = 7;
-
-	while (i < len) {
-		// Check whether the substring ending at str[i] has the form "__...E__". On
-		// the assumption that 'E' is less common in source than '_', we check
-		// str[i-2] first.
-		if (str[i - 2] == 'E' &&
-		    str[i - 0] == '_' &&
-		    str[i - 7] == '_' &&
-		    str[i - 1] == '_' &&
-		    str[i - 6] == '_') {
-			// Check the remaining characters to see if the substring is "__DATE__"
-			// or "__TIME__".
-			if (str[i - 5] == 'D' && str[i - 4] == 'A' &&
-			    str[i - 3] == 'T') {
-				result |= HASH_SOURCE_CODE_FOUND_DATE;
-			} else if (str[i - 5] == 'T' && str[i - 4] == 'I' &&
-			           str[i - 3] == 'M') {
-				result |= HASH_SOURCE_CODE_FOUND_TIME;
-			}
+	const char *limit = str + len - 7;
+	const char *p = str;
+	while ((p = find_temporal_macro_candidate(p, limit)) < limit) {
+		// p points to "__???E__".
+		if (p[2] == 'D' && p[3] == 'A' && p[4] == 'T') {
+			result |= HASH_SOURCE_CODE_FOUND_DATE;
+		} else if (p[2] == 'T' && p[3] == 'I' && p[4] == 'M') {
+			result |= HASH_SOURCE_CODE_FOUND_TIME;
 		}
+		p++;
+	}
+
+	return result;
+}
 
-		// macro_skip tells us how far we can skip forward upon seeing str[i] at
-		// the end of a substring.
-		i += macro_skip[(uint8_t)str[i]];
+// Hash a buffer of source code and, unless sloppiness says otherwise, search
+// it for temporal macros. The buffer is processed in chunks that stay in the
+// CPU cache between searching and hashing. Returns a bitmask of
+// HASH_SOURCE_CODE_* results, but doesn't hash anything for found temporal
+// macros; see hash_temporal_macros().
+int
+hash_source_code_buffer(
+  struct conf *conf, struct hash *hash, const char *str, size_t len)
+{
+	int result = HASH_SOURCE_CODE_OK;
+	bool check = !(conf->sloppiness & SLOPPY_TIME_MACROS);
+
+	for (size_t pos = 0; pos < len; pos += HASH_CHUNK_SIZE) {
+		size_t n = MIN(HASH_CHUNK_SIZE, len - pos);
+		if (check) {
+			// Include the beginning of the next chunk so that a macro crossing the
+			// chunk boundary is found.
+			result |= check_for_temporal_macros(str + pos, MIN(n + 7, len - pos));
+		}
+		hash_buffer(hash, str + pos, n);
 	}
 
 	return result;
 }
 
-// Hash a string. Returns a bitmask of HASH_SOURCE_CODE_* results.
+// Like hash_source_code_buffer() but for the content of an open file, which is
+// read in chunks of HASH_CHUNK_SIZE bytes so that the whole file never needs to
+// be in memory. On read error, HASH_SOURCE_CODE_ERROR is returned with errno
+// set.
+//
+// This function doesn't log anything, so it may be called from worker threads.
 int
-hash_source_code_string(
-  struct conf *conf, struct mdfour *hash, const char *str, size_t len,
-  const char *path)
+hash_source_code_fd(struct conf *conf, struct hash *hash, int fd)
 {
 	int result = HASH_SOURCE_CODE_OK;
+	bool check = !(conf->sloppiness & SLOPPY_TIME_MACROS);
 
-	// Check for __DATE__ and __TIME__ if the sloppiness configuration tells us
-	// we should.
-	if (!(conf->sloppiness & SLOPPY_TIME_MACROS)) {
-		result |= check_for_temporal_macros(str, len);
+	// The first 7 bytes hold the end of the previous chunk so that a macro
+	// crossing the chunk boundary is found.
+	char buf[7 + HASH_CHUNK_SIZE];
+	size_t kept = 0;
+	ssize_t n;
+	while ((n = read(fd, buf + kept, HASH_CHUNK_SIZE)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			result = HASH_SOURCE_CODE_ERROR;
+			break;
+		}
+		if (check) {
+			result |= check_for_temporal_macros(buf, kept + n);
+		}
+		hash_buffer(hash, buf + kept, n);
+
+		size_t total = kept + n;
+		kept = MIN(total, 7);
+		memmove(buf, buf + total - kept, kept);
 	}
+	return result;
+}
 
-	// Hash the source string.
-	hash_buffer(hash, str, len);
+// Hash a string. Returns a bitmask of HASH_SOURCE_CODE_* results.
+int
+hash_source_code_string(
+  struct conf *conf, struct hash *hash, const char *str, size_t len,
+  const char *path)
+{
+	int result = hash_source_code_buffer(conf, hash, str, len);
+	hash_temporal_macros(hash, result, path);
+	return result;
+}
 
+// Update the hash for temporal macros found by check_for_temporal_macros() in
+// the source code of path.
+void
+hash_temporal_macros(struct hash *hash, int result, const char *path)
+{
 	if (result & HASH_SOURCE_CODE_FOUND_DATE) {
 		// Make sure that the hash sum changes if the (potential) expansion of
 		// __DATE__ changes.
@@ -123,14 +172,12 @@ hash_source_code_string(
 		// disabled.
 		cc_log("Found __TIME__ in %s", path);
 	}
-
-	return result;
 }
 
 // Hash a file ignoring comments. Returns a bitmask of HASH_SOURCE_CODE_*
 // results.
 int
-hash_source_code_file(struct conf *conf, struct mdfour *hash, const char *path)
+hash_source_code_file(struct conf *conf, struct hash *hash, const char *path)
 {
 	if (is_precompiled_header(path)) {
 		if (hash_file(hash, path)) {
@@ -139,19 +186,24 @@ hash_source_code_file(struct conf *conf, struct mdfour *hash, const char *path)
 			return HASH_SOURCE_CODE_ERROR;
 		}
 	} else {
-		char *data;
-		size_t size;
-		if (!read_file(path, 0, &data, &size)) {
+		int fd = open(path, O_RDONLY | O_BINARY);
+		if (fd == -1) {
+			cc_log("Failed to open %s: %s", path, strerror(errno));
 			return HASH_SOURCE_CODE_ERROR;
 		}
-		int result = hash_source_code_string(conf, hash, data, size, path);
-		free(data);
+		int result = hash_source_code_fd(conf, hash, fd);
+		if (result & HASH_SOURCE_CODE_ERROR) {
+			cc_log("Failed to read %s: %s", path, strerror(errno));
+		} else {
+			hash_temporal_macros(hash, result, path);
+		}
+		close(fd);
 		return result;
 	}
 }
 
 bool
-hash_command_output(struct mdfour *hash, const char *command,
+hash_command_output(struct hash *hash, const char *command,
                     const char *compiler)
 {
 #ifdef _WIN32
@@ -291,7 +343,7 @@ hash_command_output(struct mdfour *hash, const char *command,
 }
 
 bool
-hash_multicommand_output(struct mdfour *hash, const char *commands,
+hash_multicommand_output(struct hash *hash, const char *commands,
                          const char *compiler)
 {
 	char *command_string = x_strdup(commands);
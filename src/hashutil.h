@@ -2,11 +2,11 @@
 #define HASHUTIL_H
 
 #include "conf.h"
-#include "mdfour.h"
+#include "hash.h"
 
 struct file_hash
 {
-	uint8_t hash[16];
+	uint8_t hash[DIGEST_SIZE];
 	uint32_t size;
 };
 
@@ -21,14 +21,18 @@ int file_hashes_equal(struct file_hash *fh1, struct file_hash *fh2);
 #define	HASH_SOURCE_CODE_FOUND_TIME 4
 
 int check_for_temporal_macros(const char *str, size_t len);
+int hash_source_code_buffer(
+	struct conf *conf, struct hash *hash, const char *str, size_t len);
+int hash_source_code_fd(struct conf *conf, struct hash *hash, int fd);
 int hash_source_code_string(
-	struct conf *conf, struct mdfour *hash, const char *str, size_t len,
+	struct conf *conf, struct hash *hash, const char *str, size_t len,
 	const char *path);
+void hash_temporal_macros(struct hash *hash, int result, const char *path);
 int hash_source_code_file(
-	struct conf *conf, struct mdfour *hash, const char *path);
-bool hash_command_output(struct mdfour *hash, const char *command,
+	struct conf *conf, struct hash *hash, const char *path);
+bool hash_command_output(struct hash *hash, const char *command,
                          const char *compiler);
-bool hash_multicommand_output(struct mdfour *hash, const char *command,
+bool hash_multicommand_output(struct hash *hash, const char *command,
                               const char *compiler);
 
 #endif
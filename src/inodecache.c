@@ -0,0 +1,386 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// The inode cache remembers the hash of file contents, keyed on the stat
+// information of the file (device, inode, size, mtime and ctime). Entries can
+// also be tagged with a string, in which case they hold the hash of something
+// derived from the file, e.g. the output of a command run on a compiler. It
+// lives in the file "inode-cache" in the cache directory, which is memory
+// mapped and shared by all ccache processes.
+//
+// The file is a fixed-size hash table with INODE_CACHE_BUCKETS buckets of
+// INODE_CACHE_WAYS entries. There is no locking: every entry carries a
+// checksum, and an entry that has been torn by concurrent writers simply
+// doesn't match anymore. An entry that is new in a bucket is put first and the
+// oldest entry falls out.
+//
+// Only files with an mtime and ctime older than time_of_compilation are
+// stored and looked up. Any modification of such a file after (or while) it is
+// hashed gives it a ctime that is not older than time_of_compilation, so an
+// entry can never be associated with content other than what was hashed.
+
+#include "ccache.h"
+#include "inodecache.h"
+#include "murmurhashneutral2.h"
+
+#define INODE_CACHE_MAGIC "cCiC"
+#define INODE_CACHE_VERSION 2
+#define INODE_CACHE_BUCKETS 8192
+#define INODE_CACHE_WAYS 4
+
+struct inode_cache_key {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	int64_t ctime;
+	// First 8 bytes of the hash of the tag, or zero for untagged entries.
+	uint8_t tag[8];
+};
+
+struct inode_cache_entry {
+	// First 8 bytes of the hash of the rest of the entry.
+	uint8_t checksum[8];
+	struct inode_cache_key key;
+	uint8_t hash[DIGEST_SIZE];
+	uint32_t hash_size;
+	// Whether the content was checked for __DATE__ and __TIME__ (and found
+	// none).
+	uint32_t checked_temporal_macros;
+};
+
+struct inode_cache_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t digest_size;
+	uint16_t entry_size;
+	uint32_t n_buckets;
+	uint32_t n_ways;
+};
+
+struct inode_cache_file {
+	struct inode_cache_header header;
+	struct inode_cache_entry entries[INODE_CACHE_BUCKETS][INODE_CACHE_WAYS];
+};
+
+#ifdef HAVE_SYS_MMAN_H
+// The mapped file, or NULL if not yet mapped.
+static struct inode_cache_file *cache_file = NULL;
+// Whether mapping the file has failed, in which case the cache is not used.
+static bool cache_failed = false;
+
+static void
+init_header(struct inode_cache_header *header)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, INODE_CACHE_MAGIC, sizeof(header->magic));
+	header->version = INODE_CACHE_VERSION;
+	header->digest_size = DIGEST_SIZE;
+	header->entry_size = sizeof(struct inode_cache_entry);
+	header->n_buckets = INODE_CACHE_BUCKETS;
+	header->n_ways = INODE_CACHE_WAYS;
+}
+
+// Create an empty cache file and atomically move it into place.
+static bool
+create_cache_file(const char *path)
+{
+	char *tmp_path = format("%s.%s", path, tmp_string());
+	int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_BINARY, 0666);
+	if (fd == -1) {
+		cc_log("Failed to create %s: %s", tmp_path, strerror(errno));
+		free(tmp_path);
+		return false;
+	}
+
+	struct inode_cache_header header;
+	init_header(&header);
+	bool ok = write(fd, &header, sizeof(header)) == sizeof(header)
+	          && ftruncate(fd, sizeof(struct inode_cache_file)) == 0;
+	close(fd);
+	if (ok) {
+		ok = x_rename(tmp_path, path) == 0;
+	} else {
+		cc_log("Failed to initialize %s: %s", tmp_path, strerror(errno));
+	}
+	if (!ok) {
+		tmp_unlink(tmp_path);
+	}
+	free(tmp_path);
+	return ok;
+}
+
+// Map the cache file, creating it if needed. Returns false if the cache can't
+// be used.
+static bool
+map_cache_file(struct conf *conf)
+{
+	if (cache_file) {
+		return true;
+	}
+	if (cache_failed) {
+		return false;
+	}
+	cache_failed = true;
+
+	char *path = format("%s/inode-cache", conf->cache_dir);
+	struct inode_cache_header expected;
+	init_header(&expected);
+
+	for (int attempt = 0; attempt < 2; attempt++) {
+		int fd = open(path, O_RDWR | O_BINARY);
+		if (fd != -1) {
+			struct stat st;
+			void *p = MAP_FAILED;
+			if (fstat(fd, &st) == 0
+			    && st.st_size == sizeof(struct inode_cache_file)) {
+				p = mmap(NULL, sizeof(struct inode_cache_file),
+				         PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			}
+			close(fd);
+			if (p != MAP_FAILED) {
+				if (memcmp(p, &expected, sizeof(expected)) == 0) {
+					cache_file = p;
+					cache_failed = false;
+					break;
+				}
+				munmap(p, sizeof(struct inode_cache_file));
+			}
+			cc_log("Recreating incompatible %s", path);
+		} else if (errno != ENOENT) {
+			cc_log("Failed to open %s: %s", path, strerror(errno));
+			break;
+		}
+		if (create_dir(conf->cache_dir) != 0 || !create_cache_file(path)) {
+			break;
+		}
+	}
+
+	free(path);
+	return !cache_failed;
+}
+
+static bool
+is_cacheable(struct conf *conf, const struct stat *st)
+{
+	return conf->inode_cache
+	       && !conf->read_only
+	       && S_ISREG(st->st_mode)
+	       && st->st_mtime < time_of_compilation
+	       && st->st_ctime < time_of_compilation;
+}
+
+static void
+init_key(struct inode_cache_key *key, const struct stat *st, const char *tag)
+{
+	memset(key, 0, sizeof(*key));
+	key->dev = st->st_dev;
+	key->ino = st->st_ino;
+	key->size = st->st_size;
+	key->mtime = st->st_mtime;
+	key->ctime = st->st_ctime;
+	if (tag) {
+		struct hash hash;
+		hash_start(&hash);
+		hash_string(&hash, tag);
+		unsigned char sum[DIGEST_SIZE];
+		hash_result_as_bytes(&hash, sum);
+		memcpy(key->tag, sum, sizeof(key->tag));
+	}
+}
+
+static void
+compute_checksum(const struct inode_cache_entry *entry, uint8_t *checksum)
+{
+	struct hash hash;
+	hash_start(&hash);
+	hash_buffer(&hash,
+	            (const char *)entry + sizeof(entry->checksum),
+	            sizeof(*entry) - sizeof(entry->checksum));
+	unsigned char sum[DIGEST_SIZE];
+	hash_result_as_bytes(&hash, sum);
+	memcpy(checksum, sum, sizeof(entry->checksum));
+}
+
+static struct inode_cache_entry *
+find_bucket(const struct inode_cache_key *key)
+{
+	unsigned h = murmurhashneutral2(key, sizeof(*key), 0);
+	return cache_file->entries[h % INODE_CACHE_BUCKETS];
+}
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+// Find the entry for the key. Returns false if there is none.
+static bool
+lookup(const struct inode_cache_key *key, struct inode_cache_entry *result)
+{
+	struct inode_cache_entry *bucket = find_bucket(key);
+	for (int i = 0; i < INODE_CACHE_WAYS; i++) {
+		// Copy the entry since other processes may write to it concurrently.
+		memcpy(result, &bucket[i], sizeof(*result));
+		if (memcmp(&result->key, key, sizeof(*key)) != 0) {
+			continue;
+		}
+		uint8_t checksum[sizeof(result->checksum)];
+		compute_checksum(result, checksum);
+		if (memcmp(checksum, result->checksum, sizeof(checksum)) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+store(struct inode_cache_entry *entry)
+{
+	compute_checksum(entry, entry->checksum);
+
+	struct inode_cache_entry *bucket = find_bucket(&entry->key);
+	int i;
+	for (i = 0; i < INODE_CACHE_WAYS - 1; i++) {
+		if (memcmp(&bucket[i].key, &entry->key, sizeof(entry->key)) == 0) {
+			break;
+		}
+	}
+	// Make room first in the bucket, dropping the replaced or oldest entry.
+	memmove(&bucket[1], &bucket[0], i * sizeof(*entry));
+	memcpy(&bucket[0], entry, sizeof(*entry));
+}
+#endif
+
+// Look up the hash of a file with stat information st. Returns true and sets
+// result on a hit.
+bool
+inode_cache_get(struct conf *conf, const struct stat *st,
+                struct file_hash *result)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (!is_cacheable(conf, st) || !map_cache_file(conf)) {
+		return false;
+	}
+
+	struct inode_cache_key key;
+	init_key(&key, st, NULL);
+	struct inode_cache_entry entry;
+	if (!lookup(&key, &entry)) {
+		return false;
+	}
+	if (!entry.checked_temporal_macros
+	    && !(conf->sloppiness & SLOPPY_TIME_MACROS)) {
+		return false;
+	}
+	memcpy(result->hash, entry.hash, sizeof(result->hash));
+	result->size = entry.hash_size;
+	return true;
+#else
+	(void)conf;
+	(void)st;
+	(void)result;
+	return false;
+#endif
+}
+
+// Remember result as the hash of a file with stat information st. The hash
+// must be of the file content only, i.e. not include any __DATE__ handling.
+void
+inode_cache_put(struct conf *conf, const struct stat *st,
+                const struct file_hash *result)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (!is_cacheable(conf, st) || !map_cache_file(conf)) {
+		return;
+	}
+
+	struct inode_cache_entry entry;
+	memset(&entry, 0, sizeof(entry));
+	init_key(&entry.key, st, NULL);
+	memcpy(entry.hash, result->hash, sizeof(entry.hash));
+	entry.hash_size = result->size;
+	entry.checked_temporal_macros = !(conf->sloppiness & SLOPPY_TIME_MACROS);
+	store(&entry);
+#else
+	(void)conf;
+	(void)st;
+	(void)result;
+#endif
+}
+
+// Like inode_cache_get but for an entry stored with inode_cache_put_tagged.
+bool
+inode_cache_get_tagged(struct conf *conf, const struct stat *st,
+                       const char *tag, struct file_hash *result)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (!is_cacheable(conf, st) || !map_cache_file(conf)) {
+		return false;
+	}
+
+	struct inode_cache_key key;
+	init_key(&key, st, tag);
+	struct inode_cache_entry entry;
+	if (!lookup(&key, &entry)) {
+		return false;
+	}
+	memcpy(result->hash, entry.hash, sizeof(result->hash));
+	result->size = entry.hash_size;
+	return true;
+#else
+	(void)conf;
+	(void)st;
+	(void)tag;
+	(void)result;
+	return false;
+#endif
+}
+
+// Remember result as the hash of something identified by tag that only
+// depends on the file with stat information st.
+void
+inode_cache_put_tagged(struct conf *conf, const struct stat *st,
+                       const char *tag, const struct file_hash *result)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (!is_cacheable(conf, st) || !map_cache_file(conf)) {
+		return;
+	}
+
+	struct inode_cache_entry entry;
+	memset(&entry, 0, sizeof(entry));
+	init_key(&entry.key, st, tag);
+	memcpy(entry.hash, result->hash, sizeof(entry.hash));
+	entry.hash_size = result->size;
+	store(&entry);
+#else
+	(void)conf;
+	(void)st;
+	(void)tag;
+	(void)result;
+#endif
+}
+
+// Unmap the cache file.
+void
+inode_cache_release(void)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (cache_file) {
+		munmap(cache_file, sizeof(struct inode_cache_file));
+		cache_file = NULL;
+	}
+	cache_failed = false;
+#endif
+}
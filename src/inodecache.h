@@ -0,0 +1,33 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef INODECACHE_H
+#define INODECACHE_H
+
+#include "conf.h"
+#include "hashutil.h"
+
+bool inode_cache_get(struct conf *conf, const struct stat *st,
+                     struct file_hash *result);
+void inode_cache_put(struct conf *conf, const struct stat *st,
+                     const struct file_hash *result);
+bool inode_cache_get_tagged(struct conf *conf, const struct stat *st,
+                            const char *tag, struct file_hash *result);
+void inode_cache_put_tagged(struct conf *conf, const struct stat *st,
+                            const char *tag, const struct file_hash *result);
+void inode_cache_release(void);
+
+#endif
@@ -16,6 +16,136 @@
 
 #include "ccache.h"
 
+// There are two lock methods, selected by the lock_method setting:
+//
+// - symlink: The lock is a symbolic link (a file on Windows) called
+//   <path>.lock whose content identifies the owner. Waiting is done by
+//   sleeping with exponential backoff, and a lock that doesn't change for
+//   staleness_limit microseconds is broken. This works on NFS.
+// - fcntl: The lock is an open file description lock (F_OFD_SETLKW, or flock()
+//   where not available) on a file called <path>.lck, which is kept. The
+//   kernel wakes waiters when the lock is released and releases the locks of
+//   dead processes, so there is no polling or staleness detection. This
+//   requires locks that work between all hosts sharing the cache.
+//
+// All ccache processes that use the same cache must use the same method. Time
+// spent waiting for locks and the number of times a lock was busy are recorded
+// in the statistics.
+
+extern struct conf *conf;
+
+#if !defined(_WIN32) && (defined(F_OFD_SETLKW) || defined(LOCK_EX))
+#define USE_FCNTL_LOCKS
+
+// A lock held with the fcntl method.
+struct fcntl_lock {
+	char *path;
+	int fd;
+	struct fcntl_lock *next;
+};
+
+static struct fcntl_lock *fcntl_locks;
+
+// Take an exclusive lock on fd. Fails with EAGAIN, EWOULDBLOCK or EACCES if
+// block is false and the lock is held by somebody else.
+static bool
+lock_fd(int fd, bool block)
+{
+#ifdef F_OFD_SETLKW
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	if (fcntl(fd, block ? F_OFD_SETLKW : F_OFD_SETLK, &fl) == 0) {
+		return true;
+	}
+#ifdef LOCK_EX
+	if (errno == EINVAL) {
+		// The kernel doesn't support OFD locks.
+		return flock(fd, block ? LOCK_EX : LOCK_EX | LOCK_NB) == 0;
+	}
+#endif
+	return false;
+#else
+	return flock(fd, block ? LOCK_EX : LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+static bool
+fcntl_lock_acquire(const char *path)
+{
+	char *lockfile = format("%s.lck", path);
+	bool acquired = false;
+
+	int fd;
+	while ((fd = open(lockfile, O_RDWR|O_CREAT, 0666)) == -1) {
+		int saved_errno = errno;
+		cc_log("lockfile_acquire: open %s: %s", lockfile, strerror(saved_errno));
+		if (saved_errno != ENOENT || create_parent_dirs(lockfile) != 0) {
+			goto out;
+		}
+	}
+	set_cloexec_flag(fd);
+
+	if (!lock_fd(fd, false)) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EACCES) {
+			cc_log("lockfile_acquire: lock %s: %s", lockfile, strerror(errno));
+			close(fd);
+			goto out;
+		}
+		cc_log("lockfile_acquire: %s is busy; waiting", lockfile);
+		stats_add(STATS_LOCK_RETRIES, 1);
+		int64_t start = time_monotonic_us();
+		bool locked;
+		while (!(locked = lock_fd(fd, true)) && errno == EINTR) {
+		}
+		stats_add(STATS_LOCK_WAIT_TIME, time_monotonic_us() - start);
+		if (!locked) {
+			cc_log("lockfile_acquire: lock %s: %s", lockfile, strerror(errno));
+			close(fd);
+			goto out;
+		}
+	}
+
+	struct fcntl_lock *lock = x_malloc(sizeof(*lock));
+	lock->path = x_strdup(path);
+	lock->fd = fd;
+	lock->next = fcntl_locks;
+	fcntl_locks = lock;
+	acquired = true;
+
+out:
+	if (acquired) {
+		cc_log("Acquired lock %s", lockfile);
+	} else {
+		cc_log("Failed to acquire lock %s", lockfile);
+	}
+	free(lockfile);
+	return acquired;
+}
+
+// Release a lock on path taken with the fcntl method. Returns false if there
+// is no such lock.
+static bool
+fcntl_lock_release(const char *path)
+{
+	for (struct fcntl_lock **p = &fcntl_locks; *p; p = &(*p)->next) {
+		struct fcntl_lock *lock = *p;
+		if (str_eq(lock->path, path)) {
+			cc_log("Releasing lock %s.lck", path);
+			// Closing the file releases the lock. The file is kept since removing
+			// it would let a waiter lock a file that nobody else will use.
+			close(lock->fd);
+			*p = lock->next;
+			free(lock->path);
+			free(lock);
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
 // This function acquires a lockfile for the given path. Returns true if the
 // lock was acquired, otherwise false. If the lock has been considered stale
 // for the number of microseconds specified by staleness_limit, the function
@@ -23,10 +153,17 @@
 // staleness limit should be reasonably larger than the longest time the lock
 // can be expected to be held, and the updates of the locked path should
 // probably be made with an atomic rename(2) to avoid corruption in the rare
-// case that the lock is broken by another process.
+// case that the lock is broken by another process. The staleness limit isn't
+// used by the fcntl lock method since those locks can't become stale.
 bool
 lockfile_acquire(const char *path, unsigned staleness_limit)
 {
+#ifdef USE_FCNTL_LOCKS
+	if (conf && str_eq(conf->lock_method, "fcntl")) {
+		return fcntl_lock_acquire(path);
+	}
+#endif
+
 	char *lockfile = format("%s.lock", path);
 	char *my_content = NULL;
 	char *content = NULL;
@@ -35,6 +172,8 @@ lockfile_acquire(const char *path, unsigned staleness_limit)
 	bool acquired = false;
 	unsigned to_sleep = 1000; // Microseconds.
 	unsigned slept = 0; // Microseconds.
+	int64_t start = time_monotonic_us();
+	bool waited = false;
 
 	while (true) {
 		free(my_content);
@@ -167,11 +306,16 @@ lockfile_acquire(const char *path, unsigned staleness_limit)
 #else
 		usleep(to_sleep);
 #endif
+		stats_add(STATS_LOCK_RETRIES, 1);
+		waited = true;
 		slept += to_sleep;
 		to_sleep *= 2;
 	}
 
 out:
+	if (waited) {
+		stats_add(STATS_LOCK_WAIT_TIME, time_monotonic_us() - start);
+	}
 	if (acquired) {
 		cc_log("Acquired lock %s", lockfile);
 	} else {
@@ -189,6 +333,12 @@ out:
 void
 lockfile_release(const char *path)
 {
+#ifdef USE_FCNTL_LOCKS
+	if (fcntl_lock_release(path)) {
+		return;
+	}
+#endif
+
 	char *lockfile = format("%s.lock", path);
 	cc_log("Releasing lock %s", lockfile);
 	tmp_unlink(lockfile);
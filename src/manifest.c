@@ -17,12 +17,63 @@
 #include "ccache.h"
 #include "hashtable_itr.h"
 #include "hashutil.h"
+#include "inodecache.h"
 #include "manifest.h"
 #include "murmurhashneutral2.h"
 
 #include <zlib.h>
 
-// Sketchy specification of the manifest disk format:
+// Sketchy specification of the manifest disk format, version 2:
+//
+// The file is uncompressed and consists of fixed-width tables stored in the
+// byte order and struct layout of the host that wrote it, so that it can be
+// memory mapped and used without decoding. A manifest written with another
+// layout is treated as corrupt and is replaced.
+//
+// <header>        struct manifest_header              (32 bytes)
+// ----------------------------------------------------------------------------
+// <file_infos>    include file hash entries           (struct file_info
+//                                                      [n_file_infos])
+// ----------------------------------------------------------------------------
+// <objects>       object name entries                 (struct object_entry
+//                                                      [n_objects], 8-byte
+//                                                      aligned)
+// ----------------------------------------------------------------------------
+// <indexes>       include file hash indexes of all    (4 byte unsigned int
+//                 objects                              [n_indexes], 8-byte
+//                                                      aligned)
+// ----------------------------------------------------------------------------
+// <offsets>       offsets of the include file paths   (4 byte unsigned int
+//                 in the string pool                   [n_files])
+// ----------------------------------------------------------------------------
+// <strings>       string pool                         (<strings_size> bytes of
+//                                                      NUL-terminated strings)
+// <padding>       zero padding to a multiple of 8 bytes
+// ----------------------------------------------------------------------------
+// <appended[0]>   object entries appended after the tables, each consisting
+// ...             of:
+// <appended[m-1]>
+//   <header>      struct appended_object_header
+//   <file_infos>  include file hash entries           (struct file_info
+//                                                      [n_file_infos], with
+//                                                      index being the offset
+//                                                      of the path in the
+//                                                      entry's string pool)
+//   <strings>     string pool                         (<strings_size> bytes)
+//   <padding>     zero padding to a multiple of 8 bytes
+//
+// New objects are appended to the file so that adding one doesn't require
+// rewriting the whole manifest. When MAX_APPENDED_OBJECTS objects have been
+// appended, or when the manifest is full, it's compacted into a new file with
+// only tables. Invalid data at the end of the file is ignored when reading,
+// since it may be an object that another process is appending. If it hasn't
+// been completed within TORN_TAIL_GRACE_PERIOD seconds, it's considered to be
+// from an interrupted write and the manifest is compacted.
+//
+// Sketchy specification of the manifest disk format, version 1, which is still
+// read so that existing manifests are upgraded when they are next updated:
+//
+// The file is compressed with gzip and all integers are big-endian.
 //
 // <magic>         magic number                        (4 bytes)
 // <version>       file format version                 (1 byte unsigned int)
@@ -65,15 +116,15 @@
 static const uint32_t MAGIC = 0x63436d46U;
 static const uint32_t MAX_MANIFEST_ENTRIES = 100;
 static const uint32_t MAX_MANIFEST_FILE_INFO_ENTRIES = 10000;
-
-#define ccache_static_assert(e) \
-  do { enum { ccache_static_assert__ = 1/(e) }; } while (false)
+static const uint32_t MAX_APPENDED_OBJECTS = 20;
+static const uint32_t APPENDED_OBJECT_MAGIC = 0x63436d41U;
+static const time_t TORN_TAIL_GRACE_PERIOD = 10;
 
 struct file_info {
 	// Index to n_files.
 	uint32_t index;
 	// Hash of referenced file.
-	uint8_t hash[16];
+	uint8_t hash[DIGEST_SIZE];
 	// Size of referenced file.
 	uint32_t size;
 	// mtime of referenced file.
@@ -82,6 +133,46 @@ struct file_info {
 	int64_t ctime;
 };
 
+// Object name entry in a version 2 manifest file.
+struct object_entry {
+	// Position of the first include file hash index in the index table.
+	uint32_t first_index;
+	// Number of include file hash indexes.
+	uint32_t n_file_info_indexes;
+	// Hash of the object itself.
+	struct file_hash hash;
+	// Use stamp of the object, see struct object.
+	uint64_t last_used;
+	// Filter of the include file hash indexes, see struct object.
+	uint64_t file_info_filter;
+};
+
+struct manifest_header {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t hash_size;
+	uint16_t reserved;
+	uint32_t n_files;
+	uint32_t n_file_infos;
+	uint32_t n_objects;
+	uint32_t n_indexes;
+	uint32_t strings_size;
+	// Struct sizes of the writer, to detect manifests written with another
+	// layout.
+	uint16_t file_info_size;
+	uint16_t object_entry_size;
+};
+
+struct appended_object_header {
+	uint32_t magic;
+	// Size of the whole entry including this header.
+	uint32_t size;
+	uint32_t n_file_infos;
+	uint32_t strings_size;
+	// The object itself. first_index and file_info_filter are not used.
+	struct object_entry object;
+};
+
 struct object {
 	// Number of entries in file_info_indexes.
 	uint32_t n_file_info_indexes;
@@ -89,6 +180,16 @@ struct object {
 	uint32_t *file_info_indexes;
 	// Hash of the object itself.
 	struct file_hash hash;
+	// Use stamp: one more than the highest stamp in the manifest when the
+	// object was added or last found, so that the least recently used object
+	// has the lowest stamp. 0 for objects read from a version 1 manifest.
+	uint64_t last_used;
+	// Union of file_info_filter_bit() of file_info_indexes, used to quickly
+	// rule out objects that refer to a file info already known not to match.
+	uint64_t file_info_filter;
+	// Offset of the use stamp in the manifest file, or 0 if the object isn't
+	// stored in a mapped version 2 manifest.
+	size_t stamp_offset;
 };
 
 struct manifest {
@@ -112,19 +213,35 @@ struct manifest {
 	// Object names plus references to include file hashes.
 	uint32_t n_objects;
 	struct object *objects;
-};
 
-struct file_stats {
-	uint32_t size;
-	int64_t mtime;
-	int64_t ctime;
+	// Content of a mapped version 2 manifest file. If map.data is non-NULL, the
+	// paths, the file infos (unless there are appended objects) and the file
+	// info indexes of the objects point into it instead of being owned by the
+	// manifest.
+	struct mapped_file map;
+
+	// Number of appended objects, which are last in objects. The file infos of
+	// those are added to a heap copy of file_infos, and their indexes are
+	// stored in appended_indexes.
+	uint32_t n_appended;
+	uint32_t *appended_indexes;
+
+	// Whether the mapped file ends with an invalid appended entry, for
+	// instance from an interrupted write.
+	bool truncated;
 };
 
+// Depending on DIGEST_SIZE, struct file_info may contain padding, so hash the
+// fields one by one.
 static unsigned int
 hash_from_file_info(void *key)
 {
-	ccache_static_assert(sizeof(struct file_info) == 40); // No padding.
-	return murmurhashneutral2(key, sizeof(struct file_info), 0);
+	struct file_info *fi = (struct file_info *)key;
+	unsigned int h = murmurhashneutral2(&fi->index, sizeof(fi->index), 0);
+	h = murmurhashneutral2(fi->hash, sizeof(fi->hash), h);
+	h = murmurhashneutral2(&fi->size, sizeof(fi->size), h);
+	h = murmurhashneutral2(&fi->mtime, sizeof(fi->mtime), h);
+	return murmurhashneutral2(&fi->ctime, sizeof(fi->ctime), h);
 }
 
 static int
@@ -133,27 +250,86 @@ file_infos_equal(void *key1, void *key2)
 	struct file_info *fi1 = (struct file_info *)key1;
 	struct file_info *fi2 = (struct file_info *)key2;
 	return fi1->index == fi2->index
-	       && memcmp(fi1->hash, fi2->hash, 16) == 0
+	       && memcmp(fi1->hash, fi2->hash, DIGEST_SIZE) == 0
 	       && fi1->size == fi2->size
 	       && fi1->mtime == fi2->mtime
 	       && fi1->ctime == fi2->ctime;
 }
 
+// Return the bit that represents file info index in a file_info_filter.
+static uint64_t
+file_info_filter_bit(uint32_t index)
+{
+	// Fibonacci hashing to spread consecutive indexes over the 64 bits.
+	return (uint64_t)1 << ((uint32_t)(index * 2654435769U) >> 26);
+}
+
+static void
+update_file_info_filter(struct object *obj)
+{
+	obj->file_info_filter = 0;
+	for (uint32_t i = 0; i < obj->n_file_info_indexes; i++) {
+		obj->file_info_filter |= file_info_filter_bit(obj->file_info_indexes[i]);
+	}
+}
+
 static void
 free_manifest(struct manifest *mf)
 {
-	for (uint32_t i = 0; i < mf->n_files; i++) {
-		free(mf->files[i]);
+	if (mf->map.data) {
+		if (mf->n_appended > 0) {
+			free(mf->file_infos);
+		}
+		free(mf->appended_indexes);
+		unmap_file(&mf->map);
+	} else {
+		for (uint32_t i = 0; i < mf->n_files; i++) {
+			free(mf->files[i]);
+		}
+		free(mf->file_infos);
+		for (uint32_t i = 0; i < mf->n_objects; i++) {
+			free(mf->objects[i].file_info_indexes);
+		}
 	}
 	free(mf->files);
-	free(mf->file_infos);
-	for (uint32_t i = 0; i < mf->n_objects; i++) {
-		free(mf->objects[i].file_info_indexes);
-	}
 	free(mf->objects);
 	free(mf);
 }
 
+// Copy the parts of a mapped manifest that point into the file to the heap so
+// that the manifest can be modified.
+static void
+detach_manifest(struct manifest *mf)
+{
+	if (!mf->map.data) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < mf->n_files; i++) {
+		mf->files[i] = x_strdup(mf->files[i]);
+	}
+	if (mf->n_appended == 0) {
+		struct file_info *file_infos =
+		  x_malloc(mf->n_file_infos * sizeof(*file_infos) + 1);
+		memcpy(file_infos, mf->file_infos,
+		       mf->n_file_infos * sizeof(*file_infos));
+		mf->file_infos = file_infos;
+	}
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		struct object *obj = &mf->objects[i];
+		uint32_t *indexes =
+		  x_malloc(obj->n_file_info_indexes * sizeof(*indexes) + 1);
+		memcpy(indexes, obj->file_info_indexes,
+		       obj->n_file_info_indexes * sizeof(*indexes));
+		obj->file_info_indexes = indexes;
+		obj->stamp_offset = 0;
+	}
+	free(mf->appended_indexes);
+	mf->appended_indexes = NULL;
+	mf->n_appended = 0;
+	unmap_file(&mf->map);
+}
+
 #define READ_BYTE(var) \
   do { \
 		int ch_ = gzgetc(f); \
@@ -212,19 +388,26 @@ static struct manifest *
 create_empty_manifest(void)
 {
 	struct manifest *mf = x_malloc(sizeof(*mf));
-	mf->hash_size = 16;
+	mf->version = MANIFEST_VERSION;
+	mf->reserved = 0;
+	mf->hash_size = DIGEST_SIZE;
 	mf->n_files = 0;
 	mf->files = NULL;
 	mf->n_file_infos = 0;
 	mf->file_infos = NULL;
 	mf->n_objects = 0;
 	mf->objects = NULL;
+	mf->map.data = NULL;
+	mf->map.size = 0;
+	mf->n_appended = 0;
+	mf->appended_indexes = NULL;
+	mf->truncated = false;
 
 	return mf;
 }
 
 static struct manifest *
-read_manifest(gzFile f)
+read_manifest_v1(gzFile f)
 {
 	struct manifest *mf = create_empty_manifest();
 
@@ -236,14 +419,14 @@ read_manifest(gzFile f)
 	}
 
 	READ_BYTE(mf->version);
-	if (mf->version != MANIFEST_VERSION) {
+	if (mf->version != 1) {
 		cc_log("Manifest file has unknown version %u", mf->version);
 		goto error;
 	}
 
 	READ_BYTE(mf->hash_size);
-	if (mf->hash_size != 16) {
-		// Temporary measure until we support different hash algorithms.
+	if (mf->hash_size != DIGEST_SIZE) {
+		// Written by a ccache built with another hash algorithm.
 		cc_log("Manifest file has unsupported hash size %u", mf->hash_size);
 		goto error;
 	}
@@ -278,6 +461,9 @@ read_manifest(gzFile f)
 		}
 		READ_BYTES(mf->hash_size, mf->objects[i].hash.hash);
 		READ_INT(4, mf->objects[i].hash.size);
+		mf->objects[i].last_used = 0;
+		mf->objects[i].stamp_offset = 0;
+		update_file_info_filter(&mf->objects[i]);
 	}
 
 	return mf;
@@ -288,143 +474,452 @@ error:
 	return NULL;
 }
 
-#define WRITE_INT(size, var) \
-  do { \
-		uint64_t u_ = (var); \
-		uint8_t ch_; \
-		size_t i_; \
-		for (i_ = 0; i_ < (size); i_++) { \
-			ch_ = (u_ >> (8 * ((size) - i_ - 1))); \
-			if (gzputc(f, ch_) == EOF) { \
-				goto error; \
-			} \
-		} \
-	} while (false)
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
 
-#define WRITE_STR(var) \
-  do { \
-		if (gzputs(f, var) == EOF || gzputc(f, '\0') == EOF) { \
-			goto error; \
-		} \
-	} while (false)
+// Lay out the tables of a version 2 manifest described by header.
+static void
+get_v2_offsets(const struct manifest_header *header, size_t *objects,
+               size_t *indexes, size_t *offsets, size_t *strings, size_t *end)
+{
+	*objects = ALIGN8(sizeof(*header)
+	                  + (size_t)header->n_file_infos * sizeof(struct file_info));
+	*indexes = ALIGN8(*objects
+	                  + (size_t)header->n_objects * sizeof(struct object_entry));
+	*offsets = *indexes + (size_t)header->n_indexes * sizeof(uint32_t);
+	*strings = *offsets + (size_t)header->n_files * sizeof(uint32_t);
+	*end = *strings + header->strings_size;
+}
 
-#define WRITE_BYTES(n, var) \
-  do { \
-		size_t i_; \
-		for (i_ = 0; i_ < (n); i_++) { \
-			if (gzputc(f, (var)[i_]) == EOF) { \
-				goto error; \
-			} \
-		} \
-	} while (false)
+// Return the size of the valid appended object entry at offset in the mapped
+// file of mf, or 0 if there is none.
+static size_t
+check_appended_object(const struct manifest *mf, size_t offset)
+{
+	const char *data = mf->map.data;
+	size_t size = mf->map.size;
+	struct appended_object_header header;
+	if (size - offset < sizeof(header)) {
+		return 0;
+	}
+	memcpy(&header, data + offset, sizeof(header));
+	uint64_t strings_offset = sizeof(header)
+	  + (uint64_t)header.n_file_infos * sizeof(struct file_info);
+	if (header.magic != APPENDED_OBJECT_MAGIC
+	    || header.size % 8 != 0
+	    || header.size > size - offset
+	    || strings_offset + header.strings_size > header.size
+	    || header.object.n_file_info_indexes != header.n_file_infos
+	    || (header.strings_size > 0
+	        && data[offset + strings_offset + header.strings_size - 1] != '\0')) {
+		return 0;
+	}
+	const struct file_info *file_infos =
+	  (const struct file_info *)(data + offset + sizeof(header));
+	for (uint32_t i = 0; i < header.n_file_infos; i++) {
+		if (file_infos[i].index >= header.strings_size) {
+			return 0;
+		}
+	}
+	return header.size;
+}
 
-static int
-write_manifest(gzFile f, const struct manifest *mf)
+// Add the objects appended after the tables of a mapped version 2 manifest
+// file, starting at offset. An invalid entry ends the list.
+static void
+read_appended_objects(struct manifest *mf, size_t offset)
 {
-	WRITE_INT(4, MAGIC);
-	WRITE_INT(1, MANIFEST_VERSION);
-	WRITE_INT(1, 16);
-	WRITE_INT(2, 0);
+	uint32_t n_objects = 0;
+	uint32_t n_file_infos = 0;
+	size_t end = offset;
+	size_t entry_size;
+	while ((entry_size = check_appended_object(mf, end)) > 0) {
+		struct appended_object_header header;
+		memcpy(&header, mf->map.data + end, sizeof(header));
+		n_objects++;
+		n_file_infos += header.n_file_infos;
+		end += entry_size;
+	}
+	if (end != mf->map.size) {
+		cc_log("Ignoring invalid data at the end of the manifest file");
+		mf->truncated = true;
+	}
+	if (n_objects == 0) {
+		return;
+	}
 
-	WRITE_INT(4, mf->n_files);
-	for (uint32_t i = 0; i < mf->n_files; i++) {
-		WRITE_STR(mf->files[i]);
+	// Each appended file info gets a path of its own. Duplicates are merged
+	// when the manifest is compacted.
+	struct file_info *file_infos = x_malloc(
+	  (mf->n_file_infos + n_file_infos) * sizeof(*file_infos));
+	memcpy(file_infos, mf->file_infos, mf->n_file_infos * sizeof(*file_infos));
+	mf->file_infos = file_infos;
+	mf->files = x_realloc(
+	  mf->files, (mf->n_files + n_file_infos) * sizeof(*mf->files) + 1);
+	mf->objects = x_realloc(
+	  mf->objects, (mf->n_objects + n_objects) * sizeof(*mf->objects));
+	mf->appended_indexes = x_malloc(n_file_infos * sizeof(uint32_t) + 1);
+	mf->n_appended = n_objects;
+
+	uint32_t *indexes = mf->appended_indexes;
+	for (size_t pos = offset; pos < end;) {
+		struct appended_object_header header;
+		memcpy(&header, mf->map.data + pos, sizeof(header));
+		const struct file_info *entry_file_infos =
+		  (const struct file_info *)(mf->map.data + pos + sizeof(header));
+		char *strings = mf->map.data + pos + sizeof(header)
+		                + header.n_file_infos * sizeof(struct file_info);
+
+		struct object *obj = &mf->objects[mf->n_objects++];
+		obj->n_file_info_indexes = header.n_file_infos;
+		obj->file_info_indexes = indexes;
+		obj->hash = header.object.hash;
+		obj->last_used = header.object.last_used;
+		obj->stamp_offset = pos
+		  + offsetof(struct appended_object_header, object)
+		  + offsetof(struct object_entry, last_used);
+		for (uint32_t i = 0; i < header.n_file_infos; i++) {
+			struct file_info fi = entry_file_infos[i];
+			mf->files[mf->n_files] = strings + fi.index;
+			fi.index = mf->n_files++;
+			mf->file_infos[mf->n_file_infos] = fi;
+			*indexes++ = mf->n_file_infos++;
+		}
+		update_file_info_filter(obj);
+		pos += header.size;
 	}
+}
+
+// Set up a manifest that refers to the tables of a mapped version 2 manifest
+// file. Takes over ownership of map.
+static struct manifest *
+read_manifest_v2(struct mapped_file *map)
+{
+	struct manifest *mf = create_empty_manifest();
+	mf->map = *map;
 
-	WRITE_INT(4, mf->n_file_infos);
+	struct manifest_header header;
+	if (map->size < sizeof(header)) {
+		goto error;
+	}
+	memcpy(&header, map->data, sizeof(header));
+	if (header.magic != MAGIC) {
+		cc_log("Manifest file has bad magic number %u", header.magic);
+		goto error;
+	}
+	mf->version = header.version;
+	if (mf->version != MANIFEST_VERSION) {
+		cc_log("Manifest file has unknown version %u", mf->version);
+		goto error;
+	}
+	mf->hash_size = header.hash_size;
+	if (mf->hash_size != DIGEST_SIZE) {
+		// Written by a ccache built with another hash algorithm.
+		cc_log("Manifest file has unsupported hash size %u", mf->hash_size);
+		goto error;
+	}
+	if (header.file_info_size != sizeof(struct file_info)
+	    || header.object_entry_size != sizeof(struct object_entry)) {
+		cc_log("Manifest file has unsupported layout");
+		goto error;
+	}
+	mf->reserved = header.reserved;
+
+	// The counts are 32 bits wide, so the sizes can't overflow a 64-bit size_t.
+	size_t objects_offset, indexes_offset, offsets_offset, strings_offset, end;
+	get_v2_offsets(&header, &objects_offset, &indexes_offset, &offsets_offset,
+	               &strings_offset, &end);
+	if (ALIGN8(end) > map->size
+	    || (header.strings_size > 0 && map->data[end - 1] != '\0')) {
+		goto error;
+	}
+
+	mf->n_file_infos = header.n_file_infos;
+	mf->file_infos = (struct file_info *)(map->data + sizeof(header));
 	for (uint32_t i = 0; i < mf->n_file_infos; i++) {
-		WRITE_INT(4, mf->file_infos[i].index);
-		WRITE_BYTES(mf->hash_size, mf->file_infos[i].hash);
-		WRITE_INT(4, mf->file_infos[i].size);
-		WRITE_INT(8, mf->file_infos[i].mtime);
-		WRITE_INT(8, mf->file_infos[i].ctime);
+		if (mf->file_infos[i].index >= header.n_files) {
+			goto error;
+		}
+	}
+
+	const uint32_t *indexes = (const uint32_t *)(map->data + indexes_offset);
+	for (uint32_t i = 0; i < header.n_indexes; i++) {
+		if (indexes[i] >= header.n_file_infos) {
+			goto error;
+		}
 	}
 
-	WRITE_INT(4, mf->n_objects);
+	const struct object_entry *entries =
+	  (const struct object_entry *)(map->data + objects_offset);
+	mf->objects = x_calloc(header.n_objects, sizeof(*mf->objects));
+	mf->n_objects = header.n_objects;
 	for (uint32_t i = 0; i < mf->n_objects; i++) {
-		WRITE_INT(4, mf->objects[i].n_file_info_indexes);
-		for (uint32_t j = 0; j < mf->objects[i].n_file_info_indexes; j++) {
-			WRITE_INT(4, mf->objects[i].file_info_indexes[j]);
+		const struct object_entry *entry = &entries[i];
+		if (entry->first_index > header.n_indexes
+		    || entry->n_file_info_indexes
+		       > header.n_indexes - entry->first_index) {
+			goto error;
 		}
-		WRITE_BYTES(mf->hash_size, mf->objects[i].hash.hash);
-		WRITE_INT(4, mf->objects[i].hash.size);
+		mf->objects[i].n_file_info_indexes = entry->n_file_info_indexes;
+		mf->objects[i].file_info_indexes =
+		  (uint32_t *)indexes + entry->first_index;
+		mf->objects[i].hash = entry->hash;
+		mf->objects[i].last_used = entry->last_used;
+		mf->objects[i].file_info_filter = entry->file_info_filter;
+		mf->objects[i].stamp_offset = objects_offset
+		  + i * sizeof(struct object_entry)
+		  + offsetof(struct object_entry, last_used);
 	}
 
-	return 1;
+	const uint32_t *offsets = (const uint32_t *)(map->data + offsets_offset);
+	mf->files = x_calloc(header.n_files, sizeof(*mf->files));
+	mf->n_files = header.n_files;
+	for (uint32_t i = 0; i < mf->n_files; i++) {
+		if (offsets[i] >= header.strings_size) {
+			goto error;
+		}
+		mf->files[i] = map->data + strings_offset + offsets[i];
+	}
+
+	read_appended_objects(mf, ALIGN8(end));
+	return mf;
 
 error:
-	cc_log("Error writing to manifest file");
-	return 0;
+	cc_log("Corrupt manifest file");
+	free_manifest(mf);
+	return NULL;
 }
 
-static int
-verify_object(struct conf *conf, struct manifest *mf, struct object *obj,
-              struct hashtable *stated_files, struct hashtable *hashed_files)
+// Read a manifest file of any supported version. Returns NULL if the file
+// can't be read, with errno set to ENOENT if it doesn't exist.
+static struct manifest *
+read_manifest(const char *path)
 {
-	for (uint32_t i = 0; i < obj->n_file_info_indexes; i++) {
-		struct file_info *fi = &mf->file_infos[obj->file_info_indexes[i]];
-		char *path = mf->files[fi->index];
-		struct file_stats *st = hashtable_search(stated_files, path);
-		if (!st) {
-			struct stat file_stat;
-			if (x_stat(path, &file_stat) != 0) {
-				return 0;
-			}
-			st = x_malloc(sizeof(*st));
-			st->size = file_stat.st_size;
-			st->mtime = file_stat.st_mtime;
-			st->ctime = file_stat.st_ctime;
-			hashtable_insert(stated_files, x_strdup(path), st);
-		}
+	struct mapped_file map;
+	if (!map_file(path, 0, false, &map)) {
+		return NULL;
+	}
 
-		if (fi->size != st->size) {
-			return 0;
+	if (map.size >= 2
+	    && (uint8_t)map.data[0] == 0x1f && (uint8_t)map.data[1] == 0x8b) {
+		// A gzip-compressed version 1 manifest.
+		unmap_file(&map);
+		gzFile f = gzopen(path, "rb");
+		if (!f) {
+			cc_log("Failed to gzopen manifest file");
+			errno = EIO;
+			return NULL;
+		}
+		struct manifest *mf = read_manifest_v1(f);
+		gzclose(f);
+		if (!mf) {
+			errno = EIO;
 		}
+		return mf;
+	}
 
-		// Clang stores the mtime of the included files in the precompiled header,
-		// and will error out if that header is later used without rebuilding.
-		if (guessed_compiler == GUESSED_CLANG
-		    && output_is_precompiled_header
-		    && fi->mtime != st->mtime) {
-			cc_log("Precompiled header includes %s, which has a new mtime", path);
-			return 0;
+	struct manifest *mf = read_manifest_v2(&map);
+	if (!mf) {
+		errno = EIO;
+	}
+	return mf;
+}
+
+static int
+write_manifest(int fd, const struct manifest *mf)
+{
+	struct manifest_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MAGIC;
+	header.version = MANIFEST_VERSION;
+	header.hash_size = DIGEST_SIZE;
+	header.n_files = mf->n_files;
+	header.n_file_infos = mf->n_file_infos;
+	header.n_objects = mf->n_objects;
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		header.n_indexes += mf->objects[i].n_file_info_indexes;
+	}
+	for (uint32_t i = 0; i < mf->n_files; i++) {
+		header.strings_size += strlen(mf->files[i]) + 1;
+	}
+	header.file_info_size = sizeof(struct file_info);
+	header.object_entry_size = sizeof(struct object_entry);
+
+	size_t objects_offset, indexes_offset, offsets_offset, strings_offset, end;
+	get_v2_offsets(&header, &objects_offset, &indexes_offset, &offsets_offset,
+	               &strings_offset, &end);
+
+	end = ALIGN8(end);
+	char *data = x_calloc(1, end);
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + sizeof(header), mf->file_infos,
+	       mf->n_file_infos * sizeof(*mf->file_infos));
+
+	struct object_entry *entries = (struct object_entry *)(data + objects_offset);
+	uint32_t *indexes = (uint32_t *)(data + indexes_offset);
+	uint32_t n_indexes = 0;
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		const struct object *obj = &mf->objects[i];
+		entries[i].first_index = n_indexes;
+		entries[i].n_file_info_indexes = obj->n_file_info_indexes;
+		entries[i].hash = obj->hash;
+		entries[i].last_used = obj->last_used;
+		entries[i].file_info_filter = obj->file_info_filter;
+		memcpy(indexes + n_indexes, obj->file_info_indexes,
+		       obj->n_file_info_indexes * sizeof(*indexes));
+		n_indexes += obj->n_file_info_indexes;
+	}
+
+	uint32_t *offsets = (uint32_t *)(data + offsets_offset);
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < mf->n_files; i++) {
+		size_t len = strlen(mf->files[i]) + 1;
+		offsets[i] = offset;
+		memcpy(data + strings_offset + offset, mf->files[i], len);
+		offset += len;
+	}
+
+	bool ok = write_fd(fd, data, end);
+	free(data);
+	if (!ok) {
+		cc_log("Error writing to manifest file: %s", strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+#define FILE_INFO_UNKNOWN 0
+#define FILE_INFO_MATCH 1
+#define FILE_INFO_MISMATCH 2
+
+// State shared by the verification of the objects in a manifest.
+struct verification {
+	struct hashtable *stated_files; // path --> struct stat
+	struct hashtable *hashed_files; // path --> struct file_hash
+	// FILE_INFO_* for each file info.
+	uint8_t *file_info_states;
+	// Union of file_info_filter_bit() of the mismatching file infos.
+	uint64_t mismatch_filter;
+};
+
+static bool
+verify_file_info(struct conf *conf, struct manifest *mf, struct file_info *fi,
+                 struct verification *v)
+{
+	char *path = mf->files[fi->index];
+	struct stat *st = hashtable_search(v->stated_files, path);
+	if (!st) {
+		struct stat file_stat;
+		if (x_stat(path, &file_stat) != 0) {
+			return false;
 		}
+		st = x_malloc(sizeof(*st));
+		*st = file_stat;
+		hashtable_insert(v->stated_files, x_strdup(path), st);
+	}
 
-		if (conf->sloppiness & SLOPPY_FILE_STAT_MATCHES) {
-			if (fi->mtime == st->mtime && fi->ctime == st->ctime) {
-				cc_log("mtime/ctime hit for %s", path);
-				continue;
-			} else {
-				cc_log("mtime/ctime miss for %s", path);
-			}
+	if (fi->size != st->st_size) {
+		return false;
+	}
+
+	// Clang stores the mtime of the included files in the precompiled header,
+	// and will error out if that header is later used without rebuilding.
+	if (guessed_compiler == GUESSED_CLANG
+	    && output_is_precompiled_header
+	    && fi->mtime != st->st_mtime) {
+		cc_log("Precompiled header includes %s, which has a new mtime", path);
+		return false;
+	}
+
+	if (conf->sloppiness & SLOPPY_FILE_STAT_MATCHES) {
+		if (fi->mtime == st->st_mtime && fi->ctime == st->st_ctime) {
+			cc_log("mtime/ctime hit for %s", path);
+			return true;
+		} else {
+			cc_log("mtime/ctime miss for %s", path);
 		}
+	}
 
-		struct file_hash *actual = hashtable_search(hashed_files, path);
-		if (!actual) {
-			struct mdfour hash;
+	// The inode cache is shared by all ccache processes, so an include file is
+	// typically hashed only once by the parallel compilations of a build.
+	struct file_hash *actual = hashtable_search(v->hashed_files, path);
+	if (!actual) {
+		struct file_hash file_hash;
+		bool is_pch = is_precompiled_header(path);
+		if (is_pch || !inode_cache_get(conf, st, &file_hash)) {
+			struct hash hash;
 			hash_start(&hash);
 			int result = hash_source_code_file(conf, &hash, path);
 			if (result & HASH_SOURCE_CODE_ERROR) {
 				cc_log("Failed hashing %s", path);
-				return 0;
+				return false;
 			}
 			if (result & HASH_SOURCE_CODE_FOUND_TIME) {
+				return false;
+			}
+			hash_result_as_bytes(&hash, file_hash.hash);
+			file_hash.size = hash.totalN;
+			if (!is_pch && !(result & HASH_SOURCE_CODE_FOUND_DATE)) {
+				inode_cache_put(conf, st, &file_hash);
+			}
+		}
+		actual = x_malloc(sizeof(*actual));
+		*actual = file_hash;
+		hashtable_insert(v->hashed_files, x_strdup(path), actual);
+	}
+	return memcmp(fi->hash, actual->hash, mf->hash_size) == 0
+	       && fi->size == actual->size;
+}
+
+static int
+verify_object(struct conf *conf, struct manifest *mf, struct object *obj,
+              struct verification *v)
+{
+	// Reject the object without looking at any files if it refers to a file
+	// info that didn't match for a previously checked object. The filter rules
+	// out most objects that don't.
+	if (obj->file_info_filter & v->mismatch_filter) {
+		for (uint32_t i = 0; i < obj->n_file_info_indexes; i++) {
+			uint32_t index = obj->file_info_indexes[i];
+			if (v->file_info_states[index] == FILE_INFO_MISMATCH) {
 				return 0;
 			}
-			actual = x_malloc(sizeof(*actual));
-			hash_result_as_bytes(&hash, actual->hash);
-			actual->size = hash.totalN;
-			hashtable_insert(hashed_files, x_strdup(path), actual);
 		}
-		if (memcmp(fi->hash, actual->hash, mf->hash_size) != 0
-		    || fi->size != actual->size) {
+	}
+
+	for (uint32_t i = 0; i < obj->n_file_info_indexes; i++) {
+		uint32_t index = obj->file_info_indexes[i];
+		if (v->file_info_states[index] == FILE_INFO_MATCH) {
+			continue;
+		}
+		if (!verify_file_info(conf, mf, &mf->file_infos[index], v)) {
+			v->file_info_states[index] = FILE_INFO_MISMATCH;
+			v->mismatch_filter |= file_info_filter_bit(index);
 			return 0;
 		}
+		v->file_info_states[index] = FILE_INFO_MATCH;
 	}
 
 	return 1;
 }
 
+struct object_order {
+	uint64_t last_used;
+	uint32_t index;
+};
+
+// Order objects with the most recently used one first and, for equal use
+// stamps, the most recently added one first.
+static int
+compare_object_order(const void *a, const void *b)
+{
+	const struct object_order *oa = a;
+	const struct object_order *ob = b;
+	if (oa->last_used != ob->last_used) {
+		return oa->last_used < ob->last_used ? 1 : -1;
+	}
+	return oa->index < ob->index ? 1 : -1;
+}
+
 static struct hashtable *
 create_string_index_map(char **strings, uint32_t len)
 {
@@ -469,17 +964,15 @@ get_include_file_index(struct manifest *mf, char *path,
 	return n;
 }
 
-static uint32_t
-get_file_hash_index(struct manifest *mf,
-                    char *path,
-                    struct file_hash *file_hash,
-                    struct hashtable *mf_files,
-                    struct hashtable *mf_file_infos)
+// Fill in the hash, size and timestamps of an included file in fi. The index
+// is set to 0.
+static void
+make_file_info(struct file_info *fi, const char *path,
+               const struct file_hash *file_hash)
 {
-	struct file_info fi;
-	fi.index = get_include_file_index(mf, path, mf_files);
-	memcpy(fi.hash, file_hash->hash, sizeof(fi.hash));
-	fi.size = file_hash->size;
+	memset(fi, 0, sizeof(*fi)); // Clear padding since fi is written as is.
+	memcpy(fi->hash, file_hash->hash, sizeof(fi->hash));
+	fi->size = file_hash->size;
 
 	// file_stat.st_{m,c}time has a resolution of 1 second, so we can cache the
 	// file's mtime and ctime only if they're at least one second older than
@@ -491,12 +984,24 @@ get_file_hash_index(struct manifest *mf,
 	struct stat file_stat;
 	if (stat(path, &file_stat) != -1
 	    && time_of_compilation > MAX(file_stat.st_mtime, file_stat.st_ctime)) {
-		fi.mtime = file_stat.st_mtime;
-		fi.ctime = file_stat.st_ctime;
+		fi->mtime = file_stat.st_mtime;
+		fi->ctime = file_stat.st_ctime;
 	} else {
-		fi.mtime = -1;
-		fi.ctime = -1;
+		fi->mtime = -1;
+		fi->ctime = -1;
 	}
+}
+
+static uint32_t
+get_file_hash_index(struct manifest *mf,
+                    char *path,
+                    struct file_hash *file_hash,
+                    struct hashtable *mf_files,
+                    struct hashtable *mf_file_infos)
+{
+	struct file_info fi;
+	make_file_info(&fi, path, file_hash);
+	fi.index = get_include_file_index(mf, path, mf_files);
 
 	uint32_t *fi_index = hashtable_search(mf_file_infos, &fi);
 	if (fi_index) {
@@ -539,6 +1044,17 @@ add_file_info_indexes(uint32_t *indexes, uint32_t size,
 	hashtable_destroy(mf_files, 1);
 }
 
+// Return the use stamp that marks an object as the most recently used one.
+static uint64_t
+next_use_stamp(const struct manifest *mf)
+{
+	uint64_t max = 0;
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		max = MAX(max, mf->objects[i].last_used);
+	}
+	return max + 1;
+}
+
 static void
 add_object_entry(struct manifest *mf,
                  struct file_hash *object_hash,
@@ -555,6 +1071,220 @@ add_object_entry(struct manifest *mf,
 	add_file_info_indexes(obj->file_info_indexes, n_fii, mf, included_files);
 	memcpy(obj->hash.hash, object_hash->hash, mf->hash_size);
 	obj->hash.size = object_hash->size;
+	obj->last_used = next_use_stamp(mf);
+	update_file_info_filter(obj);
+}
+
+// Remove the objects for which evicted[i] is true and then the file infos and
+// paths that are no longer referenced by any object.
+static void
+remove_objects(struct manifest *mf, const bool *evicted)
+{
+	uint32_t n_objects = 0;
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		if (evicted[i]) {
+			free(mf->objects[i].file_info_indexes);
+		} else {
+			mf->objects[n_objects++] = mf->objects[i];
+		}
+	}
+	mf->n_objects = n_objects;
+
+	// Old file info index --> new index, or UINT32_MAX if unreferenced.
+	uint32_t *fi_map = x_malloc(mf->n_file_infos * sizeof(*fi_map) + 1);
+	for (uint32_t i = 0; i < mf->n_file_infos; i++) {
+		fi_map[i] = UINT32_MAX;
+	}
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		for (uint32_t j = 0; j < mf->objects[i].n_file_info_indexes; j++) {
+			fi_map[mf->objects[i].file_info_indexes[j]] = 0;
+		}
+	}
+	uint32_t n_file_infos = 0;
+	for (uint32_t i = 0; i < mf->n_file_infos; i++) {
+		if (fi_map[i] != UINT32_MAX) {
+			fi_map[i] = n_file_infos;
+			mf->file_infos[n_file_infos++] = mf->file_infos[i];
+		}
+	}
+	mf->n_file_infos = n_file_infos;
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		for (uint32_t j = 0; j < mf->objects[i].n_file_info_indexes; j++) {
+			uint32_t *index = &mf->objects[i].file_info_indexes[j];
+			*index = fi_map[*index];
+		}
+		update_file_info_filter(&mf->objects[i]);
+	}
+	free(fi_map);
+
+	// Old path index --> new index, or UINT32_MAX if unreferenced.
+	uint32_t *file_map = x_malloc(mf->n_files * sizeof(*file_map) + 1);
+	for (uint32_t i = 0; i < mf->n_files; i++) {
+		file_map[i] = UINT32_MAX;
+	}
+	for (uint32_t i = 0; i < mf->n_file_infos; i++) {
+		file_map[mf->file_infos[i].index] = 0;
+	}
+	uint32_t n_files = 0;
+	for (uint32_t i = 0; i < mf->n_files; i++) {
+		if (file_map[i] == UINT32_MAX) {
+			free(mf->files[i]);
+		} else {
+			file_map[i] = n_files;
+			mf->files[n_files++] = mf->files[i];
+		}
+	}
+	mf->n_files = n_files;
+	for (uint32_t i = 0; i < mf->n_file_infos; i++) {
+		mf->file_infos[i].index = file_map[mf->file_infos[i].index];
+	}
+	free(file_map);
+}
+
+// Merge the duplicate paths and file infos that appended objects introduce.
+static void
+merge_duplicates(struct manifest *mf)
+{
+	// Old path index --> new index.
+	uint32_t *file_map = x_malloc(mf->n_files * sizeof(*file_map) + 1);
+	struct hashtable *mf_files =
+	  create_hashtable(1000, hash_from_string, strings_equal);
+	uint32_t n_files = 0;
+	for (uint32_t i = 0; i < mf->n_files; i++) {
+		uint32_t *index = hashtable_search(mf_files, mf->files[i]);
+		if (index) {
+			file_map[i] = *index;
+			free(mf->files[i]);
+		} else {
+			index = x_malloc(sizeof(*index));
+			*index = n_files;
+			hashtable_insert(mf_files, x_strdup(mf->files[i]), index);
+			file_map[i] = n_files;
+			mf->files[n_files++] = mf->files[i];
+		}
+	}
+	mf->n_files = n_files;
+	hashtable_destroy(mf_files, 1);
+
+	// Old file info index --> new index.
+	uint32_t *fi_map = x_malloc(mf->n_file_infos * sizeof(*fi_map) + 1);
+	struct hashtable *mf_file_infos =
+	  create_hashtable(1000, hash_from_file_info, file_infos_equal);
+	uint32_t n_file_infos = 0;
+	for (uint32_t i = 0; i < mf->n_file_infos; i++) {
+		struct file_info fi = mf->file_infos[i];
+		fi.index = file_map[fi.index];
+		uint32_t *index = hashtable_search(mf_file_infos, &fi);
+		if (index) {
+			fi_map[i] = *index;
+		} else {
+			struct file_info *key = x_malloc(sizeof(*key));
+			*key = fi;
+			index = x_malloc(sizeof(*index));
+			*index = n_file_infos;
+			hashtable_insert(mf_file_infos, key, index);
+			fi_map[i] = n_file_infos;
+			mf->file_infos[n_file_infos++] = fi;
+		}
+	}
+	mf->n_file_infos = n_file_infos;
+	hashtable_destroy(mf_file_infos, 1);
+	free(file_map);
+
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		for (uint32_t j = 0; j < mf->objects[i].n_file_info_indexes; j++) {
+			uint32_t *index = &mf->objects[i].file_info_indexes[j];
+			*index = fi_map[*index];
+		}
+		update_file_info_filter(&mf->objects[i]);
+	}
+	free(fi_map);
+}
+
+// Return the least recently used object that isn't evicted, or UINT32_MAX if
+// there is none. Objects are stored in the order they were added, so the
+// oldest one wins a tie.
+static uint32_t
+least_recently_used_object(const struct manifest *mf, const bool *evicted)
+{
+	uint32_t lru = UINT32_MAX;
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		if (!evicted[i]
+		    && (lru == UINT32_MAX
+		        || mf->objects[i].last_used < mf->objects[lru].last_used)) {
+			lru = i;
+		}
+	}
+	return lru;
+}
+
+// Evict the least recently used objects (and the file infos and paths only
+// they refer to) until there is room for one more object within the
+// MAX_MANIFEST_ENTRIES and MAX_MANIFEST_FILE_INFO_ENTRIES limits.
+static void
+evict_objects(struct manifest *mf)
+{
+	uint32_t n_before = mf->n_objects;
+	bool *evicted = x_calloc(mf->n_objects + 1, sizeof(*evicted));
+
+	uint32_t n_kept = mf->n_objects;
+	while (n_kept >= MAX_MANIFEST_ENTRIES) {
+		evicted[least_recently_used_object(mf, evicted)] = true;
+		n_kept--;
+	}
+	remove_objects(mf, evicted);
+
+	// How many file infos an eviction frees depends on what the other objects
+	// share, so evict one object at a time.
+	while (mf->n_file_infos >= MAX_MANIFEST_FILE_INFO_ENTRIES
+	       && mf->n_objects > 0) {
+		memset(evicted, 0, mf->n_objects * sizeof(*evicted));
+		evicted[least_recently_used_object(mf, evicted)] = true;
+		remove_objects(mf, evicted);
+	}
+	free(evicted);
+
+	if (mf->n_objects < n_before) {
+		cc_log("Evicted %u of %u entries in manifest file",
+		       n_before - mf->n_objects, n_before);
+	}
+}
+
+// Record in a version 2 manifest file that object i was used, for the LRU
+// eviction in manifest_put. Since object entries have a fixed layout, the use
+// stamp is updated in place, but only if manifest_path still is the file that
+// was read since the offset is meaningless in a file written by a concurrent
+// manifest_put. A lost update only makes the eviction slightly less accurate.
+static void
+mark_object_used(const char *manifest_path, struct manifest *mf, uint32_t i)
+{
+	// Writing to a manifest with a torn tail would update its modification
+	// time, which tells how old the tail is.
+	if (mf->objects[i].stamp_offset == 0 || mf->truncated) {
+		return;
+	}
+	uint64_t stamp = next_use_stamp(mf);
+	if (mf->objects[i].last_used == stamp - 1) {
+		// Already the most recently used object.
+		return;
+	}
+
+	off_t offset = mf->objects[i].stamp_offset;
+
+	int fd = open(manifest_path, O_WRONLY | O_BINARY);
+	if (fd == -1) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0
+	    || st.st_dev != mf->map.dev
+	    || st.st_ino != mf->map.ino) {
+		cc_log("Manifest file was replaced; not updating it");
+	} else if (lseek(fd, offset, SEEK_SET) != offset
+	           || !write_fd(fd, &stamp, sizeof(stamp))) {
+		cc_log("Failed to update manifest file: %s", strerror(errno));
+	}
+	close(fd);
 }
 
 // Try to get the object hash from a manifest file. Caller frees. Returns NULL
@@ -562,133 +1292,200 @@ add_object_entry(struct manifest *mf,
 struct file_hash *
 manifest_get(struct conf *conf, const char *manifest_path)
 {
-	gzFile f = NULL;
-	struct manifest *mf = NULL;
-	struct hashtable *hashed_files = NULL; // path --> struct file_hash
-	struct hashtable *stated_files = NULL; // path --> struct file_stats
+	struct verification v = {NULL, NULL, NULL, 0};
+	struct object_order *order = NULL;
 	struct file_hash *fh = NULL;
 
-	int fd = open(manifest_path, O_RDONLY | O_BINARY);
-	if (fd == -1) {
-		// Cache miss.
-		cc_log("No such manifest file");
-		goto out;
-	}
-	f = gzdopen(fd, "rb");
-	if (!f) {
-		close(fd);
-		cc_log("Failed to gzdopen manifest file");
-		goto out;
-	}
-	mf = read_manifest(f);
+	struct manifest *mf = read_manifest(manifest_path);
 	if (!mf) {
-		cc_log("Error reading manifest file");
+		if (errno == ENOENT) {
+			// Cache miss.
+			cc_log("No such manifest file");
+		} else {
+			cc_log("Error reading manifest file");
+		}
 		goto out;
 	}
 
-	hashed_files = create_hashtable(1000, hash_from_string, strings_equal);
-	stated_files = create_hashtable(1000, hash_from_string, strings_equal);
+	v.hashed_files = create_hashtable(1000, hash_from_string, strings_equal);
+	v.stated_files = create_hashtable(1000, hash_from_string, strings_equal);
+	v.file_info_states = x_calloc(mf->n_file_infos + 1, 1);
 
-	// Check newest object first since it's a bit more likely to match.
-	for (uint32_t i = mf->n_objects; i > 0; i--) {
-		if (verify_object(conf, mf, &mf->objects[i - 1],
-		                  stated_files, hashed_files)) {
+	// Check the most recently used objects first since they are the most likely
+	// to match.
+	order = x_malloc((mf->n_objects + 1) * sizeof(*order));
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		order[i].last_used = mf->objects[i].last_used;
+		order[i].index = i;
+	}
+	qsort(order, mf->n_objects, sizeof(*order), compare_object_order);
+
+	for (uint32_t i = 0; i < mf->n_objects; i++) {
+		uint32_t index = order[i].index;
+		if (verify_object(conf, mf, &mf->objects[index], &v)) {
 			fh = x_malloc(sizeof(*fh));
-			*fh = mf->objects[i - 1].hash;
+			*fh = mf->objects[index].hash;
+			if (!conf->read_only && !conf->read_only_direct) {
+				mark_object_used(manifest_path, mf, index);
+			}
 			goto out;
 		}
 	}
 
 out:
-	if (hashed_files) {
-		hashtable_destroy(hashed_files, 1);
+	if (v.hashed_files) {
+		hashtable_destroy(v.hashed_files, 1);
 	}
-	if (stated_files) {
-		hashtable_destroy(stated_files, 1);
-	}
-	if (f) {
-		gzclose(f);
+	if (v.stated_files) {
+		hashtable_destroy(v.stated_files, 1);
 	}
+	free(v.file_info_states);
+	free(order);
 	if (mf) {
 		free_manifest(mf);
 	}
 	return fh;
 }
 
+// Append an entry for the object to the mapped manifest file of mf. The entry
+// is written with a single write call to a file opened in append mode, so
+// entries appended concurrently by other processes don't overwrite it.
+static bool
+append_object(const char *manifest_path, struct manifest *mf,
+              struct file_hash *object_hash, struct hashtable *included_files)
+{
+	uint32_t n_file_infos = hashtable_count(included_files);
+	size_t strings_size = 0;
+	struct hashtable_itr *iter = NULL;
+	if (n_file_infos > 0) {
+		iter = hashtable_iterator(included_files);
+		do {
+			strings_size += strlen(hashtable_iterator_key(iter)) + 1;
+		} while (hashtable_iterator_advance(iter));
+	}
+
+	struct appended_object_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = APPENDED_OBJECT_MAGIC;
+	size_t strings_offset =
+	  sizeof(header) + n_file_infos * sizeof(struct file_info);
+	size_t size = ALIGN8(strings_offset + strings_size);
+	if (size > UINT32_MAX) {
+		return false;
+	}
+	header.size = size;
+	header.n_file_infos = n_file_infos;
+	header.strings_size = strings_size;
+	header.object.n_file_info_indexes = n_file_infos;
+	header.object.hash = *object_hash;
+	header.object.last_used = next_use_stamp(mf);
+
+	char *data = x_calloc(1, size);
+	memcpy(data, &header, sizeof(header));
+	struct file_info *file_infos = (struct file_info *)(data + sizeof(header));
+	char *strings = data + strings_offset;
+	uint32_t i = 0;
+	size_t pos = 0;
+	if (n_file_infos > 0) {
+		iter = hashtable_iterator(included_files);
+		do {
+			const char *path = hashtable_iterator_key(iter);
+			make_file_info(&file_infos[i], path, hashtable_iterator_value(iter));
+			file_infos[i].index = pos;
+			strcpy(strings + pos, path);
+			pos += strlen(path) + 1;
+			i++;
+		} while (hashtable_iterator_advance(iter));
+	}
+
+	bool ret = false;
+	int fd = open(manifest_path, O_WRONLY | O_APPEND | O_BINARY);
+	if (fd != -1) {
+		ret = write_fd(fd, data, size);
+		close(fd);
+	}
+	free(data);
+	return ret;
+}
+
 // Put the object name into a manifest file given a set of included files.
-// Returns true on success, otherwise false.
-bool
+enum manifest_put_result
 manifest_put(const char *manifest_path, struct file_hash *object_hash,
              struct hashtable *included_files)
 {
-	int ret = 0;
-	gzFile f2 = NULL;
-	struct manifest *mf = NULL;
+	enum manifest_put_result ret = MANIFEST_PUT_FAILED;
+	int fd2 = -1;
 	char *tmp_file = NULL;
 
-	// We don't bother to acquire a lock when writing the manifest to disk. A
-	// race between two processes will only result in one lost entry, which is
+	// We don't bother to acquire a lock when writing the manifest to disk.
+	// Objects are normally appended to the file, which doesn't lose concurrently
+	// added objects. A race with a compaction can still lose an entry, which is
 	// not a big deal, and it's also very unlikely.
 
-	int fd1 = open(manifest_path, O_RDONLY | O_BINARY);
-	if (fd1 == -1) {
+	struct manifest *mf = read_manifest(manifest_path);
+	if (mf
+	    && mf->truncated
+	    && time(NULL) < mf->map.mtime + TORN_TAIL_GRACE_PERIOD) {
+		// Neither append after the partial entry, which would hide the new object
+		// if the partial entry is never completed, nor compact, which would lose
+		// the entry that another process may still be writing.
+		cc_log("Manifest file ends with a recently written partial entry;"
+		       " not updating it");
+		ret = MANIFEST_PUT_SKIPPED;
+		goto out;
+	}
+	if (mf
+	    && mf->map.data
+	    && !mf->truncated
+	    && mf->n_appended < MAX_APPENDED_OBJECTS
+	    && mf->n_objects < MAX_MANIFEST_ENTRIES
+	    && mf->n_file_infos + hashtable_count(included_files)
+	       < MAX_MANIFEST_FILE_INFO_ENTRIES) {
+		if (append_object(manifest_path, mf, object_hash, included_files)) {
+			ret = MANIFEST_PUT_ADDED;
+		} else {
+			cc_log("Failed to append to manifest file: %s", strerror(errno));
+		}
+		goto out;
+	}
+
+	if (mf) {
+		if (mf->n_appended > 0) {
+			cc_log("Compacting manifest file with %u appended entries",
+			       mf->n_appended);
+		}
+		detach_manifest(mf);
+		merge_duplicates(mf);
+	} else if (errno == ENOENT) {
 		// New file.
 		mf = create_empty_manifest();
 	} else {
-		gzFile f1 = gzdopen(fd1, "rb");
-		if (!f1) {
-			cc_log("Failed to gzdopen manifest file");
-			close(fd1);
-			goto out;
-		}
-		mf = read_manifest(f1);
-		gzclose(f1);
-		if (!mf) {
-			cc_log("Failed to read manifest file; deleting it");
-			x_unlink(manifest_path);
-			mf = create_empty_manifest();
-		}
-	}
-
-	if (mf->n_objects > MAX_MANIFEST_ENTRIES) {
-		// Normally, there shouldn't be many object entries in the manifest since
-		// new entries are added only if an include file has changed but not the
-		// source file, and you typically change source files more often than
-		// header files. However, it's certainly possible to imagine cases where
-		// the manifest will grow large (for instance, a generated header file that
-		// changes for every build), and this must be taken care of since
-		// processing an ever growing manifest eventually will take too much time.
-		// A good way of solving this would be to maintain the object entries in
-		// LRU order and discarding the old ones. An easy way is to throw away all
-		// entries when there are too many. Let's do that for now.
-		cc_log("More than %u entries in manifest file; discarding",
-		       MAX_MANIFEST_ENTRIES);
-		free_manifest(mf);
-		mf = create_empty_manifest();
-	} else if (mf->n_file_infos > MAX_MANIFEST_FILE_INFO_ENTRIES) {
-		// Rarely, file_info entries can grow large in pathological cases where
-		// many included files change, but the main file does not. This also puts
-		// an upper bound on the number of file_info entries.
-		cc_log("More than %u file_info entries in manifest file; discarding",
-		       MAX_MANIFEST_FILE_INFO_ENTRIES);
-		free_manifest(mf);
+		cc_log("Failed to read manifest file; deleting it");
+		x_unlink(manifest_path);
 		mf = create_empty_manifest();
 	}
 
+	// Normally, there shouldn't be many object entries in the manifest since
+	// new entries are added only if an include file has changed but not the
+	// source file, and you typically change source files more often than header
+	// files. However, it's certainly possible to imagine cases where the
+	// manifest will grow large (for instance, a generated header file that
+	// changes for every build), and this must be taken care of since processing
+	// an ever growing manifest eventually will take too much time. Similarly,
+	// file_info entries can grow large in pathological cases where many
+	// included files change, but the main file does not. Therefore, the least
+	// recently used entries are discarded when there are too many.
+	evict_objects(mf);
+
 	tmp_file = format("%s.tmp", manifest_path);
-	int fd2 = create_tmp_fd(&tmp_file);
-	f2 = gzdopen(fd2, "wb");
-	if (!f2) {
-		cc_log("Failed to gzdopen %s", tmp_file);
-		goto out;
-	}
+	fd2 = create_tmp_fd(&tmp_file);
 
 	add_object_entry(mf, object_hash, included_files);
-	if (write_manifest(f2, mf)) {
-		gzclose(f2);
-		f2 = NULL;
+	if (write_manifest(fd2, mf)) {
+		close(fd2);
+		fd2 = -1;
 		if (x_rename(tmp_file, manifest_path) == 0) {
-			ret = 1;
+			ret = MANIFEST_PUT_ADDED;
 		} else {
 			cc_log("Failed to rename %s to %s", tmp_file, manifest_path);
 			goto out;
@@ -702,36 +1499,28 @@ out:
 	if (mf) {
 		free_manifest(mf);
 	}
+	if (fd2 != -1) {
+		close(fd2);
+		tmp_unlink(tmp_file);
+	}
 	if (tmp_file) {
 		free(tmp_file);
 	}
-	if (f2) {
-		gzclose(f2);
-	}
 	return ret;
 }
 
 bool
 manifest_dump(const char *manifest_path, FILE *stream)
 {
-	struct manifest *mf = NULL;
-	gzFile f = NULL;
 	bool ret = false;
 
-	int fd = open(manifest_path, O_RDONLY | O_BINARY);
-	if (fd == -1) {
-		fprintf(stderr, "No such manifest file: %s\n", manifest_path);
-		goto out;
-	}
-	f = gzdopen(fd, "rb");
-	if (!f) {
-		fprintf(stderr, "Failed to dzopen manifest file\n");
-		close(fd);
-		goto out;
-	}
-	mf = read_manifest(f);
+	struct manifest *mf = read_manifest(manifest_path);
 	if (!mf) {
-		fprintf(stderr, "Error reading manifest file\n");
+		if (errno == ENOENT) {
+			fprintf(stderr, "No such manifest file: %s\n", manifest_path);
+		} else {
+			fprintf(stderr, "Error reading manifest file\n");
+		}
 		goto out;
 	}
 
@@ -759,6 +1548,7 @@ manifest_dump(const char *manifest_path, FILE *stream)
 		fprintf(stream, "    Mtime: %lld\n", (long long)mf->file_infos[i].mtime);
 		fprintf(stream, "    Ctime: %lld\n", (long long)mf->file_infos[i].ctime);
 	}
+	fprintf(stream, "Appended results: %u\n", (unsigned)mf->n_appended);
 	fprintf(stream, "Results (%u):\n", (unsigned)mf->n_objects);
 	for (unsigned i = 0; i < mf->n_objects; ++i) {
 		char *hash;
@@ -772,6 +1562,8 @@ manifest_dump(const char *manifest_path, FILE *stream)
 		fprintf(stream, "    Hash: %s\n", hash);
 		free(hash);
 		fprintf(stream, "    Size: %u\n", (unsigned)mf->objects[i].hash.size);
+		fprintf(stream, "    Last used: %llu\n",
+		        (unsigned long long)mf->objects[i].last_used);
 	}
 
 	ret = true;
@@ -780,8 +1572,5 @@ out:
 	if (mf) {
 		free_manifest(mf);
 	}
-	if (f) {
-		gzclose(f);
-	}
 	return ret;
 }
@@ -5,11 +5,24 @@
 #include "hashutil.h"
 #include "hashtable.h"
 
-#define MANIFEST_VERSION 1
+// Version of the manifest file format. Version 1 manifests are still read.
+#define MANIFEST_VERSION 2
+
+// Version included in the hash that names the manifest file. It is kept at 1
+// so that existing version 1 manifests are found and upgraded when updated.
+#define MANIFEST_NAME_VERSION 1
+
+enum manifest_put_result {
+	MANIFEST_PUT_FAILED,
+	MANIFEST_PUT_ADDED,
+	// The manifest was deliberately left alone.
+	MANIFEST_PUT_SKIPPED
+};
 
 struct file_hash *manifest_get(struct conf *conf, const char *manifest_path);
-bool manifest_put(const char *manifest_path, struct file_hash *object_hash,
-                  struct hashtable *included_files);
+enum manifest_put_result manifest_put(const char *manifest_path,
+                                      struct file_hash *object_hash,
+                                      struct hashtable *included_files);
 bool manifest_dump(const char *manifest_path, FILE *stream);
 
 #endif
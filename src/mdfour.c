@@ -16,6 +16,7 @@
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "ccache.h"
+#include "mdfour.h"
 
 // NOTE: This code makes no attempt to be fast!
 
@@ -161,14 +162,6 @@ void mdfour_tail(const unsigned char *in, size_t n)
 void
 mdfour_update(struct mdfour *md, const unsigned char *in, size_t n)
 {
-#ifdef CCACHE_DEBUG_HASH
-	if (n > 0 && getenv("CCACHE_DEBUG_HASH")) {
-		FILE *f = fopen("ccache-debug-hash.bin", "a");
-		fwrite(in, 1, n, f);
-		fclose(f);
-	}
-#endif
-
 	m = md;
 
 	if (!in) {
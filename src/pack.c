@@ -0,0 +1,767 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// A pack stores small cache files in a cache directory as records appended to
+// one file ("pack"), so that they don't use one inode and one directory entry
+// each. The file "pack.idx" next to it has a header followed by one fixed-size
+// entry per record, telling where the record is, a hash of its name and when
+// it was last used.
+//
+// Records and index entries are appended with one write(2) each to files opened
+// with O_APPEND, so adding to a pack needs no locking. A name may be stored
+// several times, in which case the last record wins. Lookups verify the record
+// header, so an index entry that doesn't match its record (e.g. after a
+// concurrent compaction) is just a miss. Both files are in native byte order.
+//
+// Compaction writes the index sorted by name hash, and the header tells how
+// many entries are sorted. A lookup scans the entries appended after them
+// backwards and then does a binary search among the sorted ones. A store that
+// makes more than PACK_MAX_UNSORTED entries unsorted compacts the pack, so the
+// cost of a lookup grows only logarithmically with the size of the pack.
+//
+// A name is removed by appending a tombstone, i.e. a copy of its last index
+// entry with the atime TOMBSTONE_ATIME. Records that are replaced or removed
+// are dropped when the pack is compacted, which is done by cleanup under a
+// lock.
+
+#include "ccache.h"
+#include "hashtable.h"
+#include "hashutil.h"
+#include "murmurhashneutral2.h"
+#include "pack.h"
+
+#define PACK_INDEX_MAGIC "cCpI"
+#define PACK_INDEX_VERSION 2
+#define PACK_RECORD_MAGIC "cCpR"
+#define PACK_MAX_UNSORTED 256
+#define TOMBSTONE_ATIME 0
+
+struct pack_index_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t reserved[3];
+	// Number of entries, sorted by name hash, before the appended ones.
+	uint64_t n_sorted;
+};
+
+struct pack_index_entry {
+	uint32_t name_hash;
+	uint32_t atime;
+	// Offset of the record in the pack.
+	uint64_t offset;
+	// Size of the data of the record.
+	uint64_t size;
+};
+
+struct pack_record_header {
+	char magic[4];
+	uint32_t name_len;
+	uint64_t size;
+};
+
+// A live index entry, i.e. the last one for a name.
+struct live_entry {
+	char *name;
+	struct pack_index_entry entry;
+};
+
+extern unsigned lock_staleness_limit;
+
+static uint32_t
+hash_name(const char *name)
+{
+	return murmurhashneutral2(name, strlen(name), 0);
+}
+
+// Size of a record with the given name length and data size.
+static uint64_t
+record_size(size_t name_len, uint64_t size)
+{
+	return sizeof(struct pack_record_header) + name_len + size;
+}
+
+static bool
+read_at(int fd, uint64_t offset, void *buf, size_t size)
+{
+	if (lseek(fd, offset, SEEK_SET) != (off_t)offset) {
+		return false;
+	}
+	char *p = buf;
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Position of entry i in an index.
+static off_t
+entry_offset(uint64_t i)
+{
+	return sizeof(struct pack_index_header)
+	       + i * sizeof(struct pack_index_entry);
+}
+
+// Read the header of an index and get its number of sorted entries and of all
+// entries. A trailing partial entry (from a concurrent append) is ignored.
+// Returns false if the index is broken.
+static bool
+read_index_header(int fd, uint64_t *n_sorted, uint64_t *n_entries)
+{
+	struct stat st;
+	struct pack_index_header header;
+	if (fstat(fd, &st) != 0
+	    || !read_at(fd, 0, &header, sizeof(header))
+	    || memcmp(header.magic, PACK_INDEX_MAGIC, sizeof(header.magic)) != 0
+	    || header.version != PACK_INDEX_VERSION) {
+		return false;
+	}
+	*n_entries =
+	  (st.st_size - sizeof(header)) / sizeof(struct pack_index_entry);
+	*n_sorted = header.n_sorted;
+	return *n_sorted <= *n_entries;
+}
+
+// Read n index entries, starting with entry first. Returns NULL on error.
+static struct pack_index_entry *
+read_entries(int fd, uint64_t first, uint64_t n)
+{
+	struct pack_index_entry *entries = x_malloc((n + 1) * sizeof(*entries));
+	if (n > 0
+	    && !read_at(fd, entry_offset(first), entries, n * sizeof(*entries))) {
+		free(entries);
+		return NULL;
+	}
+	return entries;
+}
+
+// Read the name of the record that entry points to and check that the record
+// fits in a pack of pack_size bytes. Returns NULL if the record doesn't match
+// the entry.
+static char *
+read_record_name(int pack_fd, uint64_t pack_size,
+                 const struct pack_index_entry *entry)
+{
+	struct pack_record_header header;
+	if (entry->offset + sizeof(header) > pack_size
+	    || !read_at(pack_fd, entry->offset, &header, sizeof(header))
+	    || memcmp(header.magic, PACK_RECORD_MAGIC, sizeof(header.magic)) != 0
+	    || header.size != entry->size
+	    || header.name_len > PATH_MAX
+	    || entry->offset + record_size(header.name_len, header.size)
+	       > pack_size) {
+		return NULL;
+	}
+	char *name = x_malloc(header.name_len + 1);
+	if (!read_at(pack_fd, entry->offset + sizeof(header), name,
+	             header.name_len)) {
+		free(name);
+		return NULL;
+	}
+	name[header.name_len] = '\0';
+	if (hash_name(name) != entry->name_hash) {
+		free(name);
+		return NULL;
+	}
+	return name;
+}
+
+// Return whether entry is for a record called name.
+static bool
+entry_matches(int pack_fd, uint64_t pack_size,
+              const struct pack_index_entry *entry, const char *name)
+{
+	char *record_name = read_record_name(pack_fd, pack_size, entry);
+	bool matches = record_name && str_eq(record_name, name);
+	free(record_name);
+	return matches;
+}
+
+// Find the last index entry for name. Returns the position of the entry in the
+// index, or -1 if not found or removed.
+static ssize_t
+find_entry(int index_fd, int pack_fd, const char *name,
+           struct pack_index_entry *result)
+{
+	struct stat st;
+	uint64_t n_sorted, n_entries;
+	struct pack_index_entry *appended;
+	if (fstat(pack_fd, &st) != 0
+	    || !read_index_header(index_fd, &n_sorted, &n_entries)
+	    || !(appended =
+	           read_entries(index_fd, n_sorted, n_entries - n_sorted))) {
+		return -1;
+	}
+	uint32_t name_hash = hash_name(name);
+	ssize_t found = -1;
+	for (uint64_t i = n_entries - n_sorted; found == -1 && i > 0; i--) {
+		if (appended[i - 1].name_hash == name_hash
+		    && entry_matches(pack_fd, st.st_size, &appended[i - 1], name)) {
+			*result = appended[i - 1];
+			found = n_sorted + i - 1;
+		}
+	}
+	free(appended);
+
+	if (found == -1) {
+		// Find the first sorted entry with the hash.
+		uint64_t low = 0;
+		uint64_t high = n_sorted;
+		struct pack_index_entry entry;
+		while (low < high) {
+			uint64_t middle = low + (high - low) / 2;
+			if (!read_at(index_fd, entry_offset(middle), &entry, sizeof(entry))) {
+				return -1;
+			}
+			if (entry.name_hash < name_hash) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		for (uint64_t i = low; found == -1 && i < n_sorted; i++) {
+			if (!read_at(index_fd, entry_offset(i), &entry, sizeof(entry))
+			    || entry.name_hash != name_hash) {
+				break;
+			}
+			if (entry_matches(pack_fd, st.st_size, &entry, name)) {
+				*result = entry;
+				found = i;
+			}
+		}
+	}
+
+	if (found != -1 && result->atime == TOMBSTONE_ATIME) {
+		return -1;
+	}
+	return found;
+}
+
+// Open the index index_path for appending, creating it if needed.
+static int
+open_index_for_append(const char *index_path)
+{
+	int fd = open(index_path, O_WRONLY | O_APPEND | O_BINARY);
+	if (fd != -1 || errno != ENOENT) {
+		return fd;
+	}
+
+	// Create the index with its header under a temporary name and link it into
+	// place so that nobody sees an index without a header.
+	char *tmp_path = format("%s.tmp", index_path);
+	fd = create_tmp_fd(&tmp_path);
+	struct pack_index_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PACK_INDEX_MAGIC, sizeof(header.magic));
+	header.version = PACK_INDEX_VERSION;
+	bool ok = write_fd(fd, &header, sizeof(header));
+	ok = close(fd) == 0 && ok;
+	if (ok && link(tmp_path, index_path) != 0 && errno != EEXIST) {
+		ok = false;
+	}
+	tmp_unlink(tmp_path);
+	free(tmp_path);
+	if (!ok) {
+		return -1;
+	}
+	return open(index_path, O_WRONLY | O_APPEND | O_BINARY);
+}
+
+// Store the content of the file src in the pack in the directory of path,
+// under the name of path. The size and file count deltas for the cache
+// statistics are added to size_delta and files_delta.
+bool
+pack_put(const char *path, const char *src, int64_t *size_delta,
+         int *files_delta)
+{
+	char *dir = dirname(path);
+	char *name = basename(path);
+	char *pack_path = format("%s/%s", dir, PACK_DATA_NAME);
+	char *index_path = format("%s/%s", dir, PACK_INDEX_NAME);
+	char *data = NULL;
+	char *record = NULL;
+	int pack_fd = -1;
+	int index_fd = -1;
+	bool compact = false;
+	bool ret = false;
+
+	size_t size;
+	if (!read_file(src, 0, &data, &size)) {
+		goto out;
+	}
+	size_t name_len = strlen(name);
+	struct pack_record_header header;
+	memcpy(header.magic, PACK_RECORD_MAGIC, sizeof(header.magic));
+	header.name_len = name_len;
+	header.size = size;
+	size_t len = record_size(name_len, size);
+	record = x_malloc(len);
+	memcpy(record, &header, sizeof(header));
+	memcpy(record + sizeof(header), name, name_len);
+	memcpy(record + sizeof(header) + name_len, data, size);
+
+	pack_fd = open(pack_path, O_RDWR | O_APPEND | O_CREAT | O_BINARY, 0666);
+	index_fd = open_index_for_append(index_path);
+	if (pack_fd == -1 || index_fd == -1) {
+		cc_log("Failed to open pack in %s: %s", dir, strerror(errno));
+		goto out;
+	}
+
+	// The record is written with one write so that concurrent appends don't
+	// interleave.
+	if (write(pack_fd, record, len) != (ssize_t)len) {
+		cc_log("Failed to write to %s: %s", pack_path, strerror(errno));
+		goto out;
+	}
+	struct pack_index_entry entry;
+	entry.name_hash = hash_name(name);
+	entry.atime = time(NULL);
+	entry.offset = lseek(pack_fd, 0, SEEK_CUR) - len;
+	entry.size = size;
+
+	int lookup_fd = open(index_path, O_RDONLY | O_BINARY);
+	if (lookup_fd != -1) {
+		struct pack_index_entry old;
+		if (find_entry(lookup_fd, pack_fd, name, &old) != -1) {
+			*size_delta -= record_size(name_len, old.size) + sizeof(old);
+			*files_delta -= 1;
+		}
+		uint64_t n_sorted, n_entries;
+		compact = read_index_header(lookup_fd, &n_sorted, &n_entries)
+		          && n_entries - n_sorted >= PACK_MAX_UNSORTED;
+		close(lookup_fd);
+	}
+	if (write(index_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		cc_log("Failed to write to %s: %s", index_path, strerror(errno));
+		goto out;
+	}
+	*size_delta += len + sizeof(entry);
+	*files_delta += 1;
+	ret = true;
+
+out:
+	if (pack_fd != -1) {
+		close(pack_fd);
+	}
+	if (index_fd != -1) {
+		close(index_fd);
+	}
+	if (compact) {
+		pack_compact(dir, NULL, 0);
+	}
+	free(record);
+	free(data);
+	free(index_path);
+	free(pack_path);
+	free(name);
+	free(dir);
+	return ret;
+}
+
+// Look up the file path in the pack in its directory. Returns a file
+// descriptor for the pack, with the data at record->offset and record->size
+// bytes long, or -1 if not found. If found, the record must be released with
+// pack_release.
+int
+pack_get(const char *path, struct pack_record *record)
+{
+	char *dir = dirname(path);
+	char *name = basename(path);
+	char *pack_path = format("%s/%s", dir, PACK_DATA_NAME);
+	char *index_path = format("%s/%s", dir, PACK_INDEX_NAME);
+	int ret = -1;
+
+	int index_fd = open(index_path, O_RDWR | O_BINARY);
+	int pack_fd = index_fd == -1 ? -1 : open(pack_path, O_RDONLY | O_BINARY);
+	struct pack_index_entry entry;
+	ssize_t pos;
+	if (pack_fd == -1
+	    || (pos = find_entry(index_fd, pack_fd, name, &entry)) == -1) {
+		goto out;
+	}
+
+	record->offset = entry.offset + record_size(strlen(name), 0);
+	record->size = entry.size;
+	record->index_fd = index_fd;
+	record->entry_pos = entry_offset(pos);
+	index_fd = -1;
+	ret = pack_fd;
+	pack_fd = -1;
+
+out:
+	if (pack_fd != -1) {
+		close(pack_fd);
+	}
+	if (index_fd != -1) {
+		close(index_fd);
+	}
+	free(index_path);
+	free(pack_path);
+	free(name);
+	free(dir);
+	return ret;
+}
+
+// Release a record found by pack_get. If used is true, the record is marked as
+// used so that cleanup keeps it longer. The time is written through the index
+// that the record was found in, so a concurrent compaction can't make it land
+// on another entry.
+void
+pack_release(struct pack_record *record, bool used)
+{
+	if (used) {
+		uint32_t atime = time(NULL);
+		off_t offset =
+		  record->entry_pos + offsetof(struct pack_index_entry, atime);
+		// Failing to update the time only makes the entry older for cleanup.
+		if (lseek(record->index_fd, offset, SEEK_SET) != offset
+		    || write(record->index_fd, &atime, sizeof(atime)) == -1) {
+			cc_log("Failed to update pack index: %s", strerror(errno));
+		}
+	}
+	close(record->index_fd);
+	record->index_fd = -1;
+}
+
+// Remove the file path from the pack in its directory by appending a tombstone
+// for it. Returns false if it isn't in the pack.
+bool
+pack_remove(const char *path)
+{
+	char *dir = dirname(path);
+	char *name = basename(path);
+	char *pack_path = format("%s/%s", dir, PACK_DATA_NAME);
+	char *index_path = format("%s/%s", dir, PACK_INDEX_NAME);
+	bool ret = false;
+
+	int index_fd = open(index_path, O_RDONLY | O_BINARY);
+	int pack_fd = index_fd == -1 ? -1 : open(pack_path, O_RDONLY | O_BINARY);
+	struct pack_index_entry entry;
+	if (pack_fd == -1 || find_entry(index_fd, pack_fd, name, &entry) == -1) {
+		goto out;
+	}
+
+	int append_fd = open(index_path, O_WRONLY | O_APPEND | O_BINARY);
+	entry.atime = TOMBSTONE_ATIME;
+	if (append_fd != -1
+	    && write(append_fd, &entry, sizeof(entry)) == sizeof(entry)) {
+		cc_log("Removed %s from pack in %s", name, dir);
+		ret = true;
+	} else {
+		cc_log("Failed to write to %s: %s", index_path, strerror(errno));
+	}
+	if (append_fd != -1) {
+		close(append_fd);
+	}
+
+out:
+	if (pack_fd != -1) {
+		close(pack_fd);
+	}
+	if (index_fd != -1) {
+		close(index_fd);
+	}
+	free(index_path);
+	free(pack_path);
+	free(name);
+	free(dir);
+	return ret;
+}
+
+// Get the live entries of the index in index_fd, i.e. the last entry for each
+// name unless it's a tombstone, in index order. The number of sorted entries
+// and of all entries that were read are put in n_sorted and n_entries. Returns
+// false if the index is broken.
+static bool
+read_live_entries(int index_fd, int pack_fd, struct live_entry **result,
+                  size_t *n_result, uint64_t *n_sorted, uint64_t *n_entries)
+{
+	struct stat st;
+	struct pack_index_entry *entries;
+	if (fstat(pack_fd, &st) != 0
+	    || !read_index_header(index_fd, n_sorted, n_entries)
+	    || !(entries = read_entries(index_fd, 0, *n_entries))) {
+		return false;
+	}
+
+	// Map from name to the position of its last entry.
+	struct hashtable *last =
+	  create_hashtable(1000, hash_from_string, strings_equal);
+	char **names = x_malloc((*n_entries + 1) * sizeof(*names));
+	for (size_t i = 0; i < *n_entries; i++) {
+		names[i] = read_record_name(pack_fd, st.st_size, &entries[i]);
+		if (!names[i]) {
+			continue;
+		}
+		size_t *pos = hashtable_search(last, names[i]);
+		if (!pos) {
+			pos = x_malloc(sizeof(*pos));
+			hashtable_insert(last, x_strdup(names[i]), pos);
+		}
+		*pos = i;
+	}
+
+	*result = x_malloc((*n_entries + 1) * sizeof(**result));
+	*n_result = 0;
+	for (size_t i = 0; i < *n_entries; i++) {
+		if (names[i]
+		    && *(size_t *)hashtable_search(last, names[i]) == i
+		    && entries[i].atime != TOMBSTONE_ATIME) {
+			(*result)[*n_result].name = names[i];
+			(*result)[*n_result].entry = entries[i];
+			(*n_result)++;
+		} else {
+			free(names[i]);
+		}
+	}
+	hashtable_destroy(last, 1);
+	free(names);
+	free(entries);
+	return true;
+}
+
+// Get the live entries of the pack in dir. Returns false if there is no pack
+// or if it's broken.
+bool
+pack_list(const char *dir, struct pack_entry **entries, size_t *n)
+{
+	char *pack_path = format("%s/%s", dir, PACK_DATA_NAME);
+	char *index_path = format("%s/%s", dir, PACK_INDEX_NAME);
+	bool ret = false;
+
+	int index_fd = open(index_path, O_RDONLY | O_BINARY);
+	int pack_fd = index_fd == -1 ? -1 : open(pack_path, O_RDONLY | O_BINARY);
+	struct live_entry *live;
+	size_t n_live;
+	uint64_t n_sorted, n_entries;
+	if (pack_fd != -1
+	    && read_live_entries(
+	         index_fd, pack_fd, &live, &n_live, &n_sorted, &n_entries)) {
+		*entries = x_malloc((n_live + 1) * sizeof(**entries));
+		for (size_t i = 0; i < n_live; i++) {
+			(*entries)[i].name = live[i].name;
+			(*entries)[i].size =
+			  record_size(strlen(live[i].name), live[i].entry.size)
+			  + sizeof(struct pack_index_entry);
+			(*entries)[i].atime = live[i].entry.atime;
+		}
+		*n = n_live;
+		free(live);
+		ret = true;
+	}
+
+	if (pack_fd != -1) {
+		close(pack_fd);
+	}
+	if (index_fd != -1) {
+		close(index_fd);
+	}
+	free(index_path);
+	free(pack_path);
+	return ret;
+}
+
+void
+pack_entries_free(struct pack_entry *entries, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		free(entries[i].name);
+	}
+	free(entries);
+}
+
+static int
+compare_live_entries(const void *a, const void *b)
+{
+	uint32_t hash_a = ((const struct live_entry *)a)->entry.name_hash;
+	uint32_t hash_b = ((const struct live_entry *)b)->entry.name_hash;
+	return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+// Sort entries by name hash and write them as a new index to fd.
+static bool
+write_sorted_index(int fd, struct live_entry *entries, size_t n)
+{
+	qsort(entries, n, sizeof(*entries), compare_live_entries);
+	struct pack_index_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PACK_INDEX_MAGIC, sizeof(header.magic));
+	header.version = PACK_INDEX_VERSION;
+	header.n_sorted = n;
+	bool ok = write_fd(fd, &header, sizeof(header));
+	for (size_t i = 0; ok && i < n; i++) {
+		ok = write_fd(fd, &entries[i].entry, sizeof(entries[i].entry));
+	}
+	return ok;
+}
+
+// Write the records of entries from pack_fd to a new pack and index, update
+// the offsets in entries and move the new files into place.
+static bool
+rewrite_pack(const char *pack_path, const char *index_path, int pack_fd,
+             struct live_entry *entries, size_t n)
+{
+	char *tmp_pack_path = format("%s.tmp", pack_path);
+	char *tmp_index_path = format("%s.tmp", index_path);
+	int tmp_pack_fd = create_tmp_fd(&tmp_pack_path);
+	int tmp_index_fd = create_tmp_fd(&tmp_index_path);
+
+	bool ok = true;
+	uint64_t offset = 0;
+	for (size_t i = 0; ok && i < n; i++) {
+		uint64_t len = record_size(strlen(entries[i].name), entries[i].entry.size);
+		ok = copy_fd_range(pack_fd, entries[i].entry.offset, tmp_pack_fd, len);
+		entries[i].entry.offset = offset;
+		offset += len;
+	}
+	ok = ok && write_sorted_index(tmp_index_fd, entries, n);
+	ok = close(tmp_pack_fd) == 0 && ok;
+	ok = close(tmp_index_fd) == 0 && ok;
+
+	// A lookup between the renames sees records that don't match the index and
+	// misses.
+	if (ok) {
+		ok = x_rename(tmp_pack_path, pack_path) == 0
+		     && x_rename(tmp_index_path, index_path) == 0;
+	}
+	if (!ok) {
+		tmp_unlink(tmp_pack_path);
+		tmp_unlink(tmp_index_path);
+	}
+	free(tmp_index_path);
+	free(tmp_pack_path);
+	return ok;
+}
+
+// Write entries, which point into the current pack, as a new sorted index and
+// move it into place. Entries appended to index_fd after the first n_entries
+// were read are kept after the sorted ones.
+static bool
+rewrite_index(const char *index_path, int index_fd, uint64_t n_entries,
+              struct live_entry *entries, size_t n)
+{
+	char *tmp_index_path = format("%s.tmp", index_path);
+	int tmp_index_fd = create_tmp_fd(&tmp_index_path);
+
+	bool ok = write_sorted_index(tmp_index_fd, entries, n);
+	uint64_t n_sorted, n_now;
+	if (ok && read_index_header(index_fd, &n_sorted, &n_now)
+	    && n_now > n_entries) {
+		ok = copy_fd_range(index_fd, entry_offset(n_entries), tmp_index_fd,
+		                   (n_now - n_entries) * sizeof(struct pack_index_entry));
+	}
+	ok = close(tmp_index_fd) == 0 && ok;
+
+	// An entry appended after the copy is lost, which just makes its record
+	// garbage.
+	if (ok) {
+		ok = x_rename(tmp_index_path, index_path) == 0;
+	}
+	if (!ok) {
+		tmp_unlink(tmp_index_path);
+	}
+	free(tmp_index_path);
+	return ok;
+}
+
+// Remove the given names from the pack in dir and drop replaced records. The
+// pack is only rewritten if something is removed or if at least a quarter of
+// it is garbage. Otherwise, the index is sorted again if at least
+// PACK_MAX_UNSORTED of its entries are unsorted.
+bool
+pack_compact(const char *dir, char **removed, size_t n_removed)
+{
+	char *pack_path = format("%s/%s", dir, PACK_DATA_NAME);
+	char *index_path = format("%s/%s", dir, PACK_INDEX_NAME);
+	struct live_entry *entries = NULL;
+	size_t n_entries = 0;
+	int index_fd = -1;
+	int pack_fd = -1;
+	bool ret = false;
+
+	if (!lockfile_acquire(pack_path, lock_staleness_limit)) {
+		goto out;
+	}
+	struct stat st;
+	index_fd = open(index_path, O_RDONLY | O_BINARY);
+	pack_fd = index_fd == -1 ? -1 : open(pack_path, O_RDONLY | O_BINARY);
+	uint64_t n_sorted, n_indexed;
+	if (pack_fd == -1
+	    || fstat(pack_fd, &st) != 0
+	    || !read_live_entries(
+	         index_fd, pack_fd, &entries, &n_entries, &n_sorted, &n_indexed)) {
+		goto unlock;
+	}
+
+	struct hashtable *removed_names =
+	  create_hashtable(n_removed + 1, hash_from_string, strings_equal);
+	for (size_t i = 0; i < n_removed; i++) {
+		hashtable_insert(removed_names, x_strdup(removed[i]), x_strdup(""));
+	}
+	size_t n_kept = 0;
+	uint64_t kept_size = 0;
+	for (size_t i = 0; i < n_entries; i++) {
+		if (hashtable_search(removed_names, entries[i].name)) {
+			free(entries[i].name);
+			continue;
+		}
+		kept_size +=
+		  record_size(strlen(entries[i].name), entries[i].entry.size);
+		entries[n_kept++] = entries[i];
+	}
+	hashtable_destroy(removed_names, 1);
+	bool removed_any = n_kept < n_entries;
+	n_entries = n_kept;
+
+	if (n_entries == 0) {
+		cc_log("Removing empty pack in %s", dir);
+		x_unlink(index_path);
+		x_unlink(pack_path);
+		ret = true;
+	} else if (removed_any || kept_size < (uint64_t)st.st_size * 3 / 4) {
+		cc_log("Compacting pack in %s", dir);
+		ret = rewrite_pack(pack_path, index_path, pack_fd, entries, n_entries);
+	} else if (n_indexed - n_sorted >= PACK_MAX_UNSORTED) {
+		cc_log("Sorting pack index in %s", dir);
+		ret = rewrite_index(index_path, index_fd, n_indexed, entries, n_entries);
+	} else {
+		ret = true;
+	}
+
+unlock:
+	lockfile_release(pack_path);
+out:
+	for (size_t i = 0; i < n_entries; i++) {
+		free(entries[i].name);
+	}
+	free(entries);
+	if (pack_fd != -1) {
+		close(pack_fd);
+	}
+	if (index_fd != -1) {
+		close(index_fd);
+	}
+	free(index_path);
+	free(pack_path);
+	return ret;
+}
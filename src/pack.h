@@ -0,0 +1,54 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef PACK_H
+#define PACK_H
+
+#include "system.h"
+
+// Names of the pack files in a cache directory.
+#define PACK_DATA_NAME "pack"
+#define PACK_INDEX_NAME "pack.idx"
+
+// A live entry in a pack, as seen by cleanup.
+struct pack_entry {
+	char *name;
+	// Space used by the entry in the pack and the index.
+	uint64_t size;
+	// Time of the last store or lookup.
+	time_t atime;
+};
+
+// A record found by pack_get.
+struct pack_record {
+	// Offset and size of the data in the pack.
+	uint64_t offset;
+	uint64_t size;
+	// The index that the record was found in and the position of its entry.
+	int index_fd;
+	off_t entry_pos;
+};
+
+bool pack_put(const char *path, const char *src, int64_t *size_delta,
+              int *files_delta);
+int pack_get(const char *path, struct pack_record *record);
+void pack_release(struct pack_record *record, bool used);
+bool pack_remove(const char *path);
+bool pack_list(const char *dir, struct pack_entry **entries, size_t *n);
+void pack_entries_free(struct pack_entry *entries, size_t n);
+bool pack_compact(const char *dir, char **removed, size_t n_removed);
+
+#endif
@@ -0,0 +1,778 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ccache.h"
+#include "compression.h"
+#include "pack.h"
+#include "result.h"
+
+// Sketchy specification of the result file format:
+//
+// A result file holds all files that a compilation produced (the object file,
+// the standard error output and optional outputs like the dependency file), so
+// that a cache hit only has to open and touch one file and so that a result is
+// added and removed as a whole. Everything after the header is compressed with
+// the compression type in the header, so the file can always be read
+// regardless of which compression type is configured. Integers are stored in
+// big-endian byte order.
+//
+// <magic>         magic number                        (4 bytes)
+// <version>       file format version                 (1 byte unsigned int)
+// <compr_type>    COMPR_TYPE_*, see compression.h     (1 byte unsigned int)
+// <compr_level>   compression level                   (1 byte unsigned int)
+// <wall_time>     compiler wall clock time in ms      (4 bytes unsigned int)
+// <cpu_time>      compiler CPU time in ms             (4 bytes unsigned int)
+// ----------------------------------------------------------------------------
+// <n_entries>     number of entries                   (1 byte unsigned int)
+// ----------------------------------------------------------------------------
+// <suffix_len>    length of the suffix                (1 byte unsigned int)
+// <suffix>        suffix, e.g. ".o" or ".stderr"      (suffix_len bytes)
+// <type>          RESULT_ENTRY_*                      (1 byte unsigned int)
+// <size>          size of the file                    (8 bytes unsigned int)
+// ...
+// ----------------------------------------------------------------------------
+// <data>          content of the embedded files, in   (sum of the sizes of
+//                 entry order                          the embedded files)
+//
+// The file of a raw entry isn't embedded but stored uncompressed next to the
+// result file, with the suffix of the entry instead of ".result", so that it
+// can be hard linked.
+//
+// If the compression type is COMPR_TYPE_NONE, embedded files are copied to and
+// from the result file with copy_fd_range(), so that the kernel can do the
+// copying.
+//
+// The compiler times are kept in the uncompressed header so that they can be
+// read cheaply. They are added to the time saved statistics on a cache hit.
+//
+// Result files that are at most pack_threshold bytes and have no raw entries
+// are stored in the pack of their directory instead of as files, see pack.c.
+
+static const uint32_t MAGIC = 0x63437253U;
+
+#define HEADER_SIZE 15
+
+#define RESULT_ENTRY_EMBEDDED 0
+#define RESULT_ENTRY_RAW 1
+
+#define MAX_RESULT_ENTRIES 255
+
+struct result_file {
+	char *path;
+	char *suffix;
+};
+
+struct result_files {
+	uint32_t n_files;
+	struct result_file *files;
+};
+
+struct result_entry {
+	char suffix[256];
+	uint8_t type;
+	uint64_t size;
+};
+
+struct result_reader {
+	const struct decompressor *decompressor;
+	struct decompr_state *state;
+};
+
+struct result_writer {
+	int fd;
+	const struct compressor *compressor;
+	struct compr_state *state;
+};
+
+struct result_files *
+result_files_init(void)
+{
+	struct result_files *list = x_malloc(sizeof(*list));
+	list->n_files = 0;
+	list->files = NULL;
+	return list;
+}
+
+// Add a file to a result file list. For result_put, path is the file to store;
+// for result_get, it's where the file is to be written.
+void
+result_files_add(struct result_files *list, const char *path,
+                 const char *suffix)
+{
+	assert(list->n_files < MAX_RESULT_ENTRIES);
+	assert(strlen(suffix) < sizeof(((struct result_entry *)0)->suffix));
+	list->files = x_realloc(
+	  list->files, (list->n_files + 1) * sizeof(*list->files));
+	list->files[list->n_files].path = x_strdup(path);
+	list->files[list->n_files].suffix = x_strdup(suffix);
+	list->n_files++;
+}
+
+void
+result_files_free(struct result_files *list)
+{
+	for (uint32_t i = 0; i < list->n_files; i++) {
+		free(list->files[i].path);
+		free(list->files[i].suffix);
+	}
+	free(list->files);
+	free(list);
+}
+
+// Return the path of the raw file with the given suffix for a result file.
+static char *
+get_raw_path(const char *result_path, const char *suffix)
+{
+	char *base = remove_extension(result_path);
+	char *path = format("%s%s", base, suffix);
+	free(base);
+	return path;
+}
+
+// Open the result file path, or its record in the pack if there is no such
+// file. The result is at offset in the returned file descriptor and size bytes
+// long. Returns -1 if not found. If the result is in a pack, the record is put
+// in packed, which must then be released with pack_release, otherwise
+// packed->index_fd is set to -1.
+static int
+open_result(const char *path, uint64_t *offset, uint64_t *size,
+            struct pack_record *packed)
+{
+	packed->index_fd = -1;
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			return -1;
+		}
+		fd = pack_get(path, packed);
+		*offset = packed->offset;
+		*size = packed->size;
+		return fd;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	*offset = 0;
+	*size = st.st_size;
+	return fd;
+}
+
+// Read and check the uncompressed header of a result of size bytes at offset
+// in fd and start a reader for the rest of it.
+static bool
+open_reader(int fd, uint64_t offset, uint64_t size, struct result_reader *r,
+            uint8_t *compr_type, uint8_t *compr_level, struct result_cost *cost)
+{
+	if (size < HEADER_SIZE
+	    || lseek(fd, offset, SEEK_SET) != (off_t)offset) {
+		cc_log("Result file is truncated");
+		return false;
+	}
+	uint8_t header[HEADER_SIZE];
+	size_t pos = 0;
+	while (pos < sizeof(header)) {
+		ssize_t n = read(fd, header + pos, sizeof(header) - pos);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			cc_log("Result file is truncated");
+			return false;
+		}
+		pos += n;
+	}
+
+	uint32_t magic = ((uint32_t)header[0] << 24) | (header[1] << 16)
+	                 | (header[2] << 8) | header[3];
+	if (magic != MAGIC) {
+		cc_log("Result file has bad magic number %u", (unsigned)magic);
+		return false;
+	}
+	if (header[4] != RESULT_VERSION) {
+		cc_log("Result file has unknown version %u", header[4]);
+		return false;
+	}
+	*compr_type = header[5];
+	*compr_level = header[6];
+	cost->wall_time = ((uint32_t)header[7] << 24) | (header[8] << 16)
+	                  | (header[9] << 8) | header[10];
+	cost->cpu_time = ((uint32_t)header[11] << 24) | (header[12] << 16)
+	                 | (header[13] << 8) | header[14];
+	r->decompressor = decompressor_from_type(*compr_type);
+	if (!r->decompressor) {
+		cc_log("Result file has unsupported compression type %u (%s)",
+		       *compr_type, compression_type_to_string(*compr_type));
+		return false;
+	}
+	r->state = r->decompressor->init(fd, size - HEADER_SIZE);
+	return r->state != NULL;
+}
+
+static bool
+read_bytes(struct result_reader *r, void *buf, size_t size)
+{
+	return r->decompressor->read(r->state, buf, size);
+}
+
+static bool
+read_int(struct result_reader *r, size_t size, uint64_t *value)
+{
+	uint8_t buf[8];
+	if (!read_bytes(r, buf, size)) {
+		return false;
+	}
+	*value = 0;
+	for (size_t i = 0; i < size; i++) {
+		*value = (*value << 8) | buf[i];
+	}
+	return true;
+}
+
+// Read the entry index of a result file. Returns the number of entries, or -1
+// on error.
+static int
+read_index(struct result_reader *r, struct result_entry *entries)
+{
+	uint64_t n_entries;
+	if (!read_int(r, 1, &n_entries)) {
+		return -1;
+	}
+	for (uint64_t i = 0; i < n_entries; i++) {
+		uint64_t suffix_len, type;
+		if (!read_int(r, 1, &suffix_len)
+		    || !read_bytes(r, entries[i].suffix, suffix_len)
+		    || !read_int(r, 1, &type)
+		    || !read_int(r, 8, &entries[i].size)) {
+			return -1;
+		}
+		if (type != RESULT_ENTRY_EMBEDDED && type != RESULT_ENTRY_RAW) {
+			cc_log("Result file has unknown entry type %u", (unsigned)type);
+			return -1;
+		}
+		entries[i].suffix[suffix_len] = '\0';
+		entries[i].type = type;
+	}
+	return n_entries;
+}
+
+// Copy size bytes from r to fd, or skip them if fd is -1.
+static bool
+copy_data(struct result_reader *r, int fd, uint64_t size)
+{
+	char buf[READ_BUFFER_SIZE];
+	while (size > 0) {
+		size_t n = MIN(size, sizeof(buf));
+		if (!read_bytes(r, buf, n) || (fd != -1 && !write_fd(fd, buf, n))) {
+			return false;
+		}
+		size -= n;
+	}
+	return true;
+}
+
+// Return the size of the header and index of a result file.
+static uint64_t
+index_end(const struct result_entry *entries, int n_entries)
+{
+	uint64_t size = HEADER_SIZE + 1;
+	for (int i = 0; i < n_entries; i++) {
+		size += 1 + strlen(entries[i].suffix) + 1 + 8;
+	}
+	return size;
+}
+
+// Check that an uncompressed result of size bytes is exactly as large as its
+// index says.
+static bool
+check_uncompressed_size(uint64_t size, const struct result_entry *entries,
+                        int n_entries)
+{
+	uint64_t expected = index_end(entries, n_entries);
+	for (int i = 0; i < n_entries; i++) {
+		if (entries[i].type == RESULT_ENTRY_EMBEDDED) {
+			expected += entries[i].size;
+		}
+	}
+	return size == expected;
+}
+
+// Finish reading. Returns false if the compressed data is corrupt or if there
+// is trailing data.
+static bool
+close_reader(struct result_reader *r)
+{
+	bool ok = r->decompressor->free(r->state);
+	r->state = NULL;
+	return ok;
+}
+
+static const struct result_entry *
+find_entry(const struct result_entry *entries, int n_entries,
+           const char *suffix)
+{
+	for (int i = 0; i < n_entries; i++) {
+		if (str_eq(entries[i].suffix, suffix)) {
+			return &entries[i];
+		}
+	}
+	return NULL;
+}
+
+static const struct result_file *
+find_file(const struct result_files *list, const char *suffix)
+{
+	for (uint32_t i = 0; i < list->n_files; i++) {
+		if (str_eq(list->files[i].suffix, suffix)) {
+			return &list->files[i];
+		}
+	}
+	return NULL;
+}
+
+// Get the files in list from a result file. The embedded files are written to
+// temporary files that are moved into place only when the whole result file
+// has been read successfully. The compiler times stored with the result are
+// put in cost. Returns false if the result file is missing or corrupt or
+// doesn't have all of the files, and found tells whether it's missing.
+bool
+result_get(const char *path, struct result_files *list,
+           struct result_cost *cost, bool *found)
+{
+	bool ret = false;
+	struct result_entry *entries =
+	  x_malloc(MAX_RESULT_ENTRIES * sizeof(*entries));
+	char **tmp_paths = x_calloc(list->n_files + 1, sizeof(*tmp_paths));
+	struct result_reader r = {NULL, NULL};
+	uint8_t compr_type, compr_level;
+	uint64_t base, size;
+	struct pack_record packed;
+
+	int fd = open_result(path, &base, &size, &packed);
+	*found = fd != -1;
+	if (fd == -1) {
+		cc_log("Failed to open result file %s: %s", path, strerror(errno));
+		goto out;
+	}
+	if (!open_reader(fd, base, size, &r, &compr_type, &compr_level, cost)) {
+		cc_log("Corrupt result file %s", path);
+		goto out;
+	}
+
+	int n_entries = read_index(&r, entries);
+	if (n_entries < 0) {
+		cc_log("Corrupt result file %s", path);
+		goto out;
+	}
+	for (uint32_t i = 0; i < list->n_files; i++) {
+		if (!find_entry(entries, n_entries, list->files[i].suffix)) {
+			cc_log("No %s file in result file %s", list->files[i].suffix, path);
+			goto out;
+		}
+	}
+	bool uncompressed = compr_type == COMPR_TYPE_NONE;
+	if (uncompressed && !check_uncompressed_size(size, entries, n_entries)) {
+		cc_log("Corrupt result file %s", path);
+		goto out;
+	}
+
+	uint64_t offset = base + index_end(entries, n_entries);
+	for (int i = 0; i < n_entries; i++) {
+		const struct result_file *file = find_file(list, entries[i].suffix);
+		if (entries[i].type == RESULT_ENTRY_RAW) {
+			if (file) {
+				// Raw files are never compressed, so there's no need to look at
+				// the file before linking or cloning it.
+				char *raw_path = get_raw_path(path, entries[i].suffix);
+				x_unlink(file->path);
+				bool ok = link(raw_path, file->path) == 0
+				          || copy_file(raw_path, file->path) == 0;
+				if (ok) {
+					update_mtime(raw_path);
+				} else {
+					cc_log("Failed to get %s from the cache: %s",
+					       raw_path, strerror(errno));
+				}
+				free(raw_path);
+				if (!ok) {
+					goto out;
+				}
+			}
+			continue;
+		}
+
+		int out_fd = -1;
+		if (file) {
+			tmp_paths[file - list->files] = x_strdup(file->path);
+			out_fd = create_tmp_fd(&tmp_paths[file - list->files]);
+		}
+		bool ok;
+		if (uncompressed) {
+			ok = out_fd == -1
+			     || copy_fd_range(fd, offset, out_fd, entries[i].size);
+			offset += entries[i].size;
+		} else {
+			ok = copy_data(&r, out_fd, entries[i].size);
+		}
+		if (out_fd != -1 && close(out_fd) != 0) {
+			ok = false;
+		}
+		if (!ok) {
+			cc_log("Failed to read %s entry from result file %s",
+			       entries[i].suffix, path);
+			goto out;
+		}
+	}
+	// The reader hasn't consumed uncompressed data, but its size has already
+	// been checked.
+	if (!close_reader(&r) && !uncompressed) {
+		cc_log("Corrupt result file %s", path);
+		goto out;
+	}
+
+	ret = true;
+	for (uint32_t i = 0; i < list->n_files; i++) {
+		if (tmp_paths[i] && x_rename(tmp_paths[i], list->files[i].path) != 0) {
+			ret = false;
+		}
+	}
+
+out:
+	for (uint32_t i = 0; i < list->n_files; i++) {
+		if (tmp_paths[i]) {
+			if (!ret) {
+				tmp_unlink(tmp_paths[i]);
+			}
+			free(tmp_paths[i]);
+		}
+	}
+	free(tmp_paths);
+	free(entries);
+	if (r.state) {
+		close_reader(&r);
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	// Only a packed result that could be read is marked as used, so that a
+	// broken one isn't kept alive by lookups.
+	if (packed.index_fd != -1) {
+		pack_release(&packed, ret);
+	}
+	return ret;
+}
+
+static bool
+write_bytes(struct result_writer *w, const void *buf, size_t size)
+{
+	return w->compressor->write(w->state, buf, size);
+}
+
+static bool
+write_int(struct result_writer *w, size_t size, uint64_t value)
+{
+	uint8_t buf[8];
+	for (size_t i = 0; i < size; i++) {
+		buf[i] = (value >> (8 * (size - i - 1))) & 0xFF;
+	}
+	return write_bytes(w, buf, size);
+}
+
+// Append the content of path, which must be size bytes, to w. If w has no
+// compressor state, the data is copied uncompressed to w->fd.
+static bool
+write_file_data(struct result_writer *w, const char *path, uint64_t size)
+{
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd == -1) {
+		return false;
+	}
+	if (!w->state) {
+		bool ok = copy_fd_range(fd, 0, w->fd, size);
+		close(fd);
+		return ok;
+	}
+	char buf[READ_BUFFER_SIZE];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if ((uint64_t)n > size || !write_bytes(w, buf, n)) {
+			break;
+		}
+		size -= n;
+	}
+	close(fd);
+	return n == 0 && size == 0;
+}
+
+// Store the files in list in a result file compressed with compression_type.
+// The compiler times in cost are stored with the result. If hard_link is true
+// and compression_type is COMPR_TYPE_NONE, the files (except the standard error
+// output) are hard linked next to the result file instead of being embedded. A
+// result file of at most pack_threshold bytes without hard linked files is
+// stored in the pack of its directory. The cache size counters are updated.
+// Returns false on error.
+bool
+result_put(const char *path, struct result_files *list,
+           const struct result_cost *cost,
+           enum compression_type compression_type, int compression_level,
+           bool hard_link, uint64_t pack_threshold)
+{
+	bool ret = false;
+	struct result_writer w = {-1, NULL, NULL};
+	uint8_t *types = x_calloc(list->n_files + 1, sizeof(*types));
+	uint64_t *sizes = x_calloc(list->n_files + 1, sizeof(*sizes));
+	char *tmp_path = format("%s.tmp", path);
+	int fd = create_tmp_fd(&tmp_path);
+
+	struct stat st;
+	int64_t size_delta = 0;
+	int files_delta = 0;
+	for (uint32_t i = 0; i < list->n_files; i++) {
+		const struct result_file *file = &list->files[i];
+		if (x_stat(file->path, &st) != 0) {
+			goto out;
+		}
+		sizes[i] = st.st_size;
+		types[i] = RESULT_ENTRY_EMBEDDED;
+		if (!hard_link
+		    || compression_type != COMPR_TYPE_NONE
+		    || str_eq(file->suffix, ".stderr")) {
+			continue;
+		}
+
+		char *raw_path = get_raw_path(path, file->suffix);
+		struct stat raw_st;
+		bool raw_existed = stat(raw_path, &raw_st) == 0;
+		x_unlink(raw_path);
+		if (link(file->path, raw_path) == 0) {
+			types[i] = RESULT_ENTRY_RAW;
+			size_delta += file_size(&st);
+			files_delta++;
+		} else {
+			cc_log("Failed to link %s to %s: %s",
+			       file->path, raw_path, strerror(errno));
+			cc_log("Falling back to copying");
+		}
+		if (raw_existed) {
+			size_delta -= file_size(&raw_st);
+			files_delta--;
+		}
+		free(raw_path);
+	}
+
+	uint8_t header[HEADER_SIZE] = {
+		(MAGIC >> 24) & 0xFF, (MAGIC >> 16) & 0xFF, (MAGIC >> 8) & 0xFF,
+		MAGIC & 0xFF, RESULT_VERSION, compression_type,
+		MIN(compression_level, 0xFF),
+		(cost->wall_time >> 24) & 0xFF, (cost->wall_time >> 16) & 0xFF,
+		(cost->wall_time >> 8) & 0xFF, cost->wall_time & 0xFF,
+		(cost->cpu_time >> 24) & 0xFF, (cost->cpu_time >> 16) & 0xFF,
+		(cost->cpu_time >> 8) & 0xFF, cost->cpu_time & 0xFF
+	};
+	if (!write_fd(fd, header, sizeof(header))) {
+		cc_log("Failed to write result file %s: %s", tmp_path, strerror(errno));
+		goto out;
+	}
+	w.fd = fd;
+	w.compressor = compressor_from_type(compression_type);
+	assert(w.compressor);
+	w.state = w.compressor->init(fd, compression_level);
+	if (!w.state) {
+		goto out;
+	}
+
+	bool ok = write_int(&w, 1, list->n_files);
+	for (uint32_t i = 0; ok && i < list->n_files; i++) {
+		const char *suffix = list->files[i].suffix;
+		ok = write_int(&w, 1, strlen(suffix))
+		     && write_bytes(&w, suffix, strlen(suffix))
+		     && write_int(&w, 1, types[i])
+		     && write_int(&w, 8, sizes[i]);
+	}
+	if (compression_type == COMPR_TYPE_NONE) {
+		// Flush the index so that the file data can be copied directly.
+		ok = w.compressor->free(w.state) && ok;
+		w.state = NULL;
+	}
+	for (uint32_t i = 0; ok && i < list->n_files; i++) {
+		if (types[i] == RESULT_ENTRY_EMBEDDED) {
+			ok = write_file_data(&w, list->files[i].path, sizes[i]);
+		}
+	}
+	if (w.state) {
+		ok = w.compressor->free(w.state) && ok;
+	}
+	// The close can fail on NFS if out of space.
+	ok = close(fd) == 0 && ok;
+	fd = -1;
+	if (!ok) {
+		cc_log("Failed to write result file %s: %s", tmp_path, strerror(errno));
+		goto out;
+	}
+
+	bool has_raw = false;
+	for (uint32_t i = 0; i < list->n_files; i++) {
+		has_raw = has_raw || types[i] == RESULT_ENTRY_RAW;
+	}
+	struct stat old_st;
+	bool old_existed = stat(path, &old_st) == 0;
+	if (!has_raw
+	    && x_stat(tmp_path, &st) == 0
+	    && (uint64_t)st.st_size <= pack_threshold
+	    && pack_put(path, tmp_path, &size_delta, &files_delta)) {
+		tmp_unlink(tmp_path);
+		if (old_existed) {
+			x_unlink(path);
+			size_delta -= file_size(&old_st);
+			files_delta--;
+		}
+		ret = true;
+		goto out;
+	}
+	if (x_rename(tmp_path, path) != 0 || x_stat(path, &st) != 0) {
+		goto out;
+	}
+	size_delta += file_size(&st) - (old_existed ? file_size(&old_st) : 0);
+	files_delta += old_existed ? 0 : 1;
+	ret = true;
+
+out:
+	stats_update_size(size_delta, files_delta);
+	if (fd != -1) {
+		close(fd);
+	}
+	if (!ret) {
+		tmp_unlink(tmp_path);
+	}
+	free(tmp_path);
+	free(sizes);
+	free(types);
+	return ret;
+}
+
+// Remove the raw files listed in the result file path.
+static void
+remove_raw_files(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd == -1) {
+		return;
+	}
+	struct result_entry *entries =
+	  x_malloc(MAX_RESULT_ENTRIES * sizeof(*entries));
+	struct result_reader r = {NULL, NULL};
+	uint8_t compr_type, compr_level;
+	struct result_cost cost;
+	struct stat st;
+	int n_entries = -1;
+	if (fstat(fd, &st) == 0
+	    && open_reader(fd, 0, st.st_size, &r, &compr_type, &compr_level, &cost)) {
+		n_entries = read_index(&r, entries);
+	}
+	for (int i = 0; i < n_entries; i++) {
+		if (entries[i].type == RESULT_ENTRY_RAW) {
+			char *raw_path = get_raw_path(path, entries[i].suffix);
+			x_try_unlink(raw_path);
+			free(raw_path);
+		}
+	}
+	free(entries);
+	if (r.state) {
+		close_reader(&r);
+	}
+	close(fd);
+}
+
+// Remove the result file path and its raw files, or its record in the pack if
+// there is no such file. Raw files of a result whose index can't be read are
+// left for the cleanup to evict on their own.
+void
+result_remove(const char *path)
+{
+	remove_raw_files(path);
+	if (x_try_unlink(path) != 0 && errno == ENOENT) {
+		pack_remove(path);
+	}
+}
+
+bool
+result_dump(const char *path, FILE *stream)
+{
+	bool ret = false;
+	struct result_entry *entries =
+	  x_malloc(MAX_RESULT_ENTRIES * sizeof(*entries));
+	struct result_reader r = {NULL, NULL};
+	uint8_t compr_type, compr_level;
+	struct result_cost cost;
+	uint64_t base, size;
+	struct pack_record packed;
+
+	int fd = open_result(path, &base, &size, &packed);
+	if (fd == -1) {
+		fprintf(stderr, "No such result file: %s\n", path);
+		goto out;
+	}
+	int n_entries = -1;
+	if (open_reader(fd, base, size, &r, &compr_type, &compr_level, &cost)) {
+		n_entries = read_index(&r, entries);
+	}
+	if (n_entries < 0) {
+		fprintf(stderr, "Error reading result file\n");
+		goto out;
+	}
+
+	fprintf(stream, "Magic: %c%c%c%c\n",
+	        (MAGIC >> 24) & 0xFF,
+	        (MAGIC >> 16) & 0xFF,
+	        (MAGIC >> 8) & 0xFF,
+	        MAGIC & 0xFF);
+	fprintf(stream, "Version: %u\n", RESULT_VERSION);
+	fprintf(stream, "Compression type: %s\n",
+	        compression_type_to_string(compr_type));
+	fprintf(stream, "Compression level: %u\n", compr_level);
+	fprintf(stream, "Compiler wall clock time: %u ms\n",
+	        (unsigned)cost.wall_time);
+	fprintf(stream, "Compiler CPU time: %u ms\n", (unsigned)cost.cpu_time);
+	fprintf(stream, "Entries (%d):\n", n_entries);
+	for (int i = 0; i < n_entries; i++) {
+		fprintf(stream, "  %d:\n", i);
+		fprintf(stream, "    Suffix: %s\n", entries[i].suffix);
+		fprintf(stream, "    Type: %s\n",
+		        entries[i].type == RESULT_ENTRY_RAW ? "raw" : "embedded");
+		fprintf(stream, "    Size: %llu\n", (unsigned long long)entries[i].size);
+	}
+	ret = true;
+
+out:
+	free(entries);
+	if (r.state) {
+		close_reader(&r);
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	if (packed.index_fd != -1) {
+		pack_release(&packed, false);
+	}
+	return ret;
+}
@@ -0,0 +1,51 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef RESULT_H
+#define RESULT_H
+
+#include "compression.h"
+#include "conf.h"
+
+// Version of the result file format.
+#define RESULT_VERSION 3
+
+// Time in milliseconds that the compiler took to produce a result, i.e. the
+// time that a cache hit saves.
+struct result_cost {
+	uint32_t wall_time;
+	uint32_t cpu_time;
+};
+
+// A list of files in a result, each identified by a suffix such as ".o" or
+// ".stderr".
+struct result_files;
+
+struct result_files *result_files_init(void);
+void result_files_add(struct result_files *list, const char *path,
+                      const char *suffix);
+void result_files_free(struct result_files *list);
+
+bool result_get(const char *path, struct result_files *list,
+                struct result_cost *cost, bool *found);
+bool result_put(const char *path, struct result_files *list,
+                const struct result_cost *cost,
+                enum compression_type compression_type, int compression_level,
+                bool hard_link, uint64_t pack_threshold);
+void result_remove(const char *path);
+bool result_dump(const char *path, FILE *stream);
+
+#endif
@@ -0,0 +1,276 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// Fast scanning of source code and preprocessor output. The vectorized
+// variants compare 16 (SSE2) or 32 (AVX2) bytes at a time and are selected at
+// runtime; the portable variants handle the tail and other CPUs.
+
+#include "ccache.h"
+#include "macroskip.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef HAVE_AVX2
+// Whether the CPU supports AVX2, or -1 if not known yet.
+static int avx2_supported = -1;
+
+static bool
+have_avx2(void)
+{
+	if (avx2_supported == -1) {
+		avx2_supported = __builtin_cpu_supports("avx2");
+	}
+	return avx2_supported;
+}
+#endif
+
+// Detect the CPU features used by the scanning functions. This must be done
+// before the functions are called from several threads since the detection
+// result is cached without locking.
+void
+scan_init(void)
+{
+#ifdef HAVE_AVX2
+	have_avx2();
+#endif
+}
+
+// Bytes that can start a linemarker candidate.
+static const bool linemarker_start_byte[256] = {
+	['#'] = true, ['.'] = true, ['_'] = true
+};
+
+static const char *
+find_linemarker_candidate_portable(const char *p, const char *limit, bool pump)
+{
+	for (; p < limit; p++) {
+		if (!linemarker_start_byte[(unsigned char)p[0]]) {
+			continue;
+		}
+		if ((p[0] == '#' && p[-1] == '\n')
+		    || (p[0] == '.' && p[1] == 'i')
+		    || (pump && p[0] == '_' && p[1] == '_')) {
+			return p;
+		}
+	}
+	return limit;
+}
+
+#ifdef __SSE2__
+static const char *
+find_linemarker_candidate_sse2(const char *p, const char *limit, bool pump)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i hash = _mm_set1_epi8('#');
+	const __m128i dot = _mm_set1_epi8('.');
+	const __m128i i = _mm_set1_epi8('i');
+	const __m128i underscore = _mm_set1_epi8('_');
+
+	for (; p + 16 <= limit; p += 16) {
+		__m128i prev = _mm_loadu_si128((const __m128i *)(p - 1));
+		__m128i cur = _mm_loadu_si128((const __m128i *)p);
+		__m128i next = _mm_loadu_si128((const __m128i *)(p + 1));
+		__m128i match = _mm_or_si128(
+		  _mm_and_si128(_mm_cmpeq_epi8(prev, newline), _mm_cmpeq_epi8(cur, hash)),
+		  _mm_and_si128(_mm_cmpeq_epi8(cur, dot), _mm_cmpeq_epi8(next, i)));
+		if (pump) {
+			match = _mm_or_si128(
+			  match,
+			  _mm_and_si128(_mm_cmpeq_epi8(cur, underscore),
+			                _mm_cmpeq_epi8(next, underscore)));
+		}
+		unsigned mask = _mm_movemask_epi8(match);
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+	return find_linemarker_candidate_portable(p, limit, pump);
+}
+#endif
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static const char *
+find_linemarker_candidate_avx2(const char *p, const char *limit, bool pump)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i hash = _mm256_set1_epi8('#');
+	const __m256i dot = _mm256_set1_epi8('.');
+	const __m256i i = _mm256_set1_epi8('i');
+	const __m256i underscore = _mm256_set1_epi8('_');
+
+	for (; p + 32 <= limit; p += 32) {
+		__m256i prev = _mm256_loadu_si256((const __m256i *)(p - 1));
+		__m256i cur = _mm256_loadu_si256((const __m256i *)p);
+		__m256i next = _mm256_loadu_si256((const __m256i *)(p + 1));
+		__m256i match = _mm256_or_si256(
+		  _mm256_and_si256(_mm256_cmpeq_epi8(prev, newline),
+		                   _mm256_cmpeq_epi8(cur, hash)),
+		  _mm256_and_si256(_mm256_cmpeq_epi8(cur, dot),
+		                   _mm256_cmpeq_epi8(next, i)));
+		if (pump) {
+			match = _mm256_or_si256(
+			  match,
+			  _mm256_and_si256(_mm256_cmpeq_epi8(cur, underscore),
+			                   _mm256_cmpeq_epi8(next, underscore)));
+		}
+		unsigned mask = _mm256_movemask_epi8(match);
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+#ifdef __SSE2__
+	return find_linemarker_candidate_sse2(p, limit, pump);
+#else
+	return find_linemarker_candidate_portable(p, limit, pump);
+#endif
+}
+#endif
+
+// Return the first position in [p, limit) that may start a linemarker ("#"
+// first on a line), an ".incbin" directive or a distcc-pump banner (only if
+// pump is true), or limit if there is none. p[-1] and limit[0] must be
+// readable.
+const char *
+find_linemarker_candidate(const char *p, const char *limit, bool pump)
+{
+#ifdef HAVE_AVX2
+	if (have_avx2()) {
+		return find_linemarker_candidate_avx2(p, limit, pump);
+	}
+#endif
+#ifdef __SSE2__
+	return find_linemarker_candidate_sse2(p, limit, pump);
+#else
+	return find_linemarker_candidate_portable(p, limit, pump);
+#endif
+}
+
+// Boyer-Moore-Horspool search for the end of a "__...E__" substring, as
+// check_for_temporal_macros() used to do.
+static const char *
+find_temporal_macro_candidate_portable(const char *p, const char *limit)
+{
+	const char *end = limit + 7;
+	const char *q = p + 7;
+	while (q < end) {
+		if (q[-2] == 'E' && q[0] == '_' && q[-7] == '_' && q[-1] == '_'
+		    && q[-6] == '_') {
+			return q - 7;
+		}
+		q += macro_skip[(uint8_t)q[0]];
+	}
+	return limit;
+}
+
+#ifdef __SSE2__
+static const char *
+find_temporal_macro_candidate_sse2(const char *p, const char *limit)
+{
+	const __m128i underscore = _mm_set1_epi8('_');
+	const __m128i e = _mm_set1_epi8('E');
+
+	for (; p + 16 <= limit; p += 16) {
+		// 'E' is rarer than '_' in source code, so start with it.
+		__m128i match = _mm_cmpeq_epi8(
+		  _mm_loadu_si128((const __m128i *)(p + 5)), e);
+		if (_mm_movemask_epi8(match) == 0) {
+			continue;
+		}
+		match = _mm_and_si128(
+		  match,
+		  _mm_and_si128(
+		    _mm_and_si128(
+		      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), underscore),
+		      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)),
+		                     underscore)),
+		    _mm_and_si128(
+		      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 6)),
+		                     underscore),
+		      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 7)),
+		                     underscore))));
+		unsigned mask = _mm_movemask_epi8(match);
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+	return find_temporal_macro_candidate_portable(p, limit);
+}
+#endif
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static const char *
+find_temporal_macro_candidate_avx2(const char *p, const char *limit)
+{
+	const __m256i underscore = _mm256_set1_epi8('_');
+	const __m256i e = _mm256_set1_epi8('E');
+
+	for (; p + 32 <= limit; p += 32) {
+		__m256i match = _mm256_cmpeq_epi8(
+		  _mm256_loadu_si256((const __m256i *)(p + 5)), e);
+		if (_mm256_movemask_epi8(match) == 0) {
+			continue;
+		}
+		match = _mm256_and_si256(
+		  match,
+		  _mm256_and_si256(
+		    _mm256_and_si256(
+		      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p),
+		                        underscore),
+		      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)),
+		                        underscore)),
+		    _mm256_and_si256(
+		      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 6)),
+		                        underscore),
+		      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 7)),
+		                        underscore))));
+		unsigned mask = _mm256_movemask_epi8(match);
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+#ifdef __SSE2__
+	return find_temporal_macro_candidate_sse2(p, limit);
+#else
+	return find_temporal_macro_candidate_portable(p, limit);
+#endif
+}
+#endif
+
+// Return a position in [p, limit) that starts a "__???E__" substring with no
+// "__DATE__" or "__TIME__" before it, or limit if there is none. Other
+// "__???E__" substrings may be skipped. The 7 bytes after limit must be
+// readable.
+const char *
+find_temporal_macro_candidate(const char *p, const char *limit)
+{
+#ifdef HAVE_AVX2
+	if (have_avx2()) {
+		return find_temporal_macro_candidate_avx2(p, limit);
+	}
+#endif
+#ifdef __SSE2__
+	return find_temporal_macro_candidate_sse2(p, limit);
+#else
+	return find_temporal_macro_candidate_portable(p, limit);
+#endif
+}
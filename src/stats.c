@@ -17,6 +17,19 @@
 
 // Routines to handle the stats files. The stats file is stored one per cache
 // subdirectory to make this more scalable.
+//
+// Counter updates from compilations are added without locking to shared
+// counters in a memory mapped file next to the stats file ("stats.bin"), using
+// atomic operations. The value of a counter is the sum of the stats file and
+// the shared counters. The shared counters are folded into the stats file
+// whenever the stats file is rewritten under its lock anyway, i.e. when
+// zeroing the statistics and when cleanup updates the counters. Builds without
+// mmap or atomic builtins lock and rewrite the stats file on every update.
+//
+// The shared counters file also has a histogram of the durations of each phase
+// in enum stats_phase. Bucket i counts durations of [2^i, 2^(i+1))
+// microseconds (bucket 0 also counts durations under one microsecond). The
+// histograms are not recorded by builds without shared counters.
 
 #include "ccache.h"
 #include "hashutil.h"
@@ -29,201 +42,308 @@ extern char *secondary_config_path;
 
 static struct counters *counter_updates;
 
+#define HISTOGRAM_BUCKETS 32
+
+// Pending phase duration histogram updates.
+static uint32_t phase_updates[PHASE_END][HISTOGRAM_BUCKETS];
+
+// Phase names in enum stats_phase order.
+static const char *const phase_names[] = {
+	"common hash",
+	"manifest lookup",
+	"preprocessor",
+	"compiler",
+	"get result",
+	"store result",
+	"update statistics",
+};
+
+#if defined(HAVE_SYS_MMAN_H) && defined(__ATOMIC_RELAXED)
+#define USE_SHARED_COUNTERS
+
+#define SHARED_COUNTERS_MAGIC "cCsT"
+#define SHARED_COUNTERS_VERSION 2
+#define SHARED_COUNTERS_SLOTS 64
+#define SHARED_HISTOGRAM_SLOTS 16
+
+struct shared_counters {
+	char magic[4];
+	uint8_t version;
+	uint8_t reserved[3];
+	uint32_t n_slots;
+	uint32_t reserved2;
+	// Time of the last update.
+	int64_t updated;
+	int64_t data[SHARED_COUNTERS_SLOTS];
+	int64_t histograms[SHARED_HISTOGRAM_SLOTS][HISTOGRAM_BUCKETS];
+};
+#endif
+
 #define FLAG_NOZERO 1 // don't zero with the -z option
 #define FLAG_ALWAYS 2 // always show, even if zero
 #define FLAG_NEVER 4 // never show
+#define FLAG_NOLOG 8 // don't log as a result of the compilation
 
 static void display_size_times_1024(uint64_t size);
+static void display_milliseconds(uint64_t ms);
+static void display_microseconds(uint64_t us);
 
 // Statistics fields in display order.
 static struct {
 	enum stats stat;
+	char *id; // for --print-stats
 	char *message;
 	void (*fn)(uint64_t);
 	unsigned flags;
 } stats_info[] = {
 	{
 		STATS_CACHEHIT_DIR,
+		"direct_cache_hit",
 		"cache hit (direct)",
 		NULL,
 		FLAG_ALWAYS
 	},
 	{
 		STATS_CACHEHIT_CPP,
+		"preprocessed_cache_hit",
 		"cache hit (preprocessed)",
 		NULL,
 		FLAG_ALWAYS
 	},
 	{
 		STATS_TOCACHE,
+		"cache_miss",
 		"cache miss",
 		NULL,
 		FLAG_ALWAYS
 	},
+	{
+		STATS_SAVED_WALL_TIME,
+		"saved_wall_time_ms",
+		"time saved (wall clock)",
+		display_milliseconds,
+		FLAG_NOLOG
+	},
+	{
+		STATS_SAVED_CPU_TIME,
+		"saved_cpu_time_ms",
+		"time saved (CPU)",
+		display_milliseconds,
+		FLAG_NOLOG
+	},
 	{
 		STATS_LINK,
+		"called_for_link",
 		"called for link",
 		NULL,
 		0
 	},
 	{
 		STATS_PREPROCESSING,
+		"called_for_preprocessing",
 		"called for preprocessing",
 		NULL,
 		0
 	},
 	{
 		STATS_MULTIPLE,
+		"multiple_source_files",
 		"multiple source files",
 		NULL,
 		0
 	},
 	{
 		STATS_STDOUT,
+		"compiler_produced_stdout",
 		"compiler produced stdout",
 		NULL,
 		0
 	},
 	{
 		STATS_NOOUTPUT,
+		"compiler_produced_no_output",
 		"compiler produced no output",
 		NULL,
 		0
 	},
 	{
 		STATS_EMPTYOUTPUT,
+		"compiler_produced_empty_output",
 		"compiler produced empty output",
 		NULL,
 		0
 	},
 	{
 		STATS_STATUS,
+		"compile_failed",
 		"compile failed",
 		NULL,
 		0
 	},
 	{
 		STATS_ERROR,
+		"internal_error",
 		"ccache internal error",
 		NULL,
 		0
 	},
 	{
 		STATS_PREPROCESSOR,
+		"preprocessor_error",
 		"preprocessor error",
 		NULL,
 		0
 	},
 	{
 		STATS_CANTUSEPCH,
+		"could_not_use_precompiled_header",
 		"can't use precompiled header",
 		NULL,
 		0
 	},
 	{
 		STATS_COMPILER,
+		"could_not_find_compiler",
 		"couldn't find the compiler",
 		NULL,
 		0
 	},
 	{
 		STATS_MISSING,
+		"missing_cache_file",
 		"cache file missing",
 		NULL,
 		0
 	},
 	{
 		STATS_ARGS,
+		"bad_compiler_arguments",
 		"bad compiler arguments",
 		NULL,
 		0
 	},
 	{
 		STATS_SOURCELANG,
+		"unsupported_source_language",
 		"unsupported source language",
 		NULL,
 		0
 	},
 	{
 		STATS_COMPCHECK,
+		"compiler_check_failed",
 		"compiler check failed",
 		NULL,
 		0
 	},
 	{
 		STATS_CONFTEST,
+		"autoconf_test",
 		"autoconf compile/link",
 		NULL,
 		0
 	},
 	{
 		STATS_UNSUPPORTED_OPTION,
+		"unsupported_compiler_option",
 		"unsupported compiler option",
 		NULL,
 		0
 	},
 	{
 		STATS_UNSUPPORTED_DIRECTIVE,
+		"unsupported_code_directive",
 		"unsupported code directive",
 		NULL,
 		0
 	},
+	{
+		STATS_UNHASHABLE_DEPENDENCY,
+		"unhashable_dependency",
+		"unhashable dependency",
+		NULL,
+		0
+	},
 	{
 		STATS_OUTSTDOUT,
+		"output_to_stdout",
 		"output to stdout",
 		NULL,
 		0
 	},
 	{
 		STATS_DEVICE,
+		"bad_output_file",
 		"output to a non-regular file",
 		NULL,
 		0
 	},
 	{
 		STATS_NOINPUT,
+		"no_input_file",
 		"no input file",
 		NULL,
 		0
 	},
 	{
 		STATS_BADEXTRAFILE,
+		"error_hashing_extra_file",
 		"error hashing extra file",
 		NULL,
 		0
 	},
+	{
+		STATS_LOCK_RETRIES,
+		"lock_retries",
+		"lock retries",
+		NULL,
+		FLAG_NOLOG
+	},
+	{
+		STATS_LOCK_WAIT_TIME,
+		"lock_wait_time_us",
+		"lock wait time",
+		display_microseconds,
+		FLAG_NOLOG
+	},
 	{
 		STATS_NUMCLEANUPS,
+		"cleanups_performed",
 		"cleanups performed",
 		NULL,
 		FLAG_ALWAYS
 	},
 	{
 		STATS_NUMFILES,
+		"files_in_cache",
 		"files in cache",
 		NULL,
 		FLAG_NOZERO|FLAG_ALWAYS
 	},
 	{
 		STATS_TOTALSIZE,
+		"cache_size_kibibyte",
 		"cache size",
 		display_size_times_1024,
 		FLAG_NOZERO|FLAG_ALWAYS
 	},
 	{
 		STATS_OBSOLETE_MAXFILES,
+		"obsolete_max_files",
 		"OBSOLETE",
 		NULL,
 		FLAG_NOZERO|FLAG_NEVER
 	},
 	{
 		STATS_OBSOLETE_MAXSIZE,
+		"obsolete_max_size",
 		"OBSOLETE",
 		NULL,
 		FLAG_NOZERO|FLAG_NEVER
 	},
 	{
 		STATS_ZEROTIMESTAMP,
+		"stats_zeroed_timestamp",
 		"stats last zeroed at",
 		NULL,
 		FLAG_NEVER
@@ -232,6 +352,7 @@ static struct {
 		STATS_NONE,
 		NULL,
 		NULL,
+		NULL,
 		0
 	}
 };
@@ -250,6 +371,12 @@ display_size_times_1024(uint64_t size)
 	display_size(size * 1024);
 }
 
+static void
+display_milliseconds(uint64_t ms)
+{
+	printf("%9.2f s", ms / 1000.0);
+}
+
 // Parse a stats file from a buffer, adding to the counters.
 static void
 parse_stats(struct counters *counters, const char *buf)
@@ -258,7 +385,7 @@ parse_stats(struct counters *counters, const char *buf)
 	const char *p = buf;
 	while (true) {
 		char *p2;
-		long val = strtol(p, &p2, 10);
+		unsigned long long val = strtoull(p, &p2, 10);
 		if (p2 == p) {
 			break;
 		}
@@ -285,7 +412,7 @@ stats_write(const char *path, struct counters *counters)
 	char *tmp_file = format("%s.tmp", path);
 	FILE *f = create_tmp_file(&tmp_file, "wb");
 	for (size_t i = 0; i < counters->size; i++) {
-		if (fprintf(f, "%u\n", counters->data[i]) < 0) {
+		if (fprintf(f, "%llu\n", (unsigned long long)counters->data[i]) < 0) {
 			fatal("Failed to write to %s", tmp_file);
 		}
 	}
@@ -312,6 +439,370 @@ stats_update_size(int64_t size, int files)
 	counter_updates->data[STATS_TOTALSIZE] += size / 1024;
 }
 
+#ifdef USE_SHARED_COUNTERS
+
+static void
+init_shared_counters_header(struct shared_counters *sc)
+{
+	memset(sc, 0, sizeof(*sc));
+	memcpy(sc->magic, SHARED_COUNTERS_MAGIC, sizeof(sc->magic));
+	sc->version = SHARED_COUNTERS_VERSION;
+	sc->n_slots = SHARED_COUNTERS_SLOTS;
+}
+
+// Write zeroed shared counters to path. If replace is true, an existing file
+// is replaced, otherwise it's kept since other processes may already have
+// mapped it.
+static bool
+write_shared_counters(const char *path, bool replace)
+{
+	char *tmp_path = format("%s.tmp", path);
+	int fd = create_tmp_fd(&tmp_path);
+	struct shared_counters sc;
+	init_shared_counters_header(&sc);
+	bool ok = write_fd(fd, &sc, sizeof(sc));
+	ok = close(fd) == 0 && ok;
+	if (replace) {
+		ok = ok && x_rename(tmp_path, path) == 0;
+	} else {
+		ok = ok && (link(tmp_path, path) == 0 || errno == EEXIST);
+	}
+	tmp_unlink(tmp_path);
+	free(tmp_path);
+	return ok;
+}
+
+// Create zeroed shared counters for stats_path in path, unless somebody else
+// did it first. A missing stats file is created as well so that the zero
+// timestamp is set.
+static bool
+create_shared_counters(const char *stats_path, const char *path)
+{
+	struct stat st;
+	if (stat(stats_path, &st) != 0 && errno == ENOENT
+	    && lockfile_acquire(stats_path, lock_staleness_limit)) {
+		if (stat(stats_path, &st) != 0) {
+			struct counters *counters = counters_init(STATS_END);
+			stats_write(stats_path, counters);
+			counters_free(counters);
+		}
+		lockfile_release(stats_path);
+	}
+	return write_shared_counters(path, false);
+}
+
+// Replace the incompatible shared counters in path with zeroed ones. This is
+// done under the lock of stats_path and only if path still is incompatible,
+// since another process may already have replaced it and started to use the
+// new file. The counters of a file from an older version, which has the same
+// layout up to and including the counters, are first added to the stats file.
+// Returns false if the file can't be replaced.
+static bool
+replace_shared_counters(const char *stats_path, const char *path)
+{
+	if (!lockfile_acquire(stats_path, lock_staleness_limit)) {
+		return false;
+	}
+
+	struct shared_counters expected;
+	init_shared_counters_header(&expected);
+	struct shared_counters old;
+	memset(&old, 0, sizeof(old));
+	char *data;
+	size_t size;
+	if (read_file(path, sizeof(old), &data, &size)) {
+		memcpy(&old, data, MIN(size, sizeof(old)));
+		free(data);
+	} else {
+		size = 0;
+	}
+	bool same_magic =
+	  size >= offsetof(struct shared_counters, data)
+	  && memcmp(old.magic, SHARED_COUNTERS_MAGIC, sizeof(old.magic)) == 0;
+
+	bool ok = true;
+	if (size == sizeof(old)
+	    && memcmp(&old, &expected, offsetof(struct shared_counters, updated))
+	       == 0) {
+		// Already replaced.
+	} else if (same_magic && old.version > SHARED_COUNTERS_VERSION) {
+		cc_log("Not replacing %s from a newer ccache version", path);
+		ok = false;
+	} else {
+		if (same_magic) {
+			size_t n_slots = MIN(
+			  old.n_slots,
+			  (size - offsetof(struct shared_counters, data)) / sizeof(int64_t));
+			struct counters *counters = counters_init(STATS_END);
+			stats_read(stats_path, counters);
+			for (size_t i = 0; i < MIN(n_slots, STATS_END); i++) {
+				counters->data[i] += (uint64_t)old.data[i];
+			}
+			stats_write(stats_path, counters);
+			counters_free(counters);
+		}
+		cc_log("Recreating incompatible %s", path);
+		ok = write_shared_counters(path, true);
+	}
+
+	lockfile_release(stats_path);
+	return ok;
+}
+
+// Map the shared counters of stats_path, creating them if create is true.
+// Returns NULL on failure.
+static struct shared_counters *
+map_shared_counters(const char *stats_path, bool create)
+{
+	char *path = format("%s.bin", stats_path);
+	struct shared_counters *sc = NULL;
+	struct shared_counters expected;
+	init_shared_counters_header(&expected);
+
+	for (int attempt = 0; attempt < 2 && !sc; attempt++) {
+		int fd = open(path, O_RDWR | O_BINARY);
+		if (fd == -1) {
+			if (errno != ENOENT) {
+				cc_log("Failed to open %s: %s", path, strerror(errno));
+				break;
+			}
+			if (!create || !create_shared_counters(stats_path, path)) {
+				break;
+			}
+			continue;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size == sizeof(*sc)) {
+			void *p = mmap(NULL, sizeof(*sc), PROT_READ | PROT_WRITE, MAP_SHARED,
+			               fd, 0);
+			if (p != MAP_FAILED) {
+				sc = p;
+			}
+		}
+		close(fd);
+		if (sc
+		    && memcmp(sc, &expected, offsetof(struct shared_counters, updated))
+		       != 0) {
+			munmap(sc, sizeof(*sc));
+			sc = NULL;
+		}
+		if (!sc && (!create || !replace_shared_counters(stats_path, path))) {
+			break;
+		}
+	}
+
+	free(path);
+	return sc;
+}
+
+static void
+unmap_shared_counters(struct shared_counters *sc)
+{
+	munmap(sc, sizeof(*sc));
+}
+
+// Add the shared counters of stats_path to counters and, if histograms isn't
+// NULL, the phase histograms to histograms. If fold is true, the counters are
+// also subtracted from the shared counters, so the caller must write counters
+// to the stats file (under its lock). Returns the time of the last update of
+// the shared counters, or 0 if there are none.
+static time_t
+read_shared_counters(const char *stats_path, struct counters *counters,
+                     uint64_t (*histograms)[HISTOGRAM_BUCKETS], bool fold)
+{
+	struct shared_counters *sc = map_shared_counters(stats_path, false);
+	if (!sc) {
+		return 0;
+	}
+	if (counters->size < STATS_END) {
+		counters_resize(counters, STATS_END);
+	}
+	for (int i = 0; i < STATS_END; i++) {
+		int64_t value = __atomic_load_n(&sc->data[i], __ATOMIC_RELAXED);
+		counters->data[i] += (uint64_t)value;
+		if (fold && value != 0) {
+			__atomic_fetch_sub(&sc->data[i], value, __ATOMIC_RELAXED);
+		}
+	}
+	for (int i = 0; histograms && i < PHASE_END; i++) {
+		for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			histograms[i][j] +=
+			  __atomic_load_n(&sc->histograms[i][j], __ATOMIC_RELAXED);
+		}
+	}
+	time_t updated = __atomic_load_n(&sc->updated, __ATOMIC_RELAXED);
+	unmap_shared_counters(sc);
+	return updated;
+}
+
+// Zero the phase histograms of stats_path.
+static void
+zero_shared_histograms(const char *stats_path)
+{
+	struct shared_counters *sc = map_shared_counters(stats_path, false);
+	if (!sc) {
+		return;
+	}
+	for (int i = 0; i < SHARED_HISTOGRAM_SLOTS; i++) {
+		for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			__atomic_store_n(&sc->histograms[i][j], 0, __ATOMIC_RELAXED);
+		}
+	}
+	unmap_shared_counters(sc);
+}
+
+// Add updates and the pending phase histogram updates to the shared counters
+// of stats_path and put the resulting counter values in counters. The time
+// since flush_start is recorded as the duration of the stats update phase.
+// Returns false if the shared counters can't be used.
+static bool
+update_shared_counters(const char *stats_path, struct counters *updates,
+                       struct counters *counters, int64_t flush_start)
+{
+	struct shared_counters *sc = map_shared_counters(stats_path, true);
+	if (!sc) {
+		return false;
+	}
+	for (int i = 0; i < STATS_END; i++) {
+		if (updates->data[i] != 0) {
+			// Updates of the size counters may be negative.
+			__atomic_fetch_add(
+			  &sc->data[i], (int64_t)updates->data[i], __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_store_n(&sc->updated, (int64_t)time(NULL), __ATOMIC_RELAXED);
+	stats_phase_end(PHASE_STATS_FLUSH, flush_start);
+	for (int i = 0; i < PHASE_END; i++) {
+		for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			if (phase_updates[i][j] != 0) {
+				__atomic_fetch_add(
+				  &sc->histograms[i][j], phase_updates[i][j], __ATOMIC_RELAXED);
+			}
+		}
+	}
+	unmap_shared_counters(sc);
+
+	stats_read(stats_path, counters);
+	read_shared_counters(stats_path, counters, NULL, false);
+	return true;
+}
+
+#else
+
+static time_t
+read_shared_counters(const char *stats_path, struct counters *counters,
+                     uint64_t (*histograms)[HISTOGRAM_BUCKETS], bool fold)
+{
+	(void)stats_path;
+	(void)counters;
+	(void)histograms;
+	(void)fold;
+	return 0;
+}
+
+static void
+zero_shared_histograms(const char *stats_path)
+{
+	(void)stats_path;
+}
+
+static bool
+update_shared_counters(const char *stats_path, struct counters *updates,
+                       struct counters *counters, int64_t flush_start)
+{
+	(void)stats_path;
+	(void)updates;
+	(void)counters;
+	(void)flush_start;
+	return false;
+}
+
+#endif
+
+// Record that a phase that started at start (from time_monotonic_us()) has
+// ended.
+void
+stats_phase_end(enum stats_phase phase, int64_t start)
+{
+	int64_t duration = time_monotonic_us() - start;
+	int bucket = 0;
+	while (duration > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+		duration >>= 1;
+		bucket++;
+	}
+	phase_updates[phase][bucket]++;
+}
+
+// Return the duration in microseconds below which (at least) a fraction q of
+// the durations in histogram are, as the upper bound of a bucket. Returns 0
+// for an empty histogram.
+static uint64_t
+histogram_quantile(const uint64_t *histogram, double q)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		total += histogram[i];
+	}
+	uint64_t count = 0;
+	for (int i = 0; total > 0 && i < HISTOGRAM_BUCKETS; i++) {
+		count += histogram[i];
+		if (count >= q * total) {
+			return (uint64_t)1 << (i + 1);
+		}
+	}
+	return 0;
+}
+
+// Format a duration in microseconds. Caller frees.
+static char *
+format_duration(uint64_t us)
+{
+	if (us >= 1000000) {
+		return format("%.1f s", us / 1000000.0);
+	} else if (us >= 1000) {
+		return format("%.1f ms", us / 1000.0);
+	} else {
+		return format("%u us", (unsigned)us);
+	}
+}
+
+static void
+display_microseconds(uint64_t us)
+{
+	char *s = format_duration(us);
+	printf("%11s", s);
+	free(s);
+}
+
+static void
+display_phase_histograms(uint64_t (*histograms)[HISTOGRAM_BUCKETS])
+{
+	bool header_printed = false;
+	for (int i = 0; i < PHASE_END; i++) {
+		uint64_t count = 0;
+		for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			count += histograms[i][j];
+		}
+		if (count == 0) {
+			continue;
+		}
+		if (!header_printed) {
+			printf("\n%-23s %8s %9s %9s %9s\n",
+			       "phase duration", "count", "p50", "p90", "p99");
+			header_printed = true;
+		}
+		char *p50 = format_duration(histogram_quantile(histograms[i], 0.5));
+		char *p90 = format_duration(histogram_quantile(histograms[i], 0.9));
+		char *p99 = format_duration(histogram_quantile(histograms[i], 0.99));
+		printf("%-23s %8llu %9s %9s %9s\n",
+		       phase_names[i], (unsigned long long)count, p50, p90, p99);
+		free(p99);
+		free(p90);
+		free(p50);
+	}
+}
+
 // Read in the stats from one directory and add to the counters.
 void
 stats_read(const char *sfile, struct counters *counters)
@@ -330,28 +821,66 @@ stats_timestamp(time_t time, struct counters *counters)
 	counters->data[STATS_ZEROTIMESTAMP] = (unsigned) time;
 }
 
+// Return whether there are counter updates that haven't been written to disk.
+static bool
+have_counter_updates(void)
+{
+	if (!counter_updates) {
+		return false;
+	}
+	for (int i = 0; i < STATS_END; ++i) {
+		if (counter_updates->data[i] > 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Add the counter updates to stats_file and put the resulting counter values in
+// counters. The updates are then cleared so that later ones, e.g. made by a
+// cleanup, can be written by another call. Returns false on failure.
+static bool
+write_counter_updates(struct counters *counters, int64_t start)
+{
+	if (!update_shared_counters(stats_file, counter_updates, counters, start)) {
+		if (!lockfile_acquire(stats_file, lock_staleness_limit)) {
+			return false;
+		}
+		stats_read(stats_file, counters);
+		for (int i = 0; i < STATS_END; ++i) {
+			counters->data[i] += counter_updates->data[i];
+		}
+		stats_write(stats_file, counters);
+		lockfile_release(stats_file);
+	}
+
+	if (!str_eq(conf->log_file, "")) {
+		for (int i = 0; i < STATS_END; ++i) {
+			if (counter_updates->data[stats_info[i].stat] != 0
+			    && !(stats_info[i].flags & (FLAG_NOZERO | FLAG_NOLOG))) {
+				cc_log("Result: %s", stats_info[i].message);
+			}
+		}
+	}
+
+	counters_free(counter_updates);
+	counter_updates = NULL;
+	memset(phase_updates, 0, sizeof(phase_updates));
+	return true;
+}
+
 // Write counter updates in counter_updates to disk.
 void
 stats_flush(void)
 {
 	assert(conf);
+	int64_t start = time_monotonic_us();
 
 	if (!conf->stats) {
 		return;
 	}
 
-	if (!counter_updates) {
-		return;
-	}
-
-	bool should_flush = false;
-	for (int i = 0; i < STATS_END; ++i) {
-		if (counter_updates->data[i] > 0) {
-			should_flush = true;
-			break;
-		}
-	}
-	if (!should_flush) {
+	if (!have_counter_updates()) {
 		return;
 	}
 
@@ -365,25 +894,10 @@ stats_flush(void)
 		free(stats_dir);
 	}
 
-	if (!lockfile_acquire(stats_file, lock_staleness_limit)) {
-		return;
-	}
-
 	struct counters *counters = counters_init(STATS_END);
-	stats_read(stats_file, counters);
-	for (int i = 0; i < STATS_END; ++i) {
-		counters->data[i] += counter_updates->data[i];
-	}
-	stats_write(stats_file, counters);
-	lockfile_release(stats_file);
-
-	if (!str_eq(conf->log_file, "")) {
-		for (int i = 0; i < STATS_END; ++i) {
-			if (counter_updates->data[stats_info[i].stat] != 0
-			    && !(stats_info[i].flags & FLAG_NOZERO)) {
-				cc_log("Result: %s", stats_info[i].message);
-			}
-		}
+	if (!write_counter_updates(counters, start)) {
+		counters_free(counters);
+		return;
 	}
 
 	char *subdir = dirname(stats_file);
@@ -391,23 +905,28 @@ stats_flush(void)
 
 	if (conf->max_files != 0
 	    && counters->data[STATS_NUMFILES] > conf->max_files / 16) {
-		cc_log("Need to clean up %s since it holds %u files (limit: %u files)",
+		cc_log("Need to clean up %s since it holds %llu files (limit: %u files)",
 		       subdir,
-		       counters->data[STATS_NUMFILES],
+		       (unsigned long long)counters->data[STATS_NUMFILES],
 		       conf->max_files / 16);
 		need_cleanup = true;
 	}
 	if (conf->max_size != 0
 	    && counters->data[STATS_TOTALSIZE] > conf->max_size / 1024 / 16) {
-		cc_log("Need to clean up %s since it holds %u KiB (limit: %lu KiB)",
+		cc_log("Need to clean up %s since it holds %llu KiB (limit: %lu KiB)",
 		       subdir,
-		       counters->data[STATS_TOTALSIZE],
+		       (unsigned long long)counters->data[STATS_TOTALSIZE],
 		       (unsigned long)conf->max_size / 1024 / 16);
 		need_cleanup = true;
 	}
 
 	if (need_cleanup) {
 		clean_up_dir(conf, subdir, conf->limit_multiple);
+
+		// The cleanup may have waited for locks.
+		if (have_counter_updates()) {
+			write_counter_updates(counters, time_monotonic_us());
+		}
 	}
 
 	free(subdir);
@@ -423,26 +942,34 @@ stats_update(enum stats stat)
 	counter_updates->data[stat]++;
 }
 
+// Add value to a stat.
+void
+stats_add(enum stats stat, uint64_t value)
+{
+	assert(stat > STATS_NONE && stat < STATS_END);
+	init_counter_updates();
+	counter_updates->data[stat] += value;
+}
+
 // Get the pending update of a counter value.
-unsigned
+uint64_t
 stats_get_pending(enum stats stat)
 {
 	init_counter_updates();
 	return counter_updates->data[stat];
 }
 
-// Sum and display the total stats for all cache dirs.
-void
-stats_summary(struct conf *conf)
+// Add up the stats of all cache dirs in counters and, if histograms isn't
+// NULL, the phase histograms in histograms. The zero timestamp counter is set
+// to the oldest zero timestamp. Returns the time of the last update.
+static time_t
+collect_stats(struct conf *conf, struct counters *counters,
+              uint64_t (*histograms)[HISTOGRAM_BUCKETS])
 {
-	struct counters *counters = counters_init(STATS_END);
 	time_t oldest = 0;
 	time_t updated = 0;
 	struct stat st;
 
-	assert(conf);
-
-	// Add up the stats in each directory.
 	for (int dir = -1; dir <= 0xF; dir++) {
 		char *fname;
 
@@ -461,8 +988,29 @@ stats_summary(struct conf *conf)
 		if (stat(fname, &st) == 0 && st.st_mtime > updated) {
 			updated = st.st_mtime;
 		}
+		current = read_shared_counters(fname, counters, histograms, false);
+		if (current > updated) {
+			updated = current;
+		}
 		free(fname);
 	}
+	counters->data[STATS_ZEROTIMESTAMP] = oldest;
+	return updated;
+}
+
+// Sum and display the total stats for all cache dirs. If verbose is true, the
+// phase duration percentiles are displayed as well.
+void
+stats_summary(struct conf *conf, bool verbose)
+{
+	struct counters *counters = counters_init(STATS_END);
+	uint64_t histograms[PHASE_END][HISTOGRAM_BUCKETS];
+	memset(histograms, 0, sizeof(histograms));
+
+	assert(conf);
+
+	time_t updated = collect_stats(conf, counters, histograms);
+	time_t oldest = (time_t)counters->data[STATS_ZEROTIMESTAMP];
 
 	printf("cache directory                     %s\n", conf->cache_dir);
 	printf("primary config                      %s\n",
@@ -498,15 +1046,15 @@ stats_summary(struct conf *conf)
 			stats_info[i].fn(counters->data[stat]);
 			printf("\n");
 		} else {
-			printf("%8u\n", counters->data[stat]);
+			printf("%8llu\n", (unsigned long long)counters->data[stat]);
 		}
 
 		if (stat == STATS_TOCACHE) {
-			unsigned direct = counters->data[STATS_CACHEHIT_DIR];
-			unsigned preprocessed = counters->data[STATS_CACHEHIT_CPP];
-			unsigned hit = direct + preprocessed;
-			unsigned miss = counters->data[STATS_TOCACHE];
-			unsigned total = hit + miss;
+			uint64_t direct = counters->data[STATS_CACHEHIT_DIR];
+			uint64_t preprocessed = counters->data[STATS_CACHEHIT_CPP];
+			uint64_t hit = direct + preprocessed;
+			uint64_t miss = counters->data[STATS_TOCACHE];
+			uint64_t total = hit + miss;
 			double percent = total > 0 ? (100.0f * hit) / total : 0.0f;
 			printf("cache hit rate                    %6.2f %%\n", percent);
 		}
@@ -521,7 +1069,87 @@ stats_summary(struct conf *conf)
 		printf("\n");
 	}
 
+	if (verbose) {
+		display_phase_histograms(histograms);
+	}
+
+	counters_free(counters);
+}
+
+enum stats_format {
+	STATS_FORMAT_RAW,
+	STATS_FORMAT_JSON,
+	STATS_FORMAT_PROMETHEUS
+};
+
+static void
+print_stat(enum stats_format format, const char *id, const char *help,
+           bool gauge, uint64_t value, bool first)
+{
+	switch (format) {
+	case STATS_FORMAT_RAW:
+		printf("%s\t%llu\n", id, (unsigned long long)value);
+		break;
+
+	case STATS_FORMAT_JSON:
+		printf("%s\n  \"%s\": %llu",
+		       first ? "{" : ",", id, (unsigned long long)value);
+		break;
+
+	case STATS_FORMAT_PROMETHEUS:
+		printf("# HELP ccache_%s%s %s\n", id, gauge ? "" : "_total", help);
+		printf("# TYPE ccache_%s%s %s\n",
+		       id, gauge ? "" : "_total", gauge ? "gauge" : "counter");
+		printf("ccache_%s%s %llu\n",
+		       id, gauge ? "" : "_total", (unsigned long long)value);
+		break;
+	}
+}
+
+// Print the total stats for all cache dirs in a format for other programs:
+// "raw" (tab-separated key and value per line), "json" or "prometheus" (the
+// Prometheus text exposition format). All counters are printed, also zero
+// ones, and the keys are stable. Returns false if the format is unknown.
+bool
+stats_print(struct conf *conf, const char *format_name)
+{
+	enum stats_format format;
+	if (str_eq(format_name, "raw")) {
+		format = STATS_FORMAT_RAW;
+	} else if (str_eq(format_name, "json")) {
+		format = STATS_FORMAT_JSON;
+	} else if (str_eq(format_name, "prometheus")) {
+		format = STATS_FORMAT_PROMETHEUS;
+	} else {
+		return false;
+	}
+
+	assert(conf);
+
+	struct counters *counters = counters_init(STATS_END);
+	time_t updated = collect_stats(conf, counters, NULL);
+
+	print_stat(format, "stats_zeroed_timestamp",
+	           "Time when the statistics were last zeroed.", true,
+	           counters->data[STATS_ZEROTIMESTAMP], true);
+	print_stat(format, "stats_updated_timestamp",
+	           "Time when the statistics were last updated.", true,
+	           (uint64_t)updated, false);
+	for (int i = 0; stats_info[i].message; i++) {
+		if (stats_info[i].flags & FLAG_NEVER) {
+			continue;
+		}
+		// Counters that aren't zeroed describe the cache contents.
+		bool gauge = stats_info[i].flags & FLAG_NOZERO;
+		print_stat(format, stats_info[i].id, stats_info[i].message, gauge,
+		           counters->data[stats_info[i].stat], false);
+	}
+	if (format == STATS_FORMAT_JSON) {
+		printf("\n}\n");
+	}
+
 	counters_free(counters);
+	return true;
 }
 
 // Zero all the stats structures.
@@ -545,6 +1173,8 @@ stats_zero(void)
 		}
 		if (lockfile_acquire(fname, lock_staleness_limit)) {
 			stats_read(fname, counters);
+			read_shared_counters(fname, counters, NULL, true);
+			zero_shared_histograms(fname);
 			for (unsigned i = 0; stats_info[i].message; i++) {
 				if (!(stats_info[i].flags & FLAG_NOZERO)) {
 					counters->data[stats_info[i].stat] = 0;
@@ -581,6 +1211,7 @@ stats_set_sizes(const char *dir, unsigned num_files, uint64_t total_size)
 	char *statsfile = format("%s/stats", dir);
 	if (lockfile_acquire(statsfile, lock_staleness_limit)) {
 		stats_read(statsfile, counters);
+		read_shared_counters(statsfile, counters, NULL, true);
 		counters->data[STATS_NUMFILES] = num_files;
 		counters->data[STATS_TOTALSIZE] = total_size / 1024;
 		stats_write(statsfile, counters);
@@ -598,6 +1229,7 @@ stats_add_cleanup(const char *dir, unsigned count)
 	char *statsfile = format("%s/stats", dir);
 	if (lockfile_acquire(statsfile, lock_staleness_limit)) {
 		stats_read(statsfile, counters);
+		read_shared_counters(statsfile, counters, NULL, true);
 		counters->data[STATS_NUMCLEANUPS] += count;
 		stats_write(statsfile, counters);
 		lockfile_release(statsfile);
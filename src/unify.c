@@ -29,8 +29,6 @@
 
 #include "ccache.h"
 
-static bool print_unified = true;
-
 static const char *const s_tokens[] = {
 	"...", ">>=", "<<=", "+=", "-=", "*=", "/=", "%=", "&=", "^=",
 	"|=",  ">>",  "<<",  "++", "--", "->", "&&", "||", "<=", ">=",
@@ -49,12 +47,26 @@ static const char *const s_tokens[] = {
 #define C_FLOAT 64
 #define C_SIGN  128
 
+// Character classes (C_*), kept separate from the token table below to keep
+// the table used in the inner loops small.
+static unsigned char char_type[256];
+
 static struct {
-	unsigned char type;
 	unsigned char num_toks;
+	unsigned char tok_lens[7];
 	const char *toks[7];
 } tokens[256];
 
+// Size of the buffer that unified output is collected in before it's hashed.
+#define UNIFY_BUFFER_SIZE (16 * 1024)
+
+struct unify_output {
+	struct hash *hash;
+	bool print;
+	size_t len;
+	char buf[UNIFY_BUFFER_SIZE];
+};
+
 // Build up the table used by the unifier.
 static void
 build_table(void)
@@ -65,197 +77,228 @@ build_table(void)
 	}
 	done = true;
 
+	memset(char_type, 0, sizeof(char_type));
 	memset(tokens, 0, sizeof(tokens));
 	for (unsigned char c = 0; c < 128; c++) {
 		if (isalpha(c) || c == '_') {
-			tokens[c].type |= C_ALPHA;
+			char_type[c] |= C_ALPHA;
 		}
 		if (isdigit(c)) {
-			tokens[c].type |= C_DIGIT;
+			char_type[c] |= C_DIGIT;
 		}
 		if (isspace(c)) {
-			tokens[c].type |= C_SPACE;
+			char_type[c] |= C_SPACE;
 		}
 		if (isxdigit(c)) {
-			tokens[c].type |= C_HEX;
+			char_type[c] |= C_HEX;
 		}
 	}
-	tokens['\''].type |= C_QUOTE;
-	tokens['"'].type |= C_QUOTE;
-	tokens['l'].type |= C_FLOAT;
-	tokens['L'].type |= C_FLOAT;
-	tokens['f'].type |= C_FLOAT;
-	tokens['F'].type |= C_FLOAT;
-	tokens['U'].type |= C_FLOAT;
-	tokens['u'].type |= C_FLOAT;
+	char_type['\''] |= C_QUOTE;
+	char_type['"'] |= C_QUOTE;
+	char_type['l'] |= C_FLOAT;
+	char_type['L'] |= C_FLOAT;
+	char_type['f'] |= C_FLOAT;
+	char_type['F'] |= C_FLOAT;
+	char_type['U'] |= C_FLOAT;
+	char_type['u'] |= C_FLOAT;
 
-	tokens['-'].type |= C_SIGN;
-	tokens['+'].type |= C_SIGN;
+	char_type['-'] |= C_SIGN;
+	char_type['+'] |= C_SIGN;
 
 	for (int i = 0; s_tokens[i]; i++) {
 		unsigned char c = s_tokens[i][0];
-		tokens[c].type |= C_TOKEN;
+		char_type[c] |= C_TOKEN;
 		tokens[c].toks[tokens[c].num_toks] = s_tokens[i];
+		tokens[c].tok_lens[tokens[c].num_toks] = strlen(s_tokens[i]);
 		tokens[c].num_toks++;
 	}
 }
 
-// Buffer up characters before hashing them.
 static void
-pushchar(struct mdfour *hash, unsigned char c)
+flush(struct unify_output *out)
 {
-	static unsigned char buf[64];
-	static size_t len;
+	if (out->len > 0) {
+		hash_buffer(out->hash, out->buf, out->len);
+		if (out->print) {
+			fwrite(out->buf, 1, out->len, stdout);
+		}
+		out->len = 0;
+	}
+}
 
-	if (c == 0) {
-		if (len > 0) {
-			hash_buffer(hash, (char *)buf, len);
-			if (print_unified) {
-				printf("%.*s", (int) len, buf);
-			}
-			len = 0;
+static inline void
+append(struct unify_output *out, const unsigned char *s, size_t n)
+{
+	while (n > 0) {
+		if (out->len == UNIFY_BUFFER_SIZE) {
+			flush(out);
 		}
-		hash_buffer(hash, NULL, 0);
-		return;
+		size_t chunk = MIN(n, UNIFY_BUFFER_SIZE - out->len);
+		memcpy(out->buf + out->len, s, chunk);
+		out->len += chunk;
+		s += chunk;
+		n -= chunk;
 	}
+}
 
-	buf[len++] = c;
-	if (len == 64) {
-		hash_buffer(hash, (char *)buf, len);
-		if (print_unified) {
-			printf("%.*s", (int) len, buf);
+// Emit a token followed by a newline.
+static inline void
+emit_token(struct unify_output *out, const unsigned char *s, size_t n)
+{
+	if (out->len + n >= UNIFY_BUFFER_SIZE) {
+		append(out, s, n);
+		flush(out);
+	} else if (n <= 8) {
+		// Most tokens are short; avoid a memcpy call for them.
+		for (size_t i = 0; i < n; i++) {
+			out->buf[out->len + i] = s[i];
 		}
-		len = 0;
+		out->len += n;
+	} else {
+		memcpy(out->buf + out->len, s, n);
+		out->len += n;
+	}
+	out->buf[out->len++] = '\n';
+}
+
+// Like emit_token but drops NUL characters, which the unifier has always
+// skipped in directives, string literals and unknown characters.
+static void
+emit_token_without_nul(struct unify_output *out, const unsigned char *s,
+                       size_t n)
+{
+	const unsigned char *nul;
+	while ((nul = memchr(s, '\0', n))) {
+		append(out, s, nul - s);
+		n -= nul - s + 1;
+		s = nul + 1;
 	}
+	emit_token(out, s, n);
 }
 
-// Hash some C/C++ code after unifying.
+// Hash some C/C++ code after unifying. p[size] must be readable and NUL, which
+// lets the scanning loops stop at the end without checking the length.
 static void
-unify(struct mdfour *hash, unsigned char *p, size_t size)
+unify(struct unify_output *out, const unsigned char *p, size_t size)
 {
 	build_table();
 
-	for (size_t ofs = 0; ofs < size; ) {
-		if (p[ofs] == '#') {
-			if ((size-ofs) > 2 && p[ofs+1] == ' ' && isdigit(p[ofs+2])) {
-				do {
-					ofs++;
-				} while (ofs < size && p[ofs] != '\n');
-				ofs++;
-			} else {
-				do {
-					pushchar(hash, p[ofs]);
-					ofs++;
-				} while (ofs < size && p[ofs] != '\n');
-				pushchar(hash, '\n');
-				ofs++;
+	size_t ofs = 0;
+	while (ofs < size) {
+		size_t start = ofs;
+		unsigned char c = p[ofs];
+		unsigned char type = char_type[c];
+
+		if (c == '#') {
+			const unsigned char *eol = memchr(p + ofs, '\n', size - ofs);
+			size_t end = eol ? (size_t)(eol - p) : size;
+			// Skip linemarkers ("# 17 ...").
+			if (!(size - ofs > 2 && p[ofs + 1] == ' ' && isdigit(p[ofs + 2]))) {
+				emit_token_without_nul(out, p + ofs, end - ofs);
 			}
+			ofs = end + 1;
 			continue;
 		}
 
-		if (tokens[p[ofs]].type & C_ALPHA) {
+		if (type & C_ALPHA) {
 			do {
-				pushchar(hash, p[ofs]);
 				ofs++;
-			} while (ofs < size && (tokens[p[ofs]].type & (C_ALPHA|C_DIGIT)));
-			pushchar(hash, '\n');
+			} while (char_type[p[ofs]] & (C_ALPHA|C_DIGIT));
+			emit_token(out, p + start, ofs - start);
 			continue;
 		}
 
-		if (tokens[p[ofs]].type & C_DIGIT) {
+		if (type & C_DIGIT) {
 			do {
-				pushchar(hash, p[ofs]);
 				ofs++;
-			} while (ofs < size &&
-			         ((tokens[p[ofs]].type & C_DIGIT) || p[ofs] == '.'));
-			if (ofs < size && (p[ofs] == 'x' || p[ofs] == 'X')) {
+			} while ((char_type[p[ofs]] & C_DIGIT) || p[ofs] == '.');
+			if (p[ofs] == 'x' || p[ofs] == 'X') {
 				do {
-					pushchar(hash, p[ofs]);
 					ofs++;
-				} while (ofs < size && (tokens[p[ofs]].type & C_HEX));
+				} while (char_type[p[ofs]] & C_HEX);
 			}
-			if (ofs < size && (p[ofs] == 'E' || p[ofs] == 'e')) {
-				pushchar(hash, p[ofs]);
-				ofs++;
-				while (ofs < size && (tokens[p[ofs]].type & (C_DIGIT|C_SIGN))) {
-					pushchar(hash, p[ofs]);
+			if (p[ofs] == 'E' || p[ofs] == 'e') {
+				do {
 					ofs++;
-				}
+				} while (char_type[p[ofs]] & (C_DIGIT|C_SIGN));
 			}
-			while (ofs < size && (tokens[p[ofs]].type & C_FLOAT)) {
-				pushchar(hash, p[ofs]);
+			while (char_type[p[ofs]] & C_FLOAT) {
 				ofs++;
 			}
-			pushchar(hash, '\n');
+			emit_token(out, p + start, ofs - start);
 			continue;
 		}
 
-		if (tokens[p[ofs]].type & C_SPACE) {
+		if (type & C_SPACE) {
 			do {
 				ofs++;
-			} while (ofs < size && (tokens[p[ofs]].type & C_SPACE));
+			} while (char_type[p[ofs]] & C_SPACE);
 			continue;
 		}
 
-		if (tokens[p[ofs]].type & C_QUOTE) {
-			unsigned char q = p[ofs];
-			pushchar(hash, p[ofs]);
+		if (type & C_QUOTE) {
+			// Find the closing quote, skipping escaped characters. An unterminated
+			// literal extends to the end of the input.
 			do {
 				ofs++;
-				while (ofs < size-1 && p[ofs] == '\\') {
-					pushchar(hash, p[ofs]);
-					pushchar(hash, p[ofs+1]);
+				while (ofs < size - 1 && p[ofs] == '\\') {
 					ofs += 2;
 				}
-				pushchar(hash, p[ofs]);
-			} while (ofs < size && p[ofs] != q);
-			pushchar(hash, '\n');
+			} while (ofs < size && p[ofs] != c);
+			emit_token_without_nul(out, p + start, MIN(ofs + 1, size) - start);
 			ofs++;
 			continue;
 		}
 
-		if (tokens[p[ofs]].type & C_TOKEN) {
-			unsigned char q = p[ofs];
+		if (type & C_TOKEN) {
 			int i;
-			for (i = 0; i < tokens[q].num_toks; i++) {
-				unsigned char *s = (unsigned char *)tokens[q].toks[i];
-				int len = strlen((char *)s);
-				if (size >= ofs+len && memcmp(&p[ofs], s, len) == 0) {
-					int j;
-					for (j = 0; s[j]; j++) {
-						pushchar(hash, s[j]);
-						ofs++;
+			for (i = 0; i < tokens[c].num_toks; i++) {
+				// Tokens are at most three characters long and the comparison stops
+				// at the terminating NUL at the latest.
+				const char *tok = tokens[c].toks[i];
+				if (p[ofs + 1] == tok[1] || tok[1] == '\0') {
+					size_t len = tokens[c].tok_lens[i];
+					if (len < 3 || p[ofs + 2] == tok[2]) {
+						emit_token(out, p + ofs, len);
+						ofs += len;
+						break;
 					}
-					pushchar(hash, '\n');
-					break;
 				}
 			}
-			if (i < tokens[q].num_toks) {
+			if (i < tokens[c].num_toks) {
 				continue;
 			}
 		}
 
-		pushchar(hash, p[ofs]);
-		pushchar(hash, '\n');
+		emit_token_without_nul(out, p + ofs, 1);
 		ofs++;
 	}
-	pushchar(hash, 0);
+	flush(out);
 }
 
+// Hash preprocessor output in data (with data[size] being NUL) after unifying
+// it. If print is true, the unified output is also written to stdout.
+void
+unify_buffer(struct hash *hash, const char *data, size_t size, bool print)
+{
+	struct unify_output out;
+	out.hash = hash;
+	out.print = print;
+	out.len = 0;
+	unify(&out, (const unsigned char *)data, size);
+}
 
 // Hash a file that consists of preprocessor output, but remove any line number
-// information from the hash.
+// information from the hash. shared is as for map_file().
 int
-unify_hash(struct mdfour *hash, const char *fname, bool debug)
+unify_hash(struct hash *hash, const char *fname, bool shared, bool debug)
 {
-	char *data;
-	size_t size;
-	if (!read_file(fname, 0, &data, &size)) {
+	struct mapped_file file;
+	if (!map_file(fname, 0, shared, &file)) {
 		stats_update(STATS_PREPROCESSOR);
 		return -1;
 	}
-	print_unified = debug;
-	unify(hash, (unsigned char *)data, size);
-	free(data);
+	unify_buffer(hash, file.data, file.size, debug);
+	unmap_file(&file);
 	return 0;
 }
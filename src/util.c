@@ -17,14 +17,19 @@
 
 #include "ccache.h"
 
-#include <zlib.h>
-
 #ifdef HAVE_PWD_H
 #include <pwd.h>
 #endif
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 #ifdef _WIN32
 #include <sys/locking.h>
@@ -186,18 +191,38 @@ fatal(const char *format, ...)
 	x_exit(1);
 }
 
-// Copy all data from fd_in to fd_out, decompressing data from fd_in if needed.
+// Write size bytes from buf to fd. Returns true on success, otherwise false
+// with errno set.
+bool
+write_fd(int fd, const void *buf, size_t size)
+{
+	size_t written = 0;
+	while (written < size) {
+		ssize_t count = write(fd, (const char *)buf + written, size - written);
+		if (count == -1) {
+			if (errno != EAGAIN && errno != EINTR) {
+				return false;
+			}
+		} else {
+			written += count;
+		}
+	}
+	return true;
+}
+
+// Copy all data from the current position of fd_in to fd_out.
 void
 copy_fd(int fd_in, int fd_out)
 {
-	gzFile gz_in = gzdopen(dup(fd_in), "rb");
-	if (!gz_in) {
-		fatal("Failed to copy fd");
-	}
-
-	int n;
+	ssize_t n;
 	char buf[READ_BUFFER_SIZE];
-	while ((n = gzread(gz_in, buf, sizeof(buf))) > 0) {
+	while ((n = read(fd_in, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fatal("Failed to copy fd");
+		}
 		ssize_t written = 0;
 		do {
 			ssize_t count = write(fd_out, buf + written, n - written);
@@ -210,8 +235,76 @@ copy_fd(int fd_in, int fd_out)
 			}
 		} while (written < n);
 	}
+}
 
-	gzclose(gz_in);
+// Make fd_out share the data blocks of fd_in. This only works on file systems
+// that support reflinks (like btrfs and XFS) and if both files are on the same
+// file system. Returns false if the file couldn't be cloned.
+bool
+clone_fd(int fd_in, int fd_out)
+{
+#ifdef FICLONE
+	return ioctl(fd_out, FICLONE, fd_in) == 0;
+#else
+	(void)fd_in;
+	(void)fd_out;
+	return false;
+#endif
+}
+
+// Copy size bytes starting at offset in fd_in to the current position of
+// fd_out, without decompressing. copy_file_range() and sendfile() are tried
+// first so that the kernel can copy the data without passing it through user
+// space (or share the blocks, on some file systems), and a buffered copy is
+// done for whatever they couldn't copy. Returns false on error or if fd_in is
+// too short.
+bool
+copy_fd_range(int fd_in, uint64_t offset, int fd_out, uint64_t size)
+{
+	off_t off = offset;
+#ifdef HAVE_COPY_FILE_RANGE
+	while (size > 0) {
+		ssize_t n = copy_file_range(fd_in, &off, fd_out, NULL, size, 0);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		size -= n;
+	}
+#endif
+#ifdef HAVE_SENDFILE
+	while (size > 0) {
+		ssize_t n = sendfile(fd_out, fd_in, &off, MIN(size, 0x40000000));
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		size -= n;
+	}
+#endif
+	if (size == 0) {
+		return true;
+	}
+
+	if (lseek(fd_in, off, SEEK_SET) != off) {
+		return false;
+	}
+	char buf[READ_BUFFER_SIZE];
+	while (size > 0) {
+		ssize_t n = read(fd_in, buf, MIN(size, sizeof(buf)));
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0 || !write_fd(fd_out, buf, n)) {
+			return false;
+		}
+		size -= n;
+	}
+	return true;
 }
 
 #ifndef HAVE_MKSTEMP
@@ -239,22 +332,18 @@ get_umask(void)
 }
 #endif
 
-// Copy src to dest, decompressing src if needed. compress_level > 0 decides
-// whether dest will be compressed, and with which compression level. Returns 0
-// on success and -1 on failure. On failure, errno represents the error.
+// Copy src to dest. The file is cloned with clone_fd() if possible and copied
+// with copy_fd_range() otherwise. Returns 0 on success and -1 on failure. On
+// failure, errno represents the error.
 int
-copy_file(const char *src, const char *dest, int compress_level)
+copy_file(const char *src, const char *dest)
 {
-	int fd_out;
-	gzFile gz_in = NULL;
-	gzFile gz_out = NULL;
 	int saved_errno = 0;
 
 	// Open destination file.
 	char *tmp_name = x_strdup(dest);
-	fd_out = create_tmp_fd(&tmp_name);
-	cc_log("Copying %s to %s via %s (%scompressed)",
-	       src, dest, tmp_name, compress_level > 0 ? "" : "un");
+	int fd_out = create_tmp_fd(&tmp_name);
+	cc_log("Copying %s to %s via %s", src, dest, tmp_name);
 
 	// Open source file.
 	int fd_in = open(src, O_RDONLY | O_BINARY);
@@ -264,90 +353,19 @@ copy_file(const char *src, const char *dest, int compress_level)
 		goto error;
 	}
 
-	gz_in = gzdopen(fd_in, "rb");
-	if (!gz_in) {
+	struct stat st;
+	if (x_fstat(fd_in, &st) != 0) {
 		saved_errno = errno;
-		cc_log("gzdopen(src) error: %s", strerror(saved_errno));
 		close(fd_in);
 		goto error;
 	}
-
-	if (compress_level > 0) {
-		// A gzip file occupies at least 20 bytes, so it will always occupy an
-		// entire filesystem block, even for empty files. Turn off compression for
-		// empty files to save some space.
-		struct stat st;
-		if (x_fstat(fd_in, &st) != 0) {
-			goto error;
-		}
-		if (file_size(&st) == 0) {
-			compress_level = 0;
-		}
-	}
-
-	if (compress_level > 0) {
-		gz_out = gzdopen(dup(fd_out), "wb");
-		if (!gz_out) {
-			saved_errno = errno;
-			cc_log("gzdopen(dest) error: %s", strerror(saved_errno));
-			goto error;
-		}
-		gzsetparams(gz_out, compress_level, Z_DEFAULT_STRATEGY);
-	}
-
-	int n;
-	char buf[READ_BUFFER_SIZE];
-	while ((n = gzread(gz_in, buf, sizeof(buf))) > 0) {
-		int written;
-		if (compress_level > 0) {
-			written = gzwrite(gz_out, buf, n);
-		} else {
-			written = 0;
-			do {
-				ssize_t count = write(fd_out, buf + written, n - written);
-				if (count == -1 && errno != EINTR) {
-					saved_errno = errno;
-					break;
-				}
-				written += count;
-			} while (written < n);
-		}
-		if (written != n) {
-			if (compress_level > 0) {
-				int errnum;
-				cc_log("gzwrite error: %s (errno: %s)",
-				       gzerror(gz_in, &errnum),
-				       strerror(saved_errno));
-			} else {
-				cc_log("write error: %s", strerror(saved_errno));
-			}
-			goto error;
-		}
-	}
-
-	// gzeof won't tell if there's an error in the trailing CRC, so we must check
-	// gzerror before considering everything OK.
-	int errnum;
-	gzerror(gz_in, &errnum);
-	if (!gzeof(gz_in) || (errnum != Z_OK && errnum != Z_STREAM_END)) {
-		saved_errno = errno;
-		cc_log("gzread error: %s (errno: %s)",
-		       gzerror(gz_in, &errnum), strerror(saved_errno));
-		gzclose(gz_in);
-		if (gz_out) {
-			gzclose(gz_out);
-		}
-		close(fd_out);
-		tmp_unlink(tmp_name);
-		free(tmp_name);
-		return -1;
-	}
-
-	gzclose(gz_in);
-	gz_in = NULL;
-	if (gz_out) {
-		gzclose(gz_out);
-		gz_out = NULL;
+	bool ok = clone_fd(fd_in, fd_out)
+	          || copy_fd_range(fd_in, 0, fd_out, st.st_size);
+	saved_errno = errno;
+	close(fd_in);
+	if (!ok) {
+		cc_log("copy error: %s", strerror(saved_errno));
+		goto error;
 	}
 
 #ifndef _WIN32
@@ -357,9 +375,11 @@ copy_file(const char *src, const char *dest, int compress_level)
 	// The close can fail on NFS if out of space.
 	if (close(fd_out) == -1) {
 		saved_errno = errno;
+		fd_out = -1;
 		cc_log("close error: %s", strerror(saved_errno));
 		goto error;
 	}
+	fd_out = -1;
 
 	if (x_rename(tmp_name, dest) == -1) {
 		saved_errno = errno;
@@ -372,12 +392,6 @@ copy_file(const char *src, const char *dest, int compress_level)
 	return 0;
 
 error:
-	if (gz_in) {
-		gzclose(gz_in);
-	}
-	if (gz_out) {
-		gzclose(gz_out);
-	}
 	if (fd_out != -1) {
 		close(fd_out);
 	}
@@ -387,48 +401,6 @@ error:
 	return -1;
 }
 
-// Run copy_file() and, if successful, delete the source file.
-int
-move_file(const char *src, const char *dest, int compress_level)
-{
-	int ret = copy_file(src, dest, compress_level);
-	if (ret != -1) {
-		x_unlink(src);
-	}
-	return ret;
-}
-
-// Like move_file(), but assumes that src is uncompressed and that src and dest
-// are on the same file system.
-int
-move_uncompressed_file(const char *src, const char *dest, int compress_level)
-{
-	if (compress_level > 0) {
-		return move_file(src, dest, compress_level);
-	} else {
-		return x_rename(src, dest);
-	}
-}
-
-// Test if a file is zlib compressed.
-bool
-file_is_compressed(const char *filename)
-{
-	FILE *f = fopen(filename, "rb");
-	if (!f) {
-		return false;
-	}
-
-	// Test if file starts with 1F8B, which is zlib's magic number.
-	if ((fgetc(f) != 0x1f) || (fgetc(f) != 0x8b)) {
-		fclose(f);
-		return false;
-	}
-
-	fclose(f);
-	return true;
-}
-
 // Make sure a directory exists.
 int
 create_dir(const char *dir)
@@ -571,8 +543,8 @@ char *
 format_hash_as_string(const unsigned char *hash, int size)
 {
 	int i;
-	char *ret = x_malloc(53);
-	for (i = 0; i < 16; i++) {
+	char *ret = x_malloc(2 * DIGEST_SIZE + 12);
+	for (i = 0; i < DIGEST_SIZE; i++) {
 		sprintf(&ret[i*2], "%02x", (unsigned) hash[i]);
 	}
 	if (size >= 0) {
@@ -1315,6 +1287,42 @@ update_mtime(const char *path)
 #endif
 }
 
+// Return the time in microseconds since an unspecified point, from a clock that
+// isn't affected by changes of the system time if available. Only useful for
+// measuring durations.
+int64_t
+time_monotonic_us(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+	return (int64_t)time(NULL) * 1000000;
+#endif
+}
+
+// Return the user and system CPU time in microseconds used by terminated and
+// waited for child processes, or 0 if not available.
+int64_t
+time_children_cpu_us(void)
+{
+#if defined(HAVE_GETRUSAGE) && defined(RUSAGE_CHILDREN)
+	struct rusage usage;
+	if (getrusage(RUSAGE_CHILDREN, &usage) == 0) {
+		return ((int64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+		       + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+	}
+#endif
+	return 0;
+}
+
 // If exit() already has been called, call _exit(), otherwise exit(). This is
 // used to avoid calling exit() inside an atexit handler.
 void
@@ -1452,29 +1460,22 @@ x_readlink(const char *path)
 }
 #endif
 
-// Reads the content of a file. Size hint 0 means no hint. Returns true on
-// success, otherwise false.
-bool
-read_file(const char *path, size_t size_hint, char **data, size_t *size)
+// Read the remaining content of fd into a heap buffer. The buffer has room for
+// at least one byte after the content. Returns true on success, otherwise false
+// with errno set.
+static bool
+read_fd(int fd, size_t size_hint, char **data, size_t *size)
 {
-	if (size_hint == 0) {
-		struct stat st;
-		if (x_stat(path, &st) == 0) {
-			size_hint = st.st_size;
-		}
-	}
 	size_hint = (size_hint < 1024) ? 1024 : size_hint;
 
-	int fd = open(path, O_RDONLY | O_BINARY);
-	if (fd == -1) {
-		return false;
-	}
-	size_t allocated = size_hint;
+	// Make room for one byte more than the hint so that the read() that detects
+	// end of file doesn't force the buffer to grow.
+	size_t allocated = size_hint + 1;
 	*data = x_malloc(allocated);
 	int ret;
 	size_t pos = 0;
 	while (true) {
-		if (pos > allocated / 2) {
+		if (pos == allocated) {
 			allocated *= 2;
 			*data = x_realloc(*data, allocated);
 		}
@@ -1486,11 +1487,11 @@ read_file(const char *path, size_t size_hint, char **data, size_t *size)
 			pos += ret;
 		}
 	}
-	close(fd);
 	if (ret == -1) {
-		cc_log("Failed reading %s", path);
+		int saved_errno = errno;
 		free(*data);
 		*data = NULL;
+		errno = saved_errno;
 		return false;
 	}
 
@@ -1498,6 +1499,116 @@ read_file(const char *path, size_t size_hint, char **data, size_t *size)
 	return true;
 }
 
+// Reads the content of a file. Size hint 0 means no hint. Returns true on
+// success, otherwise false.
+bool
+read_file(const char *path, size_t size_hint, char **data, size_t *size)
+{
+	if (size_hint == 0) {
+		struct stat st;
+		if (x_stat(path, &st) == 0) {
+			size_hint = st.st_size;
+		}
+	}
+
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd == -1) {
+		return false;
+	}
+	bool ok = read_fd(fd, size_hint, data, size);
+	close(fd);
+	if (!ok) {
+		cc_log("Failed reading %s", path);
+	}
+	return ok;
+}
+
+// Make the content of a file available in memory. Large regular files are
+// memory mapped (copy-on-write, so the caller may modify the data) and other
+// files are read into a heap buffer. Files that are shared, i.e. that programs
+// other than ccache may modify (like source files), are always read since
+// accessing a mapping of a file that is truncated raises SIGBUS. Size hint 0
+// means no hint. Returns true on success, otherwise false with errno set. The
+// content must be released with unmap_file().
+//
+// This function doesn't log anything, so it may be called from worker threads.
+bool
+map_file(const char *path, size_t size_hint, bool shared,
+         struct mapped_file *file)
+{
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd == -1) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		int saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+		return false;
+	}
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+	file->mtime = st.st_mtime;
+
+#ifdef HAVE_SYS_MMAN_H
+	size_hint = st.st_size;
+
+	// The byte after the content has to be NUL, and since mapping past the end
+	// of the file isn't allowed, it must come from the zero-filled remainder of
+	// the last page. Files with a size that is a multiple of the page size are
+	// therefore read instead.
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (!shared
+	    && S_ISREG(st.st_mode)
+	    && (size_t)st.st_size >= MMAP_MIN_SIZE
+	    && page_size > 0
+	    && st.st_size % page_size != 0) {
+		void *p =
+		  mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			close(fd);
+#ifdef MADV_SEQUENTIAL
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+#endif
+			file->data = p;
+			file->size = st.st_size;
+			file->mapped = true;
+			return true;
+		}
+		// Fall back to reading.
+	}
+#endif
+
+	bool ok = read_fd(fd, size_hint, &file->data, &file->size);
+	int saved_errno = errno;
+	close(fd);
+	if (!ok) {
+		errno = saved_errno;
+		return false;
+	}
+	file->data[file->size] = '\0';
+	file->mapped = false;
+	return true;
+}
+
+// Release content returned by map_file().
+void
+unmap_file(struct mapped_file *file)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (file->mapped) {
+		munmap(file->data, file->size);
+	} else {
+		free(file->data);
+	}
+#else
+	free(file->data);
+#endif
+	file->data = NULL;
+	file->size = 0;
+}
+
 // Return the content (with NUL termination) of a text file, or NULL on error.
 // Caller frees. Size hint 0 means no hint.
 char *
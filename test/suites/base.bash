@@ -623,6 +623,65 @@ EOF
     expect_stat 'cache hit (preprocessed)' 2
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPILERCHECK=content with remembered fingerprint"
+
+    cat >compiler.sh <<EOF
+#!/bin/sh
+export CCACHE_DISABLE=1 # If $COMPILER happens to be a ccache symlink...
+exec $COMPILER "\$@"
+# A comment
+EOF
+    chmod +x compiler.sh
+    backdate compiler.sh
+    sleep 1 # The inode cache is only used for files with an old ctime.
+
+    CCACHE_COMPILERCHECK=content $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    CCACHE_COMPILERCHECK=content $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+
+    sed_in_place 's/comment/yoghurt/' compiler.sh # Don't change the size
+    chmod +x compiler.sh
+    backdate compiler.sh # Don't change the timestamp
+
+    CCACHE_COMPILERCHECK=content $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPILERCHECK=command with sloppiness compiler_check_output"
+
+    cat >compiler.sh <<EOF
+#!/bin/sh
+export CCACHE_DISABLE=1 # If $COMPILER happens to be a ccache symlink...
+exec $COMPILER "\$@"
+EOF
+    chmod +x compiler.sh
+    backdate compiler.sh
+    sleep 1 # The inode cache is only used for files with an old ctime.
+    echo 1 >version
+
+    CCACHE_COMPILERCHECK="cat version" CCACHE_SLOPPINESS=compiler_check_output \
+        $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    # The remembered output is used although the command now prints something
+    # else.
+    echo 2 >version
+    CCACHE_COMPILERCHECK="cat version" CCACHE_SLOPPINESS=compiler_check_output \
+        $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+
+    CCACHE_COMPILERCHECK="cat version" $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 2
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_COMPILERCHECK=unknown_command"
 
@@ -640,17 +699,22 @@ EOF
     expect_stat 'compiler check failed' 1
 
     # -------------------------------------------------------------------------
-    TEST "CCACHE_RECACHE should remove previous .stderr"
+    TEST "CCACHE_RECACHE should replace the previous result"
 
-    $CCACHE_COMPILE -c test1.c
-    expect_stat 'cache hit (preprocessed)' 0
+    cat <<EOF >stderr.c
+int stderr(void)
+{
+  // Trigger warning by having no return statement.
+}
+EOF
+    $CCACHE_COMPILE -Wall -W -c stderr.c 2>/dev/null
     expect_stat 'cache miss' 1
-    expect_file_count 0 '*.stderr' $CCACHE_DIR
+    expect_stat 'files in cache' 1
 
-    obj_file=`find $CCACHE_DIR -name '*.o'`
-    stderr_file=`echo $obj_file | sed 's/..$/.stderr/'`
-    echo "Warning: foo" >$stderr_file
-    CCACHE_RECACHE=1 $CCACHE_COMPILE -c test1.c
+    CCACHE_RECACHE=1 $CCACHE_COMPILE -Wall -W -c stderr.c 2>/dev/null
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+    expect_stat 'files in cache' 1
     expect_file_count 0 '*.stderr' $CCACHE_DIR
 
     # -------------------------------------------------------------------------
@@ -698,9 +762,39 @@ int stderr(void)
   // Trigger warning by having no return statement.
 }
 EOF
-    $CCACHE_COMPILE -Wall -W -c stderr.c 2>/dev/null
-    expect_file_count 1 '*.stderr' $CCACHE_DIR
-    expect_stat 'files in cache' 2
+    $REAL_COMPILER -Wall -W -c stderr.c -o reference_stderr.o 2>reference_stderr.txt
+    $CCACHE_COMPILE -Wall -W -c stderr.c 2>stderr.txt
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+    expect_equal_files reference_stderr.txt stderr.txt
+
+    # The standard error output is stored in the result file.
+    $CCACHE_COMPILE -Wall -W -c stderr.c 2>stderr.txt
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_file_count 0 '*.stderr' $CCACHE_DIR
+    expect_equal_files reference_stderr.txt stderr.txt
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_LOCKMETHOD=fcntl"
+
+    CCACHE_LOCKMETHOD=fcntl $CCACHE_COMPILE -c test1.c
+    CCACHE_LOCKMETHOD=fcntl $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+    if [ -z "$(find $CCACHE_DIR -name 'stats.lck')" ]; then
+        test_failed "No lock file created"
+    fi
+    if [ -n "$(find $CCACHE_DIR -name '*.lock')" ]; then
+        test_failed "Symlink lock left behind"
+    fi
+
+    # Lock files are neither counted nor removed by cleanup.
+    CCACHE_LOCKMETHOD=fcntl $CCACHE -c >/dev/null
+    expect_stat 'files in cache' 1
+    if [ -z "$(find $CCACHE_DIR -name 'stats.lck')" ]; then
+        test_failed "Lock file removed by cleanup"
+    fi
 
     # -------------------------------------------------------------------------
     TEST "--zero-stats"
@@ -716,6 +810,105 @@ EOF
     expect_stat 'cache miss' 0
     expect_stat 'files in cache' 1
 
+    # -------------------------------------------------------------------------
+    TEST "--show-stats --verbose"
+
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE -s >stats.txt
+    if grep -q "phase duration" stats.txt; then
+        test_failed "Phase durations shown without --verbose"
+    fi
+
+    $CCACHE -s -v >stats.txt
+    for expected in "preprocessor:2" "compiler:1" "get result:2" \
+                    "store result:1"; do
+        phase=${expected%:*}
+        count=$(grep "^$phase  " stats.txt | awk '{print $(NF-6)}')
+        if [ "$count" != "${expected##*:}" ]; then
+            test_failed "Expected ${expected##*:} $phase durations, got \"$count\""
+        fi
+    done
+
+    $CCACHE -z >/dev/null
+    if $CCACHE -s -v | grep -q "phase duration"; then
+        test_failed "Phase durations not zeroed"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "--show-stats before --zero-stats"
+
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+
+    $CCACHE -s -z >stats.txt
+    if ! grep -q "^cache hit (preprocessed)  *1$" stats.txt; then
+        test_failed "Statistics not shown before being zeroed"
+    fi
+    expect_stat 'cache hit (preprocessed)' 0
+
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE -s -z -v >stats.txt
+    if ! grep -q "phase duration" stats.txt; then
+        test_failed "Phase durations not shown with -v after -s"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Time saved"
+
+    $CCACHE_COMPILE -c test1.c
+    if $CCACHE -s | grep -q "time saved"; then
+        test_failed "Time saved shown without cache hits"
+    fi
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    for kind in "wall clock" "CPU"; do
+        if ! $CCACHE -s | grep -q "^time saved ($kind)  *[0-9.]* s$"; then
+            test_failed "No time saved ($kind) shown"
+        fi
+    done
+
+    $CCACHE -z >/dev/null
+    if $CCACHE -s | grep -q "time saved"; then
+        test_failed "Time saved not zeroed"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "--print-stats"
+
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE_COMPILE -c test1.c
+
+    $CCACHE --print-stats | tr '\t' ' ' >stats.txt
+    for expected in "preprocessed_cache_hit 1" "direct_cache_hit 0" \
+                    "cache_miss 1" "files_in_cache 1" "cleanups_performed 0"; do
+        if ! grep -qxF "$expected" stats.txt; then
+            test_failed "Expected \"$expected\" in raw statistics"
+        fi
+    done
+
+    $CCACHE --print-stats --stats-format=json >stats.json
+    for expected in '{' '  "cache_miss": 1,' '}'; do
+        if ! grep -qxF "$expected" stats.json; then
+            test_failed "Expected \"$expected\" in JSON statistics"
+        fi
+    done
+
+    $CCACHE --stats-format=prometheus --print-stats >stats.prom
+    for expected in "# TYPE ccache_cache_miss_total counter" \
+                    "ccache_cache_miss_total 1" \
+                    "# TYPE ccache_files_in_cache gauge"; do
+        if ! grep -qxF "$expected" stats.prom; then
+            test_failed "Expected \"$expected\" in Prometheus statistics"
+        fi
+    done
+
+    if $CCACHE --print-stats --stats-format=unknown >/dev/null 2>&1; then
+        test_failed "Unknown statistics format accepted"
+    fi
+
     # -------------------------------------------------------------------------
     TEST "--clear"
 
@@ -119,7 +119,8 @@ SUITE_cleanup() {
 
     touch empty.c
     CCACHE_LIMIT_MULTIPLE=0.9 $CCACHE_COMPILE -c empty.c -o empty.o
-    expect_file_count 159 '*.o' $CCACHE_DIR
+    expect_file_count 1 '*.result' $CCACHE_DIR
+    expect_file_count 158 '*.o' $CCACHE_DIR
     expect_file_count 159 '*.d' $CCACHE_DIR
     expect_file_count 159 '*.stderr' $CCACHE_DIR
     expect_stat 'files in cache' 477
@@ -142,26 +143,38 @@ SUITE_cleanup() {
 
     touch empty.c
     CCACHE_LIMIT_MULTIPLE=0.7 $CCACHE_COMPILE -c empty.c -o empty.o
-    expect_file_count 157 '*.o' $CCACHE_DIR
+    expect_file_count 1 '*.result' $CCACHE_DIR
+    expect_file_count 156 '*.o' $CCACHE_DIR
     expect_file_count 157 '*.d' $CCACHE_DIR
     expect_file_count 157 '*.stderr' $CCACHE_DIR
     expect_stat 'files in cache' 471
     expect_stat 'cleanups performed' 1
 
     # -------------------------------------------------------------------------
-    TEST ".o file is removed before .stderr"
+    TEST "Contended cleanup lock is counted"
 
-    prepare_cleanup_test_dir $CCACHE_DIR/a
-    $CCACHE -F 464 -M 0 >/dev/null
-    backdate 0 $CCACHE_DIR/a/result9-4017.stderr
-    $CCACHE -c >/dev/null
-    expect_file_missing $CCACHE_DIR/a/result9-4017.stderr
-    expect_file_missing $CCACHE_DIR/a/result9-4017.o
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+    $CCACHE -F 480 -M 0 >/dev/null
 
-    # Counters expectedly doesn't match reality if x.stderr is found before
-    # x.o and the cleanup stops before x.o is found.
-    expect_stat 'files in cache' 29
-    expect_file_count 28 '*.*' $CCACHE_DIR/a
+    # Stale locks that the cleanup has to wait for before breaking them.
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        ln -s foo $CCACHE_DIR/$x/stats.lock
+    done
+    touch empty.c
+    $CCACHE_COMPILE -c empty.c -o empty.o
+    expect_stat 'cleanups performed' 1
+    retries=$($CCACHE --print-stats | awk '$1 == "lock_retries" { print $2 }')
+    if [ "$retries" -eq 0 ]; then
+        test_failed "Lock retries of the automatic cleanup not counted"
+    fi
+
+    $CCACHE -z >/dev/null
+    ln -s foo $CCACHE_DIR/0/stats.lock
+    if ! $CCACHE -c -s | grep -q "^lock retries  *[1-9]"; then
+        test_failed "Lock retries of the forced cleanup not counted"
+    fi
 
     # -------------------------------------------------------------------------
     TEST ".stderr file is not removed before .o"
@@ -226,4 +239,90 @@ SUITE_cleanup() {
     $CCACHE -c >/dev/null
     expect_file_count 1 '.nfs*' $CCACHE_DIR
     expect_stat 'files in cache' 30
+
+    # -------------------------------------------------------------------------
+    TEST "Hard linked result is evicted as a whole"
+
+    echo 'int x;' >test1.c
+    CCACHE_HARDLINK=1 $CCACHE_COMPILE -c test1.c
+    expect_stat 'files in cache' 2
+    local result=$(find $CCACHE_DIR -name '*.result')
+    local object=${result%.result}.o
+    local dir=$(dirname $result)
+    expect_file_exists $object
+
+    # The object file is removed with its older result file instead of the newer
+    # unknown file.
+    backdate 1 $result
+    backdate 2 $object
+    touch $dir/abcd.unknown
+    backdate 3 $dir/abcd.unknown
+    $CCACHE -F 32 -M 0 -c >/dev/null
+    expect_file_missing $result
+    expect_file_missing $object
+    expect_file_exists $dir/abcd.unknown
+    expect_stat 'files in cache' 1
+
+    # The object file is kept with its newer result file although it's older
+    # than the unknown file.
+    CCACHE_HARDLINK=1 $CCACHE_COMPILE -c test1.c
+    backdate 4 $result
+    backdate 1 $object
+    touch $dir/efgh.unknown
+    backdate 3 $dir/efgh.unknown
+    $CCACHE -c >/dev/null
+    expect_file_exists $result
+    expect_file_exists $object
+    expect_file_missing $dir/abcd.unknown
+    expect_file_missing $dir/efgh.unknown
+    expect_stat 'files in cache' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Cleanup of packed results"
+
+    echo 'int x;' >test1.c
+    CCACHE_PACKTHRESHOLD=64k $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_file_count 0 '*.result' $CCACHE_DIR
+    expect_file_count 1 'pack' $CCACHE_DIR
+    expect_file_count 1 'pack.idx' $CCACHE_DIR
+
+    CCACHE_PACKTHRESHOLD=64k $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+
+    $CCACHE -c >/dev/null
+    expect_stat 'files in cache' 1
+    expect_file_count 1 'pack' $CCACHE_DIR
+
+    CCACHE_MAXSIZE=1k $CCACHE -c >/dev/null
+    expect_stat 'files in cache' 0
+    expect_file_count 0 'pack' $CCACHE_DIR
+    expect_file_count 0 'pack.idx' $CCACHE_DIR
+
+    CCACHE_PACKTHRESHOLD=64k $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Broken packed result is replaced"
+
+    echo 'int x;' >test1.c
+    CCACHE_PACKTHRESHOLD=64k $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    # Overwrite the magic number of the result, which follows the 16 byte record
+    # header and the name.
+    local pack=$(find $CCACHE_DIR -name pack)
+    local name_len=$(od -An -t u4 -j 4 -N 4 $pack)
+    printf XXXX | dd of=$pack bs=1 seek=$((16 + name_len)) conv=notrunc 2>/dev/null
+
+    CCACHE_PACKTHRESHOLD=64k $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache file missing' 1
+    expect_stat 'cache miss' 1
+
+    CCACHE_PACKTHRESHOLD=64k $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache file missing' 1
+    expect_stat 'cache miss' 2
+
+    CCACHE_PACKTHRESHOLD=64k $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
 }
@@ -20,4 +20,22 @@ SUITE_compression() {
     expect_stat 'cache hit (direct)' 0
     expect_stat 'cache hit (preprocessed)' 2
     expect_stat 'cache miss' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Compression type is read from the result file"
+
+    $REAL_COMPILER -c -o reference_test.o test.c
+    for type in zlib zstd lz4; do
+        CCACHE_COMPRESS=1 CCACHE_COMPRESSTYPE=$type CCACHE_RECACHE=1 \
+            $CCACHE_COMPILE -c test.c
+        result_file=$(find $CCACHE_DIR -name '*.result')
+        $CCACHE --dump-result $result_file >dump.txt
+        if ! grep -Eq "^Compression type: ($type|zlib)\$" dump.txt; then
+            test_failed "Unexpected compression type for $type"
+        fi
+
+        $CCACHE_COMPILE -c test.c
+        expect_equal_object_files reference_test.o test.o
+    done
+    expect_stat 'cache hit (preprocessed)' 3
 }
@@ -0,0 +1,151 @@
+SUITE_depend_SETUP() {
+    unset CCACHE_NODIRECT
+    export CCACHE_DEPEND=1
+
+    cat <<EOF >test.c
+// test.c
+#include "test1.h"
+#include "test2.h"
+EOF
+    cat <<EOF >test1.h
+#include "test3.h"
+int test1;
+EOF
+    cat <<EOF >test2.h
+int test2;
+EOF
+    cat <<EOF >test3.h
+int test3;
+EOF
+    backdate test1.h test2.h test3.h
+
+    $REAL_COMPILER -c -MD -MF expected.d test.c
+    rm test.o
+}
+
+SUITE_depend() {
+    # -------------------------------------------------------------------------
+    TEST "Base case"
+
+    $REAL_COMPILER -c -o reference_test.o test.c
+
+    CCACHE_LOGFILE=depend.log $CCACHE_COMPILE -MD -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2 # .result + .manifest
+    expect_equal_object_files reference_test.o test.o
+    expect_equal_files test.d expected.d
+    if grep -q "Running preprocessor" depend.log; then
+        test_failed "The preprocessor was run in the depend mode"
+    fi
+
+    rm -f test.o test.d
+    $CCACHE_COMPILE -MD -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+    expect_equal_object_files reference_test.o test.o
+    expect_equal_files test.d expected.d
+
+    # -------------------------------------------------------------------------
+    TEST "Changed include file"
+
+    $CCACHE_COMPILE -MD -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -MD -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+
+    $CCACHE_COMPILE -MD -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Escaped space in dependency file"
+
+    mkdir "dir with space"
+    echo "int space;" >"dir with space/space.h"
+    backdate "dir with space/space.h"
+    echo '#include "dir with space/space.h"' >space.c
+
+    $CCACHE_COMPILE -MD -c space.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -MD -c space.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    echo "int space_2;" >>"dir with space/space.h"
+    backdate "dir with space/space.h"
+    $CCACHE_COMPILE -MD -c space.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Too new include file"
+
+    echo '#include "new.h"' >new.c
+    echo "int new;" >new.h # Not backdated.
+
+    CCACHE_LOGFILE=depend.log $CCACHE_COMPILE -MD -c new.c
+    expect_stat 'cache miss' 0
+    expect_stat 'unhashable dependency' 1
+    expect_file_exists new.o
+    expect_file_exists new.d
+    if [ "$(grep -c "Running real compiler" depend.log)" != 1 ]; then
+        test_failed "The compiler was not run exactly once"
+    fi
+    if $CCACHE -s | grep -q "internal error"; then
+        test_failed "Counted as an internal error"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "No dependency file"
+
+    CCACHE_LOGFILE=depend.log $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    if ! grep -q "Disabling depend mode" depend.log; then
+        test_failed "The depend mode was not disabled"
+    fi
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Depend mode disabled"
+
+    unset CCACHE_DEPEND
+    CCACHE_LOGFILE=depend.log $CCACHE_COMPILE -MD -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    if ! grep -q "Running preprocessor" depend.log; then
+        test_failed "The preprocessor was not run"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Depend mode disabled by the direct mode"
+
+    cat <<EOF >time.c
+const char *t = __TIME__;
+EOF
+    CCACHE_LOGFILE=depend.log $CCACHE_COMPILE -MD -c time.c
+    expect_stat 'cache miss' 1
+    if ! grep -q "Disabling depend mode" depend.log; then
+        test_failed "The depend mode was not disabled"
+    fi
+    if grep "Executing " depend.log | grep -v " -E " | grep -q " -MD"; then
+        test_failed "Dependency arguments were passed to the compiler"
+    fi
+    expect_file_exists time.d
+}
@@ -33,7 +33,7 @@ SUITE_direct() {
     expect_stat 'cache hit (direct)' 0
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 1
-    expect_stat 'files in cache' 2 # .o + .manifest
+    expect_stat 'files in cache' 2 # .result + .manifest
     expect_equal_object_files reference_test.o test.o
 
     $CCACHE_COMPILE -c test.c
@@ -147,7 +147,7 @@ EOF
             test_failed "$dep_file does not contain $dep_target"
         fi
     done
-    expect_stat 'files in cache' 18
+    expect_stat 'files in cache' 12
 
     # -------------------------------------------------------------------------
     TEST "-MMD for different source files"
@@ -435,7 +435,7 @@ EOF
     rm -f third_name.d
 
     # -------------------------------------------------------------------------
-    TEST "Missing .d file"
+    TEST "Corrupt result file"
 
     $CCACHE_COMPILE -c -MD test.c
     expect_stat 'cache hit (direct)' 0
@@ -448,9 +448,10 @@ EOF
     expect_stat 'cache miss' 1
     expect_equal_files test.d expected.d
 
-    find $CCACHE_DIR -name '*.d' -delete
+    result_file=`find $CCACHE_DIR -name '*.result'`
+    printf "cCrS" >$result_file
 
-    # Missing file -> consider the cached result broken.
+    # Truncated result file -> consider the cached result broken.
     $CCACHE_COMPILE -c -MD test.c
     expect_stat 'cache hit (direct)' 1
     expect_stat 'cache hit (preprocessed)' 0
@@ -834,9 +835,23 @@ EOF
     manifest=`find $CCACHE_DIR -name '*.manifest'`
     $CCACHE --dump-manifest $manifest >manifest.dump
 
-    if grep 'Hash: d4de2f956b4a386c6660990a7a1ab13f' manifest.dump >/dev/null 2>&1 && \
-       grep 'Hash: e94ceb9f1b196c387d098a5f1f4fe862' manifest.dump >/dev/null 2>&1 && \
-       grep 'Hash: ba753bebf9b5eb99524bb7447095e2e6' manifest.dump >/dev/null 2>&1; then
+    if grep 'Hash size: 16' manifest.dump >/dev/null 2>&1; then
+        # ccache built with MD4.
+        hashes="d4de2f956b4a386c6660990a7a1ab13f
+                e94ceb9f1b196c387d098a5f1f4fe862
+                ba753bebf9b5eb99524bb7447095e2e6"
+    else
+        hashes="7706603374730d6e19c22f607768040f13be686d
+                0f1d0cf7d790a6a31248d8a52e826dad433d191c
+                d07f2a91a649bc56a1b008279b326201077d341b"
+    fi
+    found=0
+    for hash in $hashes; do
+        if grep "Hash: $hash" manifest.dump >/dev/null 2>&1; then
+            found=$((found + 1))
+        fi
+    done
+    if [ $found -eq 3 ]; then
         : OK
     else
         test_failed "Unexpected output of --dump-manifest"
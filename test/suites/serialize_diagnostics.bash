@@ -19,7 +19,7 @@ SUITE_serialize_diagnostics() {
     $CCACHE_COMPILE -c --serialize-diagnostics test.dia test1.c
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 1
-    expect_stat 'files in cache' 2
+    expect_stat 'files in cache' 1
     expect_equal_files expected.dia test.dia
 
     rm test.dia
@@ -27,7 +27,7 @@ SUITE_serialize_diagnostics() {
     $CCACHE_COMPILE -c --serialize-diagnostics test.dia test1.c
     expect_stat 'cache hit (preprocessed)' 1
     expect_stat 'cache miss' 1
-    expect_stat 'files in cache' 2
+    expect_stat 'files in cache' 1
     expect_equal_files expected.dia test.dia
 
     # -------------------------------------------------------------------------
@@ -74,12 +74,12 @@ EOF
     expect_stat 'cache hit (direct)' 0
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 1
-    expect_stat 'files in cache' 4
+    expect_stat 'files in cache' 2
 
     cd ../dir2
     CCACHE_BASEDIR=`pwd` $CCACHE_COMPILE -w -MD -MF `pwd`/test.d -I`pwd`/include --serialize-diagnostics `pwd`/test.dia -c src/test.c -o `pwd`/test.o
     expect_stat 'cache hit (direct)' 1
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 1
-    expect_stat 'files in cache' 4
+    expect_stat 'files in cache' 2
 }
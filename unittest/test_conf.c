@@ -18,7 +18,7 @@
 #include "framework.h"
 #include "util.h"
 
-#define N_CONFIG_ITEMS 32
+#define N_CONFIG_ITEMS 37
 static struct {
 	char *descr;
 	const char *origin;
@@ -56,18 +56,23 @@ TEST(conf_create)
 	CHECK_STR_EQ("mtime", conf->compiler_check);
 	CHECK(!conf->compression);
 	CHECK_INT_EQ(6, conf->compression_level);
+	CHECK_STR_EQ("zlib", conf->compression_type);
 	CHECK_STR_EQ("", conf->cpp_extension);
+	CHECK(!conf->depend_mode);
 	CHECK(conf->direct_mode);
 	CHECK(!conf->disable);
 	CHECK_STR_EQ("", conf->extra_files_to_hash);
 	CHECK(!conf->hard_link);
 	CHECK(conf->hash_dir);
 	CHECK_STR_EQ("", conf->ignore_headers_in_manifest);
+	CHECK(conf->inode_cache);
 	CHECK(!conf->keep_comments_cpp);
 	CHECK_FLOAT_EQ(0.8f, conf->limit_multiple);
+	CHECK_STR_EQ("symlink", conf->lock_method);
 	CHECK_STR_EQ("", conf->log_file);
 	CHECK_INT_EQ(0, conf->max_files);
 	CHECK_INT_EQ((uint64_t)5 * 1000 * 1000 * 1000, conf->max_size);
+	CHECK_INT_EQ(0, conf->pack_threshold);
 	CHECK_STR_EQ("", conf->path);
 	CHECK(!conf->pch_external_checksum);
 	CHECK_STR_EQ("", conf->prefix_command);
@@ -108,18 +113,23 @@ TEST(conf_read_valid_config)
 	  "compiler_check = none\n"
 	  "compression=true\n"
 	  "compression_level= 2\n"
+	  "compression_type = lz4\n"
 	  "cpp_extension = .foo\n"
+	  "depend_mode = true\n"
 	  "direct_mode = false\n"
 	  "disable = true\n"
 	  "extra_files_to_hash = a:b c:$USER\n"
 	  "hard_link = true\n"
 	  "hash_dir = false\n"
 	  "ignore_headers_in_manifest = a:b/c\n"
+	  "inode_cache = false\n"
 	  "keep_comments_cpp = true\n"
 	  "limit_multiple = 1.0\n"
+	  "lock_method = fcntl\n"
 	  "log_file = $USER${USER} \n"
 	  "max_files = 17\n"
 	  "max_size = 123M\n"
+	  "pack_threshold = 4k\n"
 	  "path = $USER.x\n"
 	  "pch_external_checksum = true\n"
 	  "prefix_command = x$USER\n"
@@ -128,7 +138,7 @@ TEST(conf_read_valid_config)
 	  "read_only_direct = true\n"
 	  "recache = true\n"
 	  "run_second_cpp = false\n"
-	  "sloppiness =     file_macro   ,time_macros,  include_file_mtime,include_file_ctime,file_stat_matches,pch_defines ,  no_system_headers  \n"
+	  "sloppiness =     file_macro   ,time_macros,  include_file_mtime,include_file_ctime,file_stat_matches,pch_defines ,  no_system_headers,compiler_check_output  \n"
 	  "stats = false\n"
 	  "temporary_dir = ${USER}_foo\n"
 	  "umask = 777\n"
@@ -147,18 +157,23 @@ TEST(conf_read_valid_config)
 	CHECK_STR_EQ("none", conf->compiler_check);
 	CHECK(conf->compression);
 	CHECK_INT_EQ(2, conf->compression_level);
+	CHECK_STR_EQ("lz4", conf->compression_type);
 	CHECK_STR_EQ(".foo", conf->cpp_extension);
+	CHECK(conf->depend_mode);
 	CHECK(!conf->direct_mode);
 	CHECK(conf->disable);
 	CHECK_STR_EQ_FREE1(format("a:b c:%s", user), conf->extra_files_to_hash);
 	CHECK(conf->hard_link);
 	CHECK(!conf->hash_dir);
 	CHECK_STR_EQ("a:b/c", conf->ignore_headers_in_manifest);
+	CHECK(!conf->inode_cache);
 	CHECK(conf->keep_comments_cpp);
 	CHECK_FLOAT_EQ(1.0, conf->limit_multiple);
+	CHECK_STR_EQ("fcntl", conf->lock_method);
 	CHECK_STR_EQ_FREE1(format("%s%s", user, user), conf->log_file);
 	CHECK_INT_EQ(17, conf->max_files);
 	CHECK_INT_EQ(123 * 1000 * 1000, conf->max_size);
+	CHECK_INT_EQ(4000, conf->pack_threshold);
 	CHECK_STR_EQ_FREE1(format("%s.x", user), conf->path);
 	CHECK(conf->pch_external_checksum);
 	CHECK_STR_EQ_FREE1(format("x%s", user), conf->prefix_command);
@@ -170,7 +185,7 @@ TEST(conf_read_valid_config)
 	CHECK_INT_EQ(SLOPPY_INCLUDE_FILE_MTIME|SLOPPY_INCLUDE_FILE_CTIME|
 	             SLOPPY_FILE_MACRO|SLOPPY_TIME_MACROS|
 	             SLOPPY_FILE_STAT_MATCHES|SLOPPY_NO_SYSTEM_HEADERS|
-	             SLOPPY_PCH_DEFINES,
+	             SLOPPY_PCH_DEFINES|SLOPPY_COMPILER_CHECK_OUTPUT,
 	             conf->sloppiness);
 	CHECK(!conf->stats);
 	CHECK_STR_EQ_FREE1(format("%s_foo", user), conf->temporary_dir);
@@ -264,6 +279,28 @@ TEST(conf_read_invalid_sloppiness)
 	conf_free(conf);
 }
 
+TEST(conf_read_invalid_compression_type)
+{
+	struct conf *conf = conf_create();
+	char *errmsg;
+	create_file("ccache.conf", "compression_type = lzma");
+	CHECK(!conf_read(conf, "ccache.conf", &errmsg));
+	CHECK_STR_EQ_FREE2("ccache.conf:1: unknown compression type: \"lzma\"",
+	                   errmsg);
+	conf_free(conf);
+}
+
+TEST(conf_read_invalid_lock_method)
+{
+	struct conf *conf = conf_create();
+	char *errmsg;
+	create_file("ccache.conf", "lock_method = dotfile");
+	CHECK(!conf_read(conf, "ccache.conf", &errmsg));
+	CHECK_STR_EQ_FREE2("ccache.conf:1: unknown lock method: \"dotfile\"",
+	                   errmsg);
+	conf_free(conf);
+}
+
 TEST(conf_read_invalid_unsigned)
 {
 	struct conf *conf = conf_create();
@@ -376,18 +413,23 @@ TEST(conf_print_items)
 		"cc",
 		true,
 		8,
+		"zstd",
 		"ce",
+		true,
 		false,
 		true,
 		"efth",
 		true,
 		.hash_dir = false,
 		"ihim",
+		false,
 		true,
 		0.0,
+		"fcntl",
 		"lf",
 		4711,
 		98.7 * 1000 * 1000,
+		4000,
 		"p",
 		true,
 		"pc",
@@ -399,7 +441,7 @@ TEST(conf_print_items)
 		SLOPPY_FILE_MACRO|SLOPPY_INCLUDE_FILE_MTIME|
 		SLOPPY_INCLUDE_FILE_CTIME|SLOPPY_TIME_MACROS|
 		SLOPPY_FILE_STAT_MATCHES|SLOPPY_PCH_DEFINES|
-		SLOPPY_NO_SYSTEM_HEADERS,
+		SLOPPY_NO_SYSTEM_HEADERS|SLOPPY_COMPILER_CHECK_OUTPUT,
 		false,
 		"td",
 		022,
@@ -426,7 +468,9 @@ TEST(conf_print_items)
 	CHECK_STR_EQ("compiler_check = cc", received_conf_items[n++].descr);
 	CHECK_STR_EQ("compression = true", received_conf_items[n++].descr);
 	CHECK_STR_EQ("compression_level = 8", received_conf_items[n++].descr);
+	CHECK_STR_EQ("compression_type = zstd", received_conf_items[n++].descr);
 	CHECK_STR_EQ("cpp_extension = ce", received_conf_items[n++].descr);
+	CHECK_STR_EQ("depend_mode = true", received_conf_items[n++].descr);
 	CHECK_STR_EQ("direct_mode = false", received_conf_items[n++].descr);
 	CHECK_STR_EQ("disable = true", received_conf_items[n++].descr);
 	CHECK_STR_EQ("extra_files_to_hash = efth", received_conf_items[n++].descr);
@@ -434,11 +478,14 @@ TEST(conf_print_items)
 	CHECK_STR_EQ("hash_dir = false", received_conf_items[n++].descr);
 	CHECK_STR_EQ("ignore_headers_in_manifest = ihim",
 	             received_conf_items[n++].descr);
+	CHECK_STR_EQ("inode_cache = false", received_conf_items[n++].descr);
 	CHECK_STR_EQ("keep_comments_cpp = true", received_conf_items[n++].descr);
 	CHECK_STR_EQ("limit_multiple = 0.0", received_conf_items[n++].descr);
+	CHECK_STR_EQ("lock_method = fcntl", received_conf_items[n++].descr);
 	CHECK_STR_EQ("log_file = lf", received_conf_items[n++].descr);
 	CHECK_STR_EQ("max_files = 4711", received_conf_items[n++].descr);
 	CHECK_STR_EQ("max_size = 98.7M", received_conf_items[n++].descr);
+	CHECK_STR_EQ("pack_threshold = 4.0k", received_conf_items[n++].descr);
 	CHECK_STR_EQ("path = p", received_conf_items[n++].descr);
 	CHECK_STR_EQ("pch_external_checksum = true", received_conf_items[n++].descr);
 	CHECK_STR_EQ("prefix_command = pc", received_conf_items[n++].descr);
@@ -449,7 +496,8 @@ TEST(conf_print_items)
 	CHECK_STR_EQ("run_second_cpp = false", received_conf_items[n++].descr);
 	CHECK_STR_EQ("sloppiness = file_macro, include_file_mtime,"
 	             " include_file_ctime, time_macros, pch_defines,"
-	             " file_stat_matches, no_system_headers",
+	             " file_stat_matches, no_system_headers,"
+	             " compiler_check_output",
 	             received_conf_items[n++].descr);
 	CHECK_STR_EQ("stats = false", received_conf_items[n++].descr);
 	CHECK_STR_EQ("temporary_dir = td", received_conf_items[n++].descr);
@@ -17,36 +17,71 @@
 // This file contains tests for functions in hash.c.
 
 #include "../src/ccache.h"
+#include "../src/mdfour.h"
 #include "framework.h"
+#include "util.h"
+
+static char *
+format_digest(const unsigned char *sum, size_t size)
+{
+	char *result = x_malloc(2 * size + 1);
+	for (size_t i = 0; i < size; i++) {
+		sprintf(&result[2 * i], "%02x", (unsigned)sum[i]);
+	}
+	return result;
+}
+
+static char *
+md4_of_string(const char *s)
+{
+	struct mdfour md;
+	unsigned char sum[16];
+	mdfour_begin(&md);
+	mdfour_update(&md, (const unsigned char *)s, strlen(s));
+	mdfour_update(&md, NULL, 0);
+	mdfour_result(&md, sum);
+	return format_digest(sum, sizeof(sum));
+}
 
 TEST_SUITE(hash)
 
 TEST(test_vectors_from_rfc_1320_should_be_correct)
 {
-	struct mdfour h;
+	CHECK_STR_EQ_FREE2("31d6cfe0d16ae931b73c59d7e0c089c0", md4_of_string(""));
+	CHECK_STR_EQ_FREE2("bde52cb31de33e46245e05fbdbd6fb24", md4_of_string("a"));
+	CHECK_STR_EQ_FREE2("d9130a8164549fe818874806e1c7014b",
+	                   md4_of_string("message digest"));
+	CHECK_STR_EQ_FREE2(
+	  "e33b4ddc9c38f2199c3e7b164fcc0536",
+	  md4_of_string(
+	    "12345678901234567890123456789012345678901234567890123456789012345678901234567890"));
+}
 
-	hash_start(&h);
-	hash_string(&h, "");
-	CHECK_STR_EQ_FREE2("31d6cfe0d16ae931b73c59d7e0c089c0-0", hash_result(&h));
+TEST(hash_result_should_not_depend_on_chunking)
+{
+	char data[1000];
+	memset(data, 'a', sizeof(data));
 
-	hash_start(&h);
-	hash_string(&h, "a");
-	CHECK_STR_EQ_FREE2("bde52cb31de33e46245e05fbdbd6fb24-1", hash_result(&h));
+	struct hash h1;
+	hash_start(&h1);
+	hash_buffer(&h1, data, sizeof(data));
 
-	hash_start(&h);
-	hash_string(&h, "message digest");
-	CHECK_STR_EQ_FREE2("d9130a8164549fe818874806e1c7014b-14", hash_result(&h));
+	struct hash h2;
+	hash_start(&h2);
+	size_t chunks[] = {1, 127, 128, 129, 255, 360};
+	size_t pos = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(chunks); i++) {
+		hash_buffer(&h2, data + pos, chunks[i]);
+		pos += chunks[i];
+	}
+	CHECK_INT_EQ(sizeof(data), pos);
 
-	hash_start(&h);
-	hash_string(
-	  &h,
-	  "12345678901234567890123456789012345678901234567890123456789012345678901234567890");
-	CHECK_STR_EQ_FREE2("e33b4ddc9c38f2199c3e7b164fcc0536-80", hash_result(&h));
+	CHECK(hash_equal(&h1, &h2));
 }
 
 TEST(hash_result_should_be_idempotent)
 {
-	struct mdfour h;
+	struct hash h;
 
 	hash_start(&h);
 	hash_string(&h, "");
@@ -54,4 +89,29 @@ TEST(hash_result_should_be_idempotent)
 	CHECK_STR_EQ_FREE2("31d6cfe0d16ae931b73c59d7e0c089c0-0", hash_result(&h));
 }
 
+TEST(hash_file_should_equal_hash_buffer_of_content)
+{
+	// Both below and above the size limit for memory mapping.
+	size_t sizes[] = {100, 2 * MMAP_MIN_SIZE + 1};
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		char *content = x_malloc(sizes[i] + 1);
+		memset(content, 'x', sizes[i]);
+		content[sizes[i]] = '\0';
+		create_file("file", content);
+
+		struct hash h1;
+		hash_start(&h1);
+		hash_buffer(&h1, content, sizes[i]);
+
+		struct hash h2;
+		hash_start(&h2);
+		CHECK(hash_file(&h2, "file"));
+
+		CHECK(hash_equal(&h1, &h2));
+		CHECK_INT_EQ(sizes[i], h2.totalN);
+		free(content);
+	}
+}
+
 TEST_SUITE_END
@@ -0,0 +1,97 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// This file contains tests for the hash pool used for include files.
+
+#include "../src/ccache.h"
+#include "../src/hashpool.h"
+#include "framework.h"
+#include "util.h"
+
+#define N_FILES 50
+
+TEST_SUITE(hashpool)
+
+TEST(results_should_match_hash_source_code_file)
+{
+	struct conf *conf = conf_create();
+	char *paths[N_FILES];
+	struct file_hash results[N_FILES];
+
+	unsigned max_threads[] = {1, 4};
+
+	for (size_t t = 0; t < ARRAY_SIZE(max_threads); t++) {
+		struct hash_pool *pool = hash_pool_create(conf, max_threads[t]);
+		for (size_t i = 0; i < N_FILES; i++) {
+			paths[i] = format("file%zu.h", i);
+			char *content = format("int x%zu;\n", i);
+			create_file(paths[i], content);
+			free(content);
+			hash_pool_add(pool, paths[i], NULL, &results[i]);
+		}
+		CHECK(hash_pool_finish(pool));
+
+		for (size_t i = 0; i < N_FILES; i++) {
+			struct hash h;
+			hash_start(&h);
+			CHECK_INT_EQ(HASH_SOURCE_CODE_OK,
+			             hash_source_code_file(conf, &h, paths[i]));
+			struct file_hash expected;
+			hash_result_as_bytes(&h, expected.hash);
+			expected.size = h.totalN;
+			CHECK(file_hashes_equal(&expected, &results[i]));
+			free(paths[i]);
+		}
+	}
+
+	conf_free(conf);
+}
+
+TEST(time_macro_should_fail)
+{
+	struct conf *conf = conf_create();
+	struct file_hash results[2];
+
+	create_file("a.h", "int a;\n");
+	create_file("b.h", "const char *b = __TIME__;\n");
+
+	struct hash_pool *pool = hash_pool_create(conf, 2);
+	hash_pool_add(pool, "a.h", NULL, &results[0]);
+	hash_pool_add(pool, "b.h", NULL, &results[1]);
+	CHECK(!hash_pool_finish(pool));
+
+	conf->sloppiness |= SLOPPY_TIME_MACROS;
+	pool = hash_pool_create(conf, 2);
+	hash_pool_add(pool, "a.h", NULL, &results[0]);
+	hash_pool_add(pool, "b.h", NULL, &results[1]);
+	CHECK(hash_pool_finish(pool));
+
+	conf_free(conf);
+}
+
+TEST(missing_file_should_fail)
+{
+	struct conf *conf = conf_create();
+	struct file_hash result;
+
+	struct hash_pool *pool = hash_pool_create(conf, 2);
+	hash_pool_add(pool, "nonexistent.h", NULL, &result);
+	CHECK(!hash_pool_finish(pool));
+
+	conf_free(conf);
+}
+
+TEST_SUITE_END
@@ -25,7 +25,7 @@ TEST_SUITE(hashutil)
 
 TEST(hash_command_output_simple)
 {
-	struct mdfour h1, h2;
+	struct hash h1, h2;
 	hash_start(&h1);
 	hash_start(&h2);
 	CHECK(hash_command_output(&h1, "echo", "not used"));
@@ -35,7 +35,7 @@ TEST(hash_command_output_simple)
 
 TEST(hash_command_output_space_removal)
 {
-	struct mdfour h1, h2;
+	struct hash h1, h2;
 	hash_start(&h1);
 	hash_start(&h2);
 	CHECK(hash_command_output(&h1, "echo", "not used"));
@@ -45,7 +45,7 @@ TEST(hash_command_output_space_removal)
 
 TEST(hash_command_output_hash_inequality)
 {
-	struct mdfour h1, h2;
+	struct hash h1, h2;
 	hash_start(&h1);
 	hash_start(&h2);
 	CHECK(hash_command_output(&h1, "echo foo", "not used"));
@@ -55,7 +55,7 @@ TEST(hash_command_output_hash_inequality)
 
 TEST(hash_command_output_compiler_substitution)
 {
-	struct mdfour h1, h2;
+	struct hash h1, h2;
 	hash_start(&h1);
 	hash_start(&h2);
 	CHECK(hash_command_output(&h1, "echo foo", "not used"));
@@ -65,7 +65,7 @@ TEST(hash_command_output_compiler_substitution)
 
 TEST(hash_command_output_stdout_versus_stderr)
 {
-	struct mdfour h1, h2;
+	struct hash h1, h2;
 	hash_start(&h1);
 	hash_start(&h2);
 #ifndef _WIN32
@@ -83,7 +83,7 @@ TEST(hash_command_output_stdout_versus_stderr)
 
 TEST(hash_multicommand_output)
 {
-	struct mdfour h1, h2;
+	struct hash h1, h2;
 	hash_start(&h1);
 	hash_start(&h2);
 #ifndef _WIN32
@@ -101,7 +101,7 @@ TEST(hash_multicommand_output)
 
 TEST(hash_multicommand_output_error_handling)
 {
-	struct mdfour h1, h2;
+	struct hash h1, h2;
 	hash_start(&h1);
 	hash_start(&h2);
 	CHECK(!hash_multicommand_output(&h2, "false; true", "not used"));
@@ -185,4 +185,62 @@ TEST(check_for_temporal_macros)
 	CHECK(!check_for_temporal_macros(no_temporal + 7, sizeof(no_temporal) - 7));
 }
 
+TEST(hash_source_code_buffer_should_find_macros_across_chunks)
+{
+	struct conf *conf = conf_create();
+	size_t size = 100 * 1024;
+	char *data = x_malloc(size);
+
+	for (size_t offset = 32 * 1024 - 8; offset <= 32 * 1024; offset++) {
+		memset(data, 'x', size);
+		memcpy(data + offset, "__TIME__", 8);
+
+		struct hash h1, h2;
+		hash_start(&h1);
+		hash_start(&h2);
+		CHECK_INT_EQ(HASH_SOURCE_CODE_FOUND_TIME,
+		             hash_source_code_buffer(conf, &h1, data, size));
+		hash_buffer(&h2, data, size);
+		CHECK_STR_EQ_FREE2(hash_result(&h2), hash_result(&h1));
+	}
+
+	conf->sloppiness |= SLOPPY_TIME_MACROS;
+	struct hash h;
+	hash_start(&h);
+	CHECK_INT_EQ(HASH_SOURCE_CODE_OK,
+	             hash_source_code_buffer(conf, &h, data, size));
+
+	free(data);
+	conf_free(conf);
+}
+
+TEST(hash_source_code_fd_should_match_hash_source_code_buffer)
+{
+	struct conf *conf = conf_create();
+	size_t size = 100 * 1024 + 3;
+	char *data = x_malloc(size + 1);
+
+	for (size_t offset = 32 * 1024 - 8; offset <= 32 * 1024; offset++) {
+		memset(data, 'x', size);
+		data[size] = '\0';
+		memcpy(data + offset, "__DATE__", 8);
+		memcpy(data + size - 8, "__TIME__", 8);
+		create_file("test.h", data);
+
+		struct hash h1, h2;
+		hash_start(&h1);
+		hash_start(&h2);
+		int fd = open("test.h", O_RDONLY);
+		CHECK_INT_EQ(HASH_SOURCE_CODE_FOUND_DATE | HASH_SOURCE_CODE_FOUND_TIME,
+		             hash_source_code_fd(conf, &h1, fd));
+		close(fd);
+		CHECK_INT_EQ(HASH_SOURCE_CODE_FOUND_DATE | HASH_SOURCE_CODE_FOUND_TIME,
+		             hash_source_code_buffer(conf, &h2, data, size));
+		CHECK_STR_EQ_FREE2(hash_result(&h2), hash_result(&h1));
+	}
+
+	free(data);
+	conf_free(conf);
+}
+
 TEST_SUITE_END
@@ -0,0 +1,183 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// This file contains tests for the inode cache.
+
+#include "../src/ccache.h"
+#include "../src/inodecache.h"
+#include "framework.h"
+#include "util.h"
+
+static struct conf *
+create_test_conf(void)
+{
+	struct conf *conf = conf_create();
+	free(conf->cache_dir);
+	conf->cache_dir = x_strdup("cache");
+	return conf;
+}
+
+static void
+make_hash(struct file_hash *fh, const char *content)
+{
+	struct hash h;
+	hash_start(&h);
+	hash_string(&h, content);
+	hash_result_as_bytes(&h, fh->hash);
+	fh->size = h.totalN;
+}
+
+TEST_SUITE(inodecache)
+
+TEST(put_and_get)
+{
+	struct conf *conf = create_test_conf();
+	struct file_hash fh;
+	struct file_hash result;
+	struct stat st;
+
+	create_file("a.h", "a");
+	CHECK_INT_EQ(0, stat("a.h", &st));
+	time_of_compilation = time(NULL) + 10;
+
+	CHECK(!inode_cache_get(conf, &st, &result));
+	make_hash(&fh, "a");
+	inode_cache_put(conf, &st, &fh);
+	CHECK(inode_cache_get(conf, &st, &result));
+	CHECK(file_hashes_equal(&fh, &result));
+
+	// Another process sees the same entry.
+	inode_cache_release();
+	CHECK(inode_cache_get(conf, &st, &result));
+	CHECK(file_hashes_equal(&fh, &result));
+
+	// Changed stat information.
+	create_file("a.h", "aa");
+	CHECK_INT_EQ(0, stat("a.h", &st));
+	CHECK(!inode_cache_get(conf, &st, &result));
+
+	conf_free(conf);
+}
+
+TEST(tagged_entries_should_be_separate)
+{
+	struct conf *conf = create_test_conf();
+	struct file_hash fh1;
+	struct file_hash fh2;
+	struct file_hash result;
+	struct stat st;
+
+	create_file("cc", "compiler");
+	CHECK_INT_EQ(0, stat("cc", &st));
+	time_of_compilation = time(NULL) + 10;
+
+	make_hash(&fh1, "1");
+	make_hash(&fh2, "2");
+	inode_cache_put(conf, &st, &fh1);
+	CHECK(!inode_cache_get_tagged(conf, &st, "content", &result));
+	inode_cache_put_tagged(conf, &st, "content", &fh2);
+	CHECK(!inode_cache_get_tagged(conf, &st, "command x", &result));
+
+	CHECK(inode_cache_get(conf, &st, &result));
+	CHECK(file_hashes_equal(&fh1, &result));
+	CHECK(inode_cache_get_tagged(conf, &st, "content", &result));
+	CHECK(file_hashes_equal(&fh2, &result));
+
+	conf_free(conf);
+}
+
+TEST(too_new_file_should_not_be_cached)
+{
+	struct conf *conf = create_test_conf();
+	struct file_hash fh;
+	struct file_hash result;
+	struct stat st;
+
+	create_file("a.h", "a");
+	CHECK_INT_EQ(0, stat("a.h", &st));
+	time_of_compilation = st.st_mtime;
+
+	make_hash(&fh, "a");
+	inode_cache_put(conf, &st, &fh);
+	time_of_compilation = time(NULL) + 10;
+	CHECK(!inode_cache_get(conf, &st, &result));
+
+	conf_free(conf);
+}
+
+TEST(unchecked_temporal_macros_should_miss_unless_sloppy)
+{
+	struct conf *conf = create_test_conf();
+	struct file_hash fh;
+	struct file_hash result;
+	struct stat st;
+
+	create_file("a.h", "a");
+	CHECK_INT_EQ(0, stat("a.h", &st));
+	time_of_compilation = time(NULL) + 10;
+
+	make_hash(&fh, "a");
+	conf->sloppiness |= SLOPPY_TIME_MACROS;
+	inode_cache_put(conf, &st, &fh);
+	CHECK(inode_cache_get(conf, &st, &result));
+	conf->sloppiness &= ~SLOPPY_TIME_MACROS;
+	CHECK(!inode_cache_get(conf, &st, &result));
+
+	conf_free(conf);
+}
+
+TEST(disabled_cache_should_not_be_used)
+{
+	struct conf *conf = create_test_conf();
+	struct file_hash fh;
+	struct file_hash result;
+	struct stat st;
+
+	create_file("a.h", "a");
+	CHECK_INT_EQ(0, stat("a.h", &st));
+	time_of_compilation = time(NULL) + 10;
+
+	conf->inode_cache = false;
+	make_hash(&fh, "a");
+	inode_cache_put(conf, &st, &fh);
+	CHECK(!inode_cache_get(conf, &st, &result));
+	CHECK_INT_EQ(-1, stat("cache/inode-cache", &st));
+
+	conf_free(conf);
+}
+
+TEST(corrupt_cache_file_should_be_recreated)
+{
+	struct conf *conf = create_test_conf();
+	struct file_hash fh;
+	struct file_hash result;
+	struct stat st;
+
+	create_dir("cache");
+	create_file("cache/inode-cache", "garbage");
+	create_file("a.h", "a");
+	CHECK_INT_EQ(0, stat("a.h", &st));
+	time_of_compilation = time(NULL) + 10;
+
+	make_hash(&fh, "a");
+	inode_cache_put(conf, &st, &fh);
+	CHECK(inode_cache_get(conf, &st, &result));
+	CHECK(file_hashes_equal(&fh, &result));
+
+	conf_free(conf);
+}
+
+TEST_SUITE_END
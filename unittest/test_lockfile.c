@@ -20,6 +20,42 @@
 #include "framework.h"
 #include "util.h"
 
+extern struct conf *conf;
+
+#ifndef _WIN32
+// Return whether somebody holds an fcntl method lock on path.
+static bool
+is_fcntl_locked(const char *path)
+{
+	int fd = open(path, O_RDWR);
+	if (fd == -1) {
+		return false;
+	}
+#ifdef F_OFD_SETLK
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	bool locked = fcntl(fd, F_OFD_SETLK, &fl) != 0;
+	if (locked && errno == EINVAL) {
+		locked = flock(fd, LOCK_EX | LOCK_NB) != 0;
+	}
+#else
+	bool locked = flock(fd, LOCK_EX | LOCK_NB) != 0;
+#endif
+	close(fd);
+	return locked;
+}
+
+static void
+use_fcntl_locks(void)
+{
+	conf = conf_create();
+	free(conf->lock_method);
+	conf->lock_method = x_strdup("fcntl");
+}
+#endif
+
 TEST_SUITE(lockfile)
 
 TEST(acquire_should_create_symlink)
@@ -72,6 +108,55 @@ TEST(failed_lock_breaking)
 	create_file("test.lock", "");
 	CHECK(!lockfile_acquire("test", 1000));
 }
+
+TEST(fcntl_lock_should_be_released_but_kept)
+{
+	use_fcntl_locks();
+
+	CHECK(lockfile_acquire("test", 1000));
+	CHECK(!path_exists("test.lock"));
+	CHECK(is_fcntl_locked("test.lck"));
+
+	lockfile_release("test");
+	CHECK(path_exists("test.lck"));
+	CHECK(!is_fcntl_locked("test.lck"));
+
+	conf_free(conf);
+	conf = NULL;
+}
+
+TEST(fcntl_lock_should_wait_for_holder)
+{
+	use_fcntl_locks();
+	uint64_t retries = stats_get_pending(STATS_LOCK_RETRIES);
+	uint64_t waited = stats_get_pending(STATS_LOCK_WAIT_TIME);
+
+	int fds[2];
+	CHECK_INT_EQ(0, pipe(fds));
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Exit without releasing the lock, which the kernel then does.
+		close(fds[0]);
+		bool ok = lockfile_acquire("test", 1000) && write(fds[1], "x", 1) == 1;
+		usleep(200000);
+		_exit(ok ? 0 : 1);
+	}
+	close(fds[1]);
+	char c;
+	CHECK_INT_EQ(1, read(fds[0], &c, 1));
+	close(fds[0]);
+
+	CHECK(lockfile_acquire("test", 1000));
+	int status;
+	CHECK_INT_EQ(pid, waitpid(pid, &status, 0));
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	CHECK_INT_EQ(retries + 1, stats_get_pending(STATS_LOCK_RETRIES));
+	CHECK(stats_get_pending(STATS_LOCK_WAIT_TIME) > waited);
+	lockfile_release("test");
+
+	conf_free(conf);
+	conf = NULL;
+}
 #endif
 
 TEST_SUITE_END
@@ -0,0 +1,475 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// This file contains tests for manifest.c.
+
+#include "../src/ccache.h"
+#include "../src/inodecache.h"
+#include "../src/manifest.h"
+#include "framework.h"
+#include "util.h"
+
+#include <zlib.h>
+
+// The tests rewrite files within the same second while pretending that they
+// are old, so the inode cache is only enabled where it's tested.
+static struct conf *
+create_test_conf(void)
+{
+	struct conf *conf = conf_create();
+	free(conf->cache_dir);
+	conf->cache_dir = x_strdup("cache");
+	conf->inode_cache = false;
+	return conf;
+}
+
+static void
+make_object_hash(struct file_hash *fh, const char *name)
+{
+	struct hash h;
+	hash_start(&h);
+	hash_string(&h, name);
+	hash_result_as_bytes(&h, fh->hash);
+	fh->size = h.totalN;
+}
+
+// Create included_files as ccache.c does, with the current content hashes of
+// the given files.
+static struct hashtable *
+create_included_files(struct conf *conf, const char *const *paths, size_t n)
+{
+	struct hashtable *included_files =
+	  create_hashtable(10, hash_from_string, strings_equal);
+	for (size_t i = 0; i < n; i++) {
+		struct hash h;
+		hash_start(&h);
+		hash_source_code_file(conf, &h, paths[i]);
+		struct file_hash *fh = x_malloc(sizeof(*fh));
+		hash_result_as_bytes(&h, fh->hash);
+		fh->size = h.totalN;
+		hashtable_insert(included_files, x_strdup(paths[i]), fh);
+	}
+	return included_files;
+}
+
+static void
+put_v1_int(gzFile f, size_t size, uint64_t value)
+{
+	for (size_t i = 0; i < size; i++) {
+		gzputc(f, (value >> (8 * (size - i - 1))) & 0xFF);
+	}
+}
+
+// Write a version 1 manifest with one object that includes path.
+static void
+write_v1_manifest(struct conf *conf, const char *manifest_path,
+                  const char *path, struct file_hash *object_hash)
+{
+	struct hash h;
+	hash_start(&h);
+	hash_source_code_file(conf, &h, path);
+	uint8_t file_hash[DIGEST_SIZE];
+	hash_result_as_bytes(&h, file_hash);
+
+	gzFile f = gzopen(manifest_path, "wb");
+	put_v1_int(f, 4, 0x63436d46U);
+	put_v1_int(f, 1, 1);
+	put_v1_int(f, 1, DIGEST_SIZE);
+	put_v1_int(f, 2, 0);
+	put_v1_int(f, 4, 1);
+	gzputs(f, path);
+	gzputc(f, '\0');
+	put_v1_int(f, 4, 1);
+	put_v1_int(f, 4, 0);
+	gzwrite(f, file_hash, DIGEST_SIZE);
+	put_v1_int(f, 4, h.totalN);
+	put_v1_int(f, 8, (uint64_t)-1);
+	put_v1_int(f, 8, (uint64_t)-1);
+	put_v1_int(f, 4, 1);
+	put_v1_int(f, 4, 1);
+	put_v1_int(f, 4, 0);
+	gzwrite(f, object_hash->hash, DIGEST_SIZE);
+	put_v1_int(f, 4, object_hash->size);
+	gzclose(f);
+}
+
+// Put an object named name that includes a.h with the given content.
+static enum manifest_put_result
+put_object_result(struct conf *conf, const char *name, const char *content)
+{
+	const char *const paths[] = {"a.h"};
+	struct file_hash object_hash;
+	create_file("a.h", content);
+	make_object_hash(&object_hash, name);
+	struct hashtable *included_files = create_included_files(conf, paths, 1);
+	enum manifest_put_result result =
+	  manifest_put("test.manifest", &object_hash, included_files);
+	hashtable_destroy(included_files, 1);
+	return result;
+}
+
+// Return whether the object named name was added to the manifest.
+static bool
+put_object(struct conf *conf, const char *name, const char *content)
+{
+	return put_object_result(conf, name, content) == MANIFEST_PUT_ADDED;
+}
+
+// Return whether the object named name is found when a.h has the given
+// content.
+static bool
+get_object(struct conf *conf, const char *name, const char *content)
+{
+	struct file_hash object_hash;
+	create_file("a.h", content);
+	make_object_hash(&object_hash, name);
+	struct file_hash *result = manifest_get(conf, "test.manifest");
+	bool found = result && file_hashes_equal(&object_hash, result);
+	free(result);
+	return found;
+}
+
+// Return whether the dump of the manifest contains s.
+static bool
+dump_contains(const char *s)
+{
+	FILE *f = fopen("dump.txt", "w");
+	bool ok = manifest_dump("test.manifest", f);
+	fclose(f);
+	char *dump = read_text_file("dump.txt", 0);
+	ok = ok && dump && strstr(dump, s);
+	free(dump);
+	return ok;
+}
+
+TEST_SUITE(manifest)
+
+TEST(put_and_get)
+{
+	struct conf *conf = create_test_conf();
+	const char *const paths[] = {"a.h", "b.h"};
+	struct file_hash object_hash;
+
+	create_file("a.h", "int a;\n");
+	create_file("b.h", "int b;\n");
+	time_of_compilation = time(NULL) + 10;
+
+	CHECK(!manifest_get(conf, "test.manifest"));
+
+	make_object_hash(&object_hash, "first");
+	struct hashtable *included_files = create_included_files(conf, paths, 2);
+	CHECK(manifest_put("test.manifest", &object_hash, included_files));
+	hashtable_destroy(included_files, 1);
+
+	struct file_hash *result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&object_hash, result));
+	free(result);
+
+	// A second object for a changed include file.
+	create_file("b.h", "int b2;\n");
+	CHECK(!manifest_get(conf, "test.manifest"));
+	make_object_hash(&object_hash, "second");
+	included_files = create_included_files(conf, paths, 2);
+	CHECK(manifest_put("test.manifest", &object_hash, included_files));
+	hashtable_destroy(included_files, 1);
+
+	result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&object_hash, result));
+	free(result);
+
+	// And back again.
+	create_file("b.h", "int b;\n");
+	make_object_hash(&object_hash, "first");
+	result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&object_hash, result));
+	free(result);
+
+	conf_free(conf);
+}
+
+TEST(version_1_manifest_should_be_read_and_upgraded)
+{
+	struct conf *conf = create_test_conf();
+	const char *const paths[] = {"a.h"};
+	struct file_hash v1_object_hash;
+	struct file_hash v2_object_hash;
+
+	create_file("a.h", "int a;\n");
+	time_of_compilation = time(NULL) + 10;
+	make_object_hash(&v1_object_hash, "v1");
+	write_v1_manifest(conf, "test.manifest", "a.h", &v1_object_hash);
+
+	struct file_hash *result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&v1_object_hash, result));
+	free(result);
+
+	create_file("a.h", "int a2;\n");
+	make_object_hash(&v2_object_hash, "v2");
+	struct hashtable *included_files = create_included_files(conf, paths, 1);
+	CHECK(manifest_put("test.manifest", &v2_object_hash, included_files));
+	hashtable_destroy(included_files, 1);
+
+	// The manifest is now an uncompressed version 2 manifest with both
+	// objects.
+	char *data = read_text_file("test.manifest", 0);
+	CHECK(data);
+	CHECK_INT_EQ(MANIFEST_VERSION, data[4]);
+	free(data);
+
+	result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&v2_object_hash, result));
+	free(result);
+
+	create_file("a.h", "int a;\n");
+	result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&v1_object_hash, result));
+	free(result);
+
+	conf_free(conf);
+}
+
+TEST(corrupt_manifest_should_be_replaced)
+{
+	struct conf *conf = create_test_conf();
+	const char *const paths[] = {"a.h"};
+	struct file_hash object_hash;
+
+	create_file("a.h", "int a;\n");
+	time_of_compilation = time(NULL) + 10;
+	make_object_hash(&object_hash, "object");
+	struct hashtable *included_files = create_included_files(conf, paths, 1);
+	CHECK(manifest_put("test.manifest", &object_hash, included_files));
+
+	// Truncate the manifest.
+	struct stat st;
+	CHECK_INT_EQ(0, stat("test.manifest", &st));
+	CHECK_INT_EQ(0, truncate("test.manifest", st.st_size - 1));
+	CHECK(!manifest_get(conf, "test.manifest"));
+
+	CHECK(manifest_put("test.manifest", &object_hash, included_files));
+	hashtable_destroy(included_files, 1);
+	struct file_hash *result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&object_hash, result));
+	free(result);
+
+	conf_free(conf);
+}
+
+TEST(least_recently_used_entry_should_be_evicted)
+{
+	struct conf *conf = create_test_conf();
+	time_of_compilation = time(NULL) + 10;
+
+	for (int i = 0; i < 100; i++) {
+		char *s = format("int a%d;\n", i);
+		CHECK(put_object(conf, s, s));
+		free(s);
+	}
+	// Make the first entry the most recently used one.
+	CHECK(get_object(conf, "int a0;\n", "int a0;\n"));
+
+	CHECK(put_object(conf, "int a100;\n", "int a100;\n"));
+	CHECK(get_object(conf, "int a0;\n", "int a0;\n"));
+	CHECK(!get_object(conf, "int a1;\n", "int a1;\n"));
+	CHECK(get_object(conf, "int a2;\n", "int a2;\n"));
+	CHECK(get_object(conf, "int a100;\n", "int a100;\n"));
+
+	// The file info of the evicted entry is gone too.
+	FILE *f = fopen("dump.txt", "w");
+	CHECK(manifest_dump("test.manifest", f));
+	fclose(f);
+	char *dump = read_text_file("dump.txt", 0);
+	CHECK(strstr(dump, "File paths (1):"));
+	CHECK(strstr(dump, "File infos (100):"));
+	CHECK(strstr(dump, "Results (100):"));
+	free(dump);
+
+	conf_free(conf);
+}
+
+TEST(most_recently_used_entry_should_be_preferred)
+{
+	struct conf *conf = create_test_conf();
+	const char *const a_paths[] = {"a.h"};
+	const char *const b_paths[] = {"b.h"};
+	struct file_hash a_hash;
+	struct file_hash b_hash;
+	struct hashtable *included_files;
+
+	create_file("a.h", "int a;\n");
+	create_file("b.h", "int b;\n");
+	time_of_compilation = time(NULL) + 10;
+	make_object_hash(&a_hash, "a");
+	make_object_hash(&b_hash, "b");
+
+	included_files = create_included_files(conf, a_paths, 1);
+	CHECK(manifest_put("test.manifest", &a_hash, included_files));
+	hashtable_destroy(included_files, 1);
+	included_files = create_included_files(conf, b_paths, 1);
+	CHECK(manifest_put("test.manifest", &b_hash, included_files));
+	hashtable_destroy(included_files, 1);
+
+	// Both entries match; the most recently added one is preferred.
+	struct file_hash *result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&b_hash, result));
+	free(result);
+
+	// Use the first entry.
+	create_file("b.h", "int b2;\n");
+	result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&a_hash, result));
+	free(result);
+
+	// Both entries match again; the most recently used one is preferred.
+	create_file("b.h", "int b;\n");
+	result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&a_hash, result));
+	free(result);
+
+	conf_free(conf);
+}
+
+TEST(new_entry_should_be_appended)
+{
+	struct conf *conf = create_test_conf();
+	time_of_compilation = time(NULL) + 10;
+
+	CHECK(put_object(conf, "first", "int a;\n"));
+	struct stat st;
+	CHECK_INT_EQ(0, stat("test.manifest", &st));
+	off_t size = st.st_size;
+
+	CHECK(put_object(conf, "second", "int a2;\n"));
+	CHECK(dump_contains("Appended results: 1\n"));
+	CHECK(dump_contains("Results (2):"));
+
+	// The first part of the file is unchanged.
+	CHECK_INT_EQ(0, stat("test.manifest", &st));
+	CHECK(st.st_size > size);
+
+	CHECK(get_object(conf, "first", "int a;\n"));
+	CHECK(get_object(conf, "second", "int a2;\n"));
+	CHECK(!get_object(conf, "third", "int a3;\n"));
+
+	conf_free(conf);
+}
+
+TEST(truncated_appended_entry_should_be_ignored)
+{
+	struct conf *conf = create_test_conf();
+	time_of_compilation = time(NULL) + 10;
+
+	CHECK(put_object(conf, "first", "int a;\n"));
+	CHECK(put_object(conf, "second", "int a2;\n"));
+	struct stat st;
+	CHECK_INT_EQ(0, stat("test.manifest", &st));
+	CHECK_INT_EQ(0, truncate("test.manifest", st.st_size - 1));
+
+	CHECK(get_object(conf, "first", "int a;\n"));
+	CHECK(!get_object(conf, "second", "int a2;\n"));
+
+	// The invalid data may be an entry that is still being written, so a put
+	// leaves the manifest alone for a while.
+	CHECK_INT_EQ(MANIFEST_PUT_SKIPPED,
+	             put_object_result(conf, "third", "int a3;\n"));
+	struct stat st2;
+	CHECK_INT_EQ(0, stat("test.manifest", &st2));
+	CHECK_INT_EQ(st.st_size - 1, st2.st_size);
+
+	// After that, the next put compacts the manifest instead of appending after
+	// the invalid data.
+	struct utimbuf old_times = {st.st_atime - 60, st.st_mtime - 60};
+	CHECK_INT_EQ(0, utime("test.manifest", &old_times));
+	CHECK(put_object(conf, "third", "int a3;\n"));
+	CHECK(dump_contains("Appended results: 0\n"));
+	CHECK(get_object(conf, "first", "int a;\n"));
+	CHECK(get_object(conf, "third", "int a3;\n"));
+
+	conf_free(conf);
+}
+
+TEST(appended_entries_should_be_compacted)
+{
+	struct conf *conf = create_test_conf();
+	time_of_compilation = time(NULL) + 10;
+
+	// One full write, 20 appends and then a compaction, which merges the paths
+	// of the appended entries.
+	for (int i = 0; i < 22; i++) {
+		char *s = format("int a%d;\n", i);
+		CHECK(put_object(conf, s, s));
+		free(s);
+	}
+	CHECK(dump_contains("Appended results: 0\n"));
+	CHECK(dump_contains("File paths (1):"));
+	CHECK(dump_contains("Results (22):"));
+
+	CHECK(put_object(conf, "int a22;\n", "int a22;\n"));
+	CHECK(dump_contains("Appended results: 1\n"));
+	for (int i = 0; i < 23; i++) {
+		char *s = format("int a%d;\n", i);
+		CHECK(get_object(conf, s, s));
+		free(s);
+	}
+
+	conf_free(conf);
+}
+
+TEST(include_file_hashes_should_be_shared_via_inode_cache)
+{
+	struct conf *conf = create_test_conf();
+	const char *const paths[] = {"other.h"};
+	conf->inode_cache = true;
+	time_of_compilation = time(NULL) + 10;
+
+	CHECK(put_object(conf, "object", "int a;\n"));
+
+	// Pretend that another process has hashed a.h with its new content to the
+	// hash of its old content.
+	create_file("other.h", "int a;\n");
+	struct hashtable *included_files = create_included_files(conf, paths, 1);
+	create_file("a.h", "int b;\n");
+	struct stat st;
+	CHECK_INT_EQ(0, stat("a.h", &st));
+	inode_cache_put(conf, &st, hashtable_search(included_files, "other.h"));
+	hashtable_destroy(included_files, 1);
+
+	// The remembered hash is used instead of hashing the file.
+	struct file_hash object_hash;
+	make_object_hash(&object_hash, "object");
+	struct file_hash *result = manifest_get(conf, "test.manifest");
+	CHECK(result);
+	CHECK(file_hashes_equal(&object_hash, result));
+	free(result);
+
+	// Without the inode cache, the file is hashed.
+	conf->inode_cache = false;
+	CHECK(!manifest_get(conf, "test.manifest"));
+
+	conf_free(conf);
+}
+
+TEST_SUITE_END
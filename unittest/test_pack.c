@@ -0,0 +1,242 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// This file contains tests for pack.c.
+
+#include "../src/ccache.h"
+#include "../src/pack.h"
+#include "framework.h"
+#include "util.h"
+
+// Store content under path in the pack.
+static bool
+put(const char *path, const char *content, int64_t *size_delta,
+    int *files_delta)
+{
+	create_file("src", content);
+	bool ok = pack_put(path, "src", size_delta, files_delta);
+	x_unlink("src");
+	return ok;
+}
+
+// Return the packed content of path, or NULL if not found.
+static char *
+get(const char *path)
+{
+	struct pack_record record;
+	int fd = pack_get(path, &record);
+	if (fd == -1) {
+		return NULL;
+	}
+	uint64_t size = record.size;
+	char *data = x_malloc(size + 1);
+	bool ok = lseek(fd, record.offset, SEEK_SET) == (off_t)record.offset
+	          && read(fd, data, size) == (ssize_t)size;
+	pack_release(&record, ok);
+	close(fd);
+	if (!ok) {
+		free(data);
+		return NULL;
+	}
+	data[size] = '\0';
+	return data;
+}
+
+TEST_SUITE(pack)
+
+TEST(put_and_get)
+{
+	int64_t size_delta = 0;
+	int files_delta = 0;
+
+	CHECK(!get("a.result"));
+	CHECK(put("a.result", "first", &size_delta, &files_delta));
+	CHECK(put("b.result", "second", &size_delta, &files_delta));
+	CHECK_INT_EQ(2, files_delta);
+	CHECK(size_delta > 0);
+	CHECK(access("a.result", F_OK) != 0);
+
+	CHECK_STR_EQ_FREE2("first", get("a.result"));
+	CHECK_STR_EQ_FREE2("second", get("b.result"));
+	CHECK(!get("c.result"));
+}
+
+TEST(last_record_should_win)
+{
+	int64_t size_delta = 0;
+	int files_delta = 0;
+
+	CHECK(put("a.result", "old", &size_delta, &files_delta));
+	int64_t one_entry = size_delta;
+	CHECK(put("a.result", "new", &size_delta, &files_delta));
+	CHECK_INT_EQ(1, files_delta);
+	CHECK_INT_EQ(one_entry, size_delta);
+	CHECK_STR_EQ_FREE2("new", get("a.result"));
+
+	struct pack_entry *entries;
+	size_t n;
+	CHECK(pack_list(".", &entries, &n));
+	CHECK_INT_EQ(1, n);
+	CHECK_STR_EQ("a.result", entries[0].name);
+	CHECK_INT_EQ(one_entry, entries[0].size);
+	pack_entries_free(entries, n);
+}
+
+TEST(partial_index_entry_should_be_ignored)
+{
+	int64_t size_delta = 0;
+	int files_delta = 0;
+
+	CHECK(put("a.result", "a", &size_delta, &files_delta));
+	CHECK(put("b.result", "b", &size_delta, &files_delta));
+	struct stat st;
+	CHECK_INT_EQ(0, stat(PACK_INDEX_NAME, &st));
+	CHECK_INT_EQ(0, truncate(PACK_INDEX_NAME, st.st_size - 1));
+
+	CHECK_STR_EQ_FREE2("a", get("a.result"));
+	CHECK(!get("b.result"));
+}
+
+TEST(removed_record_should_not_be_found)
+{
+	int64_t size_delta = 0;
+	int files_delta = 0;
+
+	CHECK(!pack_remove("a.result"));
+	CHECK(put("a.result", "a", &size_delta, &files_delta));
+	CHECK(put("b.result", "b", &size_delta, &files_delta));
+	CHECK(pack_remove("a.result"));
+	CHECK(!pack_remove("a.result"));
+	CHECK(!get("a.result"));
+	CHECK_STR_EQ_FREE2("b", get("b.result"));
+
+	struct pack_entry *entries;
+	size_t n;
+	CHECK(pack_list(".", &entries, &n));
+	CHECK_INT_EQ(1, n);
+	CHECK_STR_EQ("b.result", entries[0].name);
+	pack_entries_free(entries, n);
+
+	// A removed name can be stored again.
+	CHECK(put("a.result", "new a", &size_delta, &files_delta));
+	CHECK_STR_EQ_FREE2("new a", get("a.result"));
+}
+
+TEST(record_should_only_be_marked_as_used_when_released_as_used)
+{
+	int64_t size_delta = 0;
+	int files_delta = 0;
+
+	CHECK(put("a.result", "a", &size_delta, &files_delta));
+	struct pack_entry *entries;
+	size_t n;
+	CHECK(pack_list(".", &entries, &n));
+	time_t atime = entries[0].atime;
+	pack_entries_free(entries, n);
+
+	// Make the stored time old so that an update is visible.
+	int fd = open(PACK_INDEX_NAME, O_RDWR);
+	struct pack_record record;
+	int pack_fd = pack_get("a.result", &record);
+	CHECK(pack_fd != -1);
+	uint32_t old_atime = 4711;
+	CHECK(pwrite(fd, &old_atime, sizeof(old_atime), record.entry_pos + 4) == 4);
+	close(fd);
+	pack_release(&record, false);
+	close(pack_fd);
+
+	CHECK(pack_list(".", &entries, &n));
+	CHECK_INT_EQ(4711, entries[0].atime);
+	pack_entries_free(entries, n);
+
+	pack_fd = pack_get("a.result", &record);
+	pack_release(&record, true);
+	close(pack_fd);
+	CHECK(pack_list(".", &entries, &n));
+	CHECK(entries[0].atime >= atime);
+	pack_entries_free(entries, n);
+}
+
+TEST(index_should_be_sorted_when_many_entries_are_appended)
+{
+	int64_t size_delta = 0;
+	int files_delta = 0;
+
+	for (int i = 0; i < 300; i++) {
+		char *name = format("%d.result", i);
+		char *content = format("%d", i);
+		CHECK(put(name, content, &size_delta, &files_delta));
+		free(content);
+		free(name);
+	}
+
+	// The number of sorted entries follows the 8 bytes of magic and version.
+	uint64_t n_sorted = 0;
+	int fd = open(PACK_INDEX_NAME, O_RDONLY);
+	CHECK(pread(fd, &n_sorted, sizeof(n_sorted), 8) == sizeof(n_sorted));
+	close(fd);
+	CHECK(n_sorted >= 256);
+
+	for (int i = 0; i < 300; i++) {
+		char *name = format("%d.result", i);
+		CHECK_STR_EQ_FREE12(format("%d", i), get(name));
+		free(name);
+	}
+
+	// Appended entries override sorted ones.
+	CHECK(put("5.result", "new", &size_delta, &files_delta));
+	CHECK_STR_EQ_FREE2("new", get("5.result"));
+	CHECK(pack_remove("6.result"));
+	CHECK(!get("6.result"));
+	CHECK_STR_EQ_FREE2("7", get("7.result"));
+	CHECK_INT_EQ(300, files_delta);
+}
+
+TEST(compact_should_drop_removed_and_replaced_records)
+{
+	int64_t size_delta = 0;
+	int files_delta = 0;
+	struct stat st;
+
+	CHECK(put("a.result", "a", &size_delta, &files_delta));
+	CHECK(put("b.result", "old b", &size_delta, &files_delta));
+	CHECK(put("b.result", "b", &size_delta, &files_delta));
+	CHECK(put("c.result", "c", &size_delta, &files_delta));
+
+	char *removed[] = {"a.result"};
+	CHECK(pack_compact(".", removed, 1));
+	CHECK(!get("a.result"));
+	CHECK_STR_EQ_FREE2("b", get("b.result"));
+	CHECK_STR_EQ_FREE2("c", get("c.result"));
+
+	// Only the live records are left, and the entry sizes include the 24 byte
+	// index entries.
+	struct pack_entry *entries;
+	size_t n;
+	CHECK(pack_list(".", &entries, &n));
+	CHECK_INT_EQ(2, n);
+	CHECK_INT_EQ(0, stat(PACK_DATA_NAME, &st));
+	CHECK_INT_EQ(st.st_size, entries[0].size + entries[1].size - 2 * 24);
+	pack_entries_free(entries, n);
+
+	char *all[] = {"b.result", "c.result"};
+	CHECK(pack_compact(".", all, 2));
+	CHECK(!get("b.result"));
+	CHECK(access(PACK_DATA_NAME, F_OK) != 0);
+	CHECK(access(PACK_INDEX_NAME, F_OK) != 0);
+}
+
+TEST_SUITE_END
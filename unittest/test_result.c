@@ -0,0 +1,273 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// This file contains tests for result.c.
+
+#include "../src/ccache.h"
+#include "../src/pack.h"
+#include "../src/result.h"
+#include "framework.h"
+#include "util.h"
+
+static const struct result_cost cost = {1234, 70000};
+
+// Store input.o and input.stderr in test.result.
+static bool
+put_result(enum compression_type compression_type, bool hard_link)
+{
+	struct result_files *list = result_files_init();
+	result_files_add(list, "input.stderr", ".stderr");
+	result_files_add(list, "input.o", ".o");
+	bool ok = result_put(
+	  "test.result", list, &cost, compression_type, 1, hard_link, 0);
+	result_files_free(list);
+	return ok;
+}
+
+// Get the object file and the standard error output from test.result into
+// out.o and out.stderr.
+static bool
+get_result(void)
+{
+	struct result_files *list = result_files_init();
+	result_files_add(list, "out.o", ".o");
+	result_files_add(list, "out.stderr", ".stderr");
+	struct result_cost stored_cost;
+	bool found;
+	bool ok = result_get("test.result", list, &stored_cost, &found);
+	result_files_free(list);
+	return ok
+	       && stored_cost.wall_time == cost.wall_time
+	       && stored_cost.cpu_time == cost.cpu_time;
+}
+
+// Return the compression type recorded in the header of test.result.
+static int
+stored_compression_type(void)
+{
+	FILE *f = fopen("test.result", "rb");
+	if (!f) {
+		return -1;
+	}
+	int type = -1;
+	for (int i = 0; i < 6; i++) {
+		type = fgetc(f);
+	}
+	fclose(f);
+	return type;
+}
+
+// Store and get a result compressed with type.
+static bool
+put_and_get_compressed(enum compression_type type)
+{
+	// Something compressible that doesn't fit in one read buffer.
+	size_t size = 3 * READ_BUFFER_SIZE + 17;
+	char *data = x_malloc(size + 1);
+	for (size_t i = 0; i < size; i++) {
+		data[i] = 'a' + (i * i) % 7;
+	}
+	data[size] = '\0';
+	create_file("input.o", data);
+	create_file("input.stderr", "warning\n");
+
+	bool ok = put_result(type, false)
+	          && stored_compression_type() == (int)type
+	          && get_result();
+	if (ok) {
+		char *o = read_text_file("out.o", 0);
+		char *stderr_data = read_text_file("out.stderr", 0);
+		ok = o && str_eq(o, data)
+		     && stderr_data && str_eq(stderr_data, "warning\n");
+		free(o);
+		free(stderr_data);
+	}
+	free(data);
+	return ok;
+}
+
+TEST_SUITE(result)
+
+TEST(put_and_get)
+{
+	create_file("input.o", "object");
+	create_file("input.stderr", "");
+	CHECK(put_result(COMPR_TYPE_NONE, false));
+
+	CHECK(get_result());
+	CHECK_STR_EQ_FREE2("object", read_text_file("out.o", 0));
+	CHECK_STR_EQ_FREE2("", read_text_file("out.stderr", 0));
+}
+
+TEST(put_and_get_compressed)
+{
+	CHECK(put_and_get_compressed(COMPR_TYPE_ZLIB));
+#ifdef HAVE_LIBZSTD
+	CHECK(put_and_get_compressed(COMPR_TYPE_ZSTD));
+#endif
+#ifdef HAVE_LIBLZ4
+	CHECK(put_and_get_compressed(COMPR_TYPE_LZ4));
+#endif
+}
+
+TEST(truncated_compressed_result_should_fail)
+{
+	create_file("input.o", "object");
+	create_file("input.stderr", "");
+	CHECK(put_result(COMPR_TYPE_ZLIB, false));
+
+	struct stat st;
+	CHECK_INT_EQ(0, stat("test.result", &st));
+	CHECK_INT_EQ(0, truncate("test.result", st.st_size - 1));
+	CHECK(!get_result());
+	CHECK(access("out.o", F_OK) != 0);
+}
+
+TEST(unsupported_compression_type_should_fail)
+{
+	create_file("input.o", "object");
+	create_file("input.stderr", "");
+	CHECK(put_result(COMPR_TYPE_NONE, false));
+
+	int fd = open("test.result", O_WRONLY);
+	CHECK(fd != -1);
+	CHECK(lseek(fd, 5, SEEK_SET) == 5);
+	CHECK(write(fd, "\x7f", 1) == 1);
+	close(fd);
+	CHECK(!get_result());
+	CHECK(access("out.o", F_OK) != 0);
+}
+
+TEST(only_requested_files_should_be_written)
+{
+	create_file("input.o", "object");
+	create_file("input.stderr", "warning\n");
+	CHECK(put_result(COMPR_TYPE_NONE, false));
+
+	struct result_files *list = result_files_init();
+	result_files_add(list, "out.stderr", ".stderr");
+	struct result_cost stored_cost;
+	bool found;
+	CHECK(result_get("test.result", list, &stored_cost, &found));
+	result_files_free(list);
+	CHECK_INT_EQ(1234, stored_cost.wall_time);
+	CHECK_INT_EQ(70000, stored_cost.cpu_time);
+	CHECK_STR_EQ_FREE2("warning\n", read_text_file("out.stderr", 0));
+	CHECK(access("out.o", F_OK) != 0);
+}
+
+TEST(missing_file_should_fail)
+{
+	create_file("input.o", "object");
+	create_file("input.stderr", "");
+	CHECK(put_result(COMPR_TYPE_NONE, false));
+
+	struct result_files *list = result_files_init();
+	result_files_add(list, "out.o", ".o");
+	result_files_add(list, "out.d", ".d");
+	struct result_cost stored_cost;
+	bool found;
+	CHECK(!result_get("test.result", list, &stored_cost, &found));
+	CHECK(found);
+	result_files_free(list);
+	CHECK(access("out.o", F_OK) != 0);
+}
+
+TEST(truncated_result_should_fail)
+{
+	create_file("input.o", "object");
+	create_file("input.stderr", "");
+	CHECK(put_result(COMPR_TYPE_NONE, false));
+
+	struct stat st;
+	CHECK_INT_EQ(0, stat("test.result", &st));
+	CHECK_INT_EQ(0, truncate("test.result", st.st_size - 1));
+	CHECK(!get_result());
+	CHECK(access("out.o", F_OK) != 0);
+	CHECK(access("out.stderr", F_OK) != 0);
+}
+
+TEST(hard_linked_object_should_be_stored_next_to_result)
+{
+	struct stat st;
+
+	create_file("input.o", "object");
+	create_file("input.stderr", "");
+	CHECK(put_result(COMPR_TYPE_NONE, true));
+	CHECK_INT_EQ(0, stat("input.o", &st));
+	CHECK_INT_EQ(2, st.st_nlink);
+
+	CHECK(get_result());
+	CHECK_INT_EQ(0, stat("out.o", &st));
+	CHECK_INT_EQ(3, st.st_nlink);
+	CHECK_STR_EQ_FREE2("object", read_text_file("out.o", 0));
+
+	// The object file is removed together with the result.
+	result_remove("test.result");
+	CHECK(access("test.result", F_OK) != 0);
+	CHECK(access("test.o", F_OK) != 0);
+	CHECK_INT_EQ(0, stat("out.o", &st));
+	CHECK_INT_EQ(2, st.st_nlink);
+}
+
+TEST(small_result_should_be_packed)
+{
+	create_file("input.o", "object");
+	create_file("input.stderr", "warning\n");
+	struct result_files *list = result_files_init();
+	result_files_add(list, "input.stderr", ".stderr");
+	result_files_add(list, "input.o", ".o");
+	CHECK(result_put(
+	  "test.result", list, &cost, COMPR_TYPE_ZLIB, 1, false, 4096));
+	result_files_free(list);
+
+	CHECK(access("test.result", F_OK) != 0);
+	CHECK(access(PACK_DATA_NAME, F_OK) == 0);
+	CHECK(get_result());
+	CHECK_STR_EQ_FREE2("object", read_text_file("out.o", 0));
+	CHECK_STR_EQ_FREE2("warning\n", read_text_file("out.stderr", 0));
+
+	// A broken packed result can be removed.
+	struct pack_entry *entries;
+	size_t n;
+	CHECK(pack_list(".", &entries, &n));
+	CHECK_INT_EQ(1, n);
+	pack_entries_free(entries, n);
+	int fd = open(PACK_DATA_NAME, O_WRONLY);
+	// Overwrite the magic number of the result, which follows the record
+	// header and the name.
+	CHECK(pwrite(fd, "XXXX", 4, 16 + strlen("test.result")) == 4);
+	close(fd);
+	CHECK(!get_result());
+	result_remove("test.result");
+	struct result_files *out = result_files_init();
+	struct result_cost stored_cost;
+	bool found;
+	CHECK(!result_get("test.result", out, &stored_cost, &found));
+	CHECK(!found);
+	result_files_free(out);
+	CHECK(pack_list(".", &entries, &n));
+	CHECK_INT_EQ(0, n);
+	pack_entries_free(entries, n);
+
+	// Packed results are looked up only when there is no result file.
+	create_file("input.o", "new object");
+	CHECK(put_result(COMPR_TYPE_NONE, false));
+	CHECK(get_result());
+	CHECK_STR_EQ_FREE2("new object", read_text_file("out.o", 0));
+}
+
+TEST_SUITE_END
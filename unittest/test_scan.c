@@ -0,0 +1,112 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// This file contains tests for functions in scan.c.
+
+#include "../src/ccache.h"
+#include "../src/hashutil.h"
+#include "framework.h"
+
+static const char *
+reference_find_linemarker_candidate(const char *p, const char *limit,
+                                    bool pump)
+{
+	for (; p < limit; p++) {
+		if ((p[0] == '#' && p[-1] == '\n')
+		    || (p[0] == '.' && p[1] == 'i')
+		    || (pump && p[0] == '_' && p[1] == '_')) {
+			return p;
+		}
+	}
+	return limit;
+}
+
+static int
+reference_check_for_temporal_macros(const char *str, size_t len)
+{
+	int result = 0;
+	for (size_t i = 0; i + 8 <= len; i++) {
+		if (memcmp(str + i, "__DATE__", 8) == 0) {
+			result |= HASH_SOURCE_CODE_FOUND_DATE;
+		} else if (memcmp(str + i, "__TIME__", 8) == 0) {
+			result |= HASH_SOURCE_CODE_FOUND_TIME;
+		}
+	}
+	return result;
+}
+
+TEST_SUITE(scan)
+
+TEST(find_linemarker_candidate_should_match_reference)
+{
+	const char alphabet[] = "\n#.i_ax";
+	char data[300];
+	unsigned seed = 4711;
+
+	for (int round = 0; round < 50; round++) {
+		for (size_t i = 0; i < sizeof(data); i++) {
+			seed = seed * 1103515245 + 12345;
+			// Make candidates sparse in some rounds so that whole vectors are
+			// skipped.
+			unsigned r = (seed >> 16) % (round % 2 == 0 ? 7 : 70);
+			data[i] = r < 7 ? alphabet[r] : 'x';
+		}
+		for (size_t start = 1; start < 100; start++) {
+			const char *limit = data + sizeof(data) - 1 - round;
+			for (int pump = 0; pump <= 1; pump++) {
+				const char *expected =
+				  reference_find_linemarker_candidate(data + start, limit, pump);
+				const char *actual =
+				  find_linemarker_candidate(data + start, limit, pump);
+				CHECK_INT_EQ(expected - data, actual - data);
+			}
+		}
+	}
+}
+
+TEST(find_linemarker_candidate_should_handle_empty_range)
+{
+	const char data[] = "\n#\n#";
+	CHECK(find_linemarker_candidate(data + 1, data + 1, false) == data + 1);
+	CHECK(find_linemarker_candidate(data + 1, data + 2, false) == data + 1);
+	CHECK(find_linemarker_candidate(data + 2, data + 3, false) == data + 3);
+}
+
+TEST(check_for_temporal_macros_should_match_reference)
+{
+	const char alphabet[] = "_DATEIMx";
+	char data[300];
+	unsigned seed = 17;
+
+	for (int round = 0; round < 100; round++) {
+		for (size_t i = 0; i < sizeof(data); i++) {
+			seed = seed * 1103515245 + 12345;
+			unsigned r = (seed >> 16) % (round % 2 == 0 ? 8 : 40);
+			data[i] = r < 8 ? alphabet[r] : 'x';
+		}
+		if (round % 3 == 0) {
+			memcpy(data + 100 + round, round % 2 ? "__DATE__" : "__TIME__", 8);
+		}
+		for (size_t start = 0; start < 100; start++) {
+			size_t len = sizeof(data) - start - round;
+			CHECK_INT_EQ(
+			  reference_check_for_temporal_macros(data + start, len),
+			  check_for_temporal_macros(data + start, len));
+		}
+	}
+}
+
+TEST_SUITE_END
@@ -21,6 +21,9 @@
 #include "framework.h"
 #include "util.h"
 
+extern struct conf *conf;
+extern char *stats_file;
+
 TEST_SUITE(stats)
 
 TEST(forward_compatibility)
@@ -46,4 +49,94 @@ TEST(forward_compatibility)
 	counters_free(counters);
 }
 
+TEST(updates_should_be_folded_into_stats_file)
+{
+	conf = conf_create();
+	free(conf->cache_dir);
+	conf->cache_dir = x_strdup(".");
+	stats_file = x_strdup("0/stats");
+	CHECK_INT_EQ(0, mkdir("0", 0777));
+
+	// Other tests may have left pending updates.
+	unsigned hits = stats_get_pending(STATS_CACHEHIT_CPP) + 2;
+	stats_update(STATS_CACHEHIT_CPP);
+	stats_update(STATS_CACHEHIT_CPP);
+	unsigned cleanups = stats_get_pending(STATS_NUMCLEANUPS) + 1;
+	stats_flush();
+	stats_add_cleanup("0", 1);
+
+	struct counters *counters = counters_init(STATS_END);
+	stats_read("0/stats", counters);
+	CHECK_INT_EQ(hits, counters->data[STATS_CACHEHIT_CPP]);
+	CHECK_INT_EQ(cleanups, counters->data[STATS_NUMCLEANUPS]);
+	counters_free(counters);
+
+	free(stats_file);
+	stats_file = NULL;
+	conf_free(conf);
+	conf = NULL;
+}
+
+TEST(saved_time_should_not_wrap_around)
+{
+	conf = conf_create();
+	free(conf->cache_dir);
+	conf->cache_dir = x_strdup(".");
+	stats_file = x_strdup("1/stats");
+	CHECK_INT_EQ(0, mkdir("1", 0777));
+
+	uint64_t saved = stats_get_pending(STATS_SAVED_WALL_TIME) + 5000000000;
+	stats_add(STATS_SAVED_WALL_TIME, 5000000000);
+	stats_flush();
+	stats_add_cleanup("1", 1);
+
+	struct counters *counters = counters_init(STATS_END);
+	stats_read("1/stats", counters);
+	CHECK_INT_EQ(saved, counters->data[STATS_SAVED_WALL_TIME]);
+	counters_free(counters);
+
+	free(stats_file);
+	stats_file = NULL;
+	conf_free(conf);
+	conf = NULL;
+}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(__ATOMIC_RELAXED)
+TEST(old_shared_counters_should_be_folded_and_replaced)
+{
+	conf = conf_create();
+	free(conf->cache_dir);
+	conf->cache_dir = x_strdup(".");
+	stats_file = x_strdup("2/stats");
+	CHECK_INT_EQ(0, mkdir("2", 0777));
+
+	// Version 1 shared counters: a 24 byte header followed by 64 counters.
+	int64_t old[3 + 64];
+	memset(old, 0, sizeof(old));
+	memcpy(old, "cCsT\x01\0\0\0\x40\0\0\0\0\0\0\0", 16);
+	old[3 + STATS_CACHEHIT_CPP] = 7;
+	FILE *f = fopen("2/stats.bin", "wb");
+	CHECK(fwrite(old, sizeof(old), 1, f) == 1);
+	fclose(f);
+
+	uint64_t hits = stats_get_pending(STATS_CACHEHIT_CPP) + 1 + 7;
+	stats_update(STATS_CACHEHIT_CPP);
+	stats_flush();
+	stats_add_cleanup("2", 1);
+
+	struct counters *counters = counters_init(STATS_END);
+	stats_read("2/stats", counters);
+	CHECK_INT_EQ(hits, counters->data[STATS_CACHEHIT_CPP]);
+	counters_free(counters);
+	struct stat st;
+	CHECK_INT_EQ(0, stat("2/stats.bin", &st));
+	CHECK(st.st_size > (off_t)sizeof(old));
+
+	free(stats_file);
+	stats_file = NULL;
+	conf_free(conf);
+	conf = NULL;
+}
+#endif
+
 TEST_SUITE_END
@@ -0,0 +1,81 @@
+// Copyright (C) 2018 Joel Rosdahl
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// This file contains tests for functions in unify.c.
+
+#include "../src/ccache.h"
+#include "framework.h"
+
+// Check that unifying input (of size bytes) gives the same hash as hashing
+// expected.
+static bool
+unifies_to(const char *input, size_t size, const char *expected)
+{
+	struct hash h1, h2;
+	hash_start(&h1);
+	hash_start(&h2);
+	unify_buffer(&h1, input, size, false);
+	hash_string(&h2, expected);
+	char *r1 = hash_result(&h1);
+	char *r2 = hash_result(&h2);
+	bool result = str_eq(r1, r2);
+	free(r1);
+	free(r2);
+	return result;
+}
+
+TEST_SUITE(unify)
+
+TEST(tokens)
+{
+	const char input[] =
+	  "# 1 \"foo.c\"\n"
+	  "int  x = 0x1fUL + 1.5e-3f;\n"
+	  "#pragma once\n"
+	  "char *s = \"a\\\"b\";\n"
+	  "y->z <<= 2;\n";
+	const char expected[] =
+	  "int\nx\n=\n0x1fUL\n+\n1.5e-3f\n;\n"
+	  "#pragma once\n"
+	  "char\n*\ns\n=\n\"a\\\"b\"\n;\n"
+	  "y\n->\nz\n<<=\n2\n;\n";
+	CHECK(unifies_to(input, sizeof(input) - 1, expected));
+}
+
+TEST(nul_characters_and_unterminated_literals)
+{
+	const char input1[] = "a\0b";
+	CHECK(unifies_to(input1, sizeof(input1) - 1, "a\n\nb\n"));
+
+	const char input2[] = "x \"ab";
+	CHECK(unifies_to(input2, sizeof(input2) - 1, "x\n\"ab\n"));
+
+	const char input3[] = "'\\";
+	CHECK(unifies_to(input3, sizeof(input3) - 1, "'\\\n"));
+}
+
+TEST(long_token)
+{
+	size_t size = 40000;
+	char *input = x_malloc(size + 2);
+	memset(input, 'a', size);
+	input[size] = '\n';
+	input[size + 1] = '\0';
+	CHECK(unifies_to(input, size + 1, input));
+	free(input);
+}
+
+TEST_SUITE_END
@@ -18,6 +18,7 @@
 
 #include "../src/ccache.h"
 #include "framework.h"
+#include "util.h"
 
 TEST_SUITE(util)
 
@@ -87,18 +88,95 @@ TEST(get_relative_path)
 
 TEST(format_hash_as_string)
 {
-	unsigned char hash[16] = {
-		"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
-	};
+	unsigned char hash[DIGEST_SIZE] = {0};
+	char zeros[2 * DIGEST_SIZE + 1];
+	memset(zeros, '0', 2 * DIGEST_SIZE);
+	zeros[2 * DIGEST_SIZE] = '\0';
 
-	CHECK_STR_EQ_FREE2("00000000000000000000000000000000",
-	                   format_hash_as_string(hash, -1));
-	CHECK_STR_EQ_FREE2("00000000000000000000000000000000-0",
-	                   format_hash_as_string(hash, 0));
+	CHECK_STR_EQ_FREE2(zeros, format_hash_as_string(hash, -1));
+	CHECK_STR_EQ_FREE12(format("%s-0", zeros), format_hash_as_string(hash, 0));
 	hash[0] = 17;
-	hash[15] = 42;
-	CHECK_STR_EQ_FREE2("1100000000000000000000000000002a-12345",
-	                   format_hash_as_string(hash, 12345));
+	hash[DIGEST_SIZE - 1] = 42;
+	zeros[0] = '1';
+	zeros[1] = '1';
+	zeros[2 * DIGEST_SIZE - 2] = '2';
+	zeros[2 * DIGEST_SIZE - 1] = 'a';
+	CHECK_STR_EQ_FREE12(format("%s-12345", zeros),
+	                    format_hash_as_string(hash, 12345));
+}
+
+TEST(map_file)
+{
+	// Small file (read), large file (mapped) and large file with a size that is
+	// a multiple of the page size (read).
+	size_t sizes[] = {10, 3 * MMAP_MIN_SIZE + 17, 2 * MMAP_MIN_SIZE};
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		char *content = x_malloc(sizes[i] + 1);
+		for (size_t j = 0; j < sizes[i]; j++) {
+			content[j] = 'a' + j % 26;
+		}
+		content[sizes[i]] = '\0';
+		create_file("file", content);
+
+		struct mapped_file file;
+		CHECK(map_file("file", 0, false, &file));
+		CHECK_INT_EQ(sizes[i], file.size);
+		CHECK(memcmp(content, file.data, sizes[i]) == 0);
+		CHECK_INT_EQ(0, file.data[file.size]);
+		struct stat st;
+		CHECK_INT_EQ(0, stat("file", &st));
+		CHECK(file.dev == st.st_dev && file.ino == st.st_ino);
+
+		// The content may be modified without affecting the file.
+		file.data[0] = 'X';
+		unmap_file(&file);
+		CHECK(map_file("file", sizes[i], false, &file));
+		CHECK_INT_EQ('a', file.data[0]);
+		unmap_file(&file);
+
+		// Shared files are always read.
+		CHECK(map_file("file", 0, true, &file));
+		CHECK(!file.mapped);
+		CHECK(memcmp(content, file.data, sizes[i]) == 0);
+		unmap_file(&file);
+
+		free(content);
+	}
+
+	struct mapped_file file;
+	CHECK(!map_file("nonexistent", 0, false, &file));
+}
+
+TEST(copy_fd_range)
+{
+	create_file("src", "0123456789abcdef");
+	int in = open("src", O_RDONLY);
+	int out = open("dest", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	CHECK(in != -1 && out != -1);
+	CHECK(write_fd(out, "x", 1));
+	CHECK(copy_fd_range(in, 4, out, 6));
+	CHECK(copy_fd_range(in, 0, out, 2));
+	CHECK(!copy_fd_range(in, 10, out, 7));
+	close(out);
+	close(in);
+	CHECK_STR_EQ_FREE2("x45678901abcdef", read_text_file("dest", 0));
+}
+
+TEST(copy_file)
+{
+	size_t size = 3 * READ_BUFFER_SIZE + 17;
+	char *content = x_malloc(size + 1);
+	for (size_t i = 0; i < size; i++) {
+		content[i] = 'a' + i % 26;
+	}
+	content[size] = '\0';
+	create_file("src", content);
+
+	CHECK_INT_EQ(0, copy_file("src", "dest"));
+	CHECK_STR_EQ_FREE2(content, read_text_file("dest", 0));
+	CHECK_INT_EQ(-1, copy_file("nonexistent", "dest"));
+	free(content);
 }
 
 TEST(subst_env_in_string)